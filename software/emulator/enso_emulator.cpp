@@ -0,0 +1,774 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief NIC emulator daemon for the software backend.
+ *
+ * Applications built with `-Ddev_backend=software` send their MMIO accesses
+ * and resource allocation requests to this daemon through per-core IPC queues.
+ * The daemon serves these requests using `NicEmulator` and moves packets
+ * between the applications' hugepage buffers and the emulated wire: packets
+ * may come from a pcap file or from the applications themselves (loopback).
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#include <dirent.h>
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/ixy_helpers.h>
+#include <enso/queue.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pcap/pcap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "nic_emulator.h"
+
+static volatile int keep_running = 1;
+
+// Number of IPC messages to handle per core before polling the NIC.
+static constexpr uint32_t kIpcBatchSize = 64;
+
+// Number of replayed packets to inject per iteration.
+static constexpr uint32_t kReplayBurst = 32;
+
+void int_handler(int signal __attribute__((unused))) { keep_running = 0; }
+
+/**
+ * @brief Maps the applications' hugepages into the daemon's address space.
+ *
+ * Applications tell the daemon the physical address of their buffers. The
+ * daemon finds which hugepage file backs that address, maps it, and replies
+ * with the address of the mapping in its own address space. This is the
+ * address the application will later program in the registers and in TX
+ * notifications.
+ */
+class HugePageMapper {
+ public:
+  explicit HugePageMapper(const std::string& huge_page_prefix)
+      : dir_(huge_page_prefix.substr(0, huge_page_prefix.rfind('/'))),
+        file_prefix_(
+            huge_page_prefix.substr(huge_page_prefix.rfind('/') + 1)) {}
+
+  ~HugePageMapper() {
+    for (auto& [addr, mapping] : mappings_) {
+      munmap((void*)addr, mapping.size);
+    }
+  }
+
+  /**
+   * @brief Returns the daemon address that corresponds to a physical address
+   *        in one of the application's hugepages or 0 if it cannot be found.
+   */
+  uint64_t PhysToDevAddr(uint64_t phys_addr) {
+    uint64_t page = phys_addr & ~((uint64_t)enso::kBufPageSize - 1);
+    auto it = phys_to_virt_.find(page);
+    if (it == phys_to_virt_.end()) {
+      Rescan();
+      it = phys_to_virt_.find(page);
+      if (it == phys_to_virt_.end()) {
+        return 0;
+      }
+    }
+    return it->second + (phys_addr - page);
+  }
+
+  /**
+   * @brief Converts a device address to a pointer.
+   *
+   * Device addresses are normally addresses returned by `PhysToDevAddr`. For
+   * compatibility with applications that program physical addresses directly
+   * (e.g., through the socket API), physical addresses are also accepted.
+   */
+  uint8_t* Translate(uint64_t dev_addr) {
+    auto it = mappings_.upper_bound(dev_addr);
+    if (it != mappings_.begin()) {
+      --it;
+      if (dev_addr < it->first + it->second.size) {
+        return (uint8_t*)dev_addr;
+      }
+    }
+    return (uint8_t*)PhysToDevAddr(dev_addr);
+  }
+
+  /**
+   * @brief Unmaps hugepages whose files were removed by the application so
+   *        that they can be returned to the system.
+   */
+  void Sweep() {
+    for (auto it = mappings_.begin(); it != mappings_.end();) {
+      const Mapping& mapping = it->second;
+      struct stat st;
+      if (stat(mapping.path.c_str(), &st) == 0 && st.st_ino == mapping.inode) {
+        ++it;
+        continue;
+      }
+      for (uint64_t phys_page : mapping.phys_pages) {
+        phys_to_virt_.erase(phys_page);
+      }
+      mapped_inodes_.erase(mapping.inode);
+      munmap((void*)it->first, mapping.size);
+      it = mappings_.erase(it);
+    }
+  }
+
+ private:
+  struct Mapping {
+    std::string path;
+    ino_t inode;
+    size_t size;
+    std::vector<uint64_t> phys_pages;
+  };
+
+  void Rescan() {
+    if (RescanDir(dir_, file_prefix_)) {
+      std::cerr << "Could not open " << dir_ << std::endl;
+    }
+
+    // Large pipes may use 1GB huge pages, which are optional.
+    std::string prefix_1g(enso::kHugePage1GDefaultPrefix);
+    size_t pos = prefix_1g.rfind('/');
+    RescanDir(prefix_1g.substr(0, pos), prefix_1g.substr(pos + 1));
+  }
+
+  int RescanDir(const std::string& dir_path, const std::string& file_prefix) {
+    DIR* dir = opendir(dir_path.c_str());
+    if (dir == nullptr) {
+      return -1;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      std::string name = entry->d_name;
+      if (name.rfind(file_prefix, 0) != 0) {
+        continue;
+      }
+      // IPC queues are not accessed by the NIC.
+      if (name.find(enso::kHugePageQueuePathPrefix) != std::string::npos) {
+        continue;
+      }
+
+      std::string path = dir_path + "/" + name;
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+          st.st_size == 0 || mapped_inodes_.count(st.st_ino)) {
+        continue;
+      }
+
+      Map(path, st);
+    }
+
+    closedir(dir);
+    return 0;
+  }
+
+  void Map(const std::string& path, const struct stat& st) {
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+      return;
+    }
+
+    size_t size = st.st_size;
+    void* addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "(" << errno << ") Could not map " << path << std::endl;
+      return;
+    }
+
+    Mapping mapping;
+    mapping.path = path;
+    mapping.inode = st.st_ino;
+    mapping.size = size;
+
+    for (size_t offset = 0; offset < size; offset += enso::kBufPageSize) {
+      volatile uint8_t* page = (uint8_t*)addr + offset;
+      (void)*page;  // Make sure the page is mapped before translating it.
+      uint64_t phys_page = enso::virt_to_phys((void*)page);
+      if (phys_page == 0) {
+        std::cerr << "Could not translate " << path
+                  << " (the emulator must run as root)" << std::endl;
+        continue;
+      }
+      phys_to_virt_[phys_page] = (uint64_t)page;
+      mapping.phys_pages.push_back(phys_page);
+    }
+
+    mapped_inodes_[st.st_ino] = (uint64_t)addr;
+    mappings_[(uint64_t)addr] = std::move(mapping);
+  }
+
+  std::string dir_;
+  std::string file_prefix_;
+  std::map<uint64_t, Mapping> mappings_;  // Indexed by address.
+  std::unordered_map<uint64_t, uint64_t> phys_to_virt_;
+  std::unordered_map<ino_t, uint64_t> mapped_inodes_;
+};
+
+/**
+ * @brief Wakes up applications waiting for RX notifications.
+ *
+ * Applications that want to sleep create a FIFO for their notification buffer
+ * (see `kIpcWakeupFifoPrefix`) and arm its interrupt. We write to the FIFO
+ * when the NIC raises the interrupt.
+ */
+class WakeupFifos {
+ public:
+  WakeupFifos() : fds_(enso::kMaxNbApps, -1) {}
+
+  ~WakeupFifos() {
+    for (uint32_t i = 0; i < enso::kMaxNbApps; ++i) {
+      Close(i);
+    }
+  }
+
+  void Signal(uint32_t notif_buf_id) {
+    // The FIFO that we have open may have been removed by a previous owner of
+    // the notification buffer, in which case we open it again.
+    for (uint32_t attempt = 0; attempt < 2; ++attempt) {
+      int& fd = fds_[notif_buf_id];
+      if (fd < 0) {
+        std::string path = std::string(enso::kIpcWakeupFifoPrefix) +
+                           std::to_string(notif_buf_id);
+        fd = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+          return;  // Nobody is waiting.
+        }
+      }
+
+      // A full FIFO already has a wakeup pending.
+      uint8_t value = 1;
+      if (write(fd, &value, sizeof(value)) > 0 || errno == EAGAIN) {
+        return;
+      }
+      Close(notif_buf_id);
+    }
+  }
+
+  void Close(uint32_t notif_buf_id) {
+    if (fds_[notif_buf_id] >= 0) {
+      close(fds_[notif_buf_id]);
+      fds_[notif_buf_id] = -1;
+    }
+  }
+
+ private:
+  std::vector<int> fds_;
+};
+
+/**
+ * @brief IPC queues used to communicate with applications running on a given
+ *        core.
+ */
+struct CoreChannel {
+  std::unique_ptr<enso::QueueConsumer<enso::PipeNotification>> from_app;
+  std::unique_ptr<enso::QueueProducer<enso::PipeNotification>> to_app;
+};
+
+static void reply(CoreChannel* channel, const void* msg) {
+  while (channel->to_app->Push(*(const enso::PipeNotification*)msg) != 0) {
+  }
+}
+
+static void handle_request(CoreChannel* channel,
+                           const enso::PipeNotification& request,
+                           enso::NicEmulator* nic, HugePageMapper* mapper,
+                           WakeupFifos* wakeup_fifos) {
+  using enso::NotifType;
+
+  switch (request.type) {
+    case NotifType::kWrite: {
+      auto* msg = (const enso::MmioNotification*)&request;
+      nic->MmioWrite(msg->address, msg->value);
+      break;
+    }
+    case NotifType::kRead: {
+      enso::MmioNotification msg = *(const enso::MmioNotification*)&request;
+      msg.value = nic->MmioRead(msg.address);
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kTranslAddr: {
+      enso::MmioNotification msg = *(const enso::MmioNotification*)&request;
+      msg.value = mapper->PhysToDevAddr(msg.address);
+      if (msg.value == 0) {
+        std::cerr << "Could not translate address 0x" << std::hex
+                  << msg.address << std::dec << std::endl;
+      }
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kAllocatePipe: {
+      enso::AllocatePipeNotification msg =
+          *(const enso::AllocatePipeNotification*)&request;
+      msg.pipe_id = nic->AllocatePipe(msg.fallback);
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kFreePipe: {
+      enso::FreePipeNotification msg =
+          *(const enso::FreePipeNotification*)&request;
+      msg.result = nic->FreePipe(msg.pipe_id);
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kAllocateNotifBuf: {
+      enso::NotifBufNotification msg =
+          *(const enso::NotifBufNotification*)&request;
+      msg.notif_buf_id = nic->AllocateNotifBuf();
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kFreeNotifBuf: {
+      enso::NotifBufNotification msg =
+          *(const enso::NotifBufNotification*)&request;
+      msg.result = nic->FreeNotifBuf(msg.notif_buf_id);
+      if (msg.result == 0) {
+        wakeup_fifos->Close(msg.notif_buf_id);
+      }
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kGetNbFallbackQueues: {
+      enso::FallbackNotification msg =
+          *(const enso::FallbackNotification*)&request;
+      msg.nb_fallback_queues = nic->GetNbFallbackQueues();
+      msg.result = 0;
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kSetRrStatus: {
+      enso::RoundRobinNotification msg =
+          *(const enso::RoundRobinNotification*)&request;
+      msg.result = nic->SetRrStatus(msg.round_robin);
+      reply(channel, &msg);
+      break;
+    }
+    case NotifType::kGetRrStatus: {
+      enso::RoundRobinNotification msg =
+          *(const enso::RoundRobinNotification*)&request;
+      msg.round_robin = nic->GetRrStatus();
+      msg.result = 0;
+      reply(channel, &msg);
+      break;
+    }
+    default:
+      std::cerr << "Unknown request type: " << (int)request.type << std::endl;
+      break;
+  }
+}
+
+/**
+ * @brief Replays packets from a pcap file into the NIC.
+ */
+class PcapReplayer {
+ public:
+  int Load(const std::string& pcap_file) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t* pcap = pcap_open_offline(pcap_file.c_str(), errbuf);
+    if (pcap == NULL) {
+      std::cerr << "Error loading pcap file (" << errbuf << ")" << std::endl;
+      return -1;
+    }
+
+    struct pcap_pkthdr* header;
+    const u_char* data;
+    while (pcap_next_ex(pcap, &header, &data) == 1) {
+      pkts_.push_back({data_.size(), header->caplen});
+      data_.insert(data_.end(), data, data + header->caplen);
+    }
+    pcap_close(pcap);
+
+    if (pkts_.empty()) {
+      std::cerr << "No packets in " << pcap_file << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Injects up to `burst` packets.
+   *
+   * @param nb_loops Number of times to replay the file, zero means forever.
+   * @param rate_pps Maximum rate in packets per second, zero means unlimited.
+   * @return Number of packets injected.
+   */
+  uint32_t Inject(enso::NicEmulator* nic, uint32_t burst, uint64_t nb_loops,
+                  double rate_pps) {
+    if (nb_loops != 0 && loop_ >= nb_loops) {
+      return 0;
+    }
+
+    if (rate_pps > 0) {
+      auto now = std::chrono::steady_clock::now();
+      if (!started_) {
+        start_ = now;
+        started_ = true;
+      }
+      double elapsed = std::chrono::duration<double>(now - start_).count();
+      uint64_t allowed = elapsed * rate_pps;
+      if (allowed <= nb_injected_) {
+        return 0;
+      }
+      burst = std::min((uint64_t)burst, allowed - nb_injected_);
+    }
+
+    uint32_t i;
+    for (i = 0; i < burst; ++i) {
+      const auto& [offset, len] = pkts_[next_];
+      nic->DeliverPkt(data_.data() + offset, len);
+      if (++next_ == pkts_.size()) {
+        next_ = 0;
+        if (nb_loops != 0 && ++loop_ >= nb_loops) {
+          ++i;
+          break;
+        }
+      }
+    }
+    nb_injected_ += i;
+    return i;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  std::vector<std::pair<size_t, uint32_t>> pkts_;
+  size_t next_ = 0;
+  uint64_t loop_ = 0;
+  uint64_t nb_injected_ = 0;
+  bool started_ = false;
+  std::chrono::steady_clock::time_point start_;
+};
+
+static void print_usage(const char* program_name) {
+  printf(
+      "%s\n"
+      " [--help]\n"
+      " [--pcap-in PCAP_FILE]\n"
+      " [--loops NB_LOOPS]\n"
+      " [--rate RATE_MPPS]\n"
+      " [--pcap-out PCAP_FILE]\n"
+      " [--no-loopback]\n"
+      " [--cores NB_CORES]\n"
+      " [--huge-page-prefix PREFIX]\n"
+      " [--stats]\n\n"
+
+      "  --help: Show this help and exit.\n"
+      "  --pcap-in: Replay packets from PCAP_FILE to the applications.\n"
+      "  --loops: Number of times to replay the pcap file, 0 replays it\n"
+      "           forever (default: 1).\n"
+      "  --rate: Maximum replay rate in Mpps (default: unlimited).\n"
+      "  --pcap-out: Save all packets transmitted by the applications to\n"
+      "              PCAP_FILE.\n"
+      "  --no-loopback: Drop transmitted packets instead of looping them\n"
+      "                 back to the applications.\n"
+      "  --cores: Number of cores the applications may run on (default:\n"
+      "           number of online CPUs).\n"
+      "  --huge-page-prefix: Prefix used by the applications for hugepage\n"
+      "                      files (default: %s).\n"
+      "  --stats: Print statistics every second.\n",
+      program_name, std::string(enso::kHugePageDefaultPrefix).c_str());
+}
+
+#define CMD_OPT_HELP "help"
+#define CMD_OPT_PCAP_IN "pcap-in"
+#define CMD_OPT_LOOPS "loops"
+#define CMD_OPT_RATE "rate"
+#define CMD_OPT_PCAP_OUT "pcap-out"
+#define CMD_OPT_NO_LOOPBACK "no-loopback"
+#define CMD_OPT_CORES "cores"
+#define CMD_OPT_HUGE_PAGE_PREFIX "huge-page-prefix"
+#define CMD_OPT_STATS "stats"
+
+// Map long options to short options.
+enum {
+  CMD_OPT_HELP_NUM = 256,
+  CMD_OPT_PCAP_IN_NUM,
+  CMD_OPT_LOOPS_NUM,
+  CMD_OPT_RATE_NUM,
+  CMD_OPT_PCAP_OUT_NUM,
+  CMD_OPT_NO_LOOPBACK_NUM,
+  CMD_OPT_CORES_NUM,
+  CMD_OPT_HUGE_PAGE_PREFIX_NUM,
+  CMD_OPT_STATS_NUM,
+};
+
+static const char short_options[] = "";
+
+static const struct option long_options[] = {
+    {CMD_OPT_HELP, no_argument, NULL, CMD_OPT_HELP_NUM},
+    {CMD_OPT_PCAP_IN, required_argument, NULL, CMD_OPT_PCAP_IN_NUM},
+    {CMD_OPT_LOOPS, required_argument, NULL, CMD_OPT_LOOPS_NUM},
+    {CMD_OPT_RATE, required_argument, NULL, CMD_OPT_RATE_NUM},
+    {CMD_OPT_PCAP_OUT, required_argument, NULL, CMD_OPT_PCAP_OUT_NUM},
+    {CMD_OPT_NO_LOOPBACK, no_argument, NULL, CMD_OPT_NO_LOOPBACK_NUM},
+    {CMD_OPT_CORES, required_argument, NULL, CMD_OPT_CORES_NUM},
+    {CMD_OPT_HUGE_PAGE_PREFIX, required_argument, NULL,
+     CMD_OPT_HUGE_PAGE_PREFIX_NUM},
+    {CMD_OPT_STATS, no_argument, NULL, CMD_OPT_STATS_NUM},
+    {0, 0, 0, 0}};
+
+struct parsed_args_t {
+  std::string pcap_in;
+  std::string pcap_out;
+  uint64_t nb_loops;
+  double rate_mpps;
+  bool loopback;
+  uint32_t nb_cores;
+  std::string huge_page_prefix;
+  bool stats;
+};
+
+static int parse_args(int argc, char** argv,
+                      struct parsed_args_t& parsed_args) {
+  int opt;
+  int long_index;
+
+  parsed_args.nb_loops = 1;
+  parsed_args.rate_mpps = 0;
+  parsed_args.loopback = true;
+  parsed_args.nb_cores = std::thread::hardware_concurrency();
+  parsed_args.huge_page_prefix = enso::kHugePageDefaultPrefix;
+  parsed_args.stats = false;
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options,
+                            &long_index)) != EOF) {
+    switch (opt) {
+      case CMD_OPT_HELP_NUM:
+        return 1;
+      case CMD_OPT_PCAP_IN_NUM:
+        parsed_args.pcap_in = optarg;
+        break;
+      case CMD_OPT_LOOPS_NUM:
+        parsed_args.nb_loops = atoll(optarg);
+        break;
+      case CMD_OPT_RATE_NUM:
+        parsed_args.rate_mpps = atof(optarg);
+        break;
+      case CMD_OPT_PCAP_OUT_NUM:
+        parsed_args.pcap_out = optarg;
+        break;
+      case CMD_OPT_NO_LOOPBACK_NUM:
+        parsed_args.loopback = false;
+        break;
+      case CMD_OPT_CORES_NUM:
+        parsed_args.nb_cores = atoi(optarg);
+        break;
+      case CMD_OPT_HUGE_PAGE_PREFIX_NUM:
+        parsed_args.huge_page_prefix = optarg;
+        break;
+      case CMD_OPT_STATS_NUM:
+        parsed_args.stats = true;
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  if (optind != argc || parsed_args.nb_cores == 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  struct parsed_args_t parsed_args;
+  int ret = parse_args(argc, argv, parsed_args);
+  if (ret != 0) {
+    print_usage(argv[0]);
+    return ret > 0 ? 0 : 1;
+  }
+
+  signal(SIGINT, int_handler);
+  signal(SIGTERM, int_handler);
+
+  // Applications may exit while we write to their wakeup FIFO.
+  signal(SIGPIPE, SIG_IGN);
+
+  HugePageMapper mapper(parsed_args.huge_page_prefix);
+
+  auto nic = enso::NicEmulator::Create(
+      [&mapper](uint64_t dev_addr) { return mapper.Translate(dev_addr); });
+  if (!nic) {
+    std::cerr << "Could not create NIC emulator" << std::endl;
+    return 2;
+  }
+
+  PcapReplayer replayer;
+  bool replay = !parsed_args.pcap_in.empty();
+  if (replay && replayer.Load(parsed_args.pcap_in)) {
+    return 3;
+  }
+
+  pcap_t* pcap_out = NULL;
+  pcap_dumper_t* pcap_dumper = NULL;
+  if (!parsed_args.pcap_out.empty()) {
+    pcap_out = pcap_open_dead(DLT_EN10MB, 65535);
+    if (pcap_out != NULL) {
+      pcap_dumper = pcap_dump_open(pcap_out, parsed_args.pcap_out.c_str());
+    }
+    if (pcap_dumper == NULL) {
+      std::cerr << "Could not open " << parsed_args.pcap_out << std::endl;
+      return 4;
+    }
+  }
+
+  WakeupFifos wakeup_fifos;
+  nic->set_interrupt_handler([&wakeup_fifos](uint32_t notif_buf_id) {
+    wakeup_fifos.Signal(notif_buf_id);
+  });
+
+  bool loopback = parsed_args.loopback;
+  enso::NicEmulator* nic_ptr = nic.get();
+  nic->set_tx_handler([=](const uint8_t* pkt, uint32_t len) {
+    if (pcap_dumper != NULL) {
+      struct pcap_pkthdr header;
+      gettimeofday(&header.ts, NULL);
+      header.caplen = len;
+      header.len = len;
+      pcap_dump((u_char*)pcap_dumper, &header, pkt);
+    }
+    if (loopback) {
+      nic_ptr->DeliverPkt(pkt, len);
+    }
+  });
+
+  std::vector<CoreChannel> channels(parsed_args.nb_cores);
+  for (uint32_t core_id = 0; core_id < parsed_args.nb_cores; ++core_id) {
+    // Names are from the point of view of the application.
+    std::string queue_from_app_name = std::string(enso::kIpcQueueFromAppName) +
+                                      std::to_string(core_id) + "_";
+    std::string queue_to_app_name =
+        std::string(enso::kIpcQueueToAppName) + std::to_string(core_id) + "_";
+
+    CoreChannel& channel = channels[core_id];
+    channel.from_app = enso::QueueConsumer<enso::PipeNotification>::Create(
+        queue_from_app_name);
+    channel.to_app =
+        enso::QueueProducer<enso::PipeNotification>::Create(queue_to_app_name);
+    if (!channel.from_app || !channel.to_app) {
+      std::cerr << "Could not create IPC queues for core " << core_id
+                << std::endl;
+      return 5;
+    }
+  }
+
+  std::cout << "Emulator ready, serving " << parsed_args.nb_cores << " cores"
+            << std::endl;
+
+  double rate_pps = parsed_args.rate_mpps * 1e6;
+  auto last_check = std::chrono::steady_clock::now();
+  enso::NicEmulator::Stats last_stats = nic->stats();
+  uint32_t iteration = 0;
+
+  while (keep_running) {
+    for (CoreChannel& channel : channels) {
+      for (uint32_t i = 0; i < kIpcBatchSize; ++i) {
+        std::optional<enso::PipeNotification> request =
+            channel.from_app->Pop();
+        if (!request) {
+          break;
+        }
+        handle_request(&channel, *request, nic.get(), &mapper, &wakeup_fifos);
+      }
+    }
+
+    if (replay) {
+      replayer.Inject(nic.get(), kReplayBurst, parsed_args.nb_loops,
+                      rate_pps);
+    }
+
+    nic->Poll();
+
+    if ((++iteration & 0xffff) != 0) {
+      continue;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_check < std::chrono::seconds(1)) {
+      continue;
+    }
+    last_check = now;
+
+    // Release hugepages that applications no longer use.
+    mapper.Sweep();
+
+    if (parsed_args.stats) {
+      const enso::NicEmulator::Stats& stats = nic->stats();
+      std::cout << std::dec << "RX: " << stats.rx_pkts - last_stats.rx_pkts
+                << " pps (dropped: "
+                << stats.rx_dropped_no_pipe + stats.rx_dropped_full -
+                       last_stats.rx_dropped_no_pipe -
+                       last_stats.rx_dropped_full
+                << ")  TX: " << stats.tx_pkts - last_stats.tx_pkts << " pps"
+                << std::endl;
+      last_stats = stats;
+    }
+  }
+
+  const enso::NicEmulator::Stats& stats = nic->stats();
+  std::cout << std::dec << "RX packets: " << stats.rx_pkts
+            << "  RX bytes: " << stats.rx_bytes
+            << "  RX dropped (no pipe): " << stats.rx_dropped_no_pipe
+            << "  RX dropped (full): " << stats.rx_dropped_full << std::endl
+            << "TX packets: " << stats.tx_pkts
+            << "  TX bytes: " << stats.tx_bytes
+            << "  TX bad addresses: " << stats.tx_bad_addr << std::endl;
+
+  if (pcap_dumper != NULL) {
+    pcap_dump_close(pcap_dumper);
+    pcap_close(pcap_out);
+  }
+
+  return 0;
+}
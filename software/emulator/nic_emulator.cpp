@@ -0,0 +1,718 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software model of the Enso NIC.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#include "nic_emulator.h"
+
+#include <endian.h>
+#include <enso/helpers.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace enso {
+
+// Largest packet that we may need to reassemble (max IPv4 length plus L2).
+static constexpr uint32_t kMaxPktSize = 65536 + 64;
+
+// Maximum number of flits that the rate limiter may accumulate while idle.
+static constexpr double kMaxRateLimiterBurst = kMaxTransferLen / 64;
+
+// Register indices, in 32-bit words, within a `QueueRegs`.
+static constexpr uint32_t kRxHeadReg =
+    offsetof(struct QueueRegs, rx_head) / sizeof(uint32_t);
+
+std::unique_ptr<NicEmulator> NicEmulator::Create(
+    AddrTranslator translator) noexcept {
+  std::unique_ptr<NicEmulator> nic(new (std::nothrow)
+                                       NicEmulator(std::move(translator)));
+  if (unlikely(!nic)) {
+    return std::unique_ptr<NicEmulator>{};
+  }
+
+  if (nic->Init()) {
+    return std::unique_ptr<NicEmulator>{};
+  }
+
+  return nic;
+}
+
+NicEmulator::~NicEmulator() noexcept {
+  if (bar_ != nullptr) {
+    munmap(bar_, kBarSize);
+  }
+}
+
+int NicEmulator::Init() noexcept {
+  // The register file is sparse, only the first cache line of each 4KB region
+  // is used. Reserve it lazily so that we do not touch unused pages.
+  void* bar = mmap(nullptr, kBarSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (bar == MAP_FAILED) {
+    std::cerr << "Could not allocate register file" << std::endl;
+    return -1;
+  }
+  bar_ = (uint8_t*)bar;
+
+  pipes_.resize(kMaxNbFlows);
+  notif_bufs_.resize(kMaxNbApps);
+  tx_scratch_.resize(kMaxPktSize);
+
+  return 0;
+}
+
+void NicEmulator::MmioWrite(uint64_t offset, uint32_t value) {
+  if (unlikely(offset >= kBarSize || (offset % sizeof(uint32_t)))) {
+    return;
+  }
+
+  *(volatile uint32_t*)(bar_ + offset) = value;
+
+  uint32_t queue_id = offset / kMemorySpacePerQueue;
+  uint32_t reg = (offset % kMemorySpacePerQueue) / sizeof(uint32_t);
+
+  if (queue_id < kMaxNbFlows && reg == kRxHeadReg) {
+    HeadUpdated(queue_id);
+  }
+}
+
+uint32_t NicEmulator::MmioRead(uint64_t offset) const {
+  if (unlikely(offset >= kBarSize || (offset % sizeof(uint32_t)))) {
+    return 0xffffffff;
+  }
+  return *(volatile uint32_t*)(bar_ + offset);
+}
+
+int NicEmulator::AllocateNotifBuf() {
+  for (uint32_t i = 0; i < kMaxNbApps; ++i) {
+    NotifBufState& notif_buf = notif_bufs_[i];
+    if (!notif_buf.allocated) {
+      notif_buf.allocated = true;
+      notif_buf.rx_mem_low = 0;
+      notif_buf.rx_mem_high = 0;
+      notif_buf.tx_mem_low = 0;
+      notif_buf.tx_mem_high = 0;
+      notif_buf.rx_buf = nullptr;
+      notif_buf.tx_buf = nullptr;
+      notif_buf.partial_len = 0;
+      active_notif_bufs_.push_back(i);
+      return i;
+    }
+  }
+  return -1;
+}
+
+int NicEmulator::FreeNotifBuf(int notif_buf_id) {
+  if (notif_buf_id < 0 || notif_buf_id >= (int)kMaxNbApps ||
+      !notif_bufs_[notif_buf_id].allocated) {
+    return -1;
+  }
+
+  notif_bufs_[notif_buf_id].allocated = false;
+  active_notif_bufs_.erase(std::remove(active_notif_bufs_.begin(),
+                                       active_notif_bufs_.end(), notif_buf_id),
+                           active_notif_bufs_.end());
+
+  // Disable the notification buffer.
+  volatile struct QueueRegs* notif_buf_regs = regs(notif_buf_id + kMaxNbFlows);
+  notif_buf_regs->rx_mem_low = 0;
+  notif_buf_regs->rx_mem_high = 0;
+  notif_buf_regs->tx_mem_low = 0;
+  notif_buf_regs->tx_mem_high = 0;
+  notif_buf_regs->rx_intr_arm = 0;
+
+  return 0;
+}
+
+int NicEmulator::AllocatePipe(bool fallback) {
+  if (nb_fallback_pipes_ + nb_regular_pipes_ >= (int)kMaxNbFlows) {
+    return -1;
+  }
+
+  int pipe_id;
+  if (fallback) {
+    // Fallback pipes must be contiguous and start at 0.
+    pipe_id = nb_fallback_pipes_;
+    if (pipes_[pipe_id].allocated) {
+      return -1;
+    }
+    ++nb_fallback_pipes_;
+  } else {
+    for (pipe_id = kMaxNbFlows - 1; pipe_id >= nb_fallback_pipes_; --pipe_id) {
+      if (!pipes_[pipe_id].allocated) {
+        break;
+      }
+    }
+    if (pipe_id < nb_fallback_pipes_) {
+      return -1;
+    }
+    ++nb_regular_pipes_;
+  }
+
+  PipeState& pipe = pipes_[pipe_id];
+  pipe.allocated = true;
+  pipe.mem_low = 0;
+  pipe.mem_high = 0;
+  pipe.buf = nullptr;
+  pipe.size = kEnsoPipeSize;
+
+  return pipe_id;
+}
+
+int NicEmulator::FreePipe(int pipe_id) {
+  if (pipe_id < 0 || pipe_id >= (int)kMaxNbFlows ||
+      !pipes_[pipe_id].allocated) {
+    return -1;
+  }
+
+  // Same as the kernel module: fallback pipes are at the front.
+  if (pipe_id < nb_fallback_pipes_) {
+    --nb_fallback_pipes_;
+  } else {
+    --nb_regular_pipes_;
+  }
+
+  PipeState& pipe = pipes_[pipe_id];
+  pipe.allocated = false;
+  pipe.buf = nullptr;
+
+  volatile struct QueueRegs* pipe_regs = regs(pipe_id);
+  pipe_regs->rx_mem_low = 0;
+  pipe_regs->rx_mem_high = 0;
+  pipe_regs->rx_size = 0;
+
+  return 0;
+}
+
+uint8_t* NicEmulator::RefreshPipe(enso_pipe_id_t pipe_id) {
+  PipeState& pipe = pipes_[pipe_id];
+  volatile struct QueueRegs* pipe_regs = regs(pipe_id);
+  uint32_t mem_low = pipe_regs->rx_mem_low;
+  uint32_t mem_high = pipe_regs->rx_mem_high;
+
+  if (likely(mem_low == pipe.mem_low && mem_high == pipe.mem_high)) {
+    return pipe.buf;
+  }
+
+  pipe.mem_low = mem_low;
+  pipe.mem_high = mem_high;
+
+  // The least significant bits in rx_mem_low keep the notification buffer ID.
+  uint64_t addr = ((uint64_t)mem_high << 32) | mem_low;
+  pipe.notif_buf_id = addr & (kMaxNbApps - 1);
+  addr &= ~((uint64_t)kMaxNbApps - 1);
+
+  pipe.buf = addr ? translator_(addr) : nullptr;
+  pipe.size = pipe_regs->rx_size ? pipe_regs->rx_size : kEnsoPipeSize;
+  pipe.notification_pending = false;
+
+  return pipe.buf;
+}
+
+void NicEmulator::RefreshNotifBuf(uint32_t notif_buf_id) {
+  NotifBufState& notif_buf = notif_bufs_[notif_buf_id];
+  volatile struct QueueRegs* notif_buf_regs = regs(notif_buf_id + kMaxNbFlows);
+
+  uint32_t rx_mem_low = notif_buf_regs->rx_mem_low;
+  uint32_t rx_mem_high = notif_buf_regs->rx_mem_high;
+  if (unlikely(rx_mem_low != notif_buf.rx_mem_low ||
+               rx_mem_high != notif_buf.rx_mem_high)) {
+    notif_buf.rx_mem_low = rx_mem_low;
+    notif_buf.rx_mem_high = rx_mem_high;
+    uint64_t addr = ((uint64_t)rx_mem_high << 32) | rx_mem_low;
+    notif_buf.rx_buf =
+        addr ? (struct RxNotification*)translator_(addr) : nullptr;
+  }
+
+  uint32_t tx_mem_low = notif_buf_regs->tx_mem_low;
+  uint32_t tx_mem_high = notif_buf_regs->tx_mem_high;
+  if (unlikely(tx_mem_low != notif_buf.tx_mem_low ||
+               tx_mem_high != notif_buf.tx_mem_high)) {
+    notif_buf.tx_mem_low = tx_mem_low;
+    notif_buf.tx_mem_high = tx_mem_high;
+    uint64_t addr = ((uint64_t)tx_mem_high << 32) | tx_mem_low;
+    notif_buf.tx_buf =
+        addr ? (struct TxNotification*)translator_(addr) : nullptr;
+
+    // The application sets the head before enabling the buffer.
+    notif_buf.tx_head = notif_buf_regs->tx_head % kNotificationBufSize;
+    notif_buf.partial_len = 0;
+  }
+}
+
+size_t NicEmulator::FlowKeyHash::operator()(const FlowKey& key) const {
+  uint64_t h = ((uint64_t)key.dst_ip << 32) | key.src_ip;
+  h ^= ((uint64_t)key.dst_port << 48) | ((uint64_t)key.src_port << 32) |
+       key.protocol;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+int32_t NicEmulator::Steer(const uint8_t* pkt, uint32_t len) {
+  FlowKey key = {};
+  FlowKey full_key = {};
+
+  const struct ether_header* l2_hdr = (const struct ether_header*)pkt;
+  const struct iphdr* l3_hdr = (const struct iphdr*)(l2_hdr + 1);
+
+  bool is_ipv4 = len >= sizeof(*l2_hdr) + sizeof(*l3_hdr) &&
+                 l2_hdr->ether_type == htons(ETHERTYPE_IP);
+
+  if (likely(is_ipv4)) {
+    const uint8_t* l4_hdr = (const uint8_t*)l3_hdr + l3_hdr->ihl * 4;
+    bool has_ports = l4_hdr + 4 <= pkt + len;
+
+    full_key.dst_ip = key.dst_ip = be32toh(l3_hdr->daddr);
+    full_key.src_ip = be32toh(l3_hdr->saddr);
+    full_key.protocol = l3_hdr->protocol;
+
+    if (has_ports && (l3_hdr->protocol == IPPROTO_TCP ||
+                      l3_hdr->protocol == IPPROTO_UDP)) {
+      const struct udphdr* ports = (const struct udphdr*)l4_hdr;
+      full_key.dst_port = be16toh(ports->dest);
+      full_key.src_port = be16toh(ports->source);
+    }
+
+    // Mirrors the hardware flow table: TCP SYNs and UDP match on destination
+    // only, other TCP packets match on the full 5-tuple, and other protocols
+    // match on the destination IP.
+    if (l3_hdr->protocol == IPPROTO_TCP) {
+      const struct tcphdr* tcp_hdr = (const struct tcphdr*)l4_hdr;
+      bool syn = l4_hdr + sizeof(*tcp_hdr) <= pkt + len && tcp_hdr->syn;
+      key = full_key;
+      if (syn) {
+        key.src_ip = 0;
+        key.src_port = 0;
+      }
+    } else if (l3_hdr->protocol == IPPROTO_UDP) {
+      key.dst_port = full_key.dst_port;
+      key.protocol = IPPROTO_UDP;
+    }
+
+    if (!flow_table_.empty()) {
+      auto entry = flow_table_.find(key);
+      if (entry != flow_table_.end()) {
+        return entry->second;
+      }
+    }
+  }
+
+  // Flow table miss: send to a fallback pipe.
+  if (nb_fallback_queues_ == 0) {
+    return -1;
+  }
+
+  if (fallback_rr_) {
+    return next_rr_pipe_++ & fallback_queue_mask_;
+  }
+
+  return FlowKeyHash()(full_key) & fallback_queue_mask_;
+}
+
+bool NicEmulator::DeliverPkt(const uint8_t* pkt, uint32_t len) {
+  int32_t pipe_id = Steer(pkt, len);
+  if (pipe_id < 0) {
+    ++stats_.rx_dropped_no_pipe;
+    return false;
+  }
+
+  uint8_t* buf = RefreshPipe(pipe_id);
+  if (unlikely(buf == nullptr)) {
+    ++stats_.rx_dropped_no_pipe;
+    return false;
+  }
+
+  volatile struct QueueRegs* pipe_regs = regs(pipe_id);
+  PipeState& pipe = pipes_[pipe_id];
+  uint32_t size_mask = pipe.size - 1;
+  uint32_t head = pipe_regs->rx_head & size_mask;
+  uint32_t tail = pipe_regs->rx_tail & size_mask;
+
+  uint32_t nb_flits = (len - 1) / 64 + 1;
+  uint32_t free_flits = (head - tail - 1) & size_mask;
+  if (nb_flits > free_flits) {
+    ++stats_.rx_dropped_full;
+    return false;
+  }
+
+  // The pipe is not mirrored in the emulator's address space, so packets
+  // may need to be split when the pipe wraps around.
+  uint8_t* dst = buf + tail * 64;
+  uint32_t bytes_to_end = (pipe.size - tail) * 64;
+  if (len <= bytes_to_end) {
+    memcpy(dst, pkt, len);
+  } else {
+    memcpy(dst, pkt, bytes_to_end);
+    memcpy(buf, pkt + bytes_to_end, len - bytes_to_end);
+  }
+
+  if (timestamp_enabled_ && len >= kPacketRttOffset + sizeof(uint32_t) &&
+      kPacketRttOffset + sizeof(uint32_t) <= bytes_to_end) {
+    // The hardware replaces the timestamp added on transmission with the RTT.
+    uint32_t* ts_field = (uint32_t*)(dst + kPacketRttOffset);
+    uint32_t rtt = GetTimestamp() - be32toh(*ts_field);
+    *ts_field = htobe32(rtt);
+  }
+
+  _enso_compiler_memory_barrier();
+  pipe_regs->rx_tail = (tail + nb_flits) & size_mask;
+
+  ++stats_.rx_pkts;
+  stats_.rx_bytes += len;
+
+  if (!pipe.notification_pending) {
+    pipe.notification_pending = true;
+    pending_notifications_.push_back(pipe_id);
+  }
+
+  return true;
+}
+
+bool NicEmulator::SendRxNotification(enso_pipe_id_t pipe_id) {
+  const PipeState& pipe = pipes_[pipe_id];
+  if (unlikely(!notif_bufs_[pipe.notif_buf_id].allocated)) {
+    return true;  // Nobody to notify.
+  }
+
+  RefreshNotifBuf(pipe.notif_buf_id);
+  NotifBufState& notif_buf = notif_bufs_[pipe.notif_buf_id];
+  if (unlikely(notif_buf.rx_buf == nullptr)) {
+    return true;
+  }
+
+  volatile struct QueueRegs* notif_buf_regs =
+      regs(pipe.notif_buf_id + kMaxNbFlows);
+  uint32_t head = notif_buf_regs->rx_head % kNotificationBufSize;
+  uint32_t tail = notif_buf_regs->rx_tail % kNotificationBufSize;
+
+  uint32_t free_slots = (head - tail - 1) % kNotificationBufSize;
+  if (free_slots == 0) {
+    return false;
+  }
+
+  volatile struct RxNotification* notification = notif_buf.rx_buf + tail;
+  notification->queue_id = pipe_id;
+  notification->tail = regs(pipe_id)->rx_tail;
+
+  // The application polls on the signal, so it must be written last.
+  _enso_compiler_memory_barrier();
+  notification->signal = 1;
+
+  notif_buf_regs->rx_tail = (tail + 1) % kNotificationBufSize;
+  ++stats_.rx_notifications;
+
+  return true;
+}
+
+void NicEmulator::FlushRxNotifications() {
+  uint32_t nb_kept = 0;
+  for (enso_pipe_id_t pipe_id : pending_notifications_) {
+    PipeState& pipe = pipes_[pipe_id];
+    if (!pipe.allocated || pipe.buf == nullptr) {
+      pipe.notification_pending = false;
+      continue;
+    }
+    if (SendRxNotification(pipe_id)) {
+      pipe.notification_pending = false;
+    } else {
+      // Notification buffer is full. Try again later, as the hardware would.
+      pending_notifications_[nb_kept++] = pipe_id;
+    }
+  }
+  pending_notifications_.resize(nb_kept);
+}
+
+uint32_t NicEmulator::GetTimestamp() {
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  return ns / kNsPerTimestampCycle;
+}
+
+bool NicEmulator::RateLimiterAllows() {
+  if (!rate_limit_enabled_) {
+    return true;
+  }
+
+  uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+  double flits_per_ns = (double)kMaxHardwareFlitRate * rate_limit_num_ /
+                        rate_limit_den_ / 1e9;
+  rate_limit_tokens_ += (now_ns - rate_limit_last_ns_) * flits_per_ns;
+  rate_limit_tokens_ = std::min(rate_limit_tokens_, kMaxRateLimiterBurst);
+  rate_limit_last_ns_ = now_ns;
+
+  return rate_limit_tokens_ > 0;
+}
+
+void NicEmulator::TransmitPkt(const uint8_t* pkt, uint32_t len) {
+  ++stats_.tx_pkts;
+  stats_.tx_bytes += len;
+
+  if (rate_limit_enabled_) {
+    rate_limit_tokens_ -= (len - 1) / 64 + 1;
+  }
+
+  if (!tx_handler_) {
+    return;
+  }
+
+  if (timestamp_enabled_ && len >= kPacketRttOffset + sizeof(uint32_t) &&
+      len <= tx_scratch_.size()) {
+    // The hardware stamps packets on the wire, leaving the host buffer intact.
+    memcpy(tx_scratch_.data(), pkt, len);
+    *(uint32_t*)(tx_scratch_.data() + kPacketRttOffset) =
+        htobe32(GetTimestamp());
+    pkt = tx_scratch_.data();
+  }
+
+  tx_handler_(pkt, len);
+}
+
+void NicEmulator::TransmitData(NotifBufState* notif_buf,
+                               const struct TxNotification* notification) {
+  uint8_t* data = translator_(notification->phys_addr);
+  uint32_t length = notification->length;
+  if (unlikely(data == nullptr)) {
+    ++stats_.tx_bad_addr;
+    notif_buf->partial_len = 0;
+    return;
+  }
+
+  uint32_t offset = 0;
+
+  // Finish a packet that started in the previous notification.
+  if (notif_buf->partial_len > 0) {
+    uint32_t missing = notif_buf->partial_flit_len - notif_buf->partial_len;
+    uint32_t chunk = std::min(missing, length);
+    memcpy(notif_buf->partial_pkt.data() + notif_buf->partial_len, data, chunk);
+    notif_buf->partial_len += chunk;
+    offset = chunk;
+    if (notif_buf->partial_len == notif_buf->partial_flit_len) {
+      TransmitPkt(notif_buf->partial_pkt.data(), notif_buf->partial_pkt_len);
+      notif_buf->partial_len = 0;
+    }
+  }
+
+  while (offset < length) {
+    uint8_t* pkt = data + offset;
+    uint32_t pkt_len = get_pkt_len(pkt);
+    uint32_t flit_len = ((pkt_len - 1) / 64 + 1) * 64;
+
+    if (unlikely(offset + flit_len > length)) {
+      // Packet continues in the next notification.
+      if (notif_buf->partial_pkt.empty()) {
+        notif_buf->partial_pkt.resize(kMaxPktSize);
+      }
+      notif_buf->partial_len = length - offset;
+      notif_buf->partial_flit_len = flit_len;
+      notif_buf->partial_pkt_len = pkt_len;
+      memcpy(notif_buf->partial_pkt.data(), pkt, notif_buf->partial_len);
+      break;
+    }
+
+    TransmitPkt(pkt, pkt_len);
+    offset += flit_len;
+  }
+}
+
+void NicEmulator::ApplyConfig(const struct TxNotification* notification) {
+  // All config notifications start with the signal and the config ID.
+  uint64_t config_id = ((const struct TimestampConfig*)notification)->config_id;
+
+  ++stats_.config_notifications;
+
+  switch (config_id) {
+    case FLOW_TABLE_CONFIG_ID: {
+      const struct FlowTableConfig* flow_config =
+          (const struct FlowTableConfig*)notification;
+      FlowKey key;
+      key.dst_port = flow_config->dst_port;
+      key.src_port = flow_config->src_port;
+      key.dst_ip = flow_config->dst_ip;
+      key.src_ip = flow_config->src_ip;
+      key.protocol = flow_config->protocol;
+      flow_table_[key] = flow_config->enso_pipe_id;
+      break;
+    }
+    case TIMESTAMP_CONFIG_ID: {
+      const struct TimestampConfig* ts_config =
+          (const struct TimestampConfig*)notification;
+      timestamp_enabled_ = ts_config->enable;
+      break;
+    }
+    case RATE_LIMIT_CONFIG_ID: {
+      const struct RateLimitConfig* rl_config =
+          (const struct RateLimitConfig*)notification;
+      rate_limit_enabled_ = rl_config->enable && rl_config->denominator;
+      if (rate_limit_enabled_) {
+        rate_limit_num_ = rl_config->numerator;
+        rate_limit_den_ = rl_config->denominator;
+        rate_limit_tokens_ = 0;
+        rate_limit_last_ns_ =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+      }
+      break;
+    }
+    case FALLBACK_QUEUES_CONFIG_ID: {
+      const struct FallbackQueueConfig* fb_config =
+          (const struct FallbackQueueConfig*)notification;
+      nb_fallback_queues_ = fb_config->nb_fallback_queues;
+      fallback_queue_mask_ = fb_config->fallback_queue_mask;
+      fallback_rr_ = fb_config->enable_rr;
+      break;
+    }
+    default:
+      std::cerr << "Unknown config ID: " << config_id << std::endl;
+      break;
+  }
+}
+
+uint32_t NicEmulator::ProcessTx(uint32_t budget) {
+  uint32_t nb_processed = 0;
+
+  for (uint32_t notif_buf_id : active_notif_bufs_) {
+    RefreshNotifBuf(notif_buf_id);
+    NotifBufState& notif_buf = notif_bufs_[notif_buf_id];
+    if (notif_buf.tx_buf == nullptr) {
+      continue;
+    }
+
+    volatile struct QueueRegs* notif_buf_regs =
+        regs(notif_buf_id + kMaxNbFlows);
+    uint32_t tx_tail = notif_buf_regs->tx_tail % kNotificationBufSize;
+    uint32_t tx_head = notif_buf.tx_head;
+
+    while (tx_head != tx_tail && nb_processed < budget) {
+      volatile struct TxNotification* notification =
+          notif_buf.tx_buf + tx_head;
+
+      uint64_t signal = notification->signal;
+      if (signal == 1) {
+        if (!RateLimiterAllows()) {
+          break;
+        }
+        TransmitData(&notif_buf, (const struct TxNotification*)notification);
+        ++stats_.tx_notifications;
+      } else if (signal >= 2) {
+        ApplyConfig((const struct TxNotification*)notification);
+      }
+
+      // Clearing the signal reports the completion to the application.
+      _enso_compiler_memory_barrier();
+      notification->signal = 0;
+
+      tx_head = (tx_head + 1) % kNotificationBufSize;
+      ++nb_processed;
+    }
+
+    notif_buf.tx_head = tx_head;
+    notif_buf_regs->tx_head = tx_head;
+  }
+
+  return nb_processed;
+}
+
+uint32_t NicEmulator::RaiseInterrupts() {
+  uint32_t nb_interrupts = 0;
+  for (uint32_t notif_buf_id : active_notif_bufs_) {
+    volatile struct QueueRegs* notif_buf_regs =
+        regs(notif_buf_id + kMaxNbFlows);
+    if (likely(notif_buf_regs->rx_intr_arm == 0)) {
+      continue;
+    }
+
+    // Level triggered: we also interrupt for notifications that were sent
+    // before the application armed the buffer, so wakeups are never lost.
+    if (notif_buf_regs->rx_head == notif_buf_regs->rx_tail) {
+      continue;
+    }
+
+    notif_buf_regs->rx_intr_arm = 0;
+    interrupt_handler_(notif_buf_id);
+    ++nb_interrupts;
+  }
+  stats_.interrupts += nb_interrupts;
+  return nb_interrupts;
+}
+
+uint32_t NicEmulator::Poll() {
+  uint32_t work = 0;
+
+  // The NIC sends a new notification when software updates the head of a
+  // pipe that still has data.
+  for (enso_pipe_id_t pipe_id : head_updates_) {
+    PipeState& pipe = pipes_[pipe_id];
+    if (!pipe.allocated || RefreshPipe(pipe_id) == nullptr ||
+        pipe.notification_pending) {
+      continue;
+    }
+    volatile struct QueueRegs* pipe_regs = regs(pipe_id);
+    if (pipe_regs->rx_head != pipe_regs->rx_tail) {
+      pipe.notification_pending = true;
+      pending_notifications_.push_back(pipe_id);
+    }
+  }
+  work += head_updates_.size();
+  head_updates_.clear();
+
+  work += ProcessTx(kNotificationBufSize);
+
+  work += pending_notifications_.size();
+  FlushRxNotifications();
+
+  if (interrupt_handler_) {
+    work += RaiseInterrupts();
+  }
+
+  return work;
+}
+
+}  // namespace enso
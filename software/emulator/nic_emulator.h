@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Software model of the Enso NIC.
+ *
+ * The model implements the same register interface, notification semantics,
+ * flow steering, timestamping, and rate limiting as the hardware. It does not
+ * know how it is reached: the software backend daemon feeds it MMIO requests
+ * received over IPC queues while other backends may access the register file
+ * directly.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#ifndef SOFTWARE_EMULATOR_NIC_EMULATOR_H_
+#define SOFTWARE_EMULATOR_NIC_EMULATOR_H_
+
+#include <enso/consts.h>
+#include <enso/internals.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace enso {
+
+/**
+ * @brief Software model of the Enso NIC.
+ *
+ * All methods must be called from the same thread, except for accesses to the
+ * register file returned by `bar()`, which the application may read and write
+ * concurrently, as it would with the hardware.
+ *
+ * Example:
+ * @code
+ *   auto nic = NicEmulator::Create(translate_fn);
+ *   nic->set_tx_handler([&](const uint8_t* pkt, uint32_t len) {
+ *     nic->DeliverPkt(pkt, len);  // Loopback.
+ *   });
+ *   while (running) {
+ *     nic->Poll();
+ *   }
+ * @endcode
+ */
+class NicEmulator {
+ public:
+  /**
+   * @brief Translates an address programmed by the application (in a register
+   *        or in a TX notification) to a pointer in the emulator's address
+   *        space. Must return nullptr if the address is not valid.
+   */
+  using AddrTranslator = std::function<uint8_t*(uint64_t dev_addr)>;
+
+  /**
+   * @brief Called for every packet transmitted by the application.
+   */
+  using TxHandler = std::function<void(const uint8_t* pkt, uint32_t len)>;
+
+  /**
+   * @brief Called to wake up an application that armed the interrupt of a
+   *        notification buffer, see `QueueRegs::rx_intr_arm`.
+   */
+  using InterruptHandler = std::function<void(uint32_t notif_buf_id)>;
+
+  struct Stats {
+    uint64_t rx_pkts;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped_no_pipe;  // Packets without a pipe to go to.
+    uint64_t rx_dropped_full;     // Packets dropped because the pipe was full.
+    uint64_t rx_notifications;
+    uint64_t tx_pkts;
+    uint64_t tx_bytes;
+    uint64_t tx_notifications;
+    uint64_t tx_bad_addr;  // TX notifications with an invalid address.
+    uint64_t config_notifications;
+    uint64_t interrupts;
+  };
+
+  /**
+   * @brief Instantiates a NIC emulator.
+   *
+   * @param translator Function used to translate device addresses.
+   * @return A unique pointer to the emulator or nullptr on failure.
+   */
+  static std::unique_ptr<NicEmulator> Create(
+      AddrTranslator translator) noexcept;
+
+  ~NicEmulator() noexcept;
+
+  /**
+   * @brief Returns the base of the register file (BAR 2). Its layout matches
+   *        the hardware: one `QueueRegs` per pipe followed by one per
+   *        notification buffer, each `kMemorySpacePerQueue` bytes apart.
+   */
+  uint8_t* bar() const { return bar_; }
+
+  /**
+   * @brief Size of the register file in bytes.
+   */
+  static constexpr size_t kBarSize =
+      (size_t)kMemorySpacePerQueue * (kMaxNbFlows + kMaxNbApps);
+
+  /**
+   * @brief Writes to a register, applying its side effects.
+   *
+   * Writing to a pipe's head makes the NIC send a new notification if there
+   * is still data in the pipe, which is what enables prefetching.
+   *
+   * @param offset Offset of the register in BAR 2.
+   * @param value Value to write.
+   */
+  void MmioWrite(uint64_t offset, uint32_t value);
+
+  /**
+   * @brief Reads a register.
+   *
+   * @param offset Offset of the register in BAR 2.
+   * @return Register value, or 0xffffffff for an invalid offset.
+   */
+  uint32_t MmioRead(uint64_t offset) const;
+
+  /**
+   * @brief Applies the side effects of a write to a pipe's head that the
+   *        application made directly in the register file returned by
+   *        `bar()`, as `MmioWrite()` would.
+   *
+   * @param pipe_id ID of the pipe whose `rx_head` was written.
+   */
+  void HeadUpdated(enso_pipe_id_t pipe_id) { head_updates_.push_back(pipe_id); }
+
+  /**
+   * @brief Allocates a notification buffer.
+   * @return Notification buffer ID or -1 if there is none available.
+   */
+  int AllocateNotifBuf();
+
+  /**
+   * @brief Frees a notification buffer.
+   * @return 0 on success, -1 if the ID is invalid.
+   */
+  int FreeNotifBuf(int notif_buf_id);
+
+  /**
+   * @brief Allocates a pipe.
+   *
+   * Fallback pipes are allocated contiguously starting from ID 0, regular
+   * pipes are allocated starting from the highest ID. This matches what the
+   * kernel module does.
+   *
+   * @param fallback Whether to allocate a fallback pipe.
+   * @return Pipe ID or -1 if there is none available.
+   */
+  int AllocatePipe(bool fallback);
+
+  /**
+   * @brief Frees a pipe.
+   * @return 0 on success, -1 if the ID is invalid.
+   */
+  int FreePipe(int pipe_id);
+
+  /**
+   * @brief Returns the number of allocated fallback pipes.
+   */
+  int GetNbFallbackQueues() const { return nb_fallback_pipes_; }
+
+  int SetRrStatus(bool round_robin) {
+    round_robin_ = round_robin;
+    return 0;
+  }
+
+  int GetRrStatus() const { return round_robin_; }
+
+  /**
+   * @brief Sets the function that receives transmitted packets.
+   *
+   * If not set, transmitted packets are dropped.
+   */
+  void set_tx_handler(TxHandler handler) { tx_handler_ = std::move(handler); }
+
+  /**
+   * @brief Sets the function that delivers interrupts.
+   *
+   * An interrupt is raised when a notification buffer is armed and has
+   * notifications that the application did not consume yet (i.e., its RX head
+   * and tail differ), which also covers notifications sent before the buffer
+   * was armed. Raising the interrupt disarms the buffer.
+   *
+   * If not set, notification buffers are never interrupted.
+   */
+  void set_interrupt_handler(InterruptHandler handler) {
+    interrupt_handler_ = std::move(handler);
+  }
+
+  /**
+   * @brief Receives a packet from the "wire", steering it to a pipe.
+   *
+   * The notification for the pipe is only sent by the next call to
+   * `FlushRxNotifications()` (or `Poll()`), letting multiple packets to the
+   * same pipe be coalesced into a single notification.
+   *
+   * @param pkt Packet data, starting at the Ethernet header.
+   * @param len Packet length in bytes.
+   * @return true if the packet was written to a pipe, false if dropped.
+   */
+  bool DeliverPkt(const uint8_t* pkt, uint32_t len);
+
+  /**
+   * @brief Sends notifications for all pipes that received data since the
+   *        last call.
+   */
+  void FlushRxNotifications();
+
+  /**
+   * @brief Consumes TX notifications from all notification buffers.
+   *
+   * @param budget Maximum number of notifications to consume.
+   * @return Number of consumed notifications.
+   */
+  uint32_t ProcessTx(uint32_t budget);
+
+  /**
+   * @brief Runs one iteration of the NIC: processes head updates, TX
+   *        notifications, and sends pending RX notifications.
+   *
+   * @return Amount of work done. Zero means that the NIC is idle.
+   */
+  uint32_t Poll();
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct PipeState {
+    // Last register values used to compute `buf`.
+    uint32_t mem_low;
+    uint32_t mem_high;
+    uint8_t* buf;
+    uint32_t size;  // In flits, read from `rx_size` when the pipe is enabled.
+    uint16_t notif_buf_id;
+    bool notification_pending;
+    bool allocated;
+  };
+
+  struct NotifBufState {
+    uint32_t rx_mem_low;
+    uint32_t rx_mem_high;
+    uint32_t tx_mem_low;
+    uint32_t tx_mem_high;
+    struct RxNotification* rx_buf;
+    struct TxNotification* tx_buf;
+    uint32_t tx_head;
+    bool allocated;
+
+    // Packets may be split between two TX notifications when the application
+    // buffer wraps around. We reassemble them here.
+    std::vector<uint8_t> partial_pkt;
+    uint32_t partial_len;       // Bytes already in `partial_pkt`.
+    uint32_t partial_flit_len;  // Flit-aligned length of the packet.
+    uint32_t partial_pkt_len;
+  };
+
+  struct FlowKey {
+    uint16_t dst_port;
+    uint16_t src_port;
+    uint32_t dst_ip;
+    uint32_t src_ip;
+    uint32_t protocol;
+
+    bool operator==(const FlowKey& other) const {
+      return dst_port == other.dst_port && src_port == other.src_port &&
+             dst_ip == other.dst_ip && src_ip == other.src_ip &&
+             protocol == other.protocol;
+    }
+  };
+
+  struct FlowKeyHash {
+    size_t operator()(const FlowKey& key) const;
+  };
+
+  explicit NicEmulator(AddrTranslator translator) noexcept
+      : translator_(std::move(translator)) {}
+
+  NicEmulator(const NicEmulator& other) = delete;
+  NicEmulator& operator=(const NicEmulator& other) = delete;
+  NicEmulator(NicEmulator&& other) = delete;
+  NicEmulator& operator=(NicEmulator&& other) = delete;
+
+  /**
+   * @brief Initializes the emulator.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init() noexcept;
+
+  volatile struct QueueRegs* regs(uint32_t queue_id) const {
+    return (volatile struct QueueRegs*)(bar_ +
+                                        queue_id * kMemorySpacePerQueue);
+  }
+
+  /**
+   * @brief Updates the pipe state if the application changed its address.
+   * @return The pipe buffer or nullptr if the pipe is disabled.
+   */
+  uint8_t* RefreshPipe(enso_pipe_id_t pipe_id);
+
+  /**
+   * @brief Updates the notification buffer state if the application changed
+   *        its addresses.
+   */
+  void RefreshNotifBuf(uint32_t notif_buf_id);
+
+  /**
+   * @brief Returns the pipe that should receive the packet or -1 if it should
+   *        be dropped.
+   */
+  int32_t Steer(const uint8_t* pkt, uint32_t len);
+
+  /**
+   * @brief Tries to send a notification for the given pipe.
+   * @return true on success, false if the notification buffer is full.
+   */
+  bool SendRxNotification(enso_pipe_id_t pipe_id);
+
+  /**
+   * @brief Transmits all packets in a TX notification.
+   */
+  void TransmitData(NotifBufState* notif_buf,
+                    const struct TxNotification* notification);
+
+  void TransmitPkt(const uint8_t* pkt, uint32_t len);
+
+  void ApplyConfig(const struct TxNotification* notification);
+
+  /**
+   * @brief Raises the interrupt of armed notification buffers that have
+   *        notifications pending.
+   * @return Number of interrupts raised.
+   */
+  uint32_t RaiseInterrupts();
+
+  /**
+   * @brief Refills the rate limiter tokens.
+   * @return true if the NIC is allowed to transmit.
+   */
+  bool RateLimiterAllows();
+
+  static uint32_t GetTimestamp();
+
+  AddrTranslator translator_;
+  TxHandler tx_handler_;
+  InterruptHandler interrupt_handler_;
+  uint8_t* bar_ = nullptr;
+
+  std::vector<PipeState> pipes_;
+  std::vector<NotifBufState> notif_bufs_;
+  std::vector<uint32_t> active_notif_bufs_;
+  std::vector<enso_pipe_id_t> pending_notifications_;
+  std::vector<enso_pipe_id_t> head_updates_;
+
+  int nb_fallback_pipes_ = 0;
+  int nb_regular_pipes_ = 0;
+  bool round_robin_ = false;
+
+  std::unordered_map<FlowKey, enso_pipe_id_t, FlowKeyHash> flow_table_;
+  uint32_t nb_fallback_queues_ = 0;
+  uint32_t fallback_queue_mask_ = 0;
+  bool fallback_rr_ = false;
+  uint32_t next_rr_pipe_ = 0;
+
+  bool timestamp_enabled_ = false;
+  std::vector<uint8_t> tx_scratch_;
+
+  bool rate_limit_enabled_ = false;
+  uint16_t rate_limit_num_ = 1;
+  uint16_t rate_limit_den_ = 1;
+  double rate_limit_tokens_ = 0;  // In flits.
+  uint64_t rate_limit_last_ns_ = 0;
+
+  Stats stats_ = {};
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_EMULATOR_NIC_EMULATOR_H_
@@ -30,85 +30,60 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <enso/device_group.h>
 #include <enso/helpers.h>
 #include <enso/pipe.h>
 
-#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <iostream>
 #include <memory>
-#include <thread>
+#include <vector>
 
 #include "example_helpers.h"
 
 static volatile bool keep_running = true;
-static volatile bool setup_done = false;
 
 void int_handler([[maybe_unused]] int signal) { keep_running = false; }
 
-void run_echo(uint32_t nb_queues, uint32_t core_id, uint32_t nb_cycles,
-              enso::stats_t* stats) {
-  std::this_thread::sleep_for(std::chrono::seconds(1));
+static _enso_always_inline void process_pkt(uint8_t* pkt, uint32_t nb_cycles,
+                                            enso::stats_t* stats) {
+  ++pkt[63];  // Increment payload.
 
-  std::cout << "Running on core " << sched_getcpu() << std::endl;
-
-  using enso::Device;
-  using enso::RxTxPipe;
-
-  std::unique_ptr<Device> dev = Device::Create();
-  std::vector<RxTxPipe*> pipes;
-
-  if (!dev) {
-    std::cerr << "Problem creating device" << std::endl;
-    exit(2);
+  for (uint32_t i = 0; i < nb_cycles; ++i) {
+    asm("nop");
   }
 
-  for (uint32_t i = 0; i < nb_queues; ++i) {
-    RxTxPipe* pipe = dev->AllocateRxTxPipe();
-    if (!pipe) {
-      std::cerr << "Problem creating RX/TX pipe" << std::endl;
-      exit(3);
-    }
-    uint32_t dst_ip = kBaseIpAddress + core_id * nb_queues + i;
-    pipe->Bind(kDstPort, 0, dst_ip, 0, kProtocol);
-
-    pipes.push_back(pipe);
-  }
-
-  setup_done = true;
-
-  while (keep_running) {
-    for (auto& pipe : pipes) {
-      auto batch = pipe->PeekPkts();
-
-      if (unlikely(batch.available_bytes() == 0)) {
-        continue;
-      }
+  ++(stats->nb_pkts);
+}
 
-      for (auto pkt : batch) {
-        ++pkt[63];  // Increment payload.
+void run_echo(enso::DeviceGroup::Shard& shard, uint32_t nb_cycles,
+              uint32_t prefetch_distance, enso::stats_t* stats) {
+  for (auto& pipe : shard.rx_tx_pipes) {
+    auto batch = pipe->PeekPkts();
 
-        for (uint32_t i = 0; i < nb_cycles; ++i) {
-          asm("nop");
-        }
+    if (unlikely(batch.available_bytes() == 0)) {
+      continue;
+    }
 
-        ++(stats->nb_pkts);
-      }
-      uint32_t batch_length = batch.processed_bytes();
-      pipe->ConfirmBytes(batch_length);
+    batch.SetPrefetchDistance(prefetch_distance);
+    for (auto pkt : batch) {
+      process_pkt(pkt, nb_cycles, stats);
+    }
+    uint32_t batch_length = batch.processed_bytes();
+    pipe->ConfirmBytes(batch_length);
 
-      stats->recv_bytes += batch_length;
-      ++(stats->nb_batches);
+    stats->recv_bytes += batch_length;
+    ++(stats->nb_batches);
 
-      pipe->SendAndFree(batch_length);
-    }
+    pipe->SendAndFree(batch_length);
   }
 }
 
 int main(int argc, const char* argv[]) {
-  if (argc != 4) {
-    std::cerr << "Usage: " << argv[0] << " NB_CORES NB_QUEUES NB_CYCLES"
+  if (argc != 4 && argc != 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " NB_CORES NB_QUEUES NB_CYCLES [PREFETCH_DISTANCE]"
               << std::endl
               << std::endl;
     std::cerr << "NB_CORES: Number of cores to use." << std::endl;
@@ -116,35 +91,43 @@ int main(int argc, const char* argv[]) {
     std::cerr << "NB_CYCLES: Number of cycles to busy loop when processing each"
                  " packet."
               << std::endl;
+    std::cerr << "PREFETCH_DISTANCE: Number of packets to prefetch ahead"
+                 " (default: 0)."
+              << std::endl;
     return 1;
   }
 
   uint32_t nb_cores = atoi(argv[1]);
   uint32_t nb_queues = atoi(argv[2]);
   uint32_t nb_cycles = atoi(argv[3]);
+  uint32_t prefetch_distance = (argc == 5) ? atoi(argv[4]) : 0;
 
   signal(SIGINT, int_handler);
 
-  std::vector<std::thread> threads;
-  std::vector<enso::stats_t> thread_stats(nb_cores);
+  enso::DeviceGroupConfig config;
+  config.nb_cores = nb_cores;
+  config.nb_pipes_per_core = nb_queues;
 
-  for (uint32_t core_id = 0; core_id < nb_cores; ++core_id) {
-    threads.emplace_back(run_echo, nb_queues, core_id, nb_cycles,
-                         &(thread_stats[core_id]));
-    if (enso::set_core_id(threads.back(), core_id)) {
-      std::cerr << "Error setting CPU affinity" << std::endl;
-      return 6;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  std::unique_ptr<enso::DeviceGroup> group = enso::DeviceGroup::Create(config);
+  if (!group) {
+    std::cerr << "Problem creating device group" << std::endl;
+    return 2;
   }
 
-  while (!setup_done) continue;  // Wait for setup to be done.
+  for (uint32_t i = 0; i < group->nb_pipes(); ++i) {
+    group->Bind(kDstPort, 0, kBaseIpAddress + i, 0, kProtocol);
+  }
+
+  std::vector<enso::stats_t> thread_stats(nb_cores);
+
+  group->Start([&](enso::DeviceGroup::Shard& shard) {
+    run_echo(shard, nb_cycles, prefetch_distance,
+             &(thread_stats[shard.index]));
+  });
 
   show_stats(thread_stats, &keep_running);
 
-  for (auto& thread : threads) {
-    thread.join();
-  }
+  group->Stop();
 
   return 0;
 }
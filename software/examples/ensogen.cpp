@@ -86,6 +86,9 @@
 // Default delay between displayed stats (in milliseconds).
 #define DEFAULT_STATS_DELAY 1000
 
+// Default maximum number of notifications consumed at once when adapting it.
+#define DEFAULT_MAX_NOTIF_BATCH 512
+
 // Number of CLI arguments.
 #define NB_CLI_ARGS 3
 
@@ -128,7 +131,9 @@ static void print_usage(const char* program_name) {
       " [--rtt-hist-offset HIST_OFFSET]\n"
       " [--rtt-hist-len HIST_LEN]\n"
       " [--stats-delay STATS_DELAY]\n"
-      " [--pcie-addr PCIE_ADDR]\n\n"
+      " [--pcie-addr PCIE_ADDR]\n"
+      " [--notif-batch NB_NOTIFS]\n"
+      " [--adaptive-notif-batch]\n\n"
 
       "  PCAP_FILE: Pcap file with packets to transmit.\n"
       "  RATE_NUM: Numerator of the rate used to transmit packets.\n"
@@ -150,9 +155,16 @@ static void print_usage(const char* program_name) {
       "                  performance penalty.\n"
       "  --stats-delay: Delay between displayed stats in milliseconds\n"
       "                 (default: %d).\n"
-      "  --pcie-addr: Specify the PCIe address of the NIC to use.\n",
+      "  --pcie-addr: Specify the PCIe address of the NIC to use.\n"
+      "  --notif-batch: Number of notifications to consume at once, or the\n"
+      "                 maximum with --adaptive-notif-batch (default: %d\n"
+      "                 or %d with --adaptive-notif-batch).\n"
+      "  --adaptive-notif-batch: Adapt the number of notifications consumed\n"
+      "                          at once to the load and report it at the\n"
+      "                          end.\n",
       program_name, DEFAULT_CORE_ID, DEFAULT_NB_QUEUES, DEFAULT_HIST_OFFSET,
-      DEFAULT_HIST_LEN, DEFAULT_STATS_DELAY);
+      DEFAULT_HIST_LEN, DEFAULT_STATS_DELAY, enso::kBatchSize,
+      DEFAULT_MAX_NOTIF_BATCH);
 }
 
 #define CMD_OPT_HELP "help"
@@ -167,6 +179,8 @@ static void print_usage(const char* program_name) {
 #define CMD_OPT_RTT_HIST_LEN "rtt-hist-len"
 #define CMD_OPT_STATS_DELAY "stats-delay"
 #define CMD_OPT_PCIE_ADDR "pcie-addr"
+#define CMD_OPT_NOTIF_BATCH "notif-batch"
+#define CMD_OPT_ADAPTIVE_NOTIF_BATCH "adaptive-notif-batch"
 
 // Map long options to short options.
 enum {
@@ -182,6 +196,8 @@ enum {
   CMD_OPT_RTT_HIST_LEN_NUM,
   CMD_OPT_STATS_DELAY_NUM,
   CMD_OPT_PCIE_ADDR_NUM,
+  CMD_OPT_NOTIF_BATCH_NUM,
+  CMD_OPT_ADAPTIVE_NOTIF_BATCH_NUM,
 };
 
 static const char short_options[] = "";
@@ -199,6 +215,9 @@ static const struct option long_options[] = {
     {CMD_OPT_RTT_HIST_LEN, required_argument, NULL, CMD_OPT_RTT_HIST_LEN_NUM},
     {CMD_OPT_STATS_DELAY, required_argument, NULL, CMD_OPT_STATS_DELAY_NUM},
     {CMD_OPT_PCIE_ADDR, required_argument, NULL, CMD_OPT_PCIE_ADDR_NUM},
+    {CMD_OPT_NOTIF_BATCH, required_argument, NULL, CMD_OPT_NOTIF_BATCH_NUM},
+    {CMD_OPT_ADAPTIVE_NOTIF_BATCH, no_argument, NULL,
+     CMD_OPT_ADAPTIVE_NOTIF_BATCH_NUM},
     {0, 0, 0, 0}};
 
 struct parsed_args_t {
@@ -218,6 +237,8 @@ struct parsed_args_t {
   uint32_t rtt_hist_len;
   uint32_t stats_delay;
   std::string pcie_addr;
+  uint16_t notif_batch;
+  bool adaptive_notif_batch;
 };
 
 static int parse_args(int argc, char** argv,
@@ -235,6 +256,8 @@ static int parse_args(int argc, char** argv,
   parsed_args.rtt_hist_offset = DEFAULT_HIST_OFFSET;
   parsed_args.rtt_hist_len = DEFAULT_HIST_LEN;
   parsed_args.stats_delay = DEFAULT_STATS_DELAY;
+  parsed_args.notif_batch = 0;
+  parsed_args.adaptive_notif_batch = false;
 
   while ((opt = getopt_long(argc, argv, short_options, long_options,
                             &long_index)) != EOF) {
@@ -276,6 +299,22 @@ static int parse_args(int argc, char** argv,
       case CMD_OPT_PCIE_ADDR_NUM:
         parsed_args.pcie_addr = optarg;
         break;
+      case CMD_OPT_NOTIF_BATCH_NUM: {
+        char* end;
+        errno = 0;
+        uint64_t notif_batch = strtoul(optarg, &end, 10);
+        if (errno != 0 || *end != '\0' || notif_batch == 0 ||
+            notif_batch > enso::kNotificationBufSize) {
+          std::cerr << "Notification batch must be between 1 and "
+                    << enso::kNotificationBufSize << std::endl;
+          return -1;
+        }
+        parsed_args.notif_batch = notif_batch;
+        break;
+      }
+      case CMD_OPT_ADAPTIVE_NOTIF_BATCH_NUM:
+        parsed_args.adaptive_notif_batch = true;
+        break;
       default:
         return -1;
     }
@@ -299,6 +338,10 @@ static int parse_args(int argc, char** argv,
     return -1;
   }
 
+  if (parsed_args.notif_batch == 0 && parsed_args.adaptive_notif_batch) {
+    parsed_args.notif_batch = DEFAULT_MAX_NOTIF_BATCH;
+  }
+
   return 0;
 }
 
@@ -480,16 +523,10 @@ struct TxArgs {
 
 void pcap_pkt_handler(u_char* user, const struct pcap_pkthdr* pkt_hdr,
                       const u_char* pkt_bytes) {
-  (void)pkt_hdr;
   struct PcapHandlerContext* context = (struct PcapHandlerContext*)user;
 
-  const struct ether_header* l2_hdr = (struct ether_header*)pkt_bytes;
-  if (l2_hdr->ether_type != htons(ETHERTYPE_IP)) {
-    std::cerr << "Non-IPv4 packets are not supported" << std::endl;
-    exit(8);
-  }
-
-  uint32_t len = enso::get_pkt_len(pkt_bytes);
+  // Packets that are not IP use the captured length.
+  uint32_t len = enso::get_pkt_len(pkt_bytes, pkt_hdr->caplen);
   uint32_t nb_flits = (len - 1) / 64 + 1;
 
   if (nb_flits > context->free_flits) {
@@ -783,6 +820,11 @@ int main(int argc, char** argv) {
                                      parsed_args.rate_den);
       enso::enable_device_round_robin(socket_fd);
 
+      if (parsed_args.notif_batch != 0) {
+        enso::set_device_notification_batch(socket_fd, parsed_args.notif_batch,
+                                            parsed_args.adaptive_notif_batch);
+      }
+
       if (parsed_args.enable_rtt) {
         enso::enable_device_timestamp(socket_fd);
       } else {
@@ -816,6 +858,10 @@ int main(int argc, char** argv) {
 
       rx_done = true;
 
+      if (parsed_args.adaptive_notif_batch) {
+        enso::print_sock_stats(socket_fd);
+      }
+
       enso::disable_device_rate_limit(socket_fd);
       enso::disable_device_round_robin(socket_fd);
 
@@ -908,6 +954,12 @@ int main(int argc, char** argv) {
                                          parsed_args.rate_den);
           enso::enable_device_round_robin(socket_fd);
 
+          if (parsed_args.notif_batch != 0) {
+            enso::set_device_notification_batch(
+                socket_fd, parsed_args.notif_batch,
+                parsed_args.adaptive_notif_batch);
+          }
+
           if (parsed_args.enable_rtt) {
             enso::enable_device_timestamp(socket_fd);
           }
@@ -947,6 +999,10 @@ int main(int argc, char** argv) {
 
           rx_done = true;
 
+          if (parsed_args.adaptive_notif_batch) {
+            enso::print_sock_stats(socket_fd);
+          }
+
           reclaim_all_buffers(tx_args);
 
           enso::disable_device_rate_limit(socket_fd);
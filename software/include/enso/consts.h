@@ -62,6 +62,24 @@ constexpr uint32_t kMaxTransferLen = 131072;
 // Maximum number of tails to process at once.
 constexpr uint32_t kBatchSize = 64;
 
+// Parameters used to adapt the number of notifications consumed at once, see
+// `PollProfile::adaptive_notification_batch`.
+constexpr uint16_t kMinNotifBatchSize = 8;
+constexpr uint16_t kNotifBatchSizeStep = 8;
+constexpr uint16_t kNotifBatchWindow = 64;  // Scans per adjustment.
+
+// Default time that `Device::WaitForRx()` busy polls before sleeping (in
+// microseconds).
+constexpr uint32_t kDefaultRxBusyPollBudgetUs = 50;
+
+// Default time between a pipe prefetch and the NIC's response arriving (in
+// cycles), see `Device::SetRxPrefetchLatency()`.
+constexpr uint64_t kDefaultRxPrefetchLatencyCycles = 4000;
+
+// Number of priority classes that RX pipes may be assigned to, see
+// `RxPipe::SetSchedulingClass()`.
+constexpr uint32_t kNbRxSchedulingClasses = 4;
+
 #ifndef NOTIFICATION_BUF_SIZE
 // This should be the max buffer supported by the hardware, we may override this
 // value when compiling. It is defined in number of flits (64 bytes).
@@ -76,24 +94,37 @@ constexpr uint32_t kNotificationBufSize = NOTIFICATION_BUF_SIZE;
 #endif
 constexpr uint32_t kEnsoPipeSize = ENSO_PIPE_SIZE;
 
+// Range of sizes that may be requested for individual RX pipes (in flits).
+// `kEnsoPipeSize` is used by default.
+constexpr uint32_t kMinEnsoPipeSize = 256;
+constexpr uint32_t kMaxEnsoPipeSize = 1UL << 24;
+
 constexpr uint32_t kMaxPendingTxRequests = kNotificationBufSize - 1;
 
 // Using 2MB huge pages (size in bytes).
 constexpr uint32_t kBufPageSize = 1UL << 21;
 
+// Huge pages reserved for pipe buffers when creating a device. Enough for one
+// RX and one TX pipe.
+constexpr uint32_t kDefaultNbReservedHugePages = 2;
+
 // Huge page paths.
 static constexpr std::string_view kHugePageDefaultPrefix = "/mnt/huge/enso";
+// Used for pipes that fill a whole 1GB huge page, when mounted. The file name
+// is replaced with the one from the device's prefix.
+static constexpr std::string_view kHugePage1GDefaultPrefix = "/mnt/huge1G/enso";
 static constexpr std::string_view kHugePageRxPipePathPrefix = "_rx_pipe:";
 static constexpr std::string_view kHugePagePathPrefix = "_tx_pipe:";
+static constexpr std::string_view kHugePageSharedTxPipePathPrefix =
+    "_shared_tx_pipe:";
 static constexpr std::string_view kHugePageNotifBufPathPrefix = "_notif_buf:";
 static constexpr std::string_view kHugePageQueuePathPrefix = "_queue:";
+static constexpr std::string_view kHugePagePoolPathPrefix = "_pool:";
 
 // We need this to allow the same huge page to be mapped to adjacent memory
-// regions.
-// TODO(sadok): support other buffer sizes. It may be possible to support
-// other buffer sizes by overlaying regular pages on top of the huge pages.
-// We might use those only for requests that overlap to avoid adding too
-// many entries to the TLB.
+// regions. Pipes with other sizes may be requested at runtime: larger pipes
+// need a 1GB huge page and smaller ones share a huge page (see
+// `enso_pipe_init`).
 static_assert(ENSO_PIPE_SIZE * 64 == kBufPageSize, "Unsupported buffer size");
 
 /**
@@ -135,6 +166,11 @@ static constexpr std::string_view kIpcQueueToAppName = "enso_ipc_queue_to_app";
 static constexpr std::string_view kIpcQueueFromAppName =
     "enso_ipc_queue_from_app";
 
+// FIFOs used by the emulator to wake up applications waiting for RX
+// notifications, followed by the notification buffer ID.
+static constexpr std::string_view kIpcWakeupFifoPrefix =
+    "/dev/shm/enso_ipc_wakeup_";
+
 enum class NotifType : uint8_t {
   kWrite = 0,
   kRead = 1,
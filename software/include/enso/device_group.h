@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Management of multiple per-core devices.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#ifndef SOFTWARE_INCLUDE_ENSO_DEVICE_GROUP_H_
+#define SOFTWARE_INCLUDE_ENSO_DEVICE_GROUP_H_
+
+#include <enso/pipe.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace enso {
+
+/**
+ * @brief Configuration used to create a `DeviceGroup`.
+ */
+struct DeviceGroupConfig {
+  /**
+   * Cores to use, one device is created for each. If empty, uses the first
+   * `nb_cores` cores.
+   */
+  std::vector<uint32_t> core_ids;
+
+  /**
+   * Number of cores to use when `core_ids` is empty.
+   */
+  uint32_t nb_cores = 1;
+
+  /**
+   * Number of RX or RX/TX pipes to allocate for each core.
+   */
+  uint32_t nb_pipes_per_core = 1;
+
+  /**
+   * If true, allocates RX/TX pipes. Otherwise, allocates RX pipes.
+   */
+  bool rx_tx_pipes = true;
+
+  /**
+   * Whether the pipes are fallback pipes.
+   */
+  bool fallback = false;
+
+  /**
+   * PCIe address of the device. If empty, uses the first device found.
+   */
+  std::string pcie_addr = "";
+
+  /**
+   * Prefix to use for huge pages files. If empty, uses the default prefix.
+   */
+  std::string huge_page_prefix = "";
+
+  /**
+   * Where to place the memory of each core's pipes. With
+   * `NumaPolicy::kCore`, every core uses memory from its own node.
+   */
+  NumaPolicy numa_policy = NumaPolicy::kDevice;
+
+  /**
+   * Number of huge pages to reserve for each core's pipe buffers. Use at
+   * least `nb_pipes_per_core` to allocate the initial pipes from the pool.
+   *
+   * @see Device::Create
+   * @see Device::ReserveHugePages
+   */
+  uint32_t nb_huge_pages_per_core = kDefaultNbReservedHugePages;
+};
+
+/**
+ * @brief A class that manages one `Device` per core.
+ *
+ * Each core gets its own thread, pinned to that core, which creates the core's
+ * `Device` and allocates a contiguous range of pipes. Flow bindings are spread
+ * across the pipes of all cores. Once started, every thread repeatedly calls
+ * an application-provided poll function with its `Shard`.
+ *
+ * Should be instantiated using the factory method `Create()`.
+ *
+ * Example:
+ * @code
+ *    enso::DeviceGroupConfig config;
+ *    config.nb_cores = 4;
+ *    config.nb_pipes_per_core = 2;
+ *    auto group = enso::DeviceGroup::Create(config);
+ *
+ *    for (uint32_t i = 0; i < group->nb_pipes(); ++i) {
+ *      group->Bind(dst_port, 0, base_dst_ip + i, 0, protocol);
+ *    }
+ *
+ *    group->Start([](enso::DeviceGroup::Shard& shard) {
+ *      for (auto pipe : shard.rx_tx_pipes) {
+ *        // Receive and send packets.
+ *      }
+ *    });
+ *
+ *    [...]
+ *
+ *    group->Stop();
+ * @endcode
+ */
+class DeviceGroup {
+ public:
+  /**
+   * @brief The device and pipes that belong to a single core.
+   */
+  struct Shard {
+    uint32_t index;    ///< Index of the shard in the group.
+    uint32_t core_id;  ///< Core the shard runs on.
+    std::unique_ptr<Device> device;
+    std::vector<RxPipe*> rx_pipes;       ///< If `!config.rx_tx_pipes`.
+    std::vector<RxTxPipe*> rx_tx_pipes;  ///< If `config.rx_tx_pipes`.
+    void* context = nullptr;             ///< Free for the application to use.
+  };
+
+  /**
+   * @brief Function called by each shard's thread. Used for both `init` and
+   *        `poll` in `Start()`.
+   */
+  using ShardFunction = std::function<void(Shard&)>;
+
+  /**
+   * @brief Factory method to create a device group.
+   *
+   * Creates the threads, devices, and pipes for all cores. Returns once all
+   * of them are ready.
+   *
+   * @param config The group configuration.
+   * @return A unique pointer to the group. May be null if any of the devices
+   *         or pipes cannot be created.
+   */
+  static std::unique_ptr<DeviceGroup> Create(
+      const DeviceGroupConfig& config) noexcept;
+
+  DeviceGroup(const DeviceGroup&) = delete;
+  DeviceGroup& operator=(const DeviceGroup&) = delete;
+  DeviceGroup(DeviceGroup&&) = delete;
+  DeviceGroup& operator=(DeviceGroup&&) = delete;
+
+  /**
+   * @brief Stops the threads, if they are still running, and frees all the
+   *        devices.
+   */
+  ~DeviceGroup();
+
+  /**
+   * @brief Binds a flow to one of the group's pipes.
+   *
+   * Flows are assigned to pipes in a round-robin fashion: the i-th call binds
+   * to the i-th pipe (modulo `nb_pipes()`). Pipes are numbered in core order,
+   * so consecutive flows go to the same core. Bindings are applied by the
+   * corresponding threads when calling `Start()`.
+   *
+   * @see RxPipe::Bind
+   *
+   * @return The index of the pipe the flow is bound to. Pipe `i` is pipe
+   *         `i % nb_pipes_per_core` in shard `i / nb_pipes_per_core`. Returns
+   *         -1 if the group was already started.
+   */
+  int Bind(uint16_t dst_port, uint16_t src_port, uint32_t dst_ip,
+           uint32_t src_ip, uint32_t protocol);
+
+  /**
+   * @brief Starts the poll loops.
+   *
+   * Each thread applies its bindings, calls `init` (if set) once, and then
+   * calls `poll` in a loop until `Stop()` is called. Both functions run in the
+   * shard's thread, which is the only thread that may use the shard's device
+   * and pipes.
+   *
+   * @param poll Function called on every poll iteration.
+   * @param init Function called once before polling. May be used to allocate
+   *             additional pipes.
+   * @return 0 on success, -1 if the group was already started or if `poll` is
+   *         not set.
+   */
+  int Start(ShardFunction poll, ShardFunction init = nullptr);
+
+  /**
+   * @brief Stops the poll loops and waits for the threads to finish.
+   *
+   * The devices are freed by their threads when they finish, so the shards
+   * must not be used after calling this function.
+   */
+  void Stop();
+
+  /**
+   * @brief Returns the number of shards (i.e., cores) in the group.
+   */
+  inline uint32_t nb_shards() const { return shards_.size(); }
+
+  /**
+   * @brief Returns the total number of pipes in the group.
+   */
+  inline uint32_t nb_pipes() const {
+    return shards_.size() * kConfig.nb_pipes_per_core;
+  }
+
+  /**
+   * @brief Returns a given shard.
+   *
+   * @warning The shard's device and pipes must only be used by the shard's
+   *          thread.
+   */
+  inline Shard& shard(uint32_t index) { return *shards_[index]; }
+
+ private:
+  struct FlowEntry {
+    uint16_t dst_port;
+    uint16_t src_port;
+    uint32_t dst_ip;
+    uint32_t src_ip;
+    uint32_t protocol;
+    uint32_t pipe_index;
+  };
+
+  /**
+   * Use `Create` factory method to instantiate objects externally.
+   */
+  explicit DeviceGroup(const DeviceGroupConfig& config) noexcept
+      : kConfig(config) {}
+
+  /**
+   * @brief Initializes the group.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init() noexcept;
+
+  /**
+   * @brief Body of each shard's thread.
+   */
+  void RunShard(Shard* shard);
+
+  /**
+   * @brief Creates the shard's device and pipes.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int SetupShard(Shard* shard);
+
+  const DeviceGroupConfig kConfig;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::vector<std::thread> threads_;
+  std::vector<FlowEntry> flows_;
+  uint32_t next_pipe_index_ = 0;
+
+  ShardFunction poll_;
+  ShardFunction init_;
+
+  // Index of the shard that should be set up next. Shards are set up one at
+  // a time so that each of them gets a contiguous range of pipe IDs. Setup
+  // only begins once all threads are pinned to their cores.
+  static constexpr uint32_t kSetupNotStarted = UINT32_MAX;
+  std::atomic<uint32_t> next_setup_ = kSetupNotStarted;
+  std::atomic<uint32_t> nb_ready_ = 0;
+  std::atomic<bool> setup_failed_ = false;
+  std::atomic<bool> started_ = false;
+  std::atomic<bool> keep_running_ = true;
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_INCLUDE_ENSO_DEVICE_GROUP_H_
@@ -47,6 +47,7 @@
 #include <netinet/ether.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
 #include <pthread.h>
@@ -77,6 +78,16 @@ namespace enso {
 
 #define _enso_always_inline __attribute__((always_inline)) inline
 
+/**
+ * @brief Policy used to choose the NUMA node of the memory shared with the NIC
+ *        (pipes and notification buffers).
+ */
+enum class NumaPolicy {
+  kNone,    ///< Do not bind memory, use the kernel's default policy.
+  kDevice,  ///< Prefer the NIC's NUMA node.
+  kCore     ///< Prefer the NUMA node of the core that uses the memory.
+};
+
 struct alignas(kCacheLineSize) stats_t {
   uint64_t recv_bytes;
   uint64_t nb_batches;
@@ -104,7 +115,19 @@ constexpr uint16_t be_to_le_16(const uint16_t le) {
   return ((le & (uint16_t)0x00ff) << 8) | ((le & (uint16_t)0xff00) >> 8);
 }
 
-_enso_always_inline uint16_t get_pkt_len(const uint8_t* addr) {
+// 802.1ad (QinQ) service tag, not defined in <net/ethernet.h>.
+constexpr uint16_t kEtherTypeQinQ = 0x88a8;
+
+/**
+ * @brief Returns the length of a packet that is known to be IPv4 without VLAN
+ *        tags, including the Ethernet header.
+ *
+ * Fast path for applications that only handle IPv4 traffic.
+ *
+ * @param addr Address of the packet.
+ * @return Packet length in bytes.
+ */
+_enso_always_inline uint16_t get_ipv4_pkt_len(const uint8_t* addr) {
   const struct ether_header* l2_hdr = (struct ether_header*)addr;
   const struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
   const uint16_t total_len = be_to_le_16(l3_hdr->tot_len) + sizeof(*l2_hdr);
@@ -112,6 +135,90 @@ _enso_always_inline uint16_t get_pkt_len(const uint8_t* addr) {
   return total_len;
 }
 
+/**
+ * @brief Finds the L3 header of a packet, skipping up to two VLAN tags (802.1Q
+ *        and 802.1ad) without branching.
+ *
+ * @param addr Address of the packet.
+ * @param ether_type Must be set to the EtherType in the Ethernet header
+ *                   (network byte order). Set to the EtherType that follows
+ *                   the VLAN tags.
+ * @return Offset of the L3 header from the start of the packet.
+ */
+_enso_always_inline uint32_t get_l3_offset(const uint8_t* addr,
+                                           uint16_t* ether_type) {
+  // EtherTypes after one and two VLAN tags are loaded upfront so that the loads
+  // do not depend on each other.
+  const uint16_t* inner_ether_types =
+      (const uint16_t*)(addr + sizeof(struct ether_header));
+  uint16_t ether_type_1 = inner_ether_types[1];
+  uint16_t ether_type_2 = inner_ether_types[3];
+
+  auto is_vlan = [](uint16_t type) {
+    return (type == htons(ETHERTYPE_VLAN)) | (type == htons(kEtherTypeQinQ));
+  };
+  bool has_vlan_1 = is_vlan(*ether_type);
+  bool has_vlan_2 = has_vlan_1 & is_vlan(ether_type_1);
+
+  uint16_t type = *ether_type;
+  type = has_vlan_1 ? ether_type_1 : type;
+  type = has_vlan_2 ? ether_type_2 : type;
+  *ether_type = type;
+  return sizeof(struct ether_header) + (has_vlan_1 + has_vlan_2) * 4;
+}
+
+/**
+ * @brief Returns the length of a packet with VLAN tags or that is not IPv4.
+ *
+ * Used by `get_pkt_len()` when the packet is not untagged IPv4. Skips up to two
+ * VLAN tags and then selects between the IPv4 and IPv6 lengths without
+ * branching on the EtherType.
+ *
+ * @param addr Address of the packet.
+ * @param ether_type EtherType in the Ethernet header (network byte order).
+ * @param fallback_len Length to return for unknown EtherTypes.
+ * @return Packet length in bytes.
+ */
+inline uint16_t get_tagged_pkt_len(const uint8_t* addr, uint16_t ether_type,
+                                   uint16_t fallback_len) {
+  uint32_t l3_offset = get_l3_offset(addr, &ether_type);
+
+  const uint8_t* l3_hdr = addr + l3_offset;
+  uint16_t ipv4_len =
+      be_to_le_16(((const struct iphdr*)l3_hdr)->tot_len) + l3_offset;
+  uint16_t ipv6_len = be_to_le_16(*(const uint16_t*)(l3_hdr + 4)) +
+                      sizeof(struct ip6_hdr) + l3_offset;
+
+  uint16_t len = fallback_len;
+  len = (ether_type == htons(ETHERTYPE_IPV6)) ? ipv6_len : len;
+  len = (ether_type == htons(ETHERTYPE_IP)) ? ipv4_len : len;
+  return len;
+}
+
+/**
+ * @brief Returns the length of a packet, including the Ethernet header.
+ *
+ * Supports IPv4 and IPv6 with up to two VLAN tags (802.1Q and 802.1ad).
+ * Untagged IPv4 packets take a single, predictable, branch.
+ *
+ * Other EtherTypes do not carry a length that can be found in their headers, so
+ * `fallback_len` is returned instead. The default makes iterators skip a single
+ * flit. Applications that know the length from another source (e.g., a pcap
+ * header) should pass it instead.
+ *
+ * @param addr Address of the packet.
+ * @param fallback_len Length to return for unknown EtherTypes.
+ * @return Packet length in bytes.
+ */
+_enso_always_inline uint16_t get_pkt_len(const uint8_t* addr,
+                                         uint16_t fallback_len = 64) {
+  const struct ether_header* l2_hdr = (struct ether_header*)addr;
+  if (likely(l2_hdr->ether_type == htons(ETHERTYPE_IP))) {
+    return get_ipv4_pkt_len(addr);
+  }
+  return get_tagged_pkt_len(addr, l2_hdr->ether_type, fallback_len);
+}
+
 _enso_always_inline uint8_t* get_next_pkt(uint8_t* pkt) {
   uint16_t pkt_len = get_pkt_len(pkt);
   uint16_t nb_flits = (pkt_len - 1) / 64 + 1;
@@ -48,6 +48,8 @@
 
 namespace enso {
 
+class HugePagePool;
+
 #if MAX_NB_FLOWS < 65536
 using enso_pipe_id_t = uint16_t;
 #else
@@ -63,7 +65,11 @@ struct QueueRegs {
   uint32_t tx_head;
   uint32_t tx_mem_low;
   uint32_t tx_mem_high;
-  uint32_t padding[8];
+  uint32_t rx_size;  // In flits, 0 for `kEnsoPipeSize`. Emulated NIC only.
+  // Set to request a wakeup once the notification buffer has notifications,
+  // cleared by the NIC when it sends the wakeup. Emulated NIC only.
+  uint32_t rx_intr_arm;
+  uint32_t padding[6];
 };
 
 struct __attribute__((__packed__)) RxNotification {
@@ -99,13 +105,39 @@ struct NotificationBufPair {
   struct QueueRegs* regs;
   uint64_t tx_full_cnt;
   uint32_t ref_cnt;
+  uint32_t tx_flushed_tail;     // Last TX tail written to the NIC.
+  uint32_t tx_unflushed_bytes;  // Bytes enqueued after `tx_flushed_tail`.
+  uint32_t tx_doorbell_notifs;  // Notifications that trigger a doorbell.
+  uint32_t tx_doorbell_bytes;   // Bytes that trigger a doorbell.
+  uint32_t rx_head_update_flits;   // Default policy for new pipes, see
+  uint64_t rx_head_update_cycles;  // `RxEnsoPipeInternal`.
+  uint16_t rx_notif_batch_size;    // Notifications per `get_new_tails` call.
+
+  // Adaptive notification batches, see `set_notif_batch_size`.
+  uint16_t rx_notif_max_batch_size;
+  bool rx_notif_adaptive_batch;
+  uint16_t rx_notif_window_scans;        // Scans in the current window.
+  uint16_t rx_notif_window_empty_scans;  // Empty scans in the current window.
+  uint64_t nb_rx_notif_scans;            // Calls to `get_new_tails`.
+  uint64_t nb_empty_rx_notif_scans;      // Scans that found no notification.
+  uint64_t nb_full_rx_notif_scans;       // Scans that filled the batch.
+  uint64_t nb_rx_notifs;                 // Notifications consumed.
+
+  // Blocking receive, see `wait_for_rx`.
+  uint64_t nb_rx_waits;          // Calls to `wait_for_rx`.
+  uint64_t nb_rx_sleeps;         // Times that we slept on the wakeup fd.
+  uint64_t nb_rx_wakeups;        // Times that the wakeup fd woke us up.
+  uint64_t nb_rx_wait_timeouts;  // Calls that returned without data.
 
   uint8_t* wrap_tracker;
   uint32_t* pending_rx_pipe_tails;
+  uint64_t* queued_rx_pipes;  // Bitmap of pipe ids in `next_rx_pipe_ids`.
 
   void* fpga_dev;            // Avoid exposing `DevBackend` externally.
   void* uio_mmap_bar2_addr;  // UIO mmap address for BAR 2.
   std::string huge_page_prefix;
+  int32_t numa_node;  // Node for huge pages shared with the NIC, -1 for any.
+  HugePagePool* huge_page_pool;  // Pipe buffers, see `reserve_huge_pages`.
 };
 
 struct RxEnsoPipeInternal {
@@ -115,9 +147,71 @@ struct RxEnsoPipeInternal {
   uint32_t* buf_head_ptr;
   uint32_t rx_head;
   uint32_t rx_tail;
+  uint32_t size;             // In flits, always a power of two.
   uint64_t phys_buf_offset;  // Use to convert between phys and virt address.
   enso_pipe_id_t id;
   std::string huge_page_prefix;
+
+  // Head update coalescing. The head is only written to the NIC once
+  // `head_update_flits` flits were freed since the last write or after
+  // `head_update_cycles` TSC cycles. A value of 0 disables the threshold.
+  uint32_t rx_flushed_head;  // Last head written to the NIC.
+  uint32_t head_update_flits;
+  uint64_t head_update_cycles;
+  uint64_t last_head_write_tsc;
+  uint64_t nb_head_writes;   // Number of MMIO writes to the head.
+  uint64_t nb_head_updates;  // Number of times the head was advanced.
+
+  // Out-of-order release. Bitmap with one bit per flit, set for flits that
+  // were released but are still behind the head. nullptr if disabled.
+  uint64_t* released_flits = nullptr;
+  uint32_t nb_released_flits;  // Number of bits set in `released_flits`.
+  uint64_t nb_releases;
+  uint64_t nb_out_of_order_releases;
+};
+
+enum ConfigId {
+  FLOW_TABLE_CONFIG_ID = 1,
+  TIMESTAMP_CONFIG_ID = 2,
+  RATE_LIMIT_CONFIG_ID = 3,
+  FALLBACK_QUEUES_CONFIG_ID = 4
+};
+
+struct __attribute__((__packed__)) FlowTableConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint16_t dst_port;
+  uint16_t src_port;
+  uint32_t dst_ip;
+  uint32_t src_ip;
+  uint32_t protocol;
+  uint32_t enso_pipe_id;
+  uint8_t pad[28];
+};
+
+struct __attribute__((__packed__)) TimestampConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint64_t enable;
+  uint8_t pad[40];
+};
+
+struct __attribute__((__packed__)) RateLimitConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint16_t denominator;
+  uint16_t numerator;
+  uint32_t enable;
+  uint8_t pad[40];
+};
+
+struct __attribute__((__packed__)) FallbackQueueConfig {
+  uint64_t signal;
+  uint64_t config_id;
+  uint32_t nb_fallback_queues;
+  uint32_t fallback_queue_mask;
+  uint64_t enable_rr;
+  uint8_t pad[32];
 };
 
 }  // namespace enso
@@ -46,11 +46,37 @@ namespace enso {
 /**
  * Converts a virtual address to a physical address.
  *
+ * Addresses in huge pages allocated with `get_huge_page` are translated once
+ * per page and then served from a cache, other addresses always require
+ * reading `/proc/self/pagemap`.
+ *
  * @param virt The virtual address to convert.
  * @return The physical address.
  */
 uint64_t virt_to_phys(void* virt);
 
+/**
+ * Converts multiple virtual addresses to physical addresses.
+ *
+ * Useful to register many buffers at once. Buffers in the same huge page
+ * (allocated with `get_huge_page`) share a single translation.
+ *
+ * @param virts The virtual addresses to convert.
+ * @param phys Array to be filled with the physical addresses. Addresses that
+ *             cannot be translated are set to 0.
+ * @param nb_addrs Number of addresses to convert.
+ * @return Number of addresses that were translated.
+ */
+uint32_t virt_to_phys_bulk(void* const* virts, uint64_t* phys,
+                           uint32_t nb_addrs);
+
+/**
+ * Returns a counter that is incremented every time a huge page is unmapped
+ * with `unmap_huge_page`. Can be used to invalidate caches of addresses
+ * derived from `virt_to_phys`.
+ */
+uint64_t get_huge_page_unmap_count();
+
 /**
  * Allocates a huge page and returns a pointer to it.
  *
@@ -63,10 +89,40 @@ uint64_t virt_to_phys(void* virt);
  *               the same page is mapped again right after the allocated memory.
  *               This is useful to handle wrap-around in the buffers. Defaults
  *               to false.
+ * @param numa_node NUMA node to place the huge page on. The node is a
+ *                  preference: if it has no free huge pages, the page is
+ *                  allocated elsewhere. If negative, uses the default policy.
  * @return A pointer to the allocated huge page.
  */
 void* get_huge_page(const std::string& path, size_t size = 0,
-                    bool mirror = false);
+                    bool mirror = false, int numa_node = -1);
+
+/**
+ * Unmaps a huge page allocated with `get_huge_page`, also removing its cached
+ * translations.
+ *
+ * @param virt_addr Address returned by `get_huge_page`.
+ * @param size Size used to allocate the huge page. If 0, defaults to
+ *             `kBufPageSize`.
+ * @param mirror Whether the huge page is mirrored.
+ */
+void unmap_huge_page(void* virt_addr, size_t size = 0, bool mirror = false);
+
+/**
+ * Retrieves the NUMA node of a PCIe device.
+ *
+ * @param bdf BDF of the device (assumes PCIe domain 0).
+ * @return The NUMA node, or -1 if it is unknown.
+ */
+int get_numa_node_from_bdf(uint16_t bdf);
+
+/**
+ * Retrieves the NUMA node of a core.
+ *
+ * @param core_id The core ID.
+ * @return The NUMA node, or -1 if it is unknown.
+ */
+int get_numa_node_from_core(int core_id);
 
 }  // namespace enso
 
@@ -46,7 +46,9 @@
 #include <enso/helpers.h>
 #include <enso/internals.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <iostream>
@@ -59,14 +61,234 @@ namespace enso {
 class RxPipe;
 class TxPipe;
 class RxTxPipe;
+class SharedTxPipe;
+class RxScheduler;
 
 class PktIterator;
 class PeekPktIterator;
+template <uint32_t kPktSize>
+class FixedSizePktIterator;
 
 uint32_t external_peek_next_batch_from_queue(
     struct RxEnsoPipeInternal* enso_pipe,
     struct NotificationBufPair* notification_buf_pair, void** buf);
 
+/**
+ * @brief Data received on a single pipe, as returned by `Device::RecvBurst()`.
+ */
+struct PipeBatch {
+  RxPipe* pipe;     ///< Pipe that received the data.
+  uint8_t* buf;     ///< Start of the received bytes.
+  uint32_t length;  ///< Number of bytes received.
+};
+
+/**
+ * @brief Occupancy of an RX pipe with out-of-order release, see
+ *        `RxPipe::GetReleaseStats()`.
+ */
+struct RxReleaseStats {
+  uint32_t held_bytes;                ///< Received and not released yet.
+  uint32_t blocked_bytes;             ///< Released, waiting for older bytes.
+  uint64_t nb_releases;               ///< Regions released, in any order.
+  uint64_t nb_out_of_order_releases;  ///< Releases that were not at the head.
+};
+
+/**
+ * @brief Statistics about RX head updates, see `Device::GetRxHeadStats()`.
+ *
+ * Packets are only counted when built with the `stats` option. They are
+ * counted as their bytes are released with `RxPipe::Free()`, `RxPipe::Clear()`
+ * or `RxPipe::Release()`, so every way of receiving them is covered.
+ */
+struct RxHeadStats {
+  uint64_t nb_head_writes;   ///< MMIO writes to the pipes' head registers.
+  uint64_t nb_head_updates;  ///< Times the application advanced a head.
+  uint64_t nb_pkts;          ///< Packets released by the application.
+
+  /**
+   * @brief Returns the number of MMIO writes per received packet.
+   */
+  double mmio_writes_per_pkt() const {
+    return nb_pkts ? (double)nb_head_writes / nb_pkts : 0.0;
+  }
+};
+
+/**
+ * @brief Statistics about the huge pages used for pipe buffers, see
+ *        `Device::GetHugePagePoolStats()`.
+ */
+struct HugePagePoolStats {
+  uint32_t nb_pages;             ///< Pages reserved in the pool.
+  uint32_t nb_free_pages;        ///< Reserved pages not in use by any pipe.
+  uint64_t nb_hits;              ///< Pipe buffers taken from the pool.
+  uint64_t nb_misses;            ///< Pipe buffers allocated on demand.
+  uint64_t nb_allocations;       ///< Pipe buffers allocated in total.
+  uint64_t total_allocation_ns;  ///< Time spent allocating pipe buffers.
+
+  /**
+   * @brief Returns the average time to allocate a pipe buffer in ns.
+   */
+  double avg_allocation_ns() const {
+    return nb_allocations ? (double)total_allocation_ns / nb_allocations : 0.0;
+  }
+};
+
+/**
+ * @brief Queueing delay of the pipes in an RX scheduling class, see
+ *        `Device::GetRxSchedulingStats()`.
+ *
+ * The delay of a pipe is the time between the library seeing that it has new
+ * data and the pipe being returned by `Device::NextRxPipeToRecv()` or
+ * `Device::NextRxTxPipeToRecv()`, in TSC cycles.
+ */
+struct RxSchedulingStats {
+  static constexpr uint32_t kNbDelayBuckets = 65;
+
+  uint64_t nb_dispatches;       ///< Times a pipe in the class was returned.
+  uint64_t total_delay_cycles;  ///< Sum of all queueing delays.
+  uint64_t max_delay_cycles;    ///< Largest queueing delay.
+  /// Bucket `i > 0` counts delays in [2^(i-1), 2^i), bucket 0 counts zeros.
+  std::array<uint64_t, kNbDelayBuckets> delay_histogram;
+
+  /**
+   * @brief Returns the average queueing delay in cycles.
+   */
+  double avg_delay_cycles() const {
+    return nb_dispatches ? (double)total_delay_cycles / nb_dispatches : 0.0;
+  }
+
+  /**
+   * @brief Returns an upper bound on the given percentile of the queueing
+   *        delay in cycles, e.g., `delay_percentile_cycles(0.99)`.
+   */
+  uint64_t delay_percentile_cycles(double percentile) const {
+    uint64_t target = percentile * nb_dispatches;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < kNbDelayBuckets; ++i) {
+      count += delay_histogram[i];
+      if (count > target || count == nb_dispatches) {
+        uint64_t bucket_max = i < 64 ? (1ULL << i) - 1 : UINT64_MAX;
+        return std::min(bucket_max, max_delay_cycles);
+      }
+    }
+    return max_delay_cycles;
+  }
+};
+
+/**
+ * @brief Statistics about the notifications consumed by a device, see
+ *        `Device::GetNotificationStats()`.
+ *
+ * Scans and notifications are only counted when built with the `stats`
+ * option.
+ */
+struct NotificationStats {
+  uint32_t batch_size;        ///< Notifications currently consumed at once.
+  uint64_t nb_scans;          ///< Times the notification buffer was checked.
+  uint64_t nb_empty_scans;    ///< Scans that found no notification.
+  uint64_t nb_full_scans;     ///< Scans that consumed a full batch.
+  uint64_t nb_notifications;  ///< Notifications consumed.
+
+  /**
+   * @brief Returns the fraction of scans that found no notification.
+   */
+  double empty_scan_ratio() const {
+    return nb_scans ? (double)nb_empty_scans / nb_scans : 0.0;
+  }
+
+  /**
+   * @brief Returns the average number of notifications consumed per scan.
+   */
+  double notifications_per_scan() const {
+    return nb_scans ? (double)nb_notifications / nb_scans : 0.0;
+  }
+};
+
+/**
+ * @brief Statistics about the calls to `Device::WaitForRx()`.
+ *
+ * Only counted when built with the `stats` option.
+ */
+struct RxWaitStats {
+  uint64_t nb_waits;     ///< Calls to `Device::WaitForRx()`.
+  uint64_t nb_sleeps;    ///< Times that the application slept.
+  uint64_t nb_wakeups;   ///< Times that the NIC woke the application up.
+  uint64_t nb_timeouts;  ///< Calls that returned without data.
+};
+
+/**
+ * @brief Latency/throughput modes of a device, see `PollPolicy`.
+ */
+enum class PollMode {
+  kLatency,     ///< Always use `PollPolicy::latency`.
+  kThroughput,  ///< Always use `PollPolicy::throughput`.
+  kAdaptive,    ///< Switch between the two depending on the load.
+};
+
+/**
+ * @brief Settings that a device uses while in a given mode, see `PollPolicy`.
+ */
+struct PollProfile {
+  /// Whether `Device::NextRxPipeToRecv()` and `Device::NextRxTxPipeToRecv()`
+  /// prefetch the pipes that they return and the ones that follow them, see
+  /// `Device::rx_prefetch_lookahead()`.
+  bool prefetch;
+  /// Maximum number of notifications consumed at once. Must be positive and
+  /// at most `kNotificationBufSize`.
+  uint32_t notification_batch_size;
+  /// Whether to adapt the number of notifications consumed at once to the
+  /// load, up to `notification_batch_size`. See
+  /// `Device::GetNotificationStats()`.
+  bool adaptive_notification_batch;
+  uint32_t rx_head_min_bytes;   ///< See `Device::SetRxHeadCoalescing()`.
+  uint64_t rx_head_max_cycles;  ///< See `Device::SetRxHeadCoalescing()`.
+  /// See `Device::SetTxDoorbellCoalescing()`.
+  uint32_t tx_doorbell_max_notifications;
+  uint32_t tx_doorbell_max_bytes;  ///< See `Device::SetTxDoorbellCoalescing()`.
+};
+
+/**
+ * @brief Runtime latency/throughput policy of a device, see
+ *        `Device::SetPollPolicy()`.
+ *
+ * In adaptive mode, the device counts how many calls to
+ * `Device::NextRxPipeToRecv()` or `Device::NextRxTxPipeToRecv()` return a
+ * pipe. It switches to the throughput profile once the fraction of such calls
+ * in a window reaches `adaptive_busy_threshold` and back to the latency
+ * profile once it drops to `adaptive_idle_threshold`.
+ *
+ * TX doorbell coalescing is disabled in both default profiles, since it
+ * requires applications that wait for completions to call
+ * `Device::FlushTx()`.
+ *
+ * A new device uses these defaults in `PollMode::kLatency`. If the library is
+ * built with `latency_opt=false`, it starts in `PollMode::kThroughput`
+ * instead, and with `throughput.rx_head_min_bytes` and
+ * `throughput.rx_head_max_cycles` set to 0, so that RX head updates are not
+ * coalesced, as in builds that predate poll policies. `Device::poll_policy()`
+ * reflects this, and setting a policy replaces it.
+ */
+struct PollPolicy {
+  PollMode mode = PollMode::kLatency;
+  PollProfile latency = {true, kBatchSize, false, 0, 0, 1, 0};
+  PollProfile throughput = {false, kBatchSize, false, 4096, 20000, 1, 0};
+  uint32_t adaptive_window = 16384;  ///< Calls per load measurement.
+  double adaptive_busy_threshold = 0.9;
+  double adaptive_idle_threshold = 0.5;
+};
+
+/**
+ * @brief Segment of a scatter-gather transmission, see
+ *        `TxPipe::SendSegments()`.
+ */
+struct TxSegment {
+  /// Start of the segment. Must be in pinned hugepages and aligned to 64
+  /// bytes. The segment may cross page boundaries, in which case it is sent as
+  /// one request per page.
+  const uint8_t* buf;
+  uint32_t length;  ///< Length of the segment. Must be a multiple of 64.
+};
+
 /**
  * @brief A class that represents a device.
  *
@@ -88,12 +310,21 @@ class Device {
    *                  device found.
    * @param huge_page_prefix The prefix to use for huge pages file. If empty,
    *                         uses the default prefix.
+   * @param numa_policy Where to place the memory shared with the NIC. By
+   *                    default, uses the NIC's NUMA node. Use
+   *                    `NumaPolicy::kCore` to use the node of the core that
+   *                    creates the device instead.
+   * @param nb_huge_pages Number of huge pages to reserve for pipe buffers, so
+   *                      that the first pipes do not need to allocate them.
+   *                      See `ReserveHugePages()`.
    * @return A unique pointer to the device. May be null if the device cannot be
    *         created.
    */
   static std::unique_ptr<Device> Create(
       const std::string& pcie_addr = "",
-      const std::string& huge_page_prefix = "") noexcept;
+      const std::string& huge_page_prefix = "",
+      NumaPolicy numa_policy = NumaPolicy::kDevice,
+      uint32_t nb_huge_pages = kDefaultNbReservedHugePages) noexcept;
 
   Device(const Device&) = delete;
   Device& operator=(const Device&) = delete;
@@ -117,9 +348,18 @@ class Device {
    *          If multiple applications use fallback pipes at once, the behavior
    *          is undefined.
    *
-   * @return A pointer to the pipe. May be null if the pipe cannot be created.
+   * @param size Size of the pipe in bytes. Must be a power of two between
+   *             `kMinEnsoPipeSize * 64` and `kMaxEnsoPipeSize * 64`. Pipes
+   *             smaller than a huge page share huge pages with other pipes of
+   *             the same size. Pipes larger than a 2MB huge page must fill a
+   *             huge page mounted at `kHugePage1GDefaultPrefix`. The hardware
+   *             only supports the default size.
+   *
+   * @return A pointer to the pipe. May be null if the pipe cannot be created,
+   *         errno is set to EINVAL if the size is not supported.
    */
-  RxPipe* AllocateRxPipe(bool fallback = false) noexcept;
+  RxPipe* AllocateRxPipe(bool fallback = false,
+                         uint32_t size = kEnsoPipeSize * 64) noexcept;
 
   /**
    * @brief Allocates a TX pipe.
@@ -132,6 +372,16 @@ class Device {
    */
   TxPipe* AllocateTxPipe(uint8_t* buf = nullptr) noexcept;
 
+  /**
+   * @brief Allocates a TX pipe that can be used by multiple threads at once.
+   *
+   * @note Only the allocation must be done by the thread that owns the
+   *       `Device`. The pipe is deallocated when the `Device` is destroyed.
+   *
+   * @return A pointer to the pipe. May be null if the pipe cannot be created.
+   */
+  SharedTxPipe* AllocateSharedTxPipe() noexcept;
+
   /**
    * @brief Retrieves the number of fallback queues for this device.
    */
@@ -159,6 +409,9 @@ class Device {
   /**
    * @brief Gets the next RxPipe that has data pending.
    *
+   * Pipes are returned in the order in which they receive data unless one of
+   * them has a scheduling class set, see `RxPipe::SetSchedulingClass()`.
+   *
    * @warning This function can only be used when there are *only* RX pipes.
    * Trying to use this function when there are RX/TX pipes will result in
    * undefined behavior.
@@ -170,6 +423,9 @@ class Device {
   /**
    * @brief Gets the next RxTxPipe that has data pending.
    *
+   * Pipes are returned in the order in which they receive data unless one of
+   * them has a scheduling class set, see `RxTxPipe::SetSchedulingClass()`.
+   *
    * @warning This function can only be used when there are *only* RX/TX pipes.
    * Trying to use this function when there are RX pipes allocated will result
    * in undefined behavior.
@@ -178,11 +434,349 @@ class Device {
    */
   RxTxPipe* NextRxTxPipeToRecv();
 
+  /**
+   * @brief Receives data from all the RxPipes that have data pending.
+   *
+   * This is equivalent to calling `NextRxPipeToRecv()` followed by `Recv()`
+   * for every pipe with pending data but consumes a batch of notifications at
+   * once (see `PollProfile::notification_batch_size`). Multiple
+   * notifications for the same pipe are coalesced into a single entry in
+   * `batches`.
+   *
+   * As with `Recv()`, the application must call `RxPipe::Free()` or
+   * `RxPipe::Clear()` on each returned pipe once it is done with the data.
+   *
+   * Example:
+   * @code
+   *    std::array<PipeBatch, kBatchSize> batches;
+   *    uint32_t nb_batches = device->RecvBurst(batches.data(), kBatchSize);
+   *    for (uint32_t i = 0; i < nb_batches; ++i) {
+   *      // Do something with batches[i].buf.
+   *      batches[i].pipe->Clear();
+   *    }
+   * @endcode
+   *
+   * @warning This function can only be used when there are *only* RX pipes.
+   * Trying to use this function when there are RX/TX pipes will result in
+   * undefined behavior.
+   *
+   * @note Pipes are not prefetched, regardless of the poll policy (see
+   *       `SetPollPolicy()`). Freeing a pipe already makes the NIC notify any
+   *       data that arrived in the meantime.
+   *
+   * @param batches Array that will be filled with the received data.
+   * @param max_nb_batches Maximum number of entries to fill in `batches`.
+   *
+   * @return The number of entries filled in `batches`.
+   */
+  uint32_t RecvBurst(PipeBatch* batches, uint32_t max_nb_batches);
+
+  /**
+   * @brief Waits until there is data to receive.
+   *
+   * Receiving functions (e.g., `NextRxPipeToRecv()`) never block, so an
+   * application that polls them keeps its core busy even when there is no
+   * traffic. Calling this function when they return nothing lets the core
+   * sleep instead: it busy polls for a short time (see
+   * `SetRxBusyPollBudget()`) and, if there is still no data, sleeps until the
+   * NIC wakes it up.
+   *
+   * Held back sends and RX head updates are written to the NIC before
+   * waiting.
+   *
+   * Example:
+   * @code
+   *    while (keep_running) {
+   *      RxPipe* rx_pipe = device->NextRxPipeToRecv();
+   *      if (rx_pipe == nullptr) {
+   *        device->WaitForRx(1000);
+   *        continue;
+   *      }
+   *      // Do something with the pipe.
+   *    }
+   * @endcode
+   *
+   * @note Sleeping requires a device backend that supports wakeups (currently
+   *       the software and loopback backends). Otherwise, this function busy
+   *       polls until the timeout and does not support waiting indefinitely.
+   *
+   * @param timeout_us Maximum time to wait (in microseconds), or a negative
+   *                   value to wait indefinitely.
+   *
+   * @return 1 if there is data to receive or 0 on timeout. On error (e.g., a
+   *         signal interrupted the wait), -1 is returned and errno is set
+   *         (ENOTSUP if `timeout_us` is negative and the device backend does
+   *         not support wakeups).
+   */
+  int WaitForRx(int64_t timeout_us = -1);
+
+  /**
+   * @brief Sets how long `WaitForRx()` busy polls before sleeping.
+   *
+   * Sleeping saves CPU but the wakeup adds latency to the first packets after
+   * an idle period. A longer budget avoids this latency for short gaps between
+   * packets. The default is `kDefaultRxBusyPollBudgetUs`.
+   *
+   * @param budget_us Time to busy poll (in microseconds). Use 0 to sleep right
+   *                  away.
+   */
+  void SetRxBusyPollBudget(uint32_t budget_us) {
+    rx_busy_poll_budget_us_ = budget_us;
+  }
+
+  /**
+   * @brief Returns a file descriptor that becomes readable when the device
+   *        has data to receive, after `ArmRxEvent()` is called.
+   *
+   * Lets applications wait for the device together with other file
+   * descriptors using `poll`, `select`, or `epoll`. The file descriptor is
+   * owned by the device and must not be closed.
+   *
+   * Example:
+   * @code
+   *    epoll_ctl(epfd, EPOLL_CTL_ADD, device->GetRxEventFd(), &event);
+   *    while (keep_running) {
+   *      if (device->ArmRxEvent() == 0) {
+   *        epoll_wait(epfd, events, nb_events, -1);
+   *      }
+   *      while ((rx_pipe = device->NextRxPipeToRecv()) != nullptr) {
+   *        // Do something with the pipe.
+   *      }
+   *    }
+   * @endcode
+   *
+   * @return The file descriptor. On error, -1 is returned and errno is set
+   *         (ENOTSUP if the device backend does not support wakeups).
+   */
+  int GetRxEventFd();
+
+  /**
+   * @brief Asks the NIC to make the file descriptor returned by
+   *        `GetRxEventFd()` readable once there is data to receive.
+   *
+   * Must be called every time before waiting on the file descriptor. It also
+   * consumes previous events, so the file descriptor does not need to be read.
+   *
+   * @return 1 if there already is data to receive, in which case the
+   *         application should not wait, or 0 otherwise. On error, -1 is
+   *         returned and errno is set.
+   */
+  int ArmRxEvent();
+
+  /**
+   * @brief Returns statistics about the calls to `WaitForRx()`.
+   */
+  RxWaitStats GetRxWaitStats() const;
+
   /**
    * @brief Processes completions for all pipes associated with this device.
    */
   void ProcessCompletions();
 
+  /**
+   * @brief Configures RX head update coalescing for all RX pipes.
+   *
+   * By default, every call to `RxPipe::Free()` or `RxPipe::Clear()` results in
+   * an MMIO write to tell the NIC about the freed space. Besides the cost of
+   * the writes themselves, updating the heads too frequently may overflow the
+   * hardware queue that keeps head updates (see the `PCIE_RX_IGNORED_HEAD`
+   * counter). With coalescing enabled, the head is only written once at least
+   * `min_bytes` were freed since the last write, once `max_cycles` TSC cycles
+   * elapsed since the last write, or on demand with `RxPipe::FlushHead()` or
+   * `FlushRxHeads()`. Heads are also flushed before `WaitForRx()` sleeps.
+   *
+   * Held back head updates reduce the space available to the NIC, which may
+   * cause drops if `min_bytes` is close to the pipe size.
+   *
+   * This applies to existing pipes as well as to pipes allocated afterwards.
+   *
+   * @param min_bytes Freed bytes that trigger a head write. Use 0 to disable
+   *                  coalescing (the default).
+   * @param max_cycles TSC cycles after which the head is written regardless of
+   *                   the number of freed bytes. Use 0 for no time budget.
+   *                   Time is checked when the application frees bytes and
+   *                   when `NextRxPipeToRecv()`, `NextRxTxPipeToRecv()` or
+   *                   `RecvBurst()` find no new data, so that the heads of
+   *                   idle pipes are also written.
+   */
+  void SetRxHeadCoalescing(uint32_t min_bytes, uint64_t max_cycles = 0);
+
+  /**
+   * @brief Writes all the held back RX head updates to the NIC.
+   *
+   * @see SetRxHeadCoalescing
+   */
+  void FlushRxHeads();
+
+  /**
+   * @brief Returns statistics about head updates for all RX pipes.
+   *
+   * Can be used to measure how effective head update coalescing is.
+   *
+   * @see SetRxHeadCoalescing
+   */
+  RxHeadStats GetRxHeadStats() const;
+
+  /**
+   * @brief Reserves huge pages to be used as pipe buffers.
+   *
+   * Every pipe buffer is a huge page that must be created, mapped, and pinned,
+   * which makes allocating pipes slow. Reserved pages are allocated upfront
+   * and reused: new pipes take their buffers from the reserved pages while
+   * there are free ones, and give them back when they are freed. Each RX, TX,
+   * or RX/TX pipe uses one page.
+   *
+   * `Create()` already reserves a few pages. Use this to reserve more, right
+   * after creating the device and before allocating pipes. Reserved pages are
+   * only released when the device is destroyed.
+   *
+   * @param nb_pages Number of 2MB pages to reserve.
+   * @return 0 on success, -1 on failure.
+   */
+  int ReserveHugePages(uint32_t nb_pages);
+
+  /**
+   * @brief Returns statistics about the allocation of pipe buffers.
+   *
+   * @see ReserveHugePages
+   */
+  HugePagePoolStats GetHugePagePoolStats() const;
+
+  /**
+   * @brief Returns the queueing delay of the pipes in a scheduling class.
+   *
+   * Delays are only tracked once a pipe has a scheduling class set, see
+   * `RxPipe::SetSchedulingClass()`.
+   *
+   * @param sched_class The scheduling class.
+   */
+  RxSchedulingStats GetRxSchedulingStats(uint32_t sched_class) const;
+
+  /**
+   * @brief Returns how many of the upcoming pipes `NextRxPipeToRecv()` and
+   *        `NextRxTxPipeToRecv()` prefetch.
+   *
+   * Only used when the active poll profile prefetches, see `PollProfile`.
+   * Besides the pipe that they return, these functions prefetch the pipes that
+   * follow it in the order of notifications, such that the NIC reacts to the
+   * prefetch while the application is still processing the current pipe. The
+   * number of pipes adapts to the time that the application takes between
+   * calls: the shorter the time, the more pipes need to be prefetched to hide
+   * the NIC's latency (see `SetRxPrefetchLatency()`).
+   */
+  inline uint32_t rx_prefetch_lookahead() const {
+    return rx_prefetch_lookahead_;
+  }
+
+  /**
+   * @brief Sets the time that the NIC takes to respond to a pipe prefetch,
+   *        which `rx_prefetch_lookahead()` is based on.
+   *
+   * This depends on the NIC and on the PCIe topology of the host. The default
+   * is `kDefaultRxPrefetchLatencyCycles`.
+   *
+   * @param latency_cycles Time between a prefetch and the NIC's response (in
+   *                       TSC cycles). Must be positive.
+   * @return 0 on success, -1 on failure (errno is set to EINVAL if the latency
+   *         is 0).
+   */
+  int SetRxPrefetchLatency(uint64_t latency_cycles);
+
+  /**
+   * @brief Returns statistics about the notifications consumed by the device.
+   *
+   * Can be used to see the number of notifications consumed at once when it
+   * adapts to the load, see `PollProfile::adaptive_notification_batch`.
+   */
+  NotificationStats GetNotificationStats() const;
+
+  /**
+   * @brief Converts buffer addresses to addresses that can be used by the NIC.
+   *
+   * Translations of buffers in huge pages allocated by the library (or with
+   * `get_huge_page()`) are cached per page. Calling this function when
+   * registering buffers ensures that later sends using these buffers (e.g.,
+   * with `TxPipe::SendSegments()`) do not need to translate them again.
+   *
+   * @param bufs Addresses to convert.
+   * @param dev_addrs Array to be filled with the converted addresses. Addresses
+   *                  that cannot be translated are set to 0.
+   * @param nb_bufs Number of addresses to convert.
+   * @return Number of addresses that were translated.
+   */
+  uint32_t ConvertVirtAddrsToDevAddrs(void* const* bufs, uint64_t* dev_addrs,
+                                      uint32_t nb_bufs);
+
+  /**
+   * @brief Configures TX doorbell coalescing.
+   *
+   * By default, every send results in an MMIO write to notify the NIC about
+   * the new data. When sending many small batches, these writes can become a
+   * significant cost. With coalescing enabled, sends are staged and the NIC is
+   * only notified once `max_notifications` notifications or `max_bytes` bytes
+   * are pending, when `FlushTx()` is called, or at the start of the next poll
+   * (i.e., the next call to `NextRxPipeToRecv()`, `NextRxTxPipeToRecv()` or
+   * `RecvBurst()`).
+   *
+   * Pending sends are also flushed whenever the library would otherwise need
+   * to wait for the NIC, e.g., when extending a TxPipe buffer. But
+   * `ProcessCompletions()` alone does not flush them. Applications that wait
+   * for completions by calling it in a loop must call `FlushTx()` first.
+   *
+   * @param max_notifications Number of pending TX notifications that triggers
+   *                          a doorbell. Use 1 to disable coalescing (the
+   *                          default).
+   * @param max_bytes Number of pending bytes that triggers a doorbell. Use 0
+   *                  for no byte threshold.
+   */
+  void SetTxDoorbellCoalescing(uint32_t max_notifications,
+                               uint32_t max_bytes = 0);
+
+  /**
+   * @brief Sets the latency/throughput policy of the device.
+   *
+   * The policy controls notification prefetching, how many notifications are
+   * consumed at once, RX head update coalescing and TX doorbell coalescing.
+   * Setting a policy overrides the settings made with `SetRxHeadCoalescing()`
+   * and `SetTxDoorbellCoalescing()`. Settings made with these functions
+   * afterwards are kept when the device switches profiles in adaptive mode.
+   *
+   * Devices start in `PollMode::kLatency` with the default profiles, or in
+   * `PollMode::kThroughput` if the library is built with `latency_opt=false`.
+   * In the latter case, RX head updates are not coalesced unless a policy is
+   * set.
+   *
+   * @param policy The new policy. In adaptive mode, the device starts with the
+   *               latency profile.
+   * @return 0 on success, -1 on failure (errno is set to EINVAL if the policy
+   *         is invalid).
+   */
+  int SetPollPolicy(const PollPolicy& policy);
+
+  /**
+   * @brief Returns the current latency/throughput policy of the device.
+   *
+   * @see SetPollPolicy
+   */
+  inline const PollPolicy& poll_policy() const { return poll_policy_; }
+
+  /**
+   * @brief Returns the mode whose profile is in use, either
+   *        `PollMode::kLatency` or `PollMode::kThroughput`.
+   *
+   * @see SetPollPolicy
+   */
+  inline PollMode active_poll_mode() const { return active_poll_mode_; }
+
+  /**
+   * @brief Notifies the NIC about all pending sends.
+   *
+   * Only needed when doorbell coalescing is enabled.
+   *
+   * @see SetTxDoorbellCoalescing
+   */
+  void FlushTx();
+
   /**
    * @brief Enables hardware time stamping.
    *
@@ -305,13 +899,16 @@ class Device {
   struct TxPendingRequest {
     uint32_t pipe_id;
     uint32_t nb_bytes;
+    bool segments;  // Whether the request came from `SendSegments()`.
+    bool dropped;   // Whether the request came from `Drop()`.
   };
 
   /**
    * Use `Create` factory method to instantiate objects externally.
    */
-  Device(const std::string& pcie_addr, std::string huge_page_prefix) noexcept
-      : kPcieAddr(pcie_addr) {
+  Device(const std::string& pcie_addr, std::string huge_page_prefix,
+         NumaPolicy numa_policy) noexcept
+      : kPcieAddr(pcie_addr), kNumaPolicy(numa_policy) {
 #ifndef NDEBUG
     std::cerr << "Warning: assertions are enabled. Performance may be affected."
               << std::endl;
@@ -340,26 +937,216 @@ class Device {
    */
   void Send(uint32_t tx_enso_pipe_id, uint64_t phys_addr, uint32_t nb_bytes);
 
+  /**
+   * @brief Sends a certain number of bytes to the device without blocking.
+   * This is designed to be used by a TxPipe object.
+   *
+   * @param tx_enso_pipe_id The ID of the TxPipe.
+   * @param phys_addr The physical address of the buffer region to send.
+   * @param nb_bytes The number of bytes to send.
+   * @return 0 on success. If the device cannot accept the request without
+   *         blocking, nothing is sent, -1 is returned and errno is set to
+   *         EAGAIN.
+   */
+  int TrySend(uint32_t tx_enso_pipe_id, uint64_t phys_addr, uint32_t nb_bytes);
+
+  /**
+   * @brief Sends a list of segments to the device as a single request. This is
+   * designed to be used by a TxPipe object.
+   *
+   * Every segment must start at a 64-byte aligned address and have a length
+   * that is a non-zero multiple of 64 bytes.
+   *
+   * @param tx_enso_pipe_id The ID of the TxPipe.
+   * @param segments The segments to send.
+   * @param nb_segments The number of segments to send.
+   * @return 0 on success. If any segment does not meet the contract above,
+   *         nothing is sent, -1 is returned and errno is set to EINVAL.
+   */
+  int SendSegments(uint32_t tx_enso_pipe_id, const TxSegment* segments,
+                   uint32_t nb_segments);
+
+  /**
+   * @brief Frees a certain number of bytes without sending them. This is
+   * designed to be used by a TxPipe object.
+   *
+   * No notification is sent to the device. The request completes once all the
+   * requests before it complete, so that the TxPipe's buffer is still
+   * reclaimed in order.
+   *
+   * @param tx_enso_pipe_id The ID of the TxPipe.
+   * @param nb_bytes The number of bytes to free.
+   */
+  void Drop(uint32_t tx_enso_pipe_id, uint32_t nb_bytes);
+
+  /**
+   * @brief Keeps track of a request sent to the device, so that the
+   * corresponding TxPipe can be notified once it completes.
+   *
+   * @param tx_enso_pipe_id The ID of the TxPipe.
+   * @param nb_bytes The number of bytes in the request.
+   * @param segments Whether the request came from `SendSegments()`.
+   * @param dropped Whether the request came from `Drop()`.
+   */
+  void AddPendingRequest(uint32_t tx_enso_pipe_id, uint32_t nb_bytes,
+                         bool segments, bool dropped = false);
+
+  /**
+   * @brief Sets the scheduling class of an RX pipe, creating the scheduler if
+   * needed. This is designed to be used by an RxPipe object.
+   *
+   * @param rx_enso_pipe_id The ID of the RxPipe.
+   * @param sched_class The scheduling class.
+   * @param weight The weight of the pipe within its class.
+   * @return 0 on success, -1 on failure.
+   */
+  int SetRxSchedulingClass(uint32_t rx_enso_pipe_id, uint32_t sched_class,
+                           uint32_t weight);
+
+  /**
+   * @brief Points `next_rx_pipe_id_` to the specialization of `NextRxPipeId()`
+   * or `NextScheduledRxPipeId()` for the active profile and scheduler.
+   *
+   * Must be called whenever one of them changes, so that receiving functions
+   * do not need to check them on every call.
+   */
+  void UpdateNextRxPipeIdFn();
+
+  /**
+   * @brief Gets the ID of the next RX pipe to receive from, in the order of
+   * notifications.
+   *
+   * Specialized for each poll profile, see `UpdateNextRxPipeIdFn()`.
+   *
+   * @tparam kPrefetch Whether to prefetch the returned and upcoming pipes.
+   * @tparam kAdaptive Whether to measure the load for `PollMode::kAdaptive`.
+   * @return The ID of the pipe or -1 if no pipe has data pending.
+   */
+  template <bool kPrefetch, bool kAdaptive>
+  int32_t NextRxPipeId();
+
+  /**
+   * @brief Gets the ID of the next RX pipe to receive from using the
+   * scheduler.
+   *
+   * @tparam kPrefetch Whether to prefetch the returned pipe.
+   * @tparam kAdaptive Whether to measure the load for `PollMode::kAdaptive`.
+   * @return The ID of the pipe or -1 if no pipe has data pending.
+   */
+  template <bool kPrefetch, bool kAdaptive>
+  int32_t NextScheduledRxPipeId();
+
+  /**
+   * @brief Applies the profile of the given mode.
+   *
+   * @param mode Either `PollMode::kLatency` or `PollMode::kThroughput`.
+   */
+  void ApplyPollProfile(PollMode mode);
+
+  /**
+   * @brief Counts a poll for `PollMode::kAdaptive` and switches profiles at
+   * the end of each window.
+   *
+   * @param busy Whether the poll returned a pipe.
+   */
+  inline void CountRxPoll(bool busy) {
+    nb_busy_rx_polls_ += busy;
+    if (unlikely(++nb_rx_polls_ >= poll_policy_.adaptive_window)) {
+      UpdateAdaptivePollMode();
+    }
+  }
+
+  void UpdateAdaptivePollMode();
+
+  /**
+   * @brief Configures RX head update coalescing for all RX pipes, without
+   * marking the setting as made by the application.
+   *
+   * @see SetRxHeadCoalescing
+   */
+  void UpdateRxHeadCoalescing(uint32_t min_bytes, uint64_t max_cycles);
+
+  /**
+   * @brief Writes the held back RX heads if the coalescing time budget elapsed
+   * since the last time this was done. Called when there is no new data, so
+   * that idle pipes do not keep stale heads.
+   */
+  void FlushStaleRxHeads();
+
+  /**
+   * @brief Updates the number of pipes to prefetch ahead based on the time
+   * that the application took since the last pipe was returned.
+   *
+   * @param now Current TSC.
+   */
+  void UpdateRxPrefetchLookahead(uint64_t now);
+
+  /**
+   * @brief Prefetches the pipes that are next in `next_rx_pipe_ids`, up to
+   * `rx_prefetch_lookahead_` of them. Pipes are only prefetched once.
+   */
+  void PrefetchNextRxPipes();
+
+  /**
+   * @brief Checks if there is data to receive without consuming
+   * notifications.
+   */
+  bool HasPendingRx();
+
   friend class RxPipe;
   friend class TxPipe;
   friend class RxTxPipe;
+  friend class SharedTxPipe;
 
   const std::string kPcieAddr;
+  const NumaPolicy kNumaPolicy;
 
   struct NotificationBufPair notification_buf_pair_;
-  int16_t core_id_;
+  int16_t core_id_ = -1;
   uint16_t bdf_;
   std::string huge_page_prefix_;
 
   std::vector<RxPipe*> rx_pipes_;
   std::vector<TxPipe*> tx_pipes_;
   std::vector<RxTxPipe*> rx_tx_pipes_;
+  std::vector<SharedTxPipe*> shared_tx_pipes_;
 
   std::array<RxPipe*, kMaxNbFlows> rx_pipes_map_ = {};
   std::array<RxTxPipe*, kMaxNbFlows> rx_tx_pipes_map_ = {};
 
   int32_t next_pipe_id_ = -1;
 
+  // Only set once a pipe has a scheduling class, see `SetRxSchedulingClass()`.
+  RxScheduler* rx_scheduler_ = nullptr;
+  int32_t last_scheduled_pipe_id_ = -1;
+  uint32_t last_scheduled_pipe_tail_ = 0;
+
+  // Lookahead prefetching, see `rx_prefetch_lookahead()`.
+  uint32_t rx_prefetch_lookahead_ = 1;
+  uint32_t nb_prefetched_rx_ids_ = 0;  // Entries after `next_rx_ids_head`.
+  // Value of `next_rx_ids_head` when `nb_prefetched_rx_ids_` was last updated.
+  // If it moved since, ids were consumed some other way (e.g., with
+  // `RecvBurst()`) and the count is stale.
+  uint16_t prefetched_rx_ids_head_ = 0;
+  uint64_t rx_prefetch_latency_cycles_ = kDefaultRxPrefetchLatencyCycles;
+  uint64_t avg_rx_batch_cycles_ = 0;
+  uint64_t last_rx_pipe_tsc_ = 0;  // 0 if no pipe was returned last time.
+
+  PollPolicy poll_policy_;
+  PollMode active_poll_mode_ = PollMode::kLatency;
+  bool rx_prefetch_ = false;  // Whether the active profile prefetches.
+  // Specialization used to get the next pipe, see `UpdateNextRxPipeIdFn()`.
+  int32_t (Device::*next_rx_pipe_id_)() = &Device::NextRxPipeId<false, false>;
+  // Whether the application set coalescing explicitly, in which case switching
+  // profiles does not change it.
+  bool rx_head_coalescing_set_ = false;
+  bool tx_doorbell_coalescing_set_ = false;
+  uint32_t nb_rx_polls_ = 0;
+  uint32_t nb_busy_rx_polls_ = 0;
+
+  uint32_t rx_busy_poll_budget_us_ = kDefaultRxBusyPollBudgetUs;
+  uint64_t last_rx_heads_flush_tsc_ = 0;  // See `FlushStaleRxHeads()`.
+
   uint32_t tx_pr_head_ = 0;
   uint32_t tx_pr_tail_ = 0;
   std::array<TxPendingRequest, kMaxPendingTxRequests + 1> tx_pending_requests_;
@@ -459,6 +1246,45 @@ class RxPipe {
      */
     uint8_t* buf() const { return buf_; }
 
+    /**
+     * @brief Returns the same batch, to be iterated with a different iterator.
+     *
+     * Must be called before iterating over the batch. For instance, to use a
+     * `FixedSizePktIterator` after checking `get_uniform_pkt_size()`.
+     *
+     * @param U The iterator to use.
+     *
+     * @return A new batch with the same messages.
+     */
+    template <typename U>
+    constexpr MessageBatch<U> As() const {
+      MessageBatch<U> batch(buf_, available_bytes_, message_limit_, pipe_);
+      batch.prefetch_distance_ = prefetch_distance_;
+      return batch;
+    }
+
+    /**
+     * @brief Returns how many messages ahead of the current one the iterator
+     *        prefetches.
+     *
+     * @see RxPipe::SetPrefetchDistance
+     */
+    uint32_t prefetch_distance() const { return prefetch_distance_; }
+
+    /**
+     * @brief Overrides the prefetch distance of the pipe for this batch.
+     *
+     * Must be called before iterating over the batch.
+     *
+     * @see RxPipe::SetPrefetchDistance
+     *
+     * @param distance Number of messages to prefetch ahead. 0 disables
+     *                 prefetching.
+     */
+    inline void SetPrefetchDistance(uint32_t distance) {
+      prefetch_distance_ = distance;
+    }
+
    private:
     /**
      * Can only be constructed by RxPipe.
@@ -473,16 +1299,20 @@ class RxPipe {
         : available_bytes_(available_bytes),
           message_limit_(message_limit),
           buf_(buf),
-          pipe_(pipe) {}
+          pipe_(pipe),
+          prefetch_distance_(pipe ? pipe->prefetch_distance_ : 0) {}
 
     friend class RxPipe;
     friend T;
+    template <typename U>
+    friend class MessageBatch;
 
     uint32_t available_bytes_;
     int32_t message_limit_;
     uint8_t* buf_;
     uint32_t processed_bytes_ = 0;
     RxPipe* pipe_;
+    uint32_t prefetch_distance_;
   };
 
   RxPipe(const RxPipe&) = delete;
@@ -577,7 +1407,7 @@ class RxPipe {
    */
   constexpr void ConfirmBytes(uint32_t nb_bytes) {
     uint32_t rx_tail = internal_rx_pipe_.rx_tail;
-    rx_tail = (rx_tail + nb_bytes / 64) % kEnsoPipeSize;
+    rx_tail = (rx_tail + nb_bytes / 64) & (internal_rx_pipe_.size - 1);
     internal_rx_pipe_.rx_tail = rx_tail;
   }
 
@@ -590,7 +1420,7 @@ class RxPipe {
   constexpr uint32_t capacity() const {
     uint32_t rx_head = internal_rx_pipe_.rx_head;
     uint32_t rx_tail = internal_rx_pipe_.rx_tail;
-    return ((rx_head - rx_tail) % kEnsoPipeSize) * 64;
+    return ((rx_head - rx_tail) & (internal_rx_pipe_.size - 1)) * 64;
   }
 
   /**
@@ -638,6 +1468,25 @@ class RxPipe {
     return RecvMessages<PeekPktIterator>(max_nb_pkts);
   }
 
+  /**
+   * @brief Receives a batch of packets that are all known to take the same
+   *        number of bytes in the pipe.
+   *
+   * Avoids reading every packet's length to find the next one.
+   *
+   * @param kPktSize Bytes taken by every packet, see `FixedSizePktIterator`.
+   * @param max_nb_pkts The maximum number of packets to receive. If set to -1,
+   *                    all packets in the pipe will be received.
+   *
+   * @return A MessageBatch object that can be used to iterate over the received
+   *         packets.
+   */
+  template <uint32_t kPktSize>
+  inline MessageBatch<FixedSizePktIterator<kPktSize>> RecvFixedSizePkts(
+      int32_t max_nb_pkts = -1) {
+    return RecvMessages<FixedSizePktIterator<kPktSize>>(max_nb_pkts);
+  }
+
   /**
    * @brief Prefetches the next batch of bytes to be received on the RxPipe.
    *
@@ -665,6 +1514,74 @@ class RxPipe {
    */
   void Clear();
 
+  /**
+   * @brief Enables freeing received bytes out of order with `Release()`.
+   *
+   * Uses a bitmap with one bit per flit in the pipe to track the released
+   * regions. The pipe's head, and therefore the space available to the NIC,
+   * only advances up to the oldest region that is still held. Applications can
+   * then hold some packets (e.g., while they are processed by another core)
+   * without preventing the rest of the pipe from being freed.
+   *
+   * Once enabled, `Free()` and `Clear()` can still be used. `Free()` releases
+   * the bytes at the head of the pipe and `Clear()` frees all received bytes,
+   * including the ones still held.
+   *
+   * @return 0 on success and -1 on failure, setting errno.
+   */
+  int EnableOutOfOrderRelease();
+
+  /**
+   * @brief Frees a region of received bytes, which does not need to be the
+   *        oldest one.
+   *
+   * Requires `EnableOutOfOrderRelease()`. Regions must be received before
+   * they are released and each byte may only be released once.
+   *
+   * @warning Like the other RxPipe methods, `Release()` is not thread safe and
+   *          must be called from the thread that owns the pipe. Packets held by
+   *          other threads must be handed back to the owning thread (e.g.,
+   *          through a queue), which then releases them.
+   *
+   * Example:
+   * @code
+   *    rx_pipe->EnableOutOfOrderRelease();
+   *    ...
+   *    auto batch = rx_pipe->RecvPkts();
+   *    for (auto pkt : batch) {
+   *      if (IsSlow(pkt)) {
+   *        Defer(pkt);  // Handed back to this thread once done.
+   *      } else {
+   *        // Do something with the packet.
+   *        rx_pipe->Release(pkt, enso::get_pkt_len(pkt));
+   *      }
+   *    }
+   *    for (auto pkt : DeferredDone()) {
+   *      rx_pipe->Release(pkt, enso::get_pkt_len(pkt));
+   *    }
+   * @endcode
+   *
+   * @param addr Start of the region, must be aligned to 64 bytes.
+   * @param nb_bytes Number of bytes to free.
+   */
+  void Release(const uint8_t* addr, uint32_t nb_bytes);
+
+  /**
+   * @brief Returns the occupancy of the pipe when using out-of-order release.
+   *
+   * @see EnableOutOfOrderRelease()
+   */
+  RxReleaseStats GetReleaseStats() const;
+
+  /**
+   * @brief Writes the pipe's head to the NIC, if it has been held back.
+   *
+   * Only needed when head update coalescing is enabled.
+   *
+   * @see Device::SetRxHeadCoalescing()
+   */
+  void FlushHead();
+
   /**
    * @brief Returns the pipe's internal buffer.
    *
@@ -672,6 +1589,13 @@ class RxPipe {
    */
   inline uint8_t* buf() const { return (uint8_t*)internal_rx_pipe_.buf; }
 
+  /**
+   * @brief Returns the size of the pipe, set when allocating it.
+   *
+   * @return The size of the pipe in bytes.
+   */
+  inline uint32_t size() const { return internal_rx_pipe_.size * 64; }
+
   /**
    * @brief Returns the pipe's ID.
    *
@@ -689,16 +1613,69 @@ class RxPipe {
    *
    * @see RxPipe::set_context()
    *
-   * @return The context associated with the pipe.
+   * @return The context associated with the pipe.
+   */
+  inline void* context() const { return context_; }
+
+  /**
+   * @brief Sets the context associated with the pipe.
+   *
+   * @see RxPipe::context()
+   */
+  inline void set_context(void* new_context) { context_ = new_context; }
+
+  /**
+   * @brief Sets how many messages ahead of the current one iterators prefetch.
+   *
+   * When iterating over a batch, the first cache line of the message that is
+   * `distance` messages ahead is prefetched, so that it is already in cache
+   * when the application reaches it.
+   *
+   * `PktIterator` and `PeekPktIterator` find the packets ahead by following
+   * their lengths, reading each header after it was prefetched.
+   * `FixedSizePktIterator` computes their addresses without reading them.
+   *
+   * Helps when the application does enough work per message to hide the
+   * memory latency. A good starting point is the number of messages processed
+   * during a single DRAM access (e.g., 4 to 8 for a few hundred cycles per
+   * message).
+   *
+   * @param distance Number of messages to prefetch ahead. 0 disables
+   *                 prefetching (default).
+   */
+  inline void SetPrefetchDistance(uint32_t distance) {
+    prefetch_distance_ = distance;
+  }
+
+  /**
+   * @brief Returns how many messages ahead of the current one iterators
+   *        prefetch.
+   *
+   * @see RxPipe::SetPrefetchDistance
    */
-  inline void* context() const { return context_; }
+  inline uint32_t prefetch_distance() const { return prefetch_distance_; }
 
   /**
-   * @brief Sets the context associated with the pipe.
+   * @brief Sets the scheduling class of the pipe.
    *
-   * @see RxPipe::context()
+   * Affects the order in which `Device::NextRxPipeToRecv()` returns pipes.
+   * Pipes in a higher class are always returned before pipes in a lower one
+   * (strict priority). Pipes in the same class share the core according to
+   * their weights, using deficit round robin on the bytes that the
+   * application consumes from them. Pipes start in class 0 with weight 1.
+   *
+   * Pipes are only reordered once at least one of them has a scheduling class
+   * set. The queueing delay of each class can then be retrieved with
+   * `Device::GetRxSchedulingStats()`.
+   *
+   * @param sched_class The scheduling class. Must be smaller than
+   *                    `kNbRxSchedulingClasses`.
+   * @param weight The weight of the pipe within its class. Must be positive.
+   * @return 0 on success, -1 on failure (errno is set to EINVAL if the
+   *         arguments are invalid or ENOMEM if the scheduler cannot be
+   *         allocated).
    */
-  inline void set_context(void* new_context) { context_ = new_context; }
+  int SetSchedulingClass(uint32_t sched_class, uint32_t weight = 1);
 
   /**
    * The size of a "buffer quantum" in bytes. This is the minimum unit that can
@@ -707,8 +1684,8 @@ class RxPipe {
   static constexpr uint32_t kQuantumSize = 64;
 
   /**
-   * Maximum capacity achievable by the pipe. There should always be at least
-   * one buffer quantum available.
+   * Maximum capacity achievable by a pipe of the default size. There should
+   * always be at least one buffer quantum available.
    */
   static constexpr uint32_t kMaxCapacity = kEnsoPipeSize * 64 - kQuantumSize;
 
@@ -720,7 +1697,8 @@ class RxPipe {
    * @param device The `Device` object that instantiated this pipe.
    */
   explicit RxPipe(Device* device) noexcept
-      : notification_buf_pair_(&(device->notification_buf_pair_)) {}
+      : device_(device),
+        notification_buf_pair_(&(device->notification_buf_pair_)) {}
 
   /**
    * @note RxPipes cannot be deallocated from outside. The `Device` object is in
@@ -732,10 +1710,11 @@ class RxPipe {
    * @brief Initializes the RX pipe.
    *
    * @param fallback Whether this pipe is a fallback pipe.
+   * @param size Size of the pipe in flits.
    *
    * @return 0 on success and a non-zero error code on failure.
    */
-  int Init(bool fallback) noexcept;
+  int Init(bool fallback, uint32_t size) noexcept;
 
   void SetAsNextPipe() noexcept { next_pipe_ = true; }
 
@@ -747,7 +1726,10 @@ class RxPipe {
   enso_pipe_id_t id_;       ///< The ID of the pipe.
   void* context_;
   struct RxEnsoPipeInternal internal_rx_pipe_;
+  Device* device_;
   struct NotificationBufPair* notification_buf_pair_;
+  uint64_t nb_released_pkts_ = 0;  // Only counted with `ENSO_STATS`.
+  uint32_t prefetch_distance_ = 0;
 };
 
 /**
@@ -764,7 +1746,8 @@ class RxPipe {
  *    // AllocateBuf with a non-zero argument may block waiting for the capacity
  *    // to be free. Alternatively, one may use AllocateBuf with data_size = 0
  *    // and use and useTryExtendBuf to avoid blocking, potentially dropping
- *    // data instead of waiting.
+ *    // data instead of waiting. TryAllocateBuf and TrySendAndFree can also be
+ *    // used to avoid blocking.
  *
  *    // Fill the buffer with data.
  *    [...]
@@ -816,6 +1799,26 @@ class TxPipe {
     return buf_ + app_begin_;
   }
 
+  /**
+   * @brief Allocates a buffer in the pipe without blocking.
+   *
+   * Same as `AllocateBuf()` but, instead of blocking until the buffer is at
+   * least `target_capacity` bytes, checks for completed transmissions once and
+   * gives up if the capacity is still not enough.
+   *
+   * @param target_capacity Target capacity of the buffer.
+   *
+   * @return The allocated buffer address or nullptr if the capacity is smaller
+   *         than `target_capacity`. In this case, the application may try
+   *         again later.
+   */
+  uint8_t* TryAllocateBuf(uint32_t target_capacity) {
+    if (capacity() < target_capacity && TryExtendBuf() < target_capacity) {
+      return nullptr;
+    }
+    return buf_ + app_begin_;
+  }
+
   /**
    * @brief Sends and deallocates a given number of bytes.
    *
@@ -843,6 +1846,104 @@ class TxPipe {
     device_->Send(kId, phys_addr, nb_bytes);
   }
 
+  /**
+   * @brief Sends and deallocates a given number of bytes without blocking.
+   *
+   * Same as `SendAndFree()` but, if the device cannot accept the transfer
+   * right away (e.g., because there are too many transfers pending), returns
+   * immediately without sending anything. In this case, the buffer remains
+   * allocated and unchanged, so the application may try again later.
+   *
+   * @param nb_bytes The number of bytes to send. Must be a multiple of
+   *                 `kQuantumSize`.
+   *
+   * @return 0 on success. If the transfer would block, -1 is returned and errno
+   *         is set to EAGAIN.
+   */
+  inline int TrySendAndFree(uint32_t nb_bytes) {
+    uint64_t phys_addr = buf_phys_addr_ + app_begin_;
+    assert(nb_bytes <= kMaxCapacity);
+    assert(nb_bytes / kQuantumSize * kQuantumSize == nb_bytes);
+
+    if (unlikely(device_->TrySend(kId, phys_addr, nb_bytes))) {
+      return -1;
+    }
+
+    app_begin_ = (app_begin_ + nb_bytes) & kBufMask;
+
+    return 0;
+  }
+
+  /**
+   * @brief Deallocates a given number of bytes without sending them.
+   *
+   * Same as `SendAndFree()` but the bytes are not transmitted. They only become
+   * available again once all the transfers requested before them complete.
+   *
+   * @param nb_bytes The number of bytes to deallocate.
+   */
+  inline void DropAndFree(uint32_t nb_bytes) {
+    assert(nb_bytes <= kMaxCapacity);
+    assert(nb_bytes / kQuantumSize * kQuantumSize == nb_bytes);
+
+    app_begin_ = (app_begin_ + nb_bytes) & kBufMask;
+
+    device_->Drop(kId, nb_bytes);
+  }
+
+  /**
+   * @brief Sends a list of segments as a single stream of bytes.
+   *
+   * Unlike `SendAndFree()`, the segments do not need to be in the pipe's
+   * buffer. They can be anywhere in pinned hugepages. This avoids copying the
+   * data to the pipe's buffer.
+   *
+   * Segments are sent in order, as if they were contiguous in memory. The
+   * device transfers data in 64-byte units, so every segment must start at a
+   * 64-byte aligned address and its length must be a multiple of 64 bytes. A
+   * packet may span multiple segments, but only at 64-byte boundaries. Data
+   * that does not meet this contract, such as the payload of a received packet
+   * following a header, must be copied to a buffer that does (e.g., the pipe's
+   * buffer) instead. The pipe's buffer and capacity are not affected.
+   *
+   * The segments must not be modified or deallocated until the transmission
+   * completes. Transmissions complete in order. The transmission is complete
+   * once `nb_completed_segment_sends()` is at least the value returned by this
+   * function. Completions are processed by `TryExtendBuf()` or
+   * `Device::ProcessCompletions()`.
+   *
+   * @note Every segment's address is translated before sending, which is
+   *       slower than sending from the pipe's buffer. A segment that crosses
+   *       hugepage boundaries is translated once per page.
+   *
+   * @param segments The segments to send.
+   * @param nb_segments The number of segments to send.
+   *
+   * @return The sequence number of the transmission. Sequence numbers start at
+   *         1. If a segment does not meet the alignment and length contract,
+   *         nothing is sent, 0 is returned and errno is set to EINVAL.
+   */
+  inline uint64_t SendSegments(const TxSegment* segments,
+                               uint32_t nb_segments) {
+    if (unlikely(nb_segments == 0)) {
+      return nb_segment_sends_;
+    }
+    if (unlikely(device_->SendSegments(kId, segments, nb_segments))) {
+      return 0;
+    }
+    return ++nb_segment_sends_;
+  }
+
+  /**
+   * @brief Returns the number of transmissions sent with `SendSegments()` that
+   *        have completed.
+   *
+   * @return Number of completed segment transmissions.
+   */
+  inline uint64_t nb_completed_segment_sends() const {
+    return nb_completed_segment_sends_;
+  }
+
   /**
    * @brief Explicitly requests a best-effort buffer extension.
    *
@@ -859,6 +1960,7 @@ class TxPipe {
    * @return The new buffer capacity after extending.
    */
   inline uint32_t TryExtendBuf() {
+    device_->FlushTx();
     device_->ProcessCompletions();
     return capacity();
   }
@@ -991,6 +2093,14 @@ class TxPipe {
     app_end_ = (app_end_ + nb_bytes) & kBufMask;
   }
 
+  /**
+   * @brief Notifies the Pipe that a transmission sent with `SendSegments()`
+   *        has completed.
+   *
+   * Should be used by the `Device` object only.
+   */
+  inline void NotifySegmentsCompletion() { ++nb_completed_segment_sends_; }
+
   inline std::string GetHugePageFilePath() const {
     return device_->huge_page_prefix_ + std::string(kHugePagePathPrefix) +
            std::to_string(kId);
@@ -1006,6 +2116,8 @@ class TxPipe {
   uint32_t app_begin_ = 0;  // The next byte to be sent.
   uint32_t app_end_ = 0;    // The next byte to be allocated.
   uint64_t buf_phys_addr_;
+  uint64_t nb_segment_sends_ = 0;
+  uint64_t nb_completed_segment_sends_ = 0;
 
   static constexpr uint32_t kBufMask = (kMaxCapacity + kQuantumSize) - 1;
   static_assert((kBufMask & (kBufMask + 1)) == 0,
@@ -1070,6 +2182,16 @@ class TxPipe {
  */
 class RxTxPipe {
  public:
+  /**
+   * @brief How `SendAndFreeCompacted()` skips the dropped bytes.
+   */
+  enum class CompactionMode {
+    kInPlace,  ///< Moves the remaining bytes over the dropped ones and sends
+               ///< them with a single notification.
+    kPerRun    ///< Sends every run of remaining bytes with its own
+               ///< notification, without copying.
+  };
+
   RxTxPipe(const RxTxPipe&) = delete;
   RxTxPipe& operator=(const RxTxPipe&) = delete;
   RxTxPipe(RxTxPipe&&) = delete;
@@ -1157,6 +2279,88 @@ class RxTxPipe {
     last_tx_pipe_capacity_ -= nb_bytes;
   }
 
+  /**
+   * @brief Sends and deallocates a given number of bytes without blocking.
+   *
+   * Same as `SendAndFree()` but returns immediately, without sending anything,
+   * if the transfer would block.
+   *
+   * @param nb_bytes The number of bytes to send.
+   *
+   * @return 0 on success. If the transfer would block, -1 is returned and errno
+   *         is set to EAGAIN.
+   */
+  inline int TrySendAndFree(uint32_t nb_bytes) {
+    int ret = tx_pipe_->TrySendAndFree(nb_bytes);
+    if (likely(ret == 0)) {
+      last_tx_pipe_capacity_ -= nb_bytes;
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Marks a received region as dropped, so that it is not sent by the
+   *        next call to `SendAndFreeCompacted()`.
+   *
+   * Regions must be dropped in the order they were received.
+   *
+   * @param buf Start of the region, must be aligned to 64 bytes.
+   * @param nb_bytes The number of bytes to drop (must be a multiple of 64).
+   */
+  inline void Drop(uint8_t* buf, uint32_t nb_bytes) {
+    if (!dropped_runs_.empty()) {
+      DroppedRun& last_run = dropped_runs_.back();
+      if (last_run.buf + last_run.length == buf) {
+        last_run.length += nb_bytes;
+        return;
+      }
+    }
+    dropped_runs_.push_back({buf, nb_bytes});
+  }
+
+  /**
+   * @brief Marks a received packet as dropped, so that it is not sent by the
+   *        next call to `SendAndFreeCompacted()`.
+   *
+   * Packets must be dropped in the order they were received.
+   *
+   * @param pkt The packet to drop.
+   */
+  inline void DropPkt(uint8_t* pkt) {
+    uint16_t nb_flits = (get_pkt_len(pkt) - 1) / 64 + 1;
+    Drop(pkt, nb_flits * 64);
+  }
+
+  /**
+   * @brief Sends and deallocates a given number of bytes, except for the ones
+   *        marked with `Drop()` or `DropPkt()`.
+   *
+   * Lets applications filter packets without copying the ones they keep to a
+   * different buffer. The dropped bytes are reclaimed, with the others, by
+   * `ProcessCompletions()`.
+   *
+   * Example:
+   * @code
+   *    auto batch = rx_tx_pipe->PeekPkts();
+   *    for (auto pkt : batch) {
+   *      if (IsBlocked(pkt)) {
+   *        rx_tx_pipe->DropPkt(pkt);
+   *      }
+   *    }
+   *    uint32_t batch_length = batch.processed_bytes();
+   *    rx_tx_pipe->ConfirmBytes(batch_length);
+   *    rx_tx_pipe->SendAndFreeCompacted(batch_length);
+   * @endcode
+   *
+   * @param nb_bytes The number of bytes to deallocate, including the dropped
+   *                 ones. Same requirements as in `SendAndFree()`.
+   * @param mode Whether to copy the remaining bytes together or to send them
+   *             with one notification per run. Copying is usually cheaper
+   *             when there are many small runs.
+   */
+  void SendAndFreeCompacted(uint32_t nb_bytes,
+                            CompactionMode mode = CompactionMode::kInPlace);
+
   /**
    * @brief Process completions for this pipe, potentially freeing up space to
    * receive more data.
@@ -1215,6 +2419,27 @@ class RxTxPipe {
     rx_pipe_->set_context(new_context);
   }
 
+  /**
+   * @copydoc RxPipe::SetPrefetchDistance
+   */
+  inline void SetPrefetchDistance(uint32_t distance) {
+    rx_pipe_->SetPrefetchDistance(distance);
+  }
+
+  /**
+   * @copydoc RxPipe::prefetch_distance
+   */
+  inline uint32_t prefetch_distance() const {
+    return rx_pipe_->prefetch_distance();
+  }
+
+  /**
+   * @copydoc RxPipe::SetSchedulingClass
+   */
+  inline int SetSchedulingClass(uint32_t sched_class, uint32_t weight = 1) {
+    return rx_pipe_->SetSchedulingClass(sched_class, weight);
+  }
+
   /**
    * @copydoc RxPipe::kQuantumSize
    */
@@ -1263,10 +2488,190 @@ class RxTxPipe {
 
   friend class Device;
 
+  struct DroppedRun {
+    uint8_t* buf;
+    uint32_t length;
+  };
+
   Device* device_;
   RxPipe* rx_pipe_;
   TxPipe* tx_pipe_;
   uint32_t last_tx_pipe_capacity_;
+  std::vector<DroppedRun> dropped_runs_;  ///< Marked by `Drop()`, in order.
+};
+
+/**
+ * @brief A class that represents a TX Enso Pipe that can be shared by
+ *        multiple threads.
+ *
+ * Other pipes must only be used by the thread that owns their `Device`. A
+ * SharedTxPipe, however, can be used by any number of threads at once. It
+ * has its own notification buffer, so the threads that share it do not need a
+ * `Device` (and a notification buffer) each.
+ *
+ * Threads reserve space in the pipe, fill it with data, and submit it. Only
+ * the reservation is lock-free (a compare-and-swap on the pipe's tail), so
+ * multiple threads can fill their reservations in parallel. Submissions,
+ * however, are serialized: they are sent in the same order as the space was
+ * reserved, and each one is sent while holding a spinlock that also protects
+ * the notification buffer from `ProcessCompletions()`. Therefore, `Submit()`
+ * waits for other threads that reserved space earlier to submit their data,
+ * and a thread that is descheduled inside `Submit()` stalls every producer
+ * that reserved space after it.
+ *
+ * Should be instantiated using a Device object.
+ *
+ * Example:
+ * @code
+ *    enso::SharedTxPipe* tx_pipe = device->AllocateSharedTxPipe();
+ *
+ *    // In any thread:
+ *    auto reservation = tx_pipe->Reserve(data_size);
+ *
+ *    // Fill the reservation with data.
+ *    memcpy(reservation.buf, data, data_size);
+ *
+ *    tx_pipe->Submit(reservation);
+ * @endcode
+ */
+class SharedTxPipe {
+ public:
+  /**
+   * @brief Space reserved in the pipe.
+   */
+  struct Reservation {
+    uint8_t* buf;       ///< Start of the reserved buffer.
+    uint64_t offset;    ///< Offset of the reservation in the pipe's stream.
+    uint32_t nb_bytes;  ///< Number of bytes reserved.
+  };
+
+  SharedTxPipe(const SharedTxPipe&) = delete;
+  SharedTxPipe& operator=(const SharedTxPipe&) = delete;
+  SharedTxPipe(SharedTxPipe&&) = delete;
+  SharedTxPipe& operator=(SharedTxPipe&&) = delete;
+
+  /**
+   * @brief Tries to reserve space in the pipe without blocking.
+   *
+   * Every successful reservation **must** be submitted with `Submit()`.
+   * Otherwise, submissions from all threads that reserved space afterwards
+   * will block forever.
+   *
+   * @param nb_bytes The number of bytes to reserve. Must be a multiple of
+   *                 `kQuantumSize` and no larger than `kMaxReservationSize`.
+   * @param reservation Will be set to the reserved space.
+   *
+   * @return 0 on success. If there is not enough space in the pipe, -1 is
+   *         returned and errno is set to EAGAIN.
+   */
+  int TryReserve(uint32_t nb_bytes, Reservation* reservation);
+
+  /**
+   * @brief Reserves space in the pipe, blocking until there is enough space.
+   *
+   * @see TryReserve()
+   *
+   * @param nb_bytes The number of bytes to reserve. Must be a multiple of
+   *                 `kQuantumSize` and no larger than `kMaxReservationSize`.
+   *
+   * @return The reserved space.
+   */
+  Reservation Reserve(uint32_t nb_bytes);
+
+  /**
+   * @brief Sends the data in a reservation.
+   *
+   * Blocks until all reservations made before this one have been submitted,
+   * then sends the data while holding the pipe's spinlock. The reserved buffer
+   * must not be accessed after calling this function.
+   *
+   * @param reservation The reservation to submit.
+   */
+  void Submit(const Reservation& reservation);
+
+  /**
+   * @brief Returns the number of bytes that can currently be reserved.
+   *
+   * This is only a hint, as other threads may reserve space concurrently.
+   */
+  uint32_t capacity() const {
+    return kMaxCapacity - (reserved_.load(std::memory_order_relaxed) -
+                           completed_.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * @copydoc TxPipe::kQuantumSize
+   */
+  static constexpr uint32_t kQuantumSize = TxPipe::kQuantumSize;
+
+  /**
+   * @copydoc TxPipe::kMaxCapacity
+   */
+  static constexpr uint32_t kMaxCapacity = TxPipe::kMaxCapacity;
+
+  /**
+   * Maximum number of bytes in a single reservation.
+   */
+  static constexpr uint32_t kMaxReservationSize = kMaxTransferLen;
+
+ private:
+  /**
+   * SharedTxPipes can only be instantiated from a `Device` object, using the
+   * `AllocateSharedTxPipe()` method.
+   *
+   * @param device The `Device` object that instantiated this pipe.
+   */
+  explicit SharedTxPipe(Device* device) noexcept : device_(device) {}
+
+  /**
+   * @note SharedTxPipes cannot be deallocated from outside. The `Device` object
+   * is in charge of deallocating them.
+   */
+  ~SharedTxPipe();
+
+  /**
+   * @brief Initializes the shared TX pipe.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init() noexcept;
+
+  /**
+   * @brief Frees the space used by completed transmissions. Must be called with
+   *        `notif_buf_lock_` held.
+   */
+  void ProcessCompletions();
+
+  /**
+   * @brief Calls `ProcessCompletions()` if no other thread is using the
+   *        notification buffer.
+   */
+  void TryProcessCompletions();
+
+  friend class Device;
+
+  Device* device_;
+  uint8_t* buf_ = nullptr;
+  uint64_t buf_phys_addr_;
+  std::string huge_page_path_;
+  struct NotificationBufPair notification_buf_pair_;
+  bool notification_buf_initialized_ = false;
+
+  // Offsets in the pipe's stream of bytes. Reservations are made by advancing
+  // `reserved_`. Submissions advance `published_`, in order, and completed
+  // transmissions advance `completed_`.
+  alignas(64) std::atomic<uint64_t> reserved_ = 0;
+  alignas(64) std::atomic<uint64_t> published_ = 0;
+  alignas(64) std::atomic<uint64_t> completed_ = 0;
+
+  // Protects `notification_buf_pair_` and the pending submissions below. Held
+  // by every `Submit()`, which serializes the producers.
+  alignas(64) std::atomic_flag notif_buf_lock_ = ATOMIC_FLAG_INIT;
+  uint32_t pending_head_ = 0;
+  uint32_t pending_tail_ = 0;
+  std::array<uint32_t, kNotificationBufSize> pending_bytes_;
+
+  static constexpr uint64_t kBufMask = kMaxCapacity + kQuantumSize - 1;
 };
 
 /**
@@ -1300,6 +2705,10 @@ class MessageIteratorBase {
     addr_ = next_addr_;
     next_addr_ = child->GetNextMessage(addr_);
 
+    if (prefetch_addr_ < prefetch_end_) {
+      PrefetchNextMessage();
+    }
+
     --missing_messages_;
     batch_->NotifyProcessedBytes(nb_bytes);
 
@@ -1311,7 +2720,9 @@ class MessageIteratorBase {
       : addr_(nullptr),
         missing_messages_(0),
         batch_(nullptr),
-        next_addr_(nullptr) {}
+        next_addr_(nullptr),
+        prefetch_addr_(nullptr),
+        prefetch_end_(nullptr) {}
 
   MessageIteratorBase(const MessageIteratorBase&) = default;
   MessageIteratorBase& operator=(const MessageIteratorBase&) = default;
@@ -1328,12 +2739,40 @@ class MessageIteratorBase {
       : addr_(addr),
         missing_messages_(message_limit),
         batch_(batch),
-        next_addr_(static_cast<T*>(this)->GetNextMessage(addr)) {}
+        next_addr_(static_cast<T*>(this)->GetNextMessage(addr)),
+        prefetch_addr_(addr),
+        prefetch_end_(nullptr) {
+    uint32_t prefetch_distance = batch->prefetch_distance();
+    if (prefetch_distance == 0) {
+      return;
+    }
+    prefetch_end_ = batch->buf() + batch->available_bytes();
+    for (uint32_t i = 0;
+         i < prefetch_distance && prefetch_addr_ < prefetch_end_; ++i) {
+      PrefetchNextMessage();
+    }
+  }
+
+  /**
+   * @brief Advances the prefetch address by one message and prefetches it.
+   *
+   * For variable-size messages, this reads the length of the message at the
+   * prefetch address, which was itself prefetched one message earlier. The
+   * load does not depend on the application's work and can overlap with it.
+   *
+   * Must only be called while `prefetch_addr_` is within the batch.
+   */
+  _enso_always_inline void PrefetchNextMessage() {
+    prefetch_addr_ = static_cast<T*>(this)->GetNextMessage(prefetch_addr_);
+    _mm_prefetch((const char*)prefetch_addr_, _MM_HINT_T0);
+  }
 
   uint8_t* addr_;
   int32_t missing_messages_;
   RxPipe::MessageBatch<T>* batch_;
   uint8_t* next_addr_;
+  uint8_t* prefetch_addr_;  ///< Last message prefetched.
+  uint8_t* prefetch_end_;   ///< End of the batch, nullptr if not prefetching.
 };
 
 /**
@@ -1407,6 +2846,107 @@ class PeekPktIterator : public MessageIteratorBase<PeekPktIterator> {
   constexpr void OnAdvanceMessage([[maybe_unused]] uint32_t nb_bytes) {}
 };
 
+/**
+ * @brief Packet iterator for packets that all take the same number of bytes.
+ *
+ * Unlike `PktIterator`, it does not read the packet length to find the next
+ * packet. The address of the next packet is then known without waiting for
+ * the current one to be loaded.
+ *
+ * Packets are consumed from the pipe in the same way as with `PktIterator`.
+ *
+ * @param kPktSize Number of bytes taken by every packet in the pipe, i.e., the
+ *                 packet size rounded up to a multiple of 64.
+ *
+ * @see RxPipe::RecvFixedSizePkts
+ * @see get_uniform_pkt_size
+ */
+template <uint32_t kPktSize>
+class FixedSizePktIterator
+    : public MessageIteratorBase<FixedSizePktIterator<kPktSize>> {
+ public:
+  static_assert(kPktSize > 0 && kPktSize % 64 == 0,
+                "Packet size must be a multiple of 64");
+
+  /**
+   * @copydoc MessageIteratorBase::MessageIteratorBase
+   */
+  inline FixedSizePktIterator(
+      uint8_t* addr, int32_t message_limit,
+      RxPipe::MessageBatch<FixedSizePktIterator>* batch)
+      : MessageIteratorBase<FixedSizePktIterator>(addr, message_limit, batch) {
+  }
+
+  /**
+   * @copydoc PktIterator::GetNextMessage
+   */
+  _enso_always_inline uint8_t* GetNextMessage(uint8_t* current_message) {
+    return current_message + kPktSize;
+  }
+
+  /**
+   * @copydoc PktIterator::OnAdvanceMessage
+   */
+  constexpr void OnAdvanceMessage(uint32_t nb_bytes) {
+    this->batch_->pipe_->ConfirmBytes(nb_bytes);
+  }
+};
+
+/**
+ * @brief Checks if all packets in a batch take the same number of bytes.
+ *
+ * Packets are expected at fixed offsets, so their lengths are read with loads
+ * that do not depend on each other, unlike when iterating over the batch.
+ *
+ * Example:
+ * @code
+ *    auto batch = rx_pipe->RecvPkts();
+ *    if (enso::get_uniform_pkt_size(batch) == 64) {
+ *      for (auto pkt : batch.As<enso::FixedSizePktIterator<64>>()) {
+ *        // Do something with the packet.
+ *      }
+ *    } else {
+ *      for (auto pkt : batch) {
+ *        // Do something with the packet.
+ *      }
+ *    }
+ *    rx_pipe->Clear();
+ * @endcode
+ *
+ * @param batch The batch to check. Only the packets within the batch's
+ *              message limit are considered.
+ *
+ * @return Number of bytes taken by every packet (i.e., the packet size rounded
+ *         up to a multiple of 64) or 0 if packets have different sizes or the
+ *         batch is empty.
+ */
+template <typename T>
+uint32_t get_uniform_pkt_size(const RxPipe::MessageBatch<T>& batch) {
+  uint32_t nb_bytes = batch.available_bytes();
+  if (nb_bytes == 0) {
+    return 0;
+  }
+
+  const uint8_t* buf = batch.buf();
+  uint16_t pkt_len = get_pkt_len(buf);
+  uint32_t pkt_size = ((pkt_len - 1) / 64 + 1) * 64;
+  if (nb_bytes % pkt_size != 0) {
+    return 0;
+  }
+
+  uint32_t nb_pkts = nb_bytes / pkt_size;
+  if (batch.message_limit() >= 0) {
+    nb_pkts = std::min(nb_pkts, (uint32_t)batch.message_limit());
+  }
+
+  bool uniform = true;
+  for (uint32_t i = 1; i < nb_pkts; ++i) {
+    uniform &= get_pkt_len(buf + i * pkt_size) == pkt_len;
+  }
+
+  return uniform ? pkt_size : 0;
+}
+
 }  // namespace enso
 
 #endif  // SOFTWARE_INCLUDE_ENSO_PIPE_H_
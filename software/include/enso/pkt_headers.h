@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Extraction of packet header fields for whole batches of packets.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#ifndef SOFTWARE_INCLUDE_ENSO_PKT_HEADERS_H_
+#define SOFTWARE_INCLUDE_ENSO_PKT_HEADERS_H_
+
+#include <enso/consts.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <immintrin.h>
+#include <netinet/ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace enso {
+
+/**
+ * @brief Header fields of a batch of packets in struct-of-arrays layout.
+ *
+ * Filled by `parse_pkt_headers()`. Keeping each field in its own array allows
+ * classification, hashing and flow lookups to run as vector loops instead of
+ * going through every packet.
+ *
+ * All fields are in host byte order. Packets may have up to two VLAN tags
+ * (802.1Q and 802.1ad). `ether_type` tells which of the other fields are set:
+ *  - IPv4: all of them.
+ *  - IPv6: all but `src_ip` and `dst_ip`, which do not fit. `protocol` is the
+ *    Next Header field, so packets with extension headers have no ports.
+ *  - Other EtherTypes: none, they are 0.
+ *
+ * Ports are only set for TCP and UDP packets that are long enough to have them.
+ *
+ * @tparam N Maximum number of packets. Must be a multiple of 16.
+ */
+template <uint32_t N>
+struct PktHeaders {
+  static_assert(N > 0 && N % 16 == 0, "N must be a multiple of 16");
+
+  uint8_t* buf;      ///< Start of the batch.
+  uint32_t nb_pkts;  ///< Number of packets parsed.
+
+  alignas(kCacheLineSize) uint32_t offset[N];  ///< From the start of `buf`.
+  alignas(kCacheLineSize) uint32_t src_ip[N];
+  alignas(kCacheLineSize) uint32_t dst_ip[N];
+  alignas(kCacheLineSize) uint16_t length[N];
+  alignas(kCacheLineSize) uint16_t ether_type[N];  ///< After VLAN tags.
+  alignas(kCacheLineSize) uint16_t src_port[N];
+  alignas(kCacheLineSize) uint16_t dst_port[N];
+  alignas(kCacheLineSize) uint16_t l4_offset[N];  ///< From the packet start.
+  alignas(kCacheLineSize) uint8_t protocol[N];
+};
+
+// Offsets of the fields loaded by `fill_pkt_header_fields()`. L2 fields are
+// from the start of the packet and L3 fields from the start of the L3 header.
+constexpr int32_t kPktEtherTypeOffset =
+    offsetof(struct ether_header, ether_type);
+constexpr int32_t kPktVlan1EtherTypeOffset = sizeof(struct ether_header) + 2;
+constexpr int32_t kPktVlan2EtherTypeOffset = sizeof(struct ether_header) + 6;
+constexpr int32_t kPktL3Offset = sizeof(struct ether_header);
+// A single load gets the IPv6 Next Header (first byte) and the IPv4 protocol
+// (last byte).
+constexpr int32_t kL3ProtocolOffset = offsetof(struct ip6_hdr, ip6_nxt);
+static_assert(offsetof(struct iphdr, protocol) == kL3ProtocolOffset + 3,
+              "IPv4 protocol must be in the same load as the IPv6 Next Header");
+constexpr int32_t kL3SrcIpOffset = offsetof(struct iphdr, saddr);
+constexpr int32_t kL3DstIpOffset = offsetof(struct iphdr, daddr);
+constexpr int32_t kIpv6HdrLen = sizeof(struct ip6_hdr);
+
+/**
+ * @brief Fills the header fields of a single packet, given its offset and
+ *        length.
+ *
+ * @param headers Headers to fill.
+ * @param i Index of the packet.
+ */
+template <uint32_t N>
+_enso_always_inline void fill_pkt_header_fields_scalar(PktHeaders<N>* headers,
+                                                       uint32_t i) {
+  const uint8_t* pkt = headers->buf + headers->offset[i];
+  const struct ether_header* l2_hdr = (const struct ether_header*)pkt;
+  uint16_t ether_type = l2_hdr->ether_type;
+  uint32_t l3_offset = get_l3_offset(pkt, &ether_type);
+  const uint8_t* l3_hdr = pkt + l3_offset;
+
+  headers->ether_type[i] = be16toh(ether_type);
+  headers->src_ip[i] = 0;
+  headers->dst_ip[i] = 0;
+  headers->src_port[i] = 0;
+  headers->dst_port[i] = 0;
+  headers->l4_offset[i] = 0;
+  headers->protocol[i] = 0;
+
+  uint16_t l4_offset;
+  uint8_t protocol;
+  if (likely(ether_type == htons(ETHERTYPE_IP))) {
+    const struct iphdr* ipv4_hdr = (const struct iphdr*)l3_hdr;
+    l4_offset = l3_offset + ipv4_hdr->ihl * 4;
+    protocol = ipv4_hdr->protocol;
+    headers->src_ip[i] = be32toh(ipv4_hdr->saddr);
+    headers->dst_ip[i] = be32toh(ipv4_hdr->daddr);
+  } else if (ether_type == htons(ETHERTYPE_IPV6)) {
+    l4_offset = l3_offset + kIpv6HdrLen;
+    protocol = ((const struct ip6_hdr*)l3_hdr)->ip6_nxt;
+  } else {
+    return;
+  }
+  headers->l4_offset[i] = l4_offset;
+  headers->protocol[i] = protocol;
+
+  if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) &&
+      l4_offset + 4 <= headers->length[i]) {
+    const uint16_t* ports = (const uint16_t*)(pkt + l4_offset);
+    headers->src_port[i] = be16toh(ports[0]);
+    headers->dst_port[i] = be16toh(ports[1]);
+  }
+}
+
+#if defined __AVX512F__
+
+/**
+ * @brief Loads 32 bits from `offset + field_offset` for every lane.
+ */
+_enso_always_inline __m512i gather_pkt_field(const uint8_t* buf, __m512i offset,
+                                             int32_t field_offset) {
+  return _mm512_i32gather_epi32(
+      _mm512_add_epi32(offset, _mm512_set1_epi32(field_offset)), buf, 1);
+}
+
+_enso_always_inline __m512i bswap_epi32(__m512i v) {
+  __m512i even = _mm512_and_si512(v, _mm512_set1_epi32(0x00ff00ff));
+  __m512i odd = _mm512_and_si512(v, _mm512_set1_epi32(0xff00ff00));
+  return _mm512_or_si512(_mm512_ror_epi32(even, 8), _mm512_rol_epi32(odd, 8));
+}
+
+#elif defined __AVX2__
+
+/**
+ * @brief Loads 32 bits from `offset + field_offset` for every lane.
+ */
+_enso_always_inline __m256i gather_pkt_field(const uint8_t* buf, __m256i offset,
+                                             int32_t field_offset) {
+  return _mm256_i32gather_epi32(
+      (const int*)buf,
+      _mm256_add_epi32(offset, _mm256_set1_epi32(field_offset)), 1);
+}
+
+_enso_always_inline __m256i bswap_epi32(__m256i v) {
+  const __m256i kShuffle =
+      _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12,
+                      13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  return _mm256_shuffle_epi8(v, kShuffle);
+}
+
+/**
+ * @brief Packs eight 32-bit values, all smaller than 2^16, as 16-bit values.
+ */
+_enso_always_inline __m128i pack_epi32_to_epi16(__m256i v) {
+  __m256i packed = _mm256_packus_epi32(v, v);
+  return _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08));
+}
+
+#endif  // __AVX512F__
+
+/**
+ * @brief Fills all the header fields, given the packets' offsets and lengths.
+ *
+ * Uses gathers to load the same field from multiple packets at once when
+ * AVX-512 or AVX2 are available.
+ *
+ * @param headers Headers to fill. `buf`, `nb_pkts` and the first `nb_pkts`
+ *                offsets and lengths must be set.
+ */
+template <uint32_t N>
+_enso_always_inline void fill_pkt_header_fields(PktHeaders<N>* headers) {
+  uint32_t nb_pkts = headers->nb_pkts;
+  if (unlikely(nb_pkts == 0)) {
+    return;
+  }
+
+#if defined __AVX512F__ || defined __AVX2__
+  // Unused lanes load the first packet, so that gathers stay within the batch.
+  // Their results are ignored.
+  uint32_t nb_lanes = (nb_pkts + 15) & ~15U;
+  for (uint32_t i = nb_pkts; i < nb_lanes; ++i) {
+    headers->offset[i] = 0;
+    headers->length[i] = 0;
+  }
+
+  const uint8_t* buf = headers->buf;
+#endif
+
+#if defined __AVX512F__
+// GCC warns about the undefined vectors used internally by the intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+  const __m512i kIpv4 = _mm512_set1_epi32(htons(ETHERTYPE_IP));
+  const __m512i kIpv6 = _mm512_set1_epi32(htons(ETHERTYPE_IPV6));
+  const __m512i kVlan = _mm512_set1_epi32(htons(ETHERTYPE_VLAN));
+  const __m512i kQinQ = _mm512_set1_epi32(htons(kEtherTypeQinQ));
+  const __m512i kTcp = _mm512_set1_epi32(IPPROTO_TCP);
+  const __m512i kUdp = _mm512_set1_epi32(IPPROTO_UDP);
+  const __m512i kByteMask = _mm512_set1_epi32(0xff);
+  const __m512i kHalfMask = _mm512_set1_epi32(0xffff);
+  const __m512i kVlanTagLen = _mm512_set1_epi32(4);
+
+  for (uint32_t i = 0; i < nb_pkts; i += 16) {
+    __m512i offset = _mm512_load_si512(&headers->offset[i]);
+    __m512i length = _mm512_cvtepu16_epi32(
+        _mm256_load_si256((const __m256i*)&headers->length[i]));
+
+    // Skips up to two VLAN tags, as in `get_l3_offset()`.
+    __m512i ether_type = _mm512_and_si512(
+        gather_pkt_field(buf, offset, kPktEtherTypeOffset), kHalfMask);
+    __m512i ether_type_1 = _mm512_and_si512(
+        gather_pkt_field(buf, offset, kPktVlan1EtherTypeOffset), kHalfMask);
+    __m512i ether_type_2 = _mm512_and_si512(
+        gather_pkt_field(buf, offset, kPktVlan2EtherTypeOffset), kHalfMask);
+    __mmask16 has_vlan_1 = _mm512_cmpeq_epi32_mask(ether_type, kVlan) |
+                           _mm512_cmpeq_epi32_mask(ether_type, kQinQ);
+    __mmask16 has_vlan_2 = has_vlan_1 &
+                           (_mm512_cmpeq_epi32_mask(ether_type_1, kVlan) |
+                            _mm512_cmpeq_epi32_mask(ether_type_1, kQinQ));
+    ether_type = _mm512_mask_mov_epi32(ether_type, has_vlan_1, ether_type_1);
+    ether_type = _mm512_mask_mov_epi32(ether_type, has_vlan_2, ether_type_2);
+    __m512i l3_offset = _mm512_set1_epi32(kPktL3Offset);
+    l3_offset =
+        _mm512_mask_add_epi32(l3_offset, has_vlan_1, l3_offset, kVlanTagLen);
+    l3_offset =
+        _mm512_mask_add_epi32(l3_offset, has_vlan_2, l3_offset, kVlanTagLen);
+    __m512i l3_hdr = _mm512_add_epi32(offset, l3_offset);
+
+    __mmask16 is_ipv4 = _mm512_cmpeq_epi32_mask(ether_type, kIpv4);
+    __mmask16 is_ip = is_ipv4 | _mm512_cmpeq_epi32_mask(ether_type, kIpv6);
+
+    __m512i ihl = _mm512_and_si512(gather_pkt_field(buf, l3_hdr, 0),
+                                   _mm512_set1_epi32(0x0f));
+    __m512i l4_offset = _mm512_add_epi32(
+        l3_offset, _mm512_mask_slli_epi32(_mm512_set1_epi32(kIpv6HdrLen),
+                                          is_ipv4, ihl, 2));
+    __m512i protocol_fields = gather_pkt_field(buf, l3_hdr, kL3ProtocolOffset);
+    __m512i protocol = _mm512_mask_srli_epi32(
+        _mm512_and_si512(protocol_fields, kByteMask), is_ipv4,
+        protocol_fields, 24);
+    __m512i src_ip = bswap_epi32(gather_pkt_field(buf, l3_hdr, kL3SrcIpOffset));
+    __m512i dst_ip = bswap_epi32(gather_pkt_field(buf, l3_hdr, kL3DstIpOffset));
+    __m512i ports = bswap_epi32(_mm512_i32gather_epi32(
+        _mm512_add_epi32(offset, l4_offset), buf, 1));
+
+    __mmask16 has_ports =
+        is_ip &
+        (_mm512_cmpeq_epi32_mask(protocol, kTcp) |
+         _mm512_cmpeq_epi32_mask(protocol, kUdp)) &
+        _mm512_cmple_epu32_mask(
+            _mm512_add_epi32(l4_offset, _mm512_set1_epi32(4)), length);
+
+    // Back to host byte order.
+    __m512i host_ether_type = _mm512_or_si512(
+        _mm512_slli_epi32(_mm512_and_si512(ether_type, kByteMask), 8),
+        _mm512_srli_epi32(ether_type, 8));
+    _mm256_store_si256((__m256i*)&headers->ether_type[i],
+                       _mm512_cvtepi32_epi16(host_ether_type));
+
+    _mm512_store_si512(&headers->src_ip[i],
+                       _mm512_maskz_mov_epi32(is_ipv4, src_ip));
+    _mm512_store_si512(&headers->dst_ip[i],
+                       _mm512_maskz_mov_epi32(is_ipv4, dst_ip));
+    _mm256_store_si256(
+        (__m256i*)&headers->src_port[i],
+        _mm512_cvtepi32_epi16(_mm512_maskz_srli_epi32(has_ports, ports, 16)));
+    _mm256_store_si256(
+        (__m256i*)&headers->dst_port[i],
+        _mm512_cvtepi32_epi16(_mm512_maskz_and_epi32(has_ports, ports,
+                                                     kHalfMask)));
+    _mm256_store_si256(
+        (__m256i*)&headers->l4_offset[i],
+        _mm512_cvtepi32_epi16(_mm512_maskz_mov_epi32(is_ip, l4_offset)));
+    _mm_store_si128(
+        (__m128i*)&headers->protocol[i],
+        _mm512_cvtepi32_epi8(_mm512_maskz_mov_epi32(is_ip, protocol)));
+  }
+#pragma GCC diagnostic pop
+
+#elif defined __AVX2__
+  const __m256i kIpv4 = _mm256_set1_epi32(htons(ETHERTYPE_IP));
+  const __m256i kIpv6 = _mm256_set1_epi32(htons(ETHERTYPE_IPV6));
+  const __m256i kVlan = _mm256_set1_epi32(htons(ETHERTYPE_VLAN));
+  const __m256i kQinQ = _mm256_set1_epi32(htons(kEtherTypeQinQ));
+  const __m256i kTcp = _mm256_set1_epi32(IPPROTO_TCP);
+  const __m256i kUdp = _mm256_set1_epi32(IPPROTO_UDP);
+  const __m256i kByteMask = _mm256_set1_epi32(0xff);
+  const __m256i kHalfMask = _mm256_set1_epi32(0xffff);
+  const __m256i kVlanTagLen = _mm256_set1_epi32(4);
+
+  for (uint32_t i = 0; i < nb_pkts; i += 8) {
+    __m256i offset = _mm256_load_si256((const __m256i*)&headers->offset[i]);
+    __m256i length = _mm256_cvtepu16_epi32(
+        _mm_load_si128((const __m128i*)&headers->length[i]));
+
+    // Skips up to two VLAN tags, as in `get_l3_offset()`.
+    __m256i ether_type = _mm256_and_si256(
+        gather_pkt_field(buf, offset, kPktEtherTypeOffset), kHalfMask);
+    __m256i ether_type_1 = _mm256_and_si256(
+        gather_pkt_field(buf, offset, kPktVlan1EtherTypeOffset), kHalfMask);
+    __m256i ether_type_2 = _mm256_and_si256(
+        gather_pkt_field(buf, offset, kPktVlan2EtherTypeOffset), kHalfMask);
+    __m256i has_vlan_1 = _mm256_or_si256(_mm256_cmpeq_epi32(ether_type, kVlan),
+                                         _mm256_cmpeq_epi32(ether_type, kQinQ));
+    __m256i has_vlan_2 = _mm256_and_si256(
+        has_vlan_1, _mm256_or_si256(_mm256_cmpeq_epi32(ether_type_1, kVlan),
+                                    _mm256_cmpeq_epi32(ether_type_1, kQinQ)));
+    ether_type = _mm256_blendv_epi8(ether_type, ether_type_1, has_vlan_1);
+    ether_type = _mm256_blendv_epi8(ether_type, ether_type_2, has_vlan_2);
+    __m256i l3_offset = _mm256_add_epi32(
+        _mm256_set1_epi32(kPktL3Offset),
+        _mm256_add_epi32(_mm256_and_si256(has_vlan_1, kVlanTagLen),
+                         _mm256_and_si256(has_vlan_2, kVlanTagLen)));
+    __m256i l3_hdr = _mm256_add_epi32(offset, l3_offset);
+
+    __m256i is_ipv4 = _mm256_cmpeq_epi32(ether_type, kIpv4);
+    __m256i is_ip =
+        _mm256_or_si256(is_ipv4, _mm256_cmpeq_epi32(ether_type, kIpv6));
+
+    __m256i ihl = _mm256_and_si256(gather_pkt_field(buf, l3_hdr, 0),
+                                   _mm256_set1_epi32(0x0f));
+    __m256i l4_offset = _mm256_add_epi32(
+        l3_offset, _mm256_blendv_epi8(_mm256_set1_epi32(kIpv6HdrLen),
+                                      _mm256_slli_epi32(ihl, 2), is_ipv4));
+    __m256i protocol_fields = gather_pkt_field(buf, l3_hdr, kL3ProtocolOffset);
+    __m256i protocol = _mm256_blendv_epi8(
+        _mm256_and_si256(protocol_fields, kByteMask),
+        _mm256_srli_epi32(protocol_fields, 24), is_ipv4);
+    __m256i src_ip = bswap_epi32(gather_pkt_field(buf, l3_hdr, kL3SrcIpOffset));
+    __m256i dst_ip = bswap_epi32(gather_pkt_field(buf, l3_hdr, kL3DstIpOffset));
+    __m256i ports = bswap_epi32(_mm256_i32gather_epi32(
+        (const int*)buf, _mm256_add_epi32(offset, l4_offset), 1));
+
+    __m256i is_tcp_or_udp = _mm256_or_si256(_mm256_cmpeq_epi32(protocol, kTcp),
+                                            _mm256_cmpeq_epi32(protocol, kUdp));
+    __m256i truncated = _mm256_cmpgt_epi32(
+        _mm256_add_epi32(l4_offset, _mm256_set1_epi32(4)), length);
+    __m256i has_ports = _mm256_andnot_si256(
+        truncated, _mm256_and_si256(is_ip, is_tcp_or_udp));
+
+    // Back to host byte order.
+    __m256i host_ether_type = _mm256_or_si256(
+        _mm256_slli_epi32(_mm256_and_si256(ether_type, kByteMask), 8),
+        _mm256_srli_epi32(ether_type, 8));
+    _mm_store_si128((__m128i*)&headers->ether_type[i],
+                    pack_epi32_to_epi16(host_ether_type));
+
+    _mm256_store_si256((__m256i*)&headers->src_ip[i],
+                       _mm256_and_si256(is_ipv4, src_ip));
+    _mm256_store_si256((__m256i*)&headers->dst_ip[i],
+                       _mm256_and_si256(is_ipv4, dst_ip));
+    _mm_store_si128((__m128i*)&headers->src_port[i],
+                    pack_epi32_to_epi16(_mm256_and_si256(
+                        has_ports, _mm256_srli_epi32(ports, 16))));
+    _mm_store_si128((__m128i*)&headers->dst_port[i],
+                    pack_epi32_to_epi16(_mm256_and_si256(
+                        has_ports, _mm256_and_si256(ports, kHalfMask))));
+    _mm_store_si128((__m128i*)&headers->l4_offset[i],
+                    pack_epi32_to_epi16(_mm256_and_si256(is_ip, l4_offset)));
+    __m128i protocol_epi16 =
+        pack_epi32_to_epi16(_mm256_and_si256(is_ip, protocol));
+    _mm_storel_epi64((__m128i*)&headers->protocol[i],
+                     _mm_packus_epi16(protocol_epi16, protocol_epi16));
+  }
+
+#else   // !__AVX512F__ && !__AVX2__
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    fill_pkt_header_fields_scalar(headers, i);
+  }
+
+#endif  // __AVX512F__
+}
+
+/**
+ * @brief Parses the headers of the packets in a batch of bytes, e.g., as
+ *        returned by `Device::RecvBurst()`.
+ *
+ * Packets are only read, the caller is still in charge of freeing them.
+ *
+ * Example:
+ * @code
+ *    enso::PktHeaders<64> headers;
+ *    uint32_t nb_batches = device->RecvBurst(batches, kMaxNbBatches);
+ *    for (uint32_t i = 0; i < nb_batches; ++i) {
+ *      uint32_t parsed = 0;
+ *      while (parsed < batches[i].length) {
+ *        parsed += enso::parse_pkt_headers(batches[i].buf + parsed,
+ *                                          batches[i].length - parsed,
+ *                                          &headers);
+ *        for (uint32_t j = 0; j < headers.nb_pkts; ++j) {
+ *          // Use headers.dst_ip[j], headers.dst_port[j], ...
+ *        }
+ *      }
+ *      batches[i].pipe->Clear();
+ *    }
+ * @endcode
+ *
+ * @param buf Start of the batch, must point to a packet.
+ * @param nb_bytes Number of bytes in the batch.
+ * @param headers Filled with the headers of up to `N` packets.
+ *
+ * @return Number of bytes parsed. May be less than `nb_bytes` if the batch has
+ *         more than `N` packets.
+ */
+template <uint32_t N>
+uint32_t parse_pkt_headers(uint8_t* buf, uint32_t nb_bytes,
+                           PktHeaders<N>* headers) {
+  uint32_t offset = 0;
+  uint32_t nb_pkts = 0;
+
+  while (offset < nb_bytes && nb_pkts < N) {
+    uint16_t pkt_len = get_pkt_len(buf + offset);
+    headers->offset[nb_pkts] = offset;
+    headers->length[nb_pkts] = pkt_len;
+    offset += ((pkt_len - 1) / 64 + 1) * 64;
+    ++nb_pkts;
+  }
+
+  headers->buf = buf;
+  headers->nb_pkts = nb_pkts;
+  fill_pkt_header_fields(headers);
+
+  return offset;
+}
+
+/**
+ * @brief Parses the headers of the packets in a message batch.
+ *
+ * The batch is walked with its iterator, so packets are consumed in the same
+ * way as when iterating over the batch with a range-based for loop. Only the
+ * first `N` packets are parsed, the others are left in the pipe. Use
+ * `RxPipe::RecvPkts(N)` to receive batches that fit.
+ *
+ * Example:
+ * @code
+ *    enso::PktHeaders<64> headers;
+ *    auto batch = rx_pipe->RecvPkts(64);
+ *    enso::parse_pkt_headers(batch, &headers);
+ *    for (uint32_t i = 0; i < headers.nb_pkts; ++i) {
+ *      // Use headers.dst_ip[i], headers.dst_port[i], ...
+ *    }
+ *    rx_pipe->Clear();
+ * @endcode
+ *
+ * @param batch Batch of packets, e.g., from `RxPipe::RecvPkts()`.
+ * @param headers Filled with the headers of up to `N` packets.
+ *
+ * @return Number of packets parsed.
+ */
+template <uint32_t N, typename T>
+uint32_t parse_pkt_headers(RxPipe::MessageBatch<T>& batch,
+                           PktHeaders<N>* headers) {
+  uint8_t* buf = batch.buf();
+  uint32_t nb_pkts = 0;
+
+  auto end = batch.end();
+  for (auto it = batch.begin(); nb_pkts < N && it != end; ++it) {
+    uint8_t* pkt = *it;
+    headers->offset[nb_pkts] = pkt - buf;
+    headers->length[nb_pkts] = get_pkt_len(pkt);
+    ++nb_pkts;
+  }
+
+  headers->buf = buf;
+  headers->nb_pkts = nb_pkts;
+  fill_pkt_header_fields(headers);
+
+  return nb_pkts;
+}
+
+}  // namespace enso
+
+#endif  // SOFTWARE_INCLUDE_ENSO_PKT_HEADERS_H_
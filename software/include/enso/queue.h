@@ -102,7 +102,8 @@ class Queue {
       align_cache_power_two(kElementMetaSize) - kElementMetaSize;
 
   struct alignas(kCacheLineSize) Element {
-    uint64_t signal;
+    // Volatile since the other end of the queue may be in another process.
+    volatile uint64_t signal;
     T data;
   };
 
@@ -114,7 +115,7 @@ class Queue {
 
   ~Queue() noexcept {
     if (buf_addr_ != nullptr) {
-      munmap(buf_addr_, size_);
+      unmap_huge_page(buf_addr_, size_);
       if (created_queue_) {
         unlink(huge_page_path_.c_str());
       }
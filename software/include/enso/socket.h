@@ -131,6 +131,31 @@ int enable_device_round_robin(int ref_sockfd);
  */
 int disable_device_round_robin(int ref_sockfd);
 
+/*
+ * Reserve huge pages to be reused as buffers by sockets created later. Buffers
+ * of sockets that are shut down go back to the reserved pages. This applies to
+ * all sockets.
+ */
+int reserve_device_huge_pages(int ref_sockfd, uint32_t nb_pages);
+
+/*
+ * Set how many notifications are consumed at once. If `adaptive` is true, this
+ * is the maximum number and the actual number adapts to the load. This applies
+ * to all sockets.
+ */
+int set_device_notification_batch(int ref_sockfd, uint16_t max_batch_size,
+                                  bool adaptive);
+
+/*
+ * Wait until any socket has data to receive with `recv_select`. Busy polls for
+ * `busy_poll_us` and then sleeps. A negative `timeout_us` waits indefinitely,
+ * which fails with ENOTSUP if the device backend cannot wake us up. Returns 1
+ * if there is data, 0 on timeout, -1 on error, and -2 if there are no open
+ * sockets.
+ */
+int wait_for_device_rx(int ref_sockfd, uint32_t busy_poll_us,
+                       int64_t timeout_us);
+
 /*
  * Free packet buffer. Use this to free received packets.
  */
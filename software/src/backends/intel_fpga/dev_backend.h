@@ -40,8 +40,11 @@
 #ifndef SOFTWARE_SRC_BACKENDS_INTEL_FPGA_DEV_BACKEND_H_
 #define SOFTWARE_SRC_BACKENDS_INTEL_FPGA_DEV_BACKEND_H_
 
+#include <enso/consts.h>
 #include <enso/helpers.h>
 
+#include <cerrno>
+
 #include "intel_fpga_pcie_api.hpp"
 
 namespace enso {
@@ -95,6 +98,22 @@ class DevBackend {
     return virt_to_phys(virt_addr);
   }
 
+  /**
+   * @brief Checks if the device supports RX pipes of a given size.
+   *
+   * The hardware uses the same size for all pipes (`ENSO_PIPE_SIZE`).
+   *
+   * @param size Pipe size in flits.
+   * @return True if the size is supported, false otherwise.
+   */
+  bool IsPipeSizeSupported(uint32_t size) { return size == kEnsoPipeSize; }
+
+  /**
+   * @brief Retrieves the NUMA node of the device.
+   * @return The NUMA node or -1 if it is unknown.
+   */
+  int GetNumaNode() { return get_numa_node_from_bdf(dev_->get_dev()); }
+
   /**
    * @brief Retrieves the number of fallback queues currently in use.
    * @return The number of fallback queues currently in use. On error, -1 is
@@ -137,6 +156,22 @@ class DevBackend {
     return dev_->free_notif_buf(notif_buf_id);
   }
 
+  /**
+   * @brief Retrieves a file descriptor that becomes readable when the NIC
+   *        interrupts a notification buffer.
+   *
+   * The hardware does not raise interrupts for notification buffers yet (see
+   * `handle_event` in the kernel module), so this is not supported.
+   *
+   * @param notif_buf_id Notification buffer ID.
+   *
+   * @return -1 with errno set to ENOTSUP.
+   */
+  int GetRxWakeupFd([[maybe_unused]] int notif_buf_id) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
   /**
    * @brief Allocates a pipe.
    *
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Device backend that emulates the NIC in a helper thread inside the
+ *        application process.
+ *
+ * Registers are plain memory and the emulated NIC reads and writes the
+ * application's buffers directly, so the cost of talking to the "device" is
+ * close to that of talking to the real NIC. Transmitted packets are looped
+ * back and steered to the application's pipes. The NIC may also generate
+ * traffic on its own, which is configured with the following environment
+ * variables:
+ *
+ * - `ENSO_LOOPBACK_CORE`: Core to pin the NIC thread to.
+ * - `ENSO_LOOPBACK_GEN_PKT_SIZE`: If set, the NIC continuously receives UDP
+ *   packets with this size (in bytes).
+ * - `ENSO_LOOPBACK_GEN_NB_FLOWS`: Number of destination IPs used by the
+ *   generated packets, starting from 192.168.0.0 (default: 1). Packets are
+ *   sent to UDP port 80.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#ifndef SOFTWARE_SRC_BACKENDS_LOOPBACK_DEV_BACKEND_H_
+#define SOFTWARE_SRC_BACKENDS_LOOPBACK_DEV_BACKEND_H_
+
+#include <arpa/inet.h>
+#include <enso/helpers.h>
+#include <immintrin.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nic_emulator.h"
+
+namespace enso {
+
+/**
+ * @brief NIC shared by all the `DevBackend` instances in the process.
+ */
+class LoopbackNic {
+ public:
+  /**
+   * @brief Returns the NIC, starting it if needed.
+   * @return The NIC or nullptr on failure.
+   */
+  static LoopbackNic* Acquire() noexcept {
+    std::lock_guard<std::mutex> lock(instance_mutex_);
+    if (instance_ == nullptr) {
+      LoopbackNic* nic = new (std::nothrow) LoopbackNic();
+      if (nic == nullptr) {
+        return nullptr;
+      }
+      if (nic->Init()) {
+        delete nic;
+        return nullptr;
+      }
+      instance_ = nic;
+    }
+    ++ref_cnt_;
+    return instance_;
+  }
+
+  /**
+   * @brief Releases the NIC, stopping it if this is the last reference.
+   */
+  static void Release() noexcept {
+    std::lock_guard<std::mutex> lock(instance_mutex_);
+    if (--ref_cnt_ == 0) {
+      delete instance_;
+      instance_ = nullptr;
+    }
+  }
+
+  ~LoopbackNic() noexcept {
+    keep_running_ = false;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  NicEmulator* nic() { return nic_.get(); }
+
+  /**
+   * @brief Lock that must be held while calling `NicEmulator` methods.
+   */
+  std::mutex& mutex() { return mutex_; }
+
+  /**
+   * @brief Core that the NIC thread is pinned to, or -1 if not pinned.
+   */
+  int core_id() const { return core_id_; }
+
+  /**
+   * @brief Sets the eventfd signaled by the interrupts of a notification
+   *        buffer. Must be called with `mutex()` held.
+   *
+   * @param notif_buf_id Notification buffer ID.
+   * @param fd The eventfd or -1 to stop signaling it.
+   */
+  void set_wakeup_fd(uint32_t notif_buf_id, int fd) {
+    wakeup_fds_[notif_buf_id] = fd;
+  }
+
+  /**
+   * @brief Records a write to the register file so that the NIC thread
+   *        applies its side effects (see `NicEmulator::MmioWrite()`).
+   *
+   * Registers are written directly, without the NIC lock. Only writes to the
+   * heads of pipes have side effects, so we keep a bitmap of the pipes whose
+   * heads were written.
+   *
+   * @param addr Address of the written register.
+   */
+  static _enso_always_inline void RegisterWritten(volatile uint32_t* addr) {
+    uint64_t offset = (uint64_t)addr - (uint64_t)bar_;
+    if (offset >= (uint64_t)kMaxNbFlows * kMemorySpacePerQueue ||
+        offset % kMemorySpacePerQueue != offsetof(struct QueueRegs, rx_head)) {
+      return;
+    }
+    uint32_t pipe_id = offset / kMemorySpacePerQueue;
+    head_writes_[pipe_id / 64].fetch_or(1ULL << (pipe_id % 64),
+                                        std::memory_order_release);
+    has_head_writes_.store(true, std::memory_order_release);
+  }
+
+ private:
+  LoopbackNic() noexcept {}
+
+  int Init() noexcept {
+    nic_ = NicEmulator::Create(
+        [](uint64_t dev_addr) { return (uint8_t*)dev_addr; });
+    if (!nic_) {
+      return -1;
+    }
+
+    NicEmulator* nic = nic_.get();
+    nic_->set_tx_handler([nic](const uint8_t* pkt, uint32_t len) {
+      nic->DeliverPkt(pkt, len);
+    });
+
+    bar_ = nic_->bar();
+
+    wakeup_fds_.fill(-1);
+    nic_->set_interrupt_handler([this](uint32_t notif_buf_id) {
+      int fd = wakeup_fds_[notif_buf_id];
+      if (fd >= 0) {
+        uint64_t value = 1;
+        ssize_t ret = write(fd, &value, sizeof(value));
+        (void)ret;  // The counter only overflows if nobody ever reads it.
+      }
+    });
+
+    const char* pkt_size = std::getenv("ENSO_LOOPBACK_GEN_PKT_SIZE");
+    if (pkt_size != nullptr) {
+      const char* nb_flows = std::getenv("ENSO_LOOPBACK_GEN_NB_FLOWS");
+      BuildGeneratedPkts(atoi(pkt_size), nb_flows ? atoi(nb_flows) : 1);
+    }
+
+    thread_ = std::thread(&LoopbackNic::Run, this);
+
+    const char* core = std::getenv("ENSO_LOOPBACK_CORE");
+    if (core != nullptr) {
+      if (set_core_id(thread_, atoi(core))) {
+        std::cerr << "Could not pin loopback NIC to core " << core
+                  << std::endl;
+      } else {
+        core_id_ = atoi(core);
+      }
+    }
+
+    std::cerr << "Using loopback backend" << std::endl;
+    return 0;
+  }
+
+  void BuildGeneratedPkts(uint32_t pkt_size, uint32_t nb_flows) {
+    pkt_size = std::max(pkt_size, (uint32_t)(sizeof(struct ether_header) +
+                                             sizeof(struct iphdr) +
+                                             sizeof(struct udphdr)));
+    nb_flows = std::max(nb_flows, 1U);
+
+    gen_pkt_size_ = pkt_size;
+    gen_pkts_.assign(pkt_size * nb_flows, 0);
+
+    for (uint32_t i = 0; i < nb_flows; ++i) {
+      uint8_t* pkt = gen_pkts_.data() + i * pkt_size;
+      struct ether_header* l2_hdr = (struct ether_header*)pkt;
+      struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+      struct udphdr* l4_hdr = (struct udphdr*)(l3_hdr + 1);
+
+      l2_hdr->ether_type = htons(ETHERTYPE_IP);
+      l3_hdr->version = 4;
+      l3_hdr->ihl = 5;
+      l3_hdr->tot_len = htons(pkt_size - sizeof(*l2_hdr));
+      l3_hdr->ttl = 64;
+      l3_hdr->protocol = IPPROTO_UDP;
+      l3_hdr->saddr = inet_addr("10.0.0.1");
+      l3_hdr->daddr = htonl(ntohl(inet_addr("192.168.0.0")) + i);
+      l4_hdr->source = htons(1234);
+      l4_hdr->dest = htons(80);
+      l4_hdr->len = htons(pkt_size - sizeof(*l2_hdr) - sizeof(*l3_hdr));
+    }
+  }
+
+  void Run() {
+    // Number of generated packets to inject per iteration.
+    constexpr uint32_t kGenBurst = 32;
+
+    uint32_t nb_gen_pkts = gen_pkts_.size() / std::max(gen_pkt_size_, 1U);
+    uint32_t next_gen_pkt = 0;
+
+    while (keep_running_) {
+      uint32_t work;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (uint32_t i = 0; i < nb_gen_pkts && i < kGenBurst; ++i) {
+          nic_->DeliverPkt(gen_pkts_.data() + next_gen_pkt * gen_pkt_size_,
+                           gen_pkt_size_);
+          next_gen_pkt = (next_gen_pkt + 1) % nb_gen_pkts;
+        }
+        work = ApplyHeadWrites();
+        work += nic_->Poll();
+      }
+      if (work == 0) {
+        _mm_pause();
+      }
+    }
+  }
+
+  /**
+   * @brief Tells the NIC about the heads written since the last call, see
+   *        `RegisterWritten()`. Must be called with `mutex_` held.
+   *
+   * @return Number of heads that were written.
+   */
+  uint32_t ApplyHeadWrites() {
+    if (!has_head_writes_.exchange(false, std::memory_order_acquire)) {
+      return 0;
+    }
+
+    uint32_t nb_writes = 0;
+    for (uint32_t i = 0; i < head_writes_.size(); ++i) {
+      if (head_writes_[i].load(std::memory_order_relaxed) == 0) {
+        continue;
+      }
+      uint64_t pipes = head_writes_[i].exchange(0, std::memory_order_acquire);
+      while (pipes) {
+        nic_->HeadUpdated(i * 64 + __builtin_ctzll(pipes));
+        pipes &= pipes - 1;
+        ++nb_writes;
+      }
+    }
+    return nb_writes;
+  }
+
+  std::unique_ptr<NicEmulator> nic_;
+  std::mutex mutex_;
+  std::thread thread_;
+  volatile bool keep_running_ = true;
+  int core_id_ = -1;
+
+  // Indexed by notification buffer ID, -1 if nobody is waiting on it.
+  std::array<int, kMaxNbApps> wakeup_fds_;
+
+  std::vector<uint8_t> gen_pkts_;
+  uint32_t gen_pkt_size_ = 0;
+
+  // Register file and pipes with pending head writes, see
+  // `RegisterWritten()`.
+  static inline uint8_t* bar_ = nullptr;
+  static inline std::array<std::atomic<uint64_t>, kMaxNbFlows / 64>
+      head_writes_ = {};
+  static inline std::atomic<bool> has_head_writes_ = false;
+
+  static inline LoopbackNic* instance_ = nullptr;
+  static inline uint32_t ref_cnt_ = 0;
+  static inline std::mutex instance_mutex_;
+};
+
+class DevBackend {
+ public:
+  static DevBackend* Create(unsigned int bdf, int bar) noexcept {
+    DevBackend* dev = new (std::nothrow) DevBackend(bdf, bar);
+
+    if (dev == nullptr) {
+      return nullptr;
+    }
+
+    if (dev->Init()) {
+      delete dev;
+      return nullptr;
+    }
+
+    return dev;
+  }
+
+  ~DevBackend() noexcept {
+    if (loopback_nic_ != nullptr) {
+      CloseRxWakeupFd();
+      LoopbackNic::Release();
+    }
+  }
+
+  void* uio_mmap([[maybe_unused]] size_t size,
+                 [[maybe_unused]] unsigned int mapping) {
+    return loopback_nic_->nic()->bar();
+  }
+
+  static _enso_always_inline void mmio_write32(volatile uint32_t* addr,
+                                               uint32_t value) {
+    _enso_compiler_memory_barrier();
+    *addr = value;
+    LoopbackNic::RegisterWritten(addr);
+  }
+
+  static _enso_always_inline uint32_t mmio_read32(volatile uint32_t* addr) {
+    _enso_compiler_memory_barrier();
+    return *addr;
+  }
+
+  /**
+   * @brief Converts an address in the application's virtual address space to an
+   *        address that can be used by the device.
+   * @param virt_addr Address in the application's virtual address space.
+   * @return Converted address or 0 if the address cannot be translated.
+   */
+  uint64_t ConvertVirtAddrToDevAddr(void* virt_addr) {
+    // The NIC lives in the same address space.
+    return (uint64_t)virt_addr;
+  }
+
+  /**
+   * @brief Checks if the device supports RX pipes of a given size.
+   *
+   * The emulated NIC reads the size of each pipe from its `rx_size` register,
+   * so any size is supported.
+   *
+   * @param size Pipe size in flits.
+   * @return True.
+   */
+  bool IsPipeSizeSupported([[maybe_unused]] uint32_t size) { return true; }
+
+  /**
+   * @brief Retrieves the NUMA node of the device.
+   *
+   * This is the node of the core that the NIC thread is pinned to.
+   *
+   * @return The NUMA node or -1 if it is unknown (e.g., the thread is not
+   *         pinned).
+   */
+  int GetNumaNode() {
+    return get_numa_node_from_core(loopback_nic_->core_id());
+  }
+
+  /**
+   * @brief Retrieves the number of fallback queues currently in use.
+   * @return The number of fallback queues currently in use. On error, -1 is
+   *         returned and errno is set appropriately.
+   */
+  int GetNbFallbackQueues() {
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->GetNbFallbackQueues();
+  }
+
+  /**
+   * @brief Sets the Round-Robin status.
+   *
+   * @param round_robin If true, enable RR. Otherwise, disable RR.
+   *
+   * @return Return 0 on success. On error, -1 is returned and errno is set.
+   */
+  int SetRrStatus(bool round_robin) {
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->SetRrStatus(round_robin);
+  }
+
+  /**
+   * @brief Gets the Round-Robin status.
+   *
+   * @return Return 1 if RR is enabled. Otherwise, return 0. On error, -1 is
+   *         returned and errno is set.
+   */
+  int GetRrStatus() {
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->GetRrStatus();
+  }
+
+  /**
+   * @brief Allocates a notification buffer.
+   *
+   * @return Notification buffer ID. On error, -1 is returned and errno is set.
+   */
+  int AllocateNotifBuf() {
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->AllocateNotifBuf();
+  }
+
+  /**
+   * @brief Frees a notification buffer.
+   *
+   * @param notif_buf_id Notification buffer ID.
+   *
+   * @return Return 0 on success. On error, -1 is returned and errno is set.
+   */
+  int FreeNotifBuf(int notif_buf_id) {
+    CloseRxWakeupFd();
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->FreeNotifBuf(notif_buf_id);
+  }
+
+  /**
+   * @brief Retrieves a file descriptor that becomes readable when the NIC
+   *        interrupts a notification buffer.
+   *
+   * The file descriptor is an eventfd, created on the first call and closed
+   * when the notification buffer is freed.
+   *
+   * @param notif_buf_id Notification buffer ID.
+   *
+   * @return The file descriptor. On error, -1 is returned and errno is set.
+   */
+  int GetRxWakeupFd(int notif_buf_id) {
+    if (wakeup_fd_ >= 0) {
+      return wakeup_fd_;
+    }
+
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+      return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    loopback_nic_->set_wakeup_fd(notif_buf_id, fd);
+    wakeup_fd_ = fd;
+    wakeup_notif_buf_id_ = notif_buf_id;
+
+    return fd;
+  }
+
+  /**
+   * @brief Allocates a pipe.
+   *
+   * @param fallback If true, allocates a fallback pipe. Otherwise, allocates a
+   *                regular pipe.
+   * @return Pipe ID. On error, -1 is returned and errno is set.
+   */
+  int AllocatePipe(bool fallback = false) {
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->AllocatePipe(fallback);
+  }
+
+  /**
+   * @brief Frees a pipe.
+   *
+   * @param pipe_id Pipe ID to be freed.
+   *
+   * @return 0 on success. On error, -1 is returned and errno is set.
+   */
+  int FreePipe(int pipe_id) {
+    std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+    return loopback_nic_->nic()->FreePipe(pipe_id);
+  }
+
+ private:
+  explicit DevBackend(unsigned int bdf, int bar) noexcept
+      : bdf_(bdf), bar_(bar) {}
+
+  DevBackend(const DevBackend& other) = delete;
+  DevBackend& operator=(const DevBackend& other) = delete;
+  DevBackend(DevBackend&& other) = delete;
+  DevBackend& operator=(DevBackend&& other) = delete;
+
+  /**
+   * @brief Initializes the backend.
+   *
+   * @return 0 on success and a non-zero error code on failure.
+   */
+  int Init() noexcept {
+    loopback_nic_ = LoopbackNic::Acquire();
+    if (loopback_nic_ == nullptr) {
+      std::cerr << "Could not start loopback NIC" << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Stops the NIC from signaling the wakeup fd and closes it.
+   */
+  void CloseRxWakeupFd() {
+    if (wakeup_fd_ < 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(loopback_nic_->mutex());
+      loopback_nic_->set_wakeup_fd(wakeup_notif_buf_id_, -1);
+    }
+    close(wakeup_fd_);
+    wakeup_fd_ = -1;
+  }
+
+  unsigned int bdf_;
+  int bar_;
+  LoopbackNic* loopback_nic_ = nullptr;
+  int wakeup_fd_ = -1;
+  int wakeup_notif_buf_id_ = -1;
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_SRC_BACKENDS_LOOPBACK_DEV_BACKEND_H_
@@ -42,13 +42,16 @@
 #define SOFTWARE_SRC_BACKENDS_SOFTWARE_DEV_BACKEND_H_
 
 #include <assert.h>
+#include <fcntl.h>
 #include <sched.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 
 #include "enso/consts.h"
 #include "enso/helpers.h"
@@ -79,7 +82,7 @@ class DevBackend {
     return dev;
   }
 
-  ~DevBackend() noexcept {}
+  ~DevBackend() noexcept { CloseRxWakeupFd(); }
 
   void* uio_mmap([[maybe_unused]] size_t size,
                  [[maybe_unused]] unsigned int mapping) {
@@ -135,33 +138,55 @@ class DevBackend {
    */
   uint64_t ConvertVirtAddrToDevAddr(void* virt_addr) {
     uint64_t phys_addr = virt_to_phys(virt_addr);
-
-    _enso_compiler_memory_barrier();
-
-    struct MmioNotification mmio_notification;
-    mmio_notification.type = NotifType::kTranslAddr;
-    mmio_notification.address = (uint64_t)phys_addr;
-    mmio_notification.value = 0;
-
-    enso::PipeNotification* pipe_notification =
-        (enso::PipeNotification*)&mmio_notification;
-    while (queue_to_backend_->Push(*pipe_notification) != 0) {
+    if (phys_addr == 0) {
+      return 0;
     }
 
-    std::optional<PipeNotification> notification;
+    // Device addresses are contiguous within a huge page, so we only need to
+    // ask the emulator once per page. Once a huge page is unmapped, its
+    // physical page may be reused by a different file, which the emulator maps
+    // at a different address.
+    uint64_t unmap_count = get_huge_page_unmap_count();
+    if (unlikely(unmap_count != dev_page_cache_unmap_count_)) {
+      dev_page_cache_.clear();
+      dev_page_cache_unmap_count_ = unmap_count;
+    }
 
-    // Block until receive.
-    while (!(notification = queue_from_backend_->Pop())) {
+    uint64_t phys_page = phys_addr & ~((uint64_t)kBufPageSize - 1);
+    auto it = dev_page_cache_.find(phys_page);
+    if (it != dev_page_cache_.end()) {
+      return it->second + (phys_addr - phys_page);
     }
 
-    struct MmioNotification* result =
-        (struct MmioNotification*)&notification.value();
+    uint64_t dev_page = RequestDevAddr(phys_page);
+    if (dev_page == 0) {
+      return 0;
+    }
+    dev_page_cache_[phys_page] = dev_page;
 
-    assert(result->type == NotifType::kTranslAddr);
-    assert(result->address == (uint64_t)phys_addr);
-    return result->value;
+    return dev_page + (phys_addr - phys_page);
   }
 
+  /**
+   * @brief Checks if the device supports RX pipes of a given size.
+   *
+   * The emulated NIC reads the size of each pipe from its `rx_size` register,
+   * so any size is supported.
+   *
+   * @param size Pipe size in flits.
+   * @return True.
+   */
+  bool IsPipeSizeSupported([[maybe_unused]] uint32_t size) { return true; }
+
+  /**
+   * @brief Retrieves the NUMA node of the device.
+   *
+   * The emulator daemon may run on any node, so it is always unknown.
+   *
+   * @return -1.
+   */
+  int GetNumaNode() { return -1; }
+
   /**
    * @brief Retrieves the number of fallback queues currently in use.
    * @return The number of fallback queues currently in use. On error, -1 is
@@ -284,9 +309,11 @@ class DevBackend {
    * @return Return 0 on success. On error, -1 is returned and errno is set.
    */
   int FreeNotifBuf(int notif_buf_id) {
-    (void)notif_buf_id;
+    CloseRxWakeupFd();
+
     struct NotifBufNotification nb_notification;
     nb_notification.type = NotifType::kFreeNotifBuf;
+    nb_notification.notif_buf_id = notif_buf_id;
 
     enso::PipeNotification* pipe_notification =
         (enso::PipeNotification*)&nb_notification;
@@ -306,6 +333,56 @@ class DevBackend {
     return result->result;
   }
 
+  /**
+   * @brief Retrieves a file descriptor that becomes readable when the NIC
+   *        interrupts a notification buffer.
+   *
+   * The emulator runs in a different process, so it cannot signal an eventfd
+   * created here. Instead, we create a FIFO named after the notification
+   * buffer (see `kIpcWakeupFifoPrefix`) that the emulator writes to. The
+   * FIFO is created on the first call and removed when the notification
+   * buffer is freed.
+   *
+   * @param notif_buf_id Notification buffer ID.
+   *
+   * @return The file descriptor. On error, -1 is returned and errno is set.
+   */
+  int GetRxWakeupFd(int notif_buf_id) {
+    if (wakeup_fd_ >= 0) {
+      return wakeup_fd_;
+    }
+
+    std::string path =
+        std::string(kIpcWakeupFifoPrefix) + std::to_string(notif_buf_id);
+
+    // Remove FIFOs left behind by a previous owner of the buffer.
+    unlink(path.c_str());
+    if (mkfifo(path.c_str(), 0600) != 0) {
+      return -1;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      unlink(path.c_str());
+      return -1;
+    }
+
+    // We also keep the FIFO open for writing. Otherwise, it would be reported
+    // as readable forever (POLLHUP) once the emulator closes its end.
+    int writer_fd = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (writer_fd < 0) {
+      close(fd);
+      unlink(path.c_str());
+      return -1;
+    }
+
+    wakeup_fd_ = fd;
+    wakeup_writer_fd_ = writer_fd;
+    wakeup_fifo_path_ = path;
+
+    return fd;
+  }
+
   /**
    * @brief Allocates a pipe.
    *
@@ -369,11 +446,55 @@ class DevBackend {
   explicit DevBackend(unsigned int bdf, int bar) noexcept
       : bdf_(bdf), bar_(bar) {}
 
+  /**
+   * @brief Asks the emulator to translate a physical address.
+   */
+  uint64_t RequestDevAddr(uint64_t phys_addr) {
+    _enso_compiler_memory_barrier();
+
+    struct MmioNotification mmio_notification;
+    mmio_notification.type = NotifType::kTranslAddr;
+    mmio_notification.address = (uint64_t)phys_addr;
+    mmio_notification.value = 0;
+
+    enso::PipeNotification* pipe_notification =
+        (enso::PipeNotification*)&mmio_notification;
+    while (queue_to_backend_->Push(*pipe_notification) != 0) {
+    }
+
+    std::optional<PipeNotification> notification;
+
+    // Block until receive.
+    while (!(notification = queue_from_backend_->Pop())) {
+    }
+
+    struct MmioNotification* result =
+        (struct MmioNotification*)&notification.value();
+
+    assert(result->type == NotifType::kTranslAddr);
+    assert(result->address == (uint64_t)phys_addr);
+    return result->value;
+  }
+
   DevBackend(const DevBackend& other) = delete;
   DevBackend& operator=(const DevBackend& other) = delete;
   DevBackend(DevBackend&& other) = delete;
   DevBackend& operator=(DevBackend&& other) = delete;
 
+  /**
+   * @brief Closes and removes the wakeup FIFO, if any.
+   */
+  void CloseRxWakeupFd() {
+    if (wakeup_fd_ < 0) {
+      return;
+    }
+    close(wakeup_fd_);
+    close(wakeup_writer_fd_);
+    unlink(wakeup_fifo_path_.c_str());
+    wakeup_fd_ = -1;
+    wakeup_writer_fd_ = -1;
+  }
+
   /**
    * @brief Initializes the backend.
    *
@@ -411,6 +532,16 @@ class DevBackend {
   unsigned int bdf_;
   int bar_;
   int core_id_;
+
+  // Wakeup FIFO, see `GetRxWakeupFd`.
+  int wakeup_fd_ = -1;
+  int wakeup_writer_fd_ = -1;
+  std::string wakeup_fifo_path_;
+
+  // Device address of each physical huge page, see
+  // `ConvertVirtAddrToDevAddr`.
+  std::unordered_map<uint64_t, uint64_t> dev_page_cache_;
+  uint64_t dev_page_cache_unmap_count_ = 0;
 };
 }  // namespace enso
 
@@ -49,50 +49,6 @@
 
 namespace enso {
 
-enum ConfigId {
-  FLOW_TABLE_CONFIG_ID = 1,
-  TIMESTAMP_CONFIG_ID = 2,
-  RATE_LIMIT_CONFIG_ID = 3,
-  FALLBACK_QUEUES_CONFIG_ID = 4
-};
-
-struct __attribute__((__packed__)) FlowTableConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint16_t dst_port;
-  uint16_t src_port;
-  uint32_t dst_ip;
-  uint32_t src_ip;
-  uint32_t protocol;
-  uint32_t enso_pipe_id;
-  uint8_t pad[28];
-};
-
-struct __attribute__((__packed__)) TimestampConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint64_t enable;
-  uint8_t pad[40];
-};
-
-struct __attribute__((__packed__)) RateLimitConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint16_t denominator;
-  uint16_t numerator;
-  uint32_t enable;
-  uint8_t pad[40];
-};
-
-struct __attribute__((__packed__)) FallbackQueueConfig {
-  uint64_t signal;
-  uint64_t config_id;
-  uint32_t nb_fallback_queues;
-  uint32_t fallback_queue_mask;
-  uint64_t enable_rr;
-  uint8_t pad[32];
-};
-
 int insert_flow_entry(struct NotificationBufPair* notification_buf_pair,
                       uint16_t dst_port, uint16_t src_port, uint32_t dst_ip,
                       uint32_t src_ip, uint32_t protocol,
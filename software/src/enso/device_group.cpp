@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the `DeviceGroup` class.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#include <enso/device_group.h>
+#include <enso/helpers.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace enso {
+
+std::unique_ptr<DeviceGroup> DeviceGroup::Create(
+    const DeviceGroupConfig& config) noexcept {
+  std::unique_ptr<DeviceGroup> group(new (std::nothrow) DeviceGroup(config));
+
+  if (unlikely(!group)) {
+    return std::unique_ptr<DeviceGroup>{};
+  }
+
+  if (group->Init()) {
+    return std::unique_ptr<DeviceGroup>{};
+  }
+
+  return group;
+}
+
+DeviceGroup::~DeviceGroup() { Stop(); }
+
+int DeviceGroup::Init() noexcept {
+  if (kConfig.nb_pipes_per_core == 0) {
+    std::cerr << "Need at least one pipe per core" << std::endl;
+    return -1;
+  }
+
+  std::vector<uint32_t> core_ids = kConfig.core_ids;
+  if (core_ids.empty()) {
+    for (uint32_t i = 0; i < kConfig.nb_cores; ++i) {
+      core_ids.push_back(i);
+    }
+  }
+
+  if (core_ids.empty()) {
+    std::cerr << "Need at least one core" << std::endl;
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < core_ids.size(); ++i) {
+    std::unique_ptr<Shard> shard(new (std::nothrow) Shard());
+    if (unlikely(!shard)) {
+      return -1;
+    }
+    shard->index = i;
+    shard->core_id = core_ids[i];
+    shards_.push_back(std::move(shard));
+  }
+
+  // Pin all threads before any of them allocates memory so that every device
+  // is created from its own core.
+  for (auto& shard : shards_) {
+    threads_.emplace_back(&DeviceGroup::RunShard, this, shard.get());
+    if (set_core_id(threads_.back(), shard->core_id)) {
+      std::cerr << "Could not set CPU affinity to core " << shard->core_id
+                << std::endl;
+      setup_failed_ = true;
+      Stop();
+      return -2;
+    }
+  }
+
+  next_setup_ = 0;
+
+  while (nb_ready_.load() < shards_.size() && !setup_failed_.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (setup_failed_) {
+    Stop();
+    return -3;
+  }
+
+  return 0;
+}
+
+int DeviceGroup::SetupShard(Shard* shard) {
+  shard->device =
+      Device::Create(kConfig.pcie_addr, kConfig.huge_page_prefix,
+                     kConfig.numa_policy, kConfig.nb_huge_pages_per_core);
+  if (unlikely(!shard->device)) {
+    std::cerr << "Problem creating device for core " << shard->core_id
+              << std::endl;
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < kConfig.nb_pipes_per_core; ++i) {
+    if (kConfig.rx_tx_pipes) {
+      RxTxPipe* pipe = shard->device->AllocateRxTxPipe(kConfig.fallback);
+      if (unlikely(pipe == nullptr)) {
+        std::cerr << "Problem creating RX/TX pipe" << std::endl;
+        return -2;
+      }
+      shard->rx_tx_pipes.push_back(pipe);
+    } else {
+      RxPipe* pipe = shard->device->AllocateRxPipe(kConfig.fallback);
+      if (unlikely(pipe == nullptr)) {
+        std::cerr << "Problem creating RX pipe" << std::endl;
+        return -2;
+      }
+      shard->rx_pipes.push_back(pipe);
+    }
+  }
+
+  return 0;
+}
+
+void DeviceGroup::RunShard(Shard* shard) {
+  while (next_setup_.load() != shard->index) {
+    if (setup_failed_.load() || !keep_running_.load()) {
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (SetupShard(shard)) {
+    setup_failed_ = true;
+    shard->device.reset();
+    return;
+  }
+
+  ++next_setup_;
+  ++nb_ready_;
+
+  while (!started_.load() && keep_running_.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (started_.load() && keep_running_.load()) {
+    for (const FlowEntry& flow : flows_) {
+      if (flow.pipe_index / kConfig.nb_pipes_per_core != shard->index) {
+        continue;
+      }
+      uint32_t pipe_index = flow.pipe_index % kConfig.nb_pipes_per_core;
+      if (kConfig.rx_tx_pipes) {
+        shard->rx_tx_pipes[pipe_index]->Bind(flow.dst_port, flow.src_port,
+                                             flow.dst_ip, flow.src_ip,
+                                             flow.protocol);
+      } else {
+        shard->rx_pipes[pipe_index]->Bind(flow.dst_port, flow.src_port,
+                                          flow.dst_ip, flow.src_ip,
+                                          flow.protocol);
+      }
+    }
+
+    if (init_) {
+      init_(*shard);
+    }
+
+    while (keep_running_.load(std::memory_order_relaxed)) {
+      poll_(*shard);
+    }
+  }
+
+  // Pipes are owned by the device.
+  shard->rx_pipes.clear();
+  shard->rx_tx_pipes.clear();
+  shard->device.reset();
+}
+
+int DeviceGroup::Bind(uint16_t dst_port, uint16_t src_port, uint32_t dst_ip,
+                      uint32_t src_ip, uint32_t protocol) {
+  if (started_.load()) {
+    return -1;
+  }
+
+  uint32_t pipe_index = next_pipe_index_ % nb_pipes();
+  ++next_pipe_index_;
+
+  flows_.push_back({dst_port, src_port, dst_ip, src_ip, protocol, pipe_index});
+
+  return pipe_index;
+}
+
+int DeviceGroup::Start(ShardFunction poll, ShardFunction init) {
+  if (started_.load() || !poll) {
+    return -1;
+  }
+
+  poll_ = std::move(poll);
+  init_ = std::move(init);
+
+  started_ = true;
+
+  return 0;
+}
+
+void DeviceGroup::Stop() {
+  keep_running_ = false;
+
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+}  // namespace enso
@@ -37,20 +37,63 @@
 
 #include <enso/consts.h>
 #include <enso/ixy_helpers.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <linux/mempolicy.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace enso {
 
-uint64_t virt_to_phys(void* virt) {
-  long page_size = sysconf(_SC_PAGESIZE);
-  int fd = open("/proc/self/pagemap", O_RDONLY);
+// Translations of the huge pages allocated with `get_huge_page`, indexed by
+// the virtual address of each page. A physical address of 0 means that the
+// page was not translated yet.
+struct TranslationCache {
+  std::shared_mutex mutex;
+  std::unordered_map<uintptr_t, uint64_t> pages;
+};
+
+static TranslationCache& get_translation_cache() {
+  static TranslationCache cache;
+  return cache;
+}
+
+static std::atomic<uint64_t> huge_page_unmap_count(0);
+
+static int get_pagemap_fd() {
+  static std::mutex mutex;
+  static int fd = -1;
+  static pid_t fd_pid = 0;
+
+  // Keep the file open. But after a fork, /proc/self refers to the child.
+  std::lock_guard<std::mutex> lock(mutex);
+  pid_t pid = getpid();
+  if (fd < 0 || fd_pid != pid) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = open("/proc/self/pagemap", O_RDONLY);
+    fd_pid = pid;
+  }
+
+  return fd;
+}
+
+static uint64_t read_pagemap(void* virt) {
+  static const long page_size = sysconf(_SC_PAGESIZE);
+  int fd = get_pagemap_fd();
 
   if (fd < 0) {
     return 0;
@@ -58,17 +101,11 @@ uint64_t virt_to_phys(void* virt) {
 
   // Pagemap is an array of pointers for each normal-sized page.
   off_t offset = (uintptr_t)virt / page_size * sizeof(uintptr_t);
-  if (lseek(fd, offset, SEEK_SET) < 0) {
-    close(fd);
-    return 0;
-  }
 
   uintptr_t phy = 0;
-  if (read(fd, &phy, sizeof(phy)) < 0) {
-    close(fd);
+  if (pread(fd, &phy, sizeof(phy), offset) != sizeof(phy)) {
     return 0;
   }
-  close(fd);
 
   if (!phy) {
     return 0;
@@ -79,7 +116,66 @@ uint64_t virt_to_phys(void* virt) {
                     ((uintptr_t)virt) % page_size);
 }
 
-void* get_huge_page(const std::string& path, size_t size, bool mirror) {
+uint64_t virt_to_phys(void* virt) {
+  TranslationCache& cache = get_translation_cache();
+  uintptr_t page = (uintptr_t)virt & ~((uintptr_t)kBufPageSize - 1);
+  uint64_t offset = (uintptr_t)virt - page;
+
+  {
+    std::shared_lock<std::shared_mutex> lock(cache.mutex);
+    auto it = cache.pages.find(page);
+    if (it == cache.pages.end()) {
+      // Not a huge page that we know about.
+      lock.unlock();
+      return read_pagemap(virt);
+    }
+    if (it->second != 0) {
+      return it->second + offset;
+    }
+  }
+
+  uint64_t phys_page = read_pagemap((void*)page);
+  if (phys_page == 0) {
+    return 0;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(cache.mutex);
+  auto it = cache.pages.find(page);
+  if (it != cache.pages.end()) {
+    it->second = phys_page;
+  }
+
+  return phys_page + offset;
+}
+
+uint32_t virt_to_phys_bulk(void* const* virts, uint64_t* phys,
+                           uint32_t nb_addrs) {
+  uint32_t nb_translated = 0;
+  for (uint32_t i = 0; i < nb_addrs; ++i) {
+    phys[i] = virt_to_phys(virts[i]);
+    nb_translated += (phys[i] != 0);
+  }
+  return nb_translated;
+}
+
+uint64_t get_huge_page_unmap_count() { return huge_page_unmap_count.load(); }
+
+static void set_huge_page_cached(uint8_t* virt_addr, size_t size,
+                                 bool cached) {
+  TranslationCache& cache = get_translation_cache();
+  std::unique_lock<std::shared_mutex> lock(cache.mutex);
+  for (size_t offset = 0; offset < size; offset += kBufPageSize) {
+    uintptr_t page = (uintptr_t)(virt_addr + offset);
+    if (cached) {
+      cache.pages[page] = 0;
+    } else {
+      cache.pages.erase(page);
+    }
+  }
+}
+
+void* get_huge_page(const std::string& path, size_t size, bool mirror,
+                    int numa_node) {
   int fd;
   if (size == 0) {
     size = kBufPageSize;
@@ -128,14 +224,25 @@ void* get_huge_page(const std::string& path, size_t size, bool mirror) {
                 << std::endl;
       close(fd);
       unlink(path.c_str());
-      free(virt_addr);
+      munmap(virt_addr, size * 2);
       return nullptr;
     }
   }
 
+  // The policy must be set before the pages are faulted in by `mlock`.
+  if (numa_node >= 0) {
+    std::vector<uint64_t> nodemask(numa_node / 64 + 1, 0);
+    nodemask[numa_node / 64] = 1ULL << (numa_node % 64);
+    if (syscall(SYS_mbind, virt_addr, size, MPOL_PREFERRED, nodemask.data(),
+                nodemask.size() * 64 + 1, 0)) {
+      std::cerr << "(" << errno << ") Could not bind huge page to NUMA node "
+                << numa_node << std::endl;
+    }
+  }
+
   if (mlock(virt_addr, size)) {
     std::cerr << "(" << errno << ") Could not lock huge page" << std::endl;
-    munmap(virt_addr, size);
+    munmap(virt_addr, size * 2);
     close(fd);
     unlink(path.c_str());
     return nullptr;
@@ -143,7 +250,62 @@ void* get_huge_page(const std::string& path, size_t size, bool mirror) {
 
   close(fd);
 
+  set_huge_page_cached((uint8_t*)virt_addr, mirror ? size * 2 : size, true);
+
   return virt_addr;
 }
 
+void unmap_huge_page(void* virt_addr, size_t size, bool mirror) {
+  if (size == 0) {
+    size = kBufPageSize;
+  }
+
+  set_huge_page_cached((uint8_t*)virt_addr, mirror ? size * 2 : size, false);
+  ++huge_page_unmap_count;
+
+  // `get_huge_page` always reserves twice the size, even when not mirroring.
+  munmap(virt_addr, size * 2);
+}
+
+int get_numa_node_from_bdf(uint16_t bdf) {
+  char pcie_addr[32];
+  snprintf(pcie_addr, sizeof(pcie_addr), "0000:%02x:%02x.%x", bdf >> 8,
+           (bdf >> 3) & 0x1f, bdf & 0x7);
+
+  std::ifstream numa_node_file(std::string("/sys/bus/pci/devices/") +
+                               pcie_addr + "/numa_node");
+  int numa_node = -1;
+  if (!(numa_node_file >> numa_node)) {
+    return -1;
+  }
+
+  // The kernel reports -1 when the platform does not expose the device's node.
+  return numa_node;
+}
+
+int get_numa_node_from_core(int core_id) {
+  if (core_id < 0) {
+    return -1;
+  }
+
+  // The core's directory has a `nodeN` link to the node it belongs to.
+  std::string core_path =
+      "/sys/devices/system/cpu/cpu" + std::to_string(core_id);
+  DIR* dir = opendir(core_path.c_str());
+  if (dir == nullptr) {
+    return -1;
+  }
+
+  int numa_node = -1;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (sscanf(entry->d_name, "node%d", &numa_node) == 1) {
+      break;
+    }
+  }
+  closedir(dir);
+
+  return numa_node;
+}
+
 }  // namespace enso
@@ -40,21 +40,42 @@
 #include <enso/config.h>
 #include <enso/helpers.h>
 #include <enso/pipe.h>
+#include <immintrin.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <string>
 
+#include "../huge_page_pool.h"
 #include "../pcie.h"
+#include "../rx_scheduler.h"
 
 namespace enso {
 
+// Maximum time to wait for outstanding transmissions when freeing a device.
+static constexpr std::chrono::milliseconds kTxDrainTimeout(100);
+
+// Maximum number of pipes to prefetch ahead of the current one.
+static constexpr uint32_t kMaxRxPrefetchLookahead = 16;
+
+// The `latency_opt` build option only picks the initial mode, see
+// `Device::SetPollPolicy()`.
+#ifdef LATENCY_OPT
+static constexpr PollMode kDefaultPollMode = PollMode::kLatency;
+#else   // !LATENCY_OPT
+static constexpr PollMode kDefaultPollMode = PollMode::kThroughput;
+#endif  // LATENCY_OPT
+
 uint32_t external_peek_next_batch_from_queue(
     struct RxEnsoPipeInternal* enso_pipe,
     struct NotificationBufPair* notification_buf_pair, void** buf) {
@@ -82,21 +103,82 @@ inline uint32_t RxPipe::Peek(uint8_t** buf, uint32_t max_nb_bytes) {
   return std::min(ret, max_nb_bytes);
 }
 
+#ifdef ENSO_STATS
+// Counts the packets in a region of a pipe that the application released.
+static uint64_t count_released_pkts(const uint8_t* buf, uint32_t nb_bytes) {
+  uint64_t nb_pkts = 0;
+  for (uint32_t offset = 0; offset < nb_bytes; ++nb_pkts) {
+    uint16_t nb_flits = (get_pkt_len(buf + offset) - 1) / 64 + 1;
+    offset += nb_flits * 64;
+  }
+  return nb_pkts;
+}
+#endif  // ENSO_STATS
+
 void RxPipe::Free(uint32_t nb_bytes) {
+#ifdef ENSO_STATS
+  nb_released_pkts_ += count_released_pkts(
+      buf() + internal_rx_pipe_.rx_head * 64ULL, nb_bytes);
+#endif  // ENSO_STATS
   advance_pipe(&internal_rx_pipe_, nb_bytes);
 }
 
 void RxPipe::Prefetch() { prefetch_pipe(&internal_rx_pipe_); }
 
-void RxPipe::Clear() { fully_advance_pipe(&internal_rx_pipe_); }
+void RxPipe::Clear() {
+#ifdef ENSO_STATS
+  uint32_t nb_flits = (internal_rx_pipe_.rx_tail - internal_rx_pipe_.rx_head) &
+                      (internal_rx_pipe_.size - 1);
+  nb_released_pkts_ += count_released_pkts(
+      buf() + internal_rx_pipe_.rx_head * 64ULL, nb_flits * 64);
+#endif  // ENSO_STATS
+  fully_advance_pipe(&internal_rx_pipe_);
+}
+
+int RxPipe::EnableOutOfOrderRelease() {
+  return enable_pipe_release_tracking(&internal_rx_pipe_);
+}
+
+void RxPipe::Release(const uint8_t* addr, uint32_t nb_bytes) {
+#ifdef ENSO_STATS
+  nb_released_pkts_ += count_released_pkts(addr, nb_bytes);
+#endif  // ENSO_STATS
+  release_pipe_region(&internal_rx_pipe_, addr, nb_bytes);
+}
+
+RxReleaseStats RxPipe::GetReleaseStats() const {
+  RxReleaseStats stats = {};
+  uint32_t nb_received_flits =
+      (internal_rx_pipe_.rx_tail - internal_rx_pipe_.rx_head) &
+      (internal_rx_pipe_.size - 1);
+  uint32_t nb_released_flits = 0;
+
+  if (internal_rx_pipe_.released_flits != nullptr) {
+    nb_released_flits = internal_rx_pipe_.nb_released_flits;
+    stats.nb_releases = internal_rx_pipe_.nb_releases;
+    stats.nb_out_of_order_releases =
+        internal_rx_pipe_.nb_out_of_order_releases;
+  }
+
+  stats.held_bytes = (nb_received_flits - nb_released_flits) * 64;
+  stats.blocked_bytes = nb_released_flits * 64;
+
+  return stats;
+}
+
+int RxPipe::SetSchedulingClass(uint32_t sched_class, uint32_t weight) {
+  return device_->SetRxSchedulingClass(id_, sched_class, weight);
+}
+
+void RxPipe::FlushHead() { flush_pipe_head(&internal_rx_pipe_); }
 
 RxPipe::~RxPipe() {
   enso_pipe_free(notification_buf_pair_, &internal_rx_pipe_, id_);
 }
 
-int RxPipe::Init(bool fallback) noexcept {
-  int ret =
-      enso_pipe_init(&internal_rx_pipe_, notification_buf_pair_, fallback);
+int RxPipe::Init(bool fallback, uint32_t size) noexcept {
+  int ret = enso_pipe_init(&internal_rx_pipe_, notification_buf_pair_,
+                           fallback, size);
   if (ret < 0) {
     return ret;
   }
@@ -107,29 +189,137 @@ int RxPipe::Init(bool fallback) noexcept {
 }
 
 TxPipe::~TxPipe() {
-  if (internal_buf_) {
-    munmap(buf_, kMaxCapacity);
-    std::string path = GetHugePageFilePath();
-    unlink(path.c_str());
+  if (internal_buf_ && buf_ != nullptr) {
+    free_pipe_buf(&(device_->notification_buf_pair_), buf_,
+                  GetHugePageFilePath());
   }
 }
 
 int TxPipe::Init() noexcept {
+  struct NotificationBufPair* notif_buf = &(device_->notification_buf_pair_);
+
   if (internal_buf_) {
-    std::string path = GetHugePageFilePath();
-    buf_ = (uint8_t*)get_huge_page(path, 0, true);
+    buf_ = (uint8_t*)alloc_pipe_buf(notif_buf, GetHugePageFilePath(),
+                                    &buf_phys_addr_);
     if (unlikely(!buf_)) {
       return -1;
     }
+  } else {
+    buf_phys_addr_ = get_dev_addr_from_virt_addr(notif_buf, buf_);
   }
 
-  struct NotificationBufPair* notif_buf = &(device_->notification_buf_pair_);
+  return 0;
+}
+
+SharedTxPipe::~SharedTxPipe() {
+  if (buf_ != nullptr) {
+    free_pipe_buf(&(device_->notification_buf_pair_), buf_, huge_page_path_);
+  }
+  if (notification_buf_initialized_) {
+    notification_buf_free(&notification_buf_pair_);
+  }
+}
+
+int SharedTxPipe::Init() noexcept {
+  // The pipe uses its own notification buffer, so that it does not interfere
+  // with the device's single-threaded pipes.
+  if (notification_buf_init(device_->bdf_, -1, &notification_buf_pair_,
+                            device_->huge_page_prefix_, device_->kNumaPolicy,
+                            device_->core_id_)) {
+    return -1;
+  }
+  notification_buf_initialized_ = true;
+
+  huge_page_path_ = device_->huge_page_prefix_ +
+                    std::string(kHugePageSharedTxPipePathPrefix) +
+                    std::to_string(notification_buf_pair_.id);
+  // The buffer comes from the device's pool, if it has free pages.
+  buf_ = (uint8_t*)alloc_pipe_buf(&(device_->notification_buf_pair_),
+                                  huge_page_path_, &buf_phys_addr_);
+  if (unlikely(!buf_)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int SharedTxPipe::TryReserve(uint32_t nb_bytes, Reservation* reservation) {
+  assert(nb_bytes <= kMaxReservationSize);
+  assert(nb_bytes / kQuantumSize * kQuantumSize == nb_bytes);
+
+  uint64_t offset = reserved_.load(std::memory_order_relaxed);
+  do {
+    uint64_t completed = completed_.load(std::memory_order_acquire);
+    if (unlikely(offset + nb_bytes - completed > kMaxCapacity)) {
+      TryProcessCompletions();
+      errno = EAGAIN;
+      return -1;
+    }
+  } while (!reserved_.compare_exchange_weak(offset, offset + nb_bytes,
+                                            std::memory_order_relaxed));
 
-  buf_phys_addr_ = get_dev_addr_from_virt_addr(notif_buf, buf_);
+  // The buffer is mirrored, so the reservation is always contiguous.
+  reservation->buf = buf_ + (offset & kBufMask);
+  reservation->offset = offset;
+  reservation->nb_bytes = nb_bytes;
 
   return 0;
 }
 
+SharedTxPipe::Reservation SharedTxPipe::Reserve(uint32_t nb_bytes) {
+  Reservation reservation;
+  while (TryReserve(nb_bytes, &reservation)) {
+    _mm_pause();
+  }
+  return reservation;
+}
+
+void SharedTxPipe::Submit(const Reservation& reservation) {
+  // Wait for all the previous reservations to be submitted.
+  while (published_.load(std::memory_order_acquire) != reservation.offset) {
+    _mm_pause();
+  }
+
+  while (notif_buf_lock_.test_and_set(std::memory_order_acquire)) {
+    _mm_pause();
+  }
+
+  uint64_t phys_addr = buf_phys_addr_ + (reservation.offset & kBufMask);
+  while (unlikely(try_send_to_queue(&notification_buf_pair_, phys_addr,
+                                    reservation.nb_bytes))) {
+    ProcessCompletions();
+  }
+
+  // Every submission uses at least one notification, so there is always space
+  // to keep track of it.
+  pending_bytes_[pending_tail_] = reservation.nb_bytes;
+  pending_tail_ = (pending_tail_ + 1) % kNotificationBufSize;
+
+  notif_buf_lock_.clear(std::memory_order_release);
+
+  published_.store(reservation.offset + reservation.nb_bytes,
+                   std::memory_order_release);
+}
+
+void SharedTxPipe::ProcessCompletions() {
+  uint32_t tx_completions = get_unreported_completions(&notification_buf_pair_);
+  uint64_t nb_bytes = 0;
+  for (uint32_t i = 0; i < tx_completions; ++i) {
+    nb_bytes += pending_bytes_[pending_head_];
+    pending_head_ = (pending_head_ + 1) % kNotificationBufSize;
+  }
+  if (nb_bytes > 0) {
+    completed_.fetch_add(nb_bytes, std::memory_order_release);
+  }
+}
+
+void SharedTxPipe::TryProcessCompletions() {
+  if (!notif_buf_lock_.test_and_set(std::memory_order_acquire)) {
+    ProcessCompletions();
+    notif_buf_lock_.clear(std::memory_order_release);
+  }
+}
+
 int RxTxPipe::Init(bool fallback) noexcept {
   rx_pipe_ = device_->AllocateRxPipe(fallback);
   if (rx_pipe_ == nullptr) {
@@ -146,11 +336,65 @@ int RxTxPipe::Init(bool fallback) noexcept {
   return 0;
 }
 
-std::unique_ptr<Device> Device::Create(
-    const std::string& pcie_addr,
-    const std::string& huge_page_prefix) noexcept {
-  std::unique_ptr<Device> dev(new (std::nothrow)
-                                  Device(pcie_addr, huge_page_prefix));
+void RxTxPipe::SendAndFreeCompacted(uint32_t nb_bytes, CompactionMode mode) {
+  if (dropped_runs_.empty()) {
+    SendAndFree(nb_bytes);
+    return;
+  }
+
+  // Bytes to send start at the same offset in the TX and RX pipes.
+  uint8_t* start = tx_pipe_->AllocateBuf();
+  uint32_t nb_handled_bytes = 0;  // Kept or dropped.
+  uint32_t nb_kept_bytes = 0;
+
+  for (const DroppedRun& run : dropped_runs_) {
+    uint32_t offset = run.buf - start;
+    assert(offset >= nb_handled_bytes && offset + run.length <= nb_bytes);
+    uint32_t nb_run_bytes = offset - nb_handled_bytes;
+
+    if (mode == CompactionMode::kPerRun) {
+      if (nb_run_bytes > 0) {
+        tx_pipe_->SendAndFree(nb_run_bytes);
+      }
+      tx_pipe_->DropAndFree(run.length);
+    } else if (nb_run_bytes > 0) {
+      if (nb_kept_bytes != nb_handled_bytes) {
+        memmove(start + nb_kept_bytes, start + nb_handled_bytes, nb_run_bytes);
+      }
+      nb_kept_bytes += nb_run_bytes;
+    }
+    nb_handled_bytes = offset + run.length;
+  }
+
+  uint32_t nb_run_bytes = nb_bytes - nb_handled_bytes;
+
+  if (mode == CompactionMode::kPerRun) {
+    if (nb_run_bytes > 0) {
+      tx_pipe_->SendAndFree(nb_run_bytes);
+    }
+  } else {
+    if (nb_run_bytes > 0) {
+      memmove(start + nb_kept_bytes, start + nb_handled_bytes, nb_run_bytes);
+    }
+    nb_kept_bytes += nb_run_bytes;
+
+    // The dropped bytes are now at the end, after the ones being sent.
+    if (nb_kept_bytes > 0) {
+      tx_pipe_->SendAndFree(nb_kept_bytes);
+    }
+    tx_pipe_->DropAndFree(nb_bytes - nb_kept_bytes);
+  }
+
+  last_tx_pipe_capacity_ -= nb_bytes;
+  dropped_runs_.clear();
+}
+
+std::unique_ptr<Device> Device::Create(const std::string& pcie_addr,
+                                       const std::string& huge_page_prefix,
+                                       NumaPolicy numa_policy,
+                                       uint32_t nb_huge_pages) noexcept {
+  std::unique_ptr<Device> dev(
+      new (std::nothrow) Device(pcie_addr, huge_page_prefix, numa_policy));
   if (unlikely(!dev)) {
     return std::unique_ptr<Device>{};
   }
@@ -159,10 +403,23 @@ std::unique_ptr<Device> Device::Create(
     return std::unique_ptr<Device>{};
   }
 
+  if (nb_huge_pages > 0 && dev->ReserveHugePages(nb_huge_pages)) {
+    return std::unique_ptr<Device>{};
+  }
+
   return dev;
 }
 
 Device::~Device() {
+  // Give the NIC a chance to finish outstanding transmissions before freeing
+  // the buffers that they point to.
+  flush_tx(&notification_buf_pair_);
+  auto drain_deadline = std::chrono::steady_clock::now() + kTxDrainTimeout;
+  while (notification_buf_pair_.tx_head != notification_buf_pair_.tx_tail &&
+         std::chrono::steady_clock::now() < drain_deadline) {
+    update_tx_head(&notification_buf_pair_);
+  }
+
   for (auto& pipe : rx_tx_pipes_) {
     rx_tx_pipes_map_[pipe->rx_id()] = nullptr;
     delete pipe;
@@ -177,17 +434,31 @@ Device::~Device() {
     delete pipe;
   }
 
+  for (auto& pipe : shared_tx_pipes_) {
+    delete pipe;
+  }
+
+  delete rx_scheduler_;
+
   notification_buf_free(&notification_buf_pair_);
 }
 
-RxPipe* Device::AllocateRxPipe(bool fallback) noexcept {
+RxPipe* Device::AllocateRxPipe(bool fallback, uint32_t size) noexcept {
+  // Checked before creating the pipe, which would otherwise try to free a pipe
+  // that was never allocated.
+  if (size % 64 ||
+      !is_pipe_size_supported(&notification_buf_pair_, size / 64)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+
   RxPipe* pipe(new (std::nothrow) RxPipe(this));
 
   if (unlikely(!pipe)) {
     return nullptr;
   }
 
-  if (pipe->Init(fallback)) {
+  if (pipe->Init(fallback, size / 64)) {
     delete pipe;
     return nullptr;
   }
@@ -195,6 +466,11 @@ RxPipe* Device::AllocateRxPipe(bool fallback) noexcept {
   rx_pipes_.push_back(pipe);
   rx_pipes_map_[pipe->id()] = pipe;
 
+  // The ID may have been used by a pipe that had a scheduling class.
+  if (rx_scheduler_ != nullptr) {
+    rx_scheduler_->ResetPipe(pipe->id());
+  }
+
   return pipe;
 }
 
@@ -219,6 +495,23 @@ TxPipe* Device::AllocateTxPipe(uint8_t* buf) noexcept {
   return pipe;
 }
 
+SharedTxPipe* Device::AllocateSharedTxPipe() noexcept {
+  SharedTxPipe* pipe(new (std::nothrow) SharedTxPipe(this));
+
+  if (unlikely(!pipe)) {
+    return nullptr;
+  }
+
+  if (pipe->Init()) {
+    delete pipe;
+    return nullptr;
+  }
+
+  shared_tx_pipes_.push_back(pipe);
+
+  return pipe;
+}
+
 RxTxPipe* Device::AllocateRxTxPipe(bool fallback) noexcept {
   RxTxPipe* pipe(new (std::nothrow) RxTxPipe(this));
 
@@ -234,88 +527,449 @@ RxTxPipe* Device::AllocateRxTxPipe(bool fallback) noexcept {
   rx_tx_pipes_.push_back(pipe);
   rx_tx_pipes_map_[pipe->rx_id()] = pipe;
 
+  if (rx_scheduler_ != nullptr) {
+    rx_scheduler_->ResetPipe(pipe->rx_id());
+  }
+
   return pipe;
 }
 
-// TODO(sadok): DRY this code.
+_enso_always_inline void Device::FlushStaleRxHeads() {
+  uint64_t max_cycles = notification_buf_pair_.rx_head_update_cycles;
+  if (max_cycles == 0) {
+    return;
+  }
+  uint64_t now = __rdtsc();
+  if (now - last_rx_heads_flush_tsc_ >= max_cycles) {
+    last_rx_heads_flush_tsc_ = now;
+    FlushRxHeads();
+  }
+}
+
 RxPipe* Device::NextRxPipeToRecv() {
   // This function can only be used when there are **no** RxTx pipes.
   assert(rx_tx_pipes_.size() == 0);
 
-  int32_t id;
+  // Sends from the previous poll iteration may have been held back.
+  flush_tx(&notification_buf_pair_);
 
-#ifdef LATENCY_OPT
-  // When LATENCY_OPT is enabled, we always prefetch the next pipe.
-  id = get_next_enso_pipe_id(&notification_buf_pair_);
+  int32_t id = (this->*next_rx_pipe_id_)();
+  if (id < 0) {
+    return nullptr;
+  }
 
-  while (id >= 0) {
-    RxPipe* rx_pipe = rx_pipes_map_[id];
-    assert(rx_pipe != nullptr);
+  RxPipe* rx_pipe = rx_pipes_map_[id];
+  rx_pipe->SetAsNextPipe();
+  return rx_pipe;
+}
 
-    RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
-    uint32_t enso_pipe_head = pipe.rx_tail;
-    uint32_t enso_pipe_tail = notification_buf_pair_.pending_rx_pipe_tails[id];
+uint32_t Device::RecvBurst(PipeBatch* batches, uint32_t max_nb_batches) {
+  // This function can only be used when there are **no** RxTx pipes.
+  assert(rx_tx_pipes_.size() == 0);
 
-    if (enso_pipe_head != enso_pipe_tail) {
-      rx_pipe->Prefetch();
-      break;
+  // Sends from the previous poll iteration may have been held back.
+  flush_tx(&notification_buf_pair_);
+
+  uint16_t next_rx_ids_head = notification_buf_pair_.next_rx_ids_head;
+
+  // Only fetch new notifications once we are done with the previous ones.
+  if (next_rx_ids_head == notification_buf_pair_.next_rx_ids_tail) {
+    if (get_new_tails(&notification_buf_pair_) == 0) {
+      FlushStaleRxHeads();
+      return 0;
     }
+  }
 
-    id = get_next_enso_pipe_id(&notification_buf_pair_);
+  uint16_t next_rx_ids_tail = notification_buf_pair_.next_rx_ids_tail;
+  uint32_t nb_batches = 0;
+
+  while (next_rx_ids_head != next_rx_ids_tail && nb_batches < max_nb_batches) {
+    enso_pipe_id_t id =
+        notification_buf_pair_.next_rx_pipe_ids[next_rx_ids_head];
+    next_rx_ids_head = (next_rx_ids_head + 1) % kNotificationBufSize;
+    dequeue_rx_pipe(&notification_buf_pair_, id);
+
+    RxPipe* rx_pipe = rx_pipes_map_[id];
+    if (unlikely(rx_pipe == nullptr)) {
+      continue;  // Freed after the NIC notified it.
+    }
+
+    // Pipes are only queued once, so this consumes everything up to the latest
+    // tail. The pipe may still be empty if the application consumed it some
+    // other way.
+    uint8_t* buf;
+    uint32_t nb_bytes = get_next_batch_from_queue(
+        &rx_pipe->internal_rx_pipe_, &notification_buf_pair_, (void**)&buf);
+    if (nb_bytes == 0) {
+      continue;
+    }
+
+    batches[nb_batches++] = {rx_pipe, buf, nb_bytes};
   }
 
-#else  // !LATENCY_OPT
-  id = get_next_enso_pipe_id(&notification_buf_pair_);
+  notification_buf_pair_.next_rx_ids_head = next_rx_ids_head;
 
-#endif  // LATENCY_OPT
+  return nb_batches;
+}
 
-  if (id < 0) {
-    return nullptr;
+bool Device::HasPendingRx() {
+  // The scheduler may hold pipes whose notifications were already consumed.
+  if (rx_scheduler_ != nullptr && !rx_scheduler_->empty()) {
+    return true;
   }
+  return has_pending_rx(&notification_buf_pair_);
+}
 
-  RxPipe* rx_pipe = rx_pipes_map_[id];
-  rx_pipe->SetAsNextPipe();
-  return rx_pipe;
+int Device::WaitForRx(int64_t timeout_us) {
+  if (HasPendingRx()) {
+#ifdef ENSO_STATS
+    ++notification_buf_pair_.nb_rx_waits;
+#endif  // ENSO_STATS
+    return 1;
+  }
+
+  // The NIC should not wait for us while we sleep.
+  flush_tx(&notification_buf_pair_);
+  FlushRxHeads();
+
+  return wait_for_rx(&notification_buf_pair_, rx_busy_poll_budget_us_,
+                     timeout_us);
+}
+
+int Device::GetRxEventFd() { return get_rx_wakeup_fd(&notification_buf_pair_); }
+
+int Device::ArmRxEvent() {
+  if (rx_scheduler_ != nullptr && !rx_scheduler_->empty()) {
+    return 1;
+  }
+
+  flush_tx(&notification_buf_pair_);
+  FlushRxHeads();
+
+  return arm_rx_wakeup(&notification_buf_pair_);
 }
 
 RxTxPipe* Device::NextRxTxPipeToRecv() {
+  // Sends from the previous poll iteration may have been held back.
+  flush_tx(&notification_buf_pair_);
   ProcessCompletions();
   // This function can only be used when there are only RxTx pipes.
   assert(rx_pipes_.size() == rx_tx_pipes_.size());
+
+  int32_t id = (this->*next_rx_pipe_id_)();
+  if (id < 0) {
+    return nullptr;
+  }
+
+  RxTxPipe* rx_tx_pipe = rx_tx_pipes_map_[id];
+  rx_tx_pipe->rx_pipe_->SetAsNextPipe();
+  return rx_tx_pipe;
+}
+
+template <bool kPrefetch, bool kAdaptive>
+int32_t Device::NextRxPipeId() {
   int32_t id;
 
-#ifdef LATENCY_OPT
-  // When LATENCY_OPT is enabled, we always prefetch the next pipe.
-  id = get_next_enso_pipe_id(&notification_buf_pair_);
+  if constexpr (kPrefetch) {
+    // We always prefetch the next pipe. The pipes after it are prefetched
+    // ahead of time, see `PrefetchNextRxPipes()`.
+    uint64_t now = __rdtsc();
+    UpdateRxPrefetchLookahead(now);
 
-  while (id >= 0) {
-    RxTxPipe* rx_tx_pipe = rx_tx_pipes_map_[id];
-    assert(rx_tx_pipe->rx_pipe_ != nullptr);
+    // Ids may have been consumed some other way (e.g., with `RecvBurst()`),
+    // in which case we no longer know which ones were prefetched.
+    if (notification_buf_pair_.next_rx_ids_head != prefetched_rx_ids_head_) {
+      nb_prefetched_rx_ids_ = 0;
+    }
+
+    id = get_next_enso_pipe_id(&notification_buf_pair_);
+
+    while (id >= 0) {
+      bool prefetched = nb_prefetched_rx_ids_ > 0;
+      nb_prefetched_rx_ids_ -= prefetched;
+
+      // RxTx pipes also keep their RxPipe in `rx_pipes_map_`. Pipes freed
+      // after the NIC notified them are skipped.
+      RxPipe* rx_pipe = rx_pipes_map_[id];
+      if (unlikely(rx_pipe == nullptr)) {
+        id = get_next_enso_pipe_id(&notification_buf_pair_);
+        continue;
+      }
+
+      RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
+      uint32_t enso_pipe_head = pipe.rx_tail;
+      uint32_t enso_pipe_tail =
+          notification_buf_pair_.pending_rx_pipe_tails[id];
+
+      if (enso_pipe_head != enso_pipe_tail) {
+        if (!prefetched) {
+          rx_pipe->Prefetch();
+        }
+        break;
+      }
+
+      id = get_next_enso_pipe_id(&notification_buf_pair_);
+    }
+
+    if (id >= 0) {
+      PrefetchNextRxPipes();
+      last_rx_pipe_tsc_ = now;
+    }
+    prefetched_rx_ids_head_ = notification_buf_pair_.next_rx_ids_head;
+  } else {
+    // Pipes freed after the NIC notified them are skipped.
+    do {
+      id = get_next_enso_pipe_id(&notification_buf_pair_);
+    } while (unlikely(id >= 0 && rx_pipes_map_[id] == nullptr));
+  }
+
+  if (id < 0) {
+    FlushStaleRxHeads();
+  }
+
+  if constexpr (kAdaptive) {
+    CountRxPoll(id >= 0);
+  }
+
+  return id;
+}
 
-    RxEnsoPipeInternal& pipe = rx_tx_pipe->rx_pipe_->internal_rx_pipe_;
-    uint32_t enso_pipe_head = pipe.rx_tail;
-    uint32_t enso_pipe_tail = notification_buf_pair_.pending_rx_pipe_tails[id];
+template <bool kPrefetch, bool kAdaptive>
+int32_t Device::NextScheduledRxPipeId() {
+  uint64_t now = __rdtsc();
 
-    if (enso_pipe_head != enso_pipe_tail) {
-      rx_tx_pipe->Prefetch();
+  // Move the pipes with new notifications to the scheduler.
+  for (uint32_t i = 0; i < kBatchSize; ++i) {
+    int32_t id = get_next_enso_pipe_id(&notification_buf_pair_);
+    if (id < 0) {
       break;
     }
+    rx_scheduler_->Enqueue(id, now);
+  }
 
-    id = get_next_enso_pipe_id(&notification_buf_pair_);
+  // Charge the pipe that we returned last for the bytes that the application
+  // consumed since then. It goes back to the scheduler if it has more data,
+  // which we only know after fetching the new notifications.
+  if (last_scheduled_pipe_id_ >= 0) {
+    enso_pipe_id_t last_id = last_scheduled_pipe_id_;
+    RxPipe* rx_pipe = rx_pipes_map_[last_id];
+    if (rx_pipe != nullptr) {
+      const RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
+      uint32_t nb_flits =
+          (pipe.rx_tail - last_scheduled_pipe_tail_) & (pipe.size - 1);
+      bool pending =
+          notification_buf_pair_.pending_rx_pipe_tails[last_id] != pipe.rx_tail;
+      rx_scheduler_->Charge(last_id, nb_flits * 64, pending, now);
+    }
+    last_scheduled_pipe_id_ = -1;
   }
 
-#else  // !LATENCY_OPT
-  id = get_next_enso_pipe_id(&notification_buf_pair_);
+  int32_t id;
+  while ((id = rx_scheduler_->Dequeue()) >= 0) {
+    RxPipe* rx_pipe = rx_pipes_map_[id];
+    if (rx_pipe == nullptr) {
+      continue;
+    }
+
+    // The application may have consumed the pipe some other way.
+    const RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
+    if (notification_buf_pair_.pending_rx_pipe_tails[id] == pipe.rx_tail) {
+      rx_scheduler_->Charge(id, 0, false, now);
+      continue;
+    }
 
-#endif  // LATENCY_OPT
+    rx_scheduler_->RecordDispatch(id, now);
+    last_scheduled_pipe_id_ = id;
+    last_scheduled_pipe_tail_ = pipe.rx_tail;
+
+    if constexpr (kPrefetch) {
+      rx_pipe->Prefetch();
+    }
+    break;
+  }
 
   if (id < 0) {
-    return nullptr;
+    FlushStaleRxHeads();
   }
 
-  RxTxPipe* rx_tx_pipe = rx_tx_pipes_map_[id];
-  rx_tx_pipe->rx_pipe_->SetAsNextPipe();
-  return rx_tx_pipe;
+  if constexpr (kAdaptive) {
+    CountRxPoll(id >= 0);
+  }
+
+  return id;
+}
+
+void Device::ApplyPollProfile(PollMode mode) {
+  const PollProfile& profile = mode == PollMode::kThroughput
+                                   ? poll_policy_.throughput
+                                   : poll_policy_.latency;
+  active_poll_mode_ = mode;
+
+  set_notif_batch_size(&notification_buf_pair_,
+                       profile.notification_batch_size,
+                       profile.adaptive_notification_batch);
+
+  // Settings made explicitly by the application take precedence.
+  if (!rx_head_coalescing_set_) {
+    UpdateRxHeadCoalescing(profile.rx_head_min_bytes,
+                           profile.rx_head_max_cycles);
+  }
+  if (!tx_doorbell_coalescing_set_) {
+    set_tx_doorbell_coalescing(&notification_buf_pair_,
+                               profile.tx_doorbell_max_notifications,
+                               profile.tx_doorbell_max_bytes);
+  }
+
+  // Start measuring the lookahead again if the profile prefetches.
+  rx_prefetch_ = profile.prefetch;
+  nb_prefetched_rx_ids_ = 0;
+  last_rx_pipe_tsc_ = 0;
+
+  UpdateNextRxPipeIdFn();
+}
+
+void Device::UpdateNextRxPipeIdFn() {
+  bool adaptive = poll_policy_.mode == PollMode::kAdaptive;
+
+  if (rx_scheduler_ != nullptr) {
+    if (rx_prefetch_) {
+      next_rx_pipe_id_ = adaptive ? &Device::NextScheduledRxPipeId<true, true>
+                                  : &Device::NextScheduledRxPipeId<true, false>;
+    } else {
+      next_rx_pipe_id_ = adaptive
+                             ? &Device::NextScheduledRxPipeId<false, true>
+                             : &Device::NextScheduledRxPipeId<false, false>;
+    }
+  } else if (rx_prefetch_) {
+    next_rx_pipe_id_ = adaptive ? &Device::NextRxPipeId<true, true>
+                                : &Device::NextRxPipeId<true, false>;
+  } else {
+    next_rx_pipe_id_ = adaptive ? &Device::NextRxPipeId<false, true>
+                                : &Device::NextRxPipeId<false, false>;
+  }
+}
+
+void Device::UpdateAdaptivePollMode() {
+  double busy_fraction = (double)nb_busy_rx_polls_ / nb_rx_polls_;
+  nb_rx_polls_ = 0;
+  nb_busy_rx_polls_ = 0;
+
+  if (active_poll_mode_ == PollMode::kLatency &&
+      busy_fraction >= poll_policy_.adaptive_busy_threshold) {
+    ApplyPollProfile(PollMode::kThroughput);
+  } else if (active_poll_mode_ == PollMode::kThroughput &&
+             busy_fraction <= poll_policy_.adaptive_idle_threshold) {
+    ApplyPollProfile(PollMode::kLatency);
+  }
+}
+
+int Device::SetPollPolicy(const PollPolicy& policy) {
+  for (const PollProfile* profile : {&policy.latency, &policy.throughput}) {
+    if (profile->notification_batch_size == 0 ||
+        profile->notification_batch_size > kNotificationBufSize) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  if (policy.mode == PollMode::kAdaptive &&
+      (policy.adaptive_window == 0 ||
+       policy.adaptive_idle_threshold >= policy.adaptive_busy_threshold)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  poll_policy_ = policy;
+  nb_rx_polls_ = 0;
+  nb_busy_rx_polls_ = 0;
+  rx_head_coalescing_set_ = false;
+  tx_doorbell_coalescing_set_ = false;
+
+  ApplyPollProfile(policy.mode == PollMode::kThroughput ? PollMode::kThroughput
+                                                        : PollMode::kLatency);
+  return 0;
+}
+
+void Device::UpdateRxPrefetchLookahead(uint64_t now) {
+  if (last_rx_pipe_tsc_ == 0) {
+    return;
+  }
+
+  // Longer gaps (e.g., when the application does other work) would not change
+  // the lookahead anyway, so we cap them to keep the average responsive.
+  uint64_t batch_cycles =
+      std::min(now - last_rx_pipe_tsc_, rx_prefetch_latency_cycles_);
+  last_rx_pipe_tsc_ = 0;
+  int64_t delta = (int64_t)batch_cycles - (int64_t)avg_rx_batch_cycles_;
+  avg_rx_batch_cycles_ += delta / 8;
+
+  uint64_t avg_rx_batch_cycles = std::max<uint64_t>(avg_rx_batch_cycles_, 1);
+  uint64_t lookahead = (rx_prefetch_latency_cycles_ + avg_rx_batch_cycles / 2) /
+                       avg_rx_batch_cycles;
+  rx_prefetch_lookahead_ =
+      std::clamp<uint64_t>(lookahead, 1, kMaxRxPrefetchLookahead);
+}
+
+int Device::SetRxPrefetchLatency(uint64_t latency_cycles) {
+  if (latency_cycles == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rx_prefetch_latency_cycles_ = latency_cycles;
+  return 0;
+}
+
+void Device::PrefetchNextRxPipes() {
+  uint32_t next_rx_ids_head = notification_buf_pair_.next_rx_ids_head;
+  uint32_t nb_queued_ids =
+      (notification_buf_pair_.next_rx_ids_tail - next_rx_ids_head +
+       kNotificationBufSize) %
+      kNotificationBufSize;
+  uint32_t nb_ids = std::min(rx_prefetch_lookahead_, nb_queued_ids);
+
+  for (uint32_t i = nb_prefetched_rx_ids_; i < nb_ids; ++i) {
+    enso_pipe_id_t id = notification_buf_pair_.next_rx_pipe_ids
+                            [(next_rx_ids_head + i) % kNotificationBufSize];
+    RxPipe* rx_pipe = rx_pipes_map_[id];
+    if (rx_pipe == nullptr) {
+      continue;
+    }
+
+    // Ask the NIC for the latest tail and bring the next bytes to the cache.
+    RxEnsoPipeInternal& pipe = rx_pipe->internal_rx_pipe_;
+    rx_pipe->Prefetch();
+    _mm_prefetch(&pipe.buf[pipe.rx_tail * 16], _MM_HINT_T0);
+  }
+
+  nb_prefetched_rx_ids_ = std::max(nb_prefetched_rx_ids_, nb_ids);
+}
+
+int Device::SetRxSchedulingClass(uint32_t rx_enso_pipe_id, uint32_t sched_class,
+                                 uint32_t weight) {
+  if (sched_class >= kNbRxSchedulingClasses || weight == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (rx_scheduler_ == nullptr) {
+    rx_scheduler_ = new (std::nothrow) RxScheduler();
+    if (rx_scheduler_ == nullptr) {
+      errno = ENOMEM;
+      return -1;
+    }
+    UpdateNextRxPipeIdFn();
+  }
+
+  rx_scheduler_->SetClass(rx_enso_pipe_id, sched_class, weight);
+  return 0;
+}
+
+RxSchedulingStats Device::GetRxSchedulingStats(uint32_t sched_class) const {
+  if (rx_scheduler_ == nullptr || sched_class >= kNbRxSchedulingClasses) {
+    return {};
+  }
+  return rx_scheduler_->stats(sched_class);
 }
 
 int Device::Init() noexcept {
@@ -344,12 +998,21 @@ int Device::Init() noexcept {
   std::cerr << "Running with ENSO_PIPE_SIZE: " << kEnsoPipeSize << std::endl;
 
   int ret = notification_buf_init(bdf_, bar, &notification_buf_pair_,
-                                  huge_page_prefix_);
+                                  huge_page_prefix_, kNumaPolicy, core_id_);
   if (ret != 0) {
     // Could not initialize notification buffer.
     return 3;
   }
 
+  poll_policy_.mode = kDefaultPollMode;
+#ifndef LATENCY_OPT
+  // Keep RX head updates uncoalesced by default, as in previous versions. See
+  // `PollPolicy`.
+  poll_policy_.throughput.rx_head_min_bytes = 0;
+  poll_policy_.throughput.rx_head_max_cycles = 0;
+#endif  // LATENCY_OPT
+  ApplyPollProfile(kDefaultPollMode);
+
   return 0;
 }
 
@@ -363,12 +1026,65 @@ void Device::Send(uint32_t tx_enso_pipe_id, uint64_t phys_addr,
   // tracker currently used inside send_to_queue.
   send_to_queue(&notification_buf_pair_, phys_addr, nb_bytes);
 
+  AddPendingRequest(tx_enso_pipe_id, nb_bytes, false);
+}
+
+int Device::SendSegments(uint32_t tx_enso_pipe_id, const TxSegment* segments,
+                         uint32_t nb_segments) {
+  // Check every segment before sending any of them. A misaligned start would
+  // also split the segment at a page boundary into pieces that are not
+  // multiples of 64 bytes.
+  for (uint32_t i = 0; i < nb_segments; ++i) {
+    const TxSegment& segment = segments[i];
+    if (unlikely(segment.length == 0 ||
+                 (segment.length & (TxPipe::kQuantumSize - 1)) != 0 ||
+                 ((uint64_t)segment.buf & (TxPipe::kQuantumSize - 1)) != 0)) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  for (uint32_t i = 0; i < nb_segments; ++i) {
+    const TxSegment& segment = segments[i];
+
+    // Hugepages are only contiguous in device memory within a page, so a
+    // segment that crosses a page boundary is sent as one piece per page.
+    const uint8_t* buf = segment.buf;
+    uint32_t missing_bytes = segment.length;
+    while (missing_bytes > 0) {
+      uint32_t bytes_in_page =
+          kBufPageSize - ((uint64_t)buf & ((uint64_t)kBufPageSize - 1));
+      uint32_t nb_bytes = std::min(missing_bytes, bytes_in_page);
+      missing_bytes -= nb_bytes;
+
+      uint64_t phys_addr =
+          get_dev_addr_from_virt_addr(&notification_buf_pair_, (void*)buf);
+      send_segment_to_queue(&notification_buf_pair_, phys_addr, nb_bytes,
+                            i == nb_segments - 1 && missing_bytes == 0);
+      buf += nb_bytes;
+    }
+  }
+
+  AddPendingRequest(tx_enso_pipe_id, 0, true);
+
+  return 0;
+}
+
+void Device::Drop(uint32_t tx_enso_pipe_id, uint32_t nb_bytes) {
+  AddPendingRequest(tx_enso_pipe_id, nb_bytes, false, true);
+}
+
+void Device::AddPendingRequest(uint32_t tx_enso_pipe_id, uint32_t nb_bytes,
+                               bool segments, bool dropped) {
   uint32_t nb_pending_requests =
       (tx_pr_tail_ - tx_pr_head_) & kPendingTxRequestsBufMask;
 
   // This will block until there is enough space to keep at least two requests.
   // We need space for two requests because the request may be split into two
   // if the bytes wrap around the end of the buffer.
+  if (unlikely(nb_pending_requests >= (kMaxPendingTxRequests - 2))) {
+    FlushTx();
+  }
   while (unlikely(nb_pending_requests >= (kMaxPendingTxRequests - 2))) {
     ProcessCompletions();
     nb_pending_requests =
@@ -377,17 +1093,64 @@ void Device::Send(uint32_t tx_enso_pipe_id, uint64_t phys_addr,
 
   tx_pending_requests_[tx_pr_tail_].pipe_id = tx_enso_pipe_id;
   tx_pending_requests_[tx_pr_tail_].nb_bytes = nb_bytes;
+  tx_pending_requests_[tx_pr_tail_].segments = segments;
+  tx_pending_requests_[tx_pr_tail_].dropped = dropped;
   tx_pr_tail_ = (tx_pr_tail_ + 1) & kPendingTxRequestsBufMask;
 }
 
+int Device::TrySend(uint32_t tx_enso_pipe_id, uint64_t phys_addr,
+                    uint32_t nb_bytes) {
+  uint32_t nb_pending_requests =
+      (tx_pr_tail_ - tx_pr_head_) & kPendingTxRequestsBufMask;
+
+  // Same as in `Send()`, we need space to keep at least two requests.
+  if (unlikely(nb_pending_requests >= (kMaxPendingTxRequests - 2))) {
+    FlushTx();
+    ProcessCompletions();
+    nb_pending_requests =
+        (tx_pr_tail_ - tx_pr_head_) & kPendingTxRequestsBufMask;
+    if (nb_pending_requests >= (kMaxPendingTxRequests - 2)) {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+
+  if (unlikely(try_send_to_queue(&notification_buf_pair_, phys_addr,
+                                 nb_bytes))) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  tx_pending_requests_[tx_pr_tail_].pipe_id = tx_enso_pipe_id;
+  tx_pending_requests_[tx_pr_tail_].nb_bytes = nb_bytes;
+  tx_pending_requests_[tx_pr_tail_].segments = false;
+  tx_pending_requests_[tx_pr_tail_].dropped = false;
+  tx_pr_tail_ = (tx_pr_tail_ + 1) & kPendingTxRequestsBufMask;
+
+  return 0;
+}
+
 void Device::ProcessCompletions() {
   uint32_t tx_completions = get_unreported_completions(&notification_buf_pair_);
-  for (uint32_t i = 0; i < tx_completions; ++i) {
+  while (tx_pr_head_ != tx_pr_tail_) {
     TxPendingRequest tx_req = tx_pending_requests_[tx_pr_head_];
+
+    // Dropped requests have no notification in the device. They complete as
+    // soon as all the requests before them complete.
+    if (likely(!tx_req.dropped)) {
+      if (tx_completions == 0) {
+        break;
+      }
+      --tx_completions;
+    }
     tx_pr_head_ = (tx_pr_head_ + 1) & kPendingTxRequestsBufMask;
 
     TxPipe* pipe = tx_pipes_[tx_req.pipe_id];
-    pipe->NotifyCompletion(tx_req.nb_bytes);
+    if (unlikely(tx_req.segments)) {
+      pipe->NotifySegmentsCompletion();
+    } else {
+      pipe->NotifyCompletion(tx_req.nb_bytes);
+    }
   }
 
   // RxTx pipes need to be explicitly notified so that they can free space for
@@ -397,6 +1160,86 @@ void Device::ProcessCompletions() {
   }
 }
 
+void Device::SetRxHeadCoalescing(uint32_t min_bytes, uint64_t max_cycles) {
+  rx_head_coalescing_set_ = true;
+  UpdateRxHeadCoalescing(min_bytes, max_cycles);
+}
+
+void Device::UpdateRxHeadCoalescing(uint32_t min_bytes, uint64_t max_cycles) {
+  notification_buf_pair_.rx_head_update_flits = (min_bytes + 63) / 64;
+  notification_buf_pair_.rx_head_update_cycles = max_cycles;
+  for (RxPipe* pipe : rx_pipes_) {
+    set_pipe_head_coalescing(&pipe->internal_rx_pipe_, min_bytes, max_cycles);
+  }
+}
+
+void Device::FlushRxHeads() {
+  for (RxPipe* pipe : rx_pipes_) {
+    pipe->FlushHead();
+  }
+}
+
+RxHeadStats Device::GetRxHeadStats() const {
+  RxHeadStats stats = {};
+  for (const RxPipe* pipe : rx_pipes_) {
+    stats.nb_head_writes += pipe->internal_rx_pipe_.nb_head_writes;
+    stats.nb_head_updates += pipe->internal_rx_pipe_.nb_head_updates;
+    stats.nb_pkts += pipe->nb_released_pkts_;
+  }
+  return stats;
+}
+
+int Device::ReserveHugePages(uint32_t nb_pages) {
+  return reserve_huge_pages(&notification_buf_pair_, nb_pages);
+}
+
+HugePagePoolStats Device::GetHugePagePoolStats() const {
+  const HugePagePool* pool = notification_buf_pair_.huge_page_pool;
+  HugePagePoolStats stats;
+  stats.nb_pages = pool->nb_pages();
+  stats.nb_free_pages = pool->nb_free_pages();
+  stats.nb_hits = pool->nb_hits();
+  stats.nb_misses = pool->nb_misses();
+  stats.nb_allocations = pool->nb_allocations();
+  stats.total_allocation_ns = pool->total_allocation_ns();
+  return stats;
+}
+
+NotificationStats Device::GetNotificationStats() const {
+  NotificationStats stats;
+  stats.batch_size = notification_buf_pair_.rx_notif_batch_size;
+  stats.nb_scans = notification_buf_pair_.nb_rx_notif_scans;
+  stats.nb_empty_scans = notification_buf_pair_.nb_empty_rx_notif_scans;
+  stats.nb_full_scans = notification_buf_pair_.nb_full_rx_notif_scans;
+  stats.nb_notifications = notification_buf_pair_.nb_rx_notifs;
+  return stats;
+}
+
+RxWaitStats Device::GetRxWaitStats() const {
+  RxWaitStats stats;
+  stats.nb_waits = notification_buf_pair_.nb_rx_waits;
+  stats.nb_sleeps = notification_buf_pair_.nb_rx_sleeps;
+  stats.nb_wakeups = notification_buf_pair_.nb_rx_wakeups;
+  stats.nb_timeouts = notification_buf_pair_.nb_rx_wait_timeouts;
+  return stats;
+}
+
+uint32_t Device::ConvertVirtAddrsToDevAddrs(void* const* bufs,
+                                            uint64_t* dev_addrs,
+                                            uint32_t nb_bufs) {
+  return get_dev_addrs_from_virt_addrs(&notification_buf_pair_, bufs,
+                                       dev_addrs, nb_bufs);
+}
+
+void Device::SetTxDoorbellCoalescing(uint32_t max_notifications,
+                                     uint32_t max_bytes) {
+  tx_doorbell_coalescing_set_ = true;
+  set_tx_doorbell_coalescing(&notification_buf_pair_, max_notifications,
+                             max_bytes);
+}
+
+void Device::FlushTx() { flush_tx(&notification_buf_pair_); }
+
 int Device::EnableTimeStamping() {
   return enable_timestamp(&notification_buf_pair_);
 }
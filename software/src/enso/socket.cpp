@@ -236,6 +236,53 @@ int disable_device_round_robin(int ref_sockfd) {
   return disable_round_robin(open_sockets[ref_sockfd].notification_buf_pair);
 }
 
+int reserve_device_huge_pages(int ref_sockfd, uint32_t nb_pages) {
+  if (nb_open_sockets == 0) {
+    return -2;
+  }
+  return reserve_huge_pages(open_sockets[ref_sockfd].notification_buf_pair,
+                            nb_pages);
+}
+
+int set_device_notification_batch(int ref_sockfd, uint16_t max_batch_size,
+                                  bool adaptive) {
+  if (nb_open_sockets == 0) {
+    return -2;
+  }
+  if (max_batch_size == 0 || max_batch_size > kNotificationBufSize) {
+    return -1;
+  }
+  set_notif_batch_size(open_sockets[ref_sockfd].notification_buf_pair,
+                       max_batch_size, adaptive);
+  return 0;
+}
+
+int wait_for_device_rx(int ref_sockfd, uint32_t busy_poll_us,
+                       int64_t timeout_us) {
+  if (nb_open_sockets == 0) {
+    return -2;
+  }
+  struct NotificationBufPair* notification_buf_pair =
+      open_sockets[ref_sockfd].notification_buf_pair;
+
+  // The NIC should not wait for us while we sleep.
+  flush_tx(notification_buf_pair);
+
+  // Pipes only hold back head updates if the notification buffer coalesces
+  // them, in which case we need to find the pipes of the open sockets.
+  if (notification_buf_pair->rx_head_update_flits != 0 ||
+      notification_buf_pair->rx_head_update_cycles != 0) {
+    for (struct SocketInternal& socket : open_sockets) {
+      if (socket.notification_buf_pair == notification_buf_pair &&
+          socket.enso_pipe.buf != nullptr) {
+        flush_pipe_head(&socket.enso_pipe);
+      }
+    }
+  }
+
+  return wait_for_rx(notification_buf_pair, busy_poll_us, timeout_us);
+}
+
 int shutdown(int sockfd, int how __attribute__((unused))) noexcept {
   dma_finish(&open_sockets[sockfd]);
 
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the `HugePagePool` class.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#include "huge_page_pool.h"
+
+#include <enso/consts.h>
+#include <enso/ixy_helpers.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+namespace enso {
+
+HugePagePool::~HugePagePool() {
+  for (auto& [addr, shared_page] : shared_pages_) {
+    if (shared_page.pool_index < 0) {
+      ReleaseSharedPage(shared_page);
+    }
+  }
+
+  for (uint32_t i = 0; i < pages_.size(); ++i) {
+    unmap_huge_page(pages_[i].buf, 0, true);
+    std::string path = kPathPrefix + std::to_string(i);
+    unlink(path.c_str());
+  }
+}
+
+int HugePagePool::Reserve(uint32_t nb_pages, int numa_node,
+                          const std::function<uint64_t(void*)>& to_dev_addr) {
+  pages_.reserve(pages_.size() + nb_pages);
+  free_pages_.reserve(free_pages_.size() + nb_pages);
+
+  for (uint32_t i = 0; i < nb_pages; ++i) {
+    uint32_t index = pages_.size();
+    std::string path = kPathPrefix + std::to_string(index);
+    uint8_t* buf = (uint8_t*)get_huge_page(path, 0, true, numa_node);
+    if (buf == nullptr) {
+      return -1;
+    }
+
+    pages_.push_back({buf, to_dev_addr(buf)});
+    free_pages_.push_back(index);
+    page_index_[buf] = index;
+  }
+
+  return 0;
+}
+
+bool HugePagePool::Get(Page* page) {
+  if (free_pages_.empty()) {
+    ++nb_misses_;
+    return false;
+  }
+
+  *page = pages_[free_pages_.back()];
+  free_pages_.pop_back();
+  ++nb_hits_;
+
+  return true;
+}
+
+bool HugePagePool::Put(const void* buf) {
+  auto it = page_index_.find(buf);
+  if (it == page_index_.end()) {
+    return false;
+  }
+
+  free_pages_.push_back(it->second);
+
+  return true;
+}
+
+int HugePagePool::GetSlot(uint32_t slot_size, int numa_node,
+                          const std::function<uint64_t(void*)>& to_dev_addr,
+                          Page* slot) {
+  std::vector<uintptr_t>& partial_pages = partial_pages_[slot_size];
+
+  if (partial_pages.empty()) {
+    SharedPage shared_page;
+    shared_page.slot_size = slot_size;
+    if (Get(&shared_page.page)) {
+      shared_page.pool_index = page_index_[shared_page.page.buf];
+    } else {
+      shared_page.pool_index = -1;
+      shared_page.path =
+          kPathPrefix + "shared:" + std::to_string(next_shared_page_id_++);
+      uint8_t* buf =
+          (uint8_t*)get_huge_page(shared_page.path, 0, false, numa_node);
+      if (buf == nullptr) {
+        return -1;
+      }
+      shared_page.page = {buf, to_dev_addr(buf)};
+    }
+
+    // Hand out slots from the start of the page first.
+    for (uint32_t offset = kBufPageSize; offset > 0; offset -= slot_size) {
+      shared_page.free_slots.push_back(offset - slot_size);
+    }
+
+    uintptr_t addr = (uintptr_t)shared_page.page.buf;
+    shared_pages_[addr] = std::move(shared_page);
+    partial_pages.push_back(addr);
+  }
+
+  SharedPage& shared_page = shared_pages_[partial_pages.back()];
+  uint32_t offset = shared_page.free_slots.back();
+  shared_page.free_slots.pop_back();
+  if (shared_page.free_slots.empty()) {
+    partial_pages.pop_back();
+  }
+
+  slot->buf = shared_page.page.buf + offset;
+  slot->dev_addr = shared_page.page.dev_addr + offset;
+
+  return 0;
+}
+
+bool HugePagePool::PutSlot(const void* buf) {
+  uintptr_t addr = (uintptr_t)buf & ~((uintptr_t)kBufPageSize - 1);
+  auto it = shared_pages_.find(addr);
+  if (it == shared_pages_.end()) {
+    return false;
+  }
+
+  SharedPage& shared_page = it->second;
+  std::vector<uintptr_t>& partial_pages = partial_pages_[shared_page.slot_size];
+  if (shared_page.free_slots.empty()) {
+    partial_pages.push_back(addr);
+  }
+  shared_page.free_slots.push_back((uintptr_t)buf - addr);
+
+  if (shared_page.free_slots.size() * shared_page.slot_size < kBufPageSize) {
+    return true;
+  }
+
+  // All slots are free, release the page.
+  partial_pages.erase(
+      std::find(partial_pages.begin(), partial_pages.end(), addr));
+  if (shared_page.pool_index < 0) {
+    ReleaseSharedPage(shared_page);
+  } else {
+    free_pages_.push_back(shared_page.pool_index);
+  }
+  shared_pages_.erase(it);
+
+  return true;
+}
+
+void HugePagePool::ReleaseSharedPage(const SharedPage& shared_page) {
+  unmap_huge_page(shared_page.page.buf);
+  unlink(shared_page.path.c_str());
+}
+
+}  // namespace enso
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Pool of pre-allocated huge pages used for pipe buffers.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#ifndef SOFTWARE_SRC_HUGE_PAGE_POOL_H_
+#define SOFTWARE_SRC_HUGE_PAGE_POOL_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace enso {
+
+/**
+ * @brief A pool of mirrored, pinned, 2MB huge pages.
+ *
+ * Allocating a pipe buffer requires creating a huge page file, mapping it twice
+ * and pinning it. The pool does this ahead of time so that pipes can be
+ * created and destroyed without going through the kernel. Pages are returned
+ * to the pool when the pipe is freed and remain mapped until the pool is
+ * destroyed.
+ *
+ * Pipes smaller than a page share pages, see `GetSlot()`.
+ *
+ * Not thread safe: must only be used by the thread that owns the device.
+ */
+class HugePagePool {
+ public:
+  /**
+   * @brief A page in the pool.
+   */
+  struct Page {
+    uint8_t* buf;
+    uint64_t dev_addr;
+  };
+
+  /**
+   * @param path_prefix Prefix of the files backing the pool's pages.
+   */
+  explicit HugePagePool(const std::string& path_prefix) noexcept
+      : kPathPrefix(path_prefix) {}
+
+  HugePagePool(const HugePagePool&) = delete;
+  HugePagePool& operator=(const HugePagePool&) = delete;
+  HugePagePool(HugePagePool&&) = delete;
+  HugePagePool& operator=(HugePagePool&&) = delete;
+
+  /**
+   * @brief Unmaps and removes all the pages, including those still in use.
+   */
+  ~HugePagePool();
+
+  /**
+   * @brief Adds pages to the pool.
+   *
+   * @param nb_pages Number of pages to add.
+   * @param numa_node NUMA node to place the pages on (-1 for any).
+   * @param to_dev_addr Function that translates a page address to an address
+   *                    that can be used by the device.
+   * @return 0 on success, -1 if any of the pages could not be allocated. Pages
+   *         allocated before the failure remain in the pool.
+   */
+  int Reserve(uint32_t nb_pages, int numa_node,
+              const std::function<uint64_t(void*)>& to_dev_addr);
+
+  /**
+   * @brief Takes a page from the pool.
+   *
+   * @param page Set to the page, if one is available.
+   * @return True if a page was available, false otherwise.
+   */
+  bool Get(Page* page);
+
+  /**
+   * @brief Returns a page to the pool.
+   *
+   * @param buf Address of the page.
+   * @return True if the page belongs to the pool, false otherwise. In which
+   *         case, the pool is left unchanged.
+   */
+  bool Put(const void* buf);
+
+  /**
+   * @brief Takes a slot from a page shared by slots of the same size.
+   *
+   * Slots are carved from a free page in the pool or, if there are none, from a
+   * newly allocated page. The page is released once all its slots are
+   * returned with `PutSlot()`.
+   *
+   * @param slot_size Size of the slot in bytes. Must be a power of two smaller
+   *                  than `kBufPageSize`.
+   * @param numa_node NUMA node to place new pages on (-1 for any).
+   * @param to_dev_addr Function that translates a page address to an address
+   *                    that can be used by the device.
+   * @param slot Set to the slot.
+   * @return 0 on success, -1 if a new page could not be allocated.
+   */
+  int GetSlot(uint32_t slot_size, int numa_node,
+              const std::function<uint64_t(void*)>& to_dev_addr, Page* slot);
+
+  /**
+   * @brief Returns a slot taken with `GetSlot()`.
+   *
+   * @param buf Address of the slot.
+   * @return True if the slot belongs to the pool, false otherwise.
+   */
+  bool PutSlot(const void* buf);
+
+  /**
+   * @brief Records the time it took to allocate a pipe buffer.
+   */
+  inline void RecordAllocation(uint64_t latency_ns) {
+    ++nb_allocations_;
+    total_allocation_ns_ += latency_ns;
+  }
+
+  inline uint32_t nb_pages() const { return pages_.size(); }
+  inline uint32_t nb_free_pages() const { return free_pages_.size(); }
+  inline uint64_t nb_hits() const { return nb_hits_; }
+  inline uint64_t nb_misses() const { return nb_misses_; }
+  inline uint64_t nb_allocations() const { return nb_allocations_; }
+  inline uint64_t total_allocation_ns() const { return total_allocation_ns_; }
+
+ private:
+  struct SharedPage {
+    Page page;
+    uint32_t slot_size;
+    int64_t pool_index;  // Index in `pages_` or -1 if allocated on demand.
+    std::string path;    // Only set for pages allocated on demand.
+    std::vector<uint32_t> free_slots;  // Offsets from the start of the page.
+  };
+
+  void ReleaseSharedPage(const SharedPage& shared_page);
+
+  const std::string kPathPrefix;
+
+  std::vector<Page> pages_;
+  std::vector<uint32_t> free_pages_;  // Indices in `pages_`.
+  std::unordered_map<const void*, uint32_t> page_index_;
+
+  // Pages split in slots, keyed by their address.
+  std::unordered_map<uintptr_t, SharedPage> shared_pages_;
+  // Shared pages with free slots, keyed by slot size.
+  std::unordered_map<uint32_t, std::vector<uintptr_t>> partial_pages_;
+  uint64_t next_shared_page_id_ = 0;
+
+  uint64_t nb_hits_ = 0;
+  uint64_t nb_misses_ = 0;
+  uint64_t nb_allocations_ = 0;
+  uint64_t total_allocation_ns_ = 0;
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_SRC_HUGE_PAGE_POOL_H_
@@ -44,23 +44,30 @@
 #include <enso/consts.h>
 #include <enso/helpers.h>
 #include <immintrin.h>
+#include <linux/magic.h>
+#include <poll.h>
 #include <sched.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <new>
 #include <stdexcept>
 
+#include "huge_page_pool.h"
+
 // Automatically points to the device backend configured at compile time.
 #include <dev_backend.h>
 
@@ -74,7 +81,8 @@ static _enso_always_inline void try_clflush([[maybe_unused]] void* addr) {
 
 int notification_buf_init(uint32_t bdf, int32_t bar,
                           struct NotificationBufPair* notification_buf_pair,
-                          const std::string& huge_page_prefix) {
+                          const std::string& huge_page_prefix,
+                          NumaPolicy numa_policy, int32_t core_id) {
   DevBackend* fpga_dev = DevBackend::Create(bdf, bar);
   if (unlikely(fpga_dev == nullptr)) {
     std::cerr << "Could not create device" << std::endl;
@@ -82,6 +90,21 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
   }
   notification_buf_pair->fpga_dev = fpga_dev;
 
+  switch (numa_policy) {
+    case NumaPolicy::kDevice:
+      notification_buf_pair->numa_node = fpga_dev->GetNumaNode();
+      break;
+    case NumaPolicy::kCore:
+      if (core_id < 0) {
+        core_id = sched_getcpu();
+      }
+      notification_buf_pair->numa_node = get_numa_node_from_core(core_id);
+      break;
+    default:
+      notification_buf_pair->numa_node = -1;
+      break;
+  }
+
   int notif_pipe_id = fpga_dev->AllocateNotifBuf();
 
   if (notif_pipe_id < 0) {
@@ -130,7 +153,8 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
 
   notification_buf_pair->regs = (struct QueueRegs*)notification_buf_pair_regs;
   notification_buf_pair->rx_buf =
-      (struct RxNotification*)get_huge_page(huge_page_path);
+      (struct RxNotification*)get_huge_page(huge_page_path, 0, false,
+                                            notification_buf_pair->numa_node);
   if (notification_buf_pair->rx_buf == NULL) {
     std::cerr << "Could not get huge page" << std::endl;
     return -1;
@@ -161,6 +185,31 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
       DevBackend::mmio_read32(notification_buf_pair->tx_tail_ptr);
 
   notification_buf_pair->tx_head = notification_buf_pair->tx_tail;
+  notification_buf_pair->tx_flushed_tail = notification_buf_pair->tx_tail;
+  notification_buf_pair->tx_unflushed_bytes = 0;
+
+  // By default, notify the NIC about every transmission.
+  notification_buf_pair->tx_doorbell_notifs = 1;
+  notification_buf_pair->tx_doorbell_bytes = UINT32_MAX;
+
+  // By default, write the head of RX pipes every time they are advanced.
+  notification_buf_pair->rx_head_update_flits = 0;
+  notification_buf_pair->rx_head_update_cycles = 0;
+
+  notification_buf_pair->rx_notif_batch_size = kBatchSize;
+  notification_buf_pair->rx_notif_max_batch_size = kBatchSize;
+  notification_buf_pair->rx_notif_adaptive_batch = false;
+  notification_buf_pair->rx_notif_window_scans = 0;
+  notification_buf_pair->rx_notif_window_empty_scans = 0;
+  notification_buf_pair->nb_rx_notif_scans = 0;
+  notification_buf_pair->nb_empty_rx_notif_scans = 0;
+  notification_buf_pair->nb_full_rx_notif_scans = 0;
+  notification_buf_pair->nb_rx_notifs = 0;
+
+  notification_buf_pair->nb_rx_waits = 0;
+  notification_buf_pair->nb_rx_sleeps = 0;
+  notification_buf_pair->nb_rx_wakeups = 0;
+  notification_buf_pair->nb_rx_wait_timeouts = 0;
 
   DevBackend::mmio_write32(&notification_buf_pair_regs->tx_head,
                            notification_buf_pair->tx_head);
@@ -188,12 +237,28 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
     return -1;
   }
 
+  notification_buf_pair->queued_rx_pipes =
+      (uint64_t*)calloc((kMaxNbFlows + 63) / 64, sizeof(uint64_t));
+  if (notification_buf_pair->queued_rx_pipes == NULL) {
+    std::cerr << "Could not allocate memory" << std::endl;
+    return -1;
+  }
+
   notification_buf_pair->next_rx_ids_head = 0;
   notification_buf_pair->next_rx_ids_tail = 0;
   notification_buf_pair->tx_full_cnt = 0;
   notification_buf_pair->nb_unreported_completions = 0;
   notification_buf_pair->huge_page_prefix = huge_page_prefix;
 
+  // The pool starts empty, see `reserve_huge_pages`.
+  notification_buf_pair->huge_page_pool = new (std::nothrow)
+      HugePagePool(huge_page_prefix + std::string(kHugePagePoolPathPrefix) +
+                   std::to_string(notification_buf_pair->id) + ":");
+  if (notification_buf_pair->huge_page_pool == nullptr) {
+    std::cerr << "Could not allocate memory" << std::endl;
+    return -1;
+  }
+
   // Setting the address enables the queue. Do this last.
   // Use first half of the huge page for RX and second half for TX.
   DevBackend::mmio_write32(&notification_buf_pair_regs->rx_mem_low,
@@ -211,13 +276,70 @@ int notification_buf_init(uint32_t bdf, int32_t bar,
   return 0;
 }
 
+// Pipes that cannot be mirrored need room to copy the bytes that wrap around.
+static uint32_t get_rx_pipe_buf_size(uint32_t size) {
+  uint32_t nb_bytes = size * 64;
+  if (nb_bytes < kBufPageSize) {
+    nb_bytes *= 2;
+  }
+  return nb_bytes;
+}
+
+// Pipes larger than a 2MB huge page are only physically contiguous if they fill
+// a larger huge page. We use 1GB pages for those, keeping the file name from
+// the device's prefix so that devices with different prefixes do not collide.
+// Returns an empty string if the pipe cannot be physically contiguous.
+static std::string get_rx_pipe_huge_page_prefix(
+    struct NotificationBufPair* notification_buf_pair, uint32_t nb_bytes) {
+  const std::string& dev_prefix = notification_buf_pair->huge_page_prefix;
+  if (nb_bytes <= kBufPageSize) {
+    return dev_prefix;
+  }
+
+  std::string prefix(kHugePage1GDefaultPrefix);
+  std::string dir = prefix.substr(0, prefix.rfind('/'));
+  struct statfs fs;
+  if (statfs(dir.c_str(), &fs) != 0 || fs.f_type != HUGETLBFS_MAGIC ||
+      nb_bytes % fs.f_bsize != 0) {
+    return "";
+  }
+
+  size_t name_start = dev_prefix.rfind('/');
+  if (name_start == std::string::npos) {
+    return dir + "/" + dev_prefix;
+  }
+  return dir + dev_prefix.substr(name_start);
+}
+
+bool is_pipe_size_supported(struct NotificationBufPair* notification_buf_pair,
+                            uint32_t size) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+
+  return size >= kMinEnsoPipeSize && size <= kMaxEnsoPipeSize &&
+         (size & (size - 1)) == 0 && fpga_dev->IsPipeSizeSupported(size) &&
+         !get_rx_pipe_huge_page_prefix(notification_buf_pair,
+                                       get_rx_pipe_buf_size(size))
+              .empty();
+}
+
 int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
                    struct NotificationBufPair* notification_buf_pair,
-                   bool fallback) {
+                   bool fallback, uint32_t size) {
   void* uio_mmap_bar2_addr = notification_buf_pair->uio_mmap_bar2_addr;
   DevBackend* fpga_dev =
       static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
 
+  if (!is_pipe_size_supported(notification_buf_pair, size)) {
+    std::cerr << "Unsupported pipe size: " << size << std::endl;
+    errno = EINVAL;
+    return -1;
+  }
+
+  uint32_t nb_bytes = get_rx_pipe_buf_size(size);
+  std::string huge_page_prefix =
+      get_rx_pipe_huge_page_prefix(notification_buf_pair, nb_bytes);
+
   int enso_pipe_id = fpga_dev->AllocatePipe(fallback);
 
   if (enso_pipe_id < 0) {
@@ -245,16 +367,18 @@ int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
   DevBackend::mmio_write32(&enso_pipe_regs->rx_head, 0);
   while (DevBackend::mmio_read32(&enso_pipe_regs->rx_head) != 0) continue;
 
-  std::string huge_page_path = notification_buf_pair->huge_page_prefix +
+  enso_pipe->huge_page_prefix = huge_page_prefix;
+  std::string huge_page_path = enso_pipe->huge_page_prefix +
                                std::string(kHugePageRxPipePathPrefix) +
                                std::to_string(enso_pipe_id);
 
-  enso_pipe->buf = (uint32_t*)get_huge_page(huge_page_path, 0, true);
+  uint64_t phys_addr;
+  enso_pipe->buf = (uint32_t*)alloc_pipe_buf(
+      notification_buf_pair, huge_page_path, &phys_addr, nb_bytes);
   if (enso_pipe->buf == NULL) {
     std::cerr << "Could not get huge page" << std::endl;
     return -1;
   }
-  uint64_t phys_addr = fpga_dev->ConvertVirtAddrToDevAddr(enso_pipe->buf);
 
   enso_pipe->buf_phys_addr = phys_addr;
   enso_pipe->phys_buf_offset = phys_addr - (uint64_t)(enso_pipe->buf);
@@ -263,12 +387,22 @@ int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
   enso_pipe->buf_head_ptr = (uint32_t*)&enso_pipe_regs->rx_head;
   enso_pipe->rx_head = 0;
   enso_pipe->rx_tail = 0;
-  enso_pipe->huge_page_prefix = notification_buf_pair->huge_page_prefix;
+  enso_pipe->size = size;
+  enso_pipe->rx_flushed_head = 0;
+  enso_pipe->head_update_flits = notification_buf_pair->rx_head_update_flits;
+  enso_pipe->head_update_cycles = notification_buf_pair->rx_head_update_cycles;
+  enso_pipe->last_head_write_tsc = 0;
+  enso_pipe->nb_head_writes = 0;
+  enso_pipe->nb_head_updates = 0;
 
   // Make sure the last tail matches the current head.
   notification_buf_pair->pending_rx_pipe_tails[enso_pipe->id] =
       enso_pipe->rx_head;
 
+  if (size != kEnsoPipeSize) {
+    DevBackend::mmio_write32(&enso_pipe_regs->rx_size, size);
+  }
+
   // Setting the address enables the queue. Do this last.
   // The least significant bits in rx_mem_low are used to keep the notification
   // buffer ID. Therefore we add `notification_buf_pair->id` to the address.
@@ -308,6 +442,52 @@ int dma_init(struct NotificationBufPair* notification_buf_pair,
   return enso_pipe_init(enso_pipe, notification_buf_pair, fallback);
 }
 
+// Adjusts the number of notifications consumed at once with AIMD. A scan that
+// fills the batch means that notifications arrive faster than we consume them,
+// so the batch grows additively. Windows with mostly empty scans mean that the
+// load is low, so the batch shrinks multiplicatively, letting the application
+// start processing the first pipes of a burst sooner. Windows are measured in
+// scans rather than time, which would require reading the TSC on every scan.
+static _enso_always_inline void __update_notif_batch_size(
+    struct NotificationBufPair* notification_buf_pair,
+    uint16_t nb_consumed_notifications) {
+  uint16_t batch_size = notification_buf_pair->rx_notif_batch_size;
+  bool empty = nb_consumed_notifications == 0;
+  bool full = nb_consumed_notifications == batch_size;
+
+#ifdef ENSO_STATS
+  ++notification_buf_pair->nb_rx_notif_scans;
+  notification_buf_pair->nb_empty_rx_notif_scans += empty;
+  notification_buf_pair->nb_full_rx_notif_scans += full;
+  notification_buf_pair->nb_rx_notifs += nb_consumed_notifications;
+#endif  // ENSO_STATS
+
+  if (!notification_buf_pair->rx_notif_adaptive_batch) {
+    return;
+  }
+
+  if (full) {
+    notification_buf_pair->rx_notif_batch_size =
+        std::min<uint32_t>(batch_size + kNotifBatchSizeStep,
+                           notification_buf_pair->rx_notif_max_batch_size);
+  }
+
+  notification_buf_pair->rx_notif_window_empty_scans += empty;
+  if (++notification_buf_pair->rx_notif_window_scans < kNotifBatchWindow) {
+    return;
+  }
+
+  if (notification_buf_pair->rx_notif_window_empty_scans * 2 >=
+      kNotifBatchWindow) {
+    notification_buf_pair->rx_notif_batch_size = std::max<uint16_t>(
+        notification_buf_pair->rx_notif_batch_size / 2,
+        std::min(kMinNotifBatchSize,
+                 notification_buf_pair->rx_notif_max_batch_size));
+  }
+  notification_buf_pair->rx_notif_window_scans = 0;
+  notification_buf_pair->rx_notif_window_empty_scans = 0;
+}
+
 static _enso_always_inline uint16_t
 __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
   struct RxNotification* notification_buf = notification_buf_pair->rx_buf;
@@ -315,8 +495,9 @@ __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
   uint16_t nb_consumed_notifications = 0;
 
   uint16_t next_rx_ids_tail = notification_buf_pair->next_rx_ids_tail;
+  uint16_t batch_size = notification_buf_pair->rx_notif_batch_size;
 
-  for (uint16_t i = 0; i < kBatchSize; ++i) {
+  for (uint16_t i = 0; i < batch_size; ++i) {
     struct RxNotification* cur_notification =
         notification_buf + notification_buf_head;
 
@@ -332,14 +513,24 @@ __get_new_tails(struct NotificationBufPair* notification_buf_pair) {
     notification_buf_pair->pending_rx_pipe_tails[enso_pipe_id] =
         (uint32_t)cur_notification->tail;
 
-    notification_buf_pair->next_rx_pipe_ids[next_rx_ids_tail] = enso_pipe_id;
-    next_rx_ids_tail = (next_rx_ids_tail + 1) % kNotificationBufSize;
+    // Pipes that are already queued will see the new tail when they are
+    // dequeued, so they are only queued once.
+    uint64_t* queued_word =
+        &notification_buf_pair->queued_rx_pipes[enso_pipe_id / 64];
+    uint64_t queued_mask = 1ULL << (enso_pipe_id % 64);
+    if (!(*queued_word & queued_mask)) {
+      *queued_word |= queued_mask;
+      notification_buf_pair->next_rx_pipe_ids[next_rx_ids_tail] = enso_pipe_id;
+      next_rx_ids_tail = (next_rx_ids_tail + 1) % kNotificationBufSize;
+    }
 
     ++nb_consumed_notifications;
   }
 
   notification_buf_pair->next_rx_ids_tail = next_rx_ids_tail;
 
+  __update_notif_batch_size(notification_buf_pair, nb_consumed_notifications);
+
   if (likely(nb_consumed_notifications > 0)) {
     // Update notification buffer head.
     DevBackend::mmio_write32(notification_buf_pair->rx_head_ptr,
@@ -360,6 +551,7 @@ __consume_queue(struct RxEnsoPipeInternal* enso_pipe,
                 bool peek = false) {
   uint32_t* enso_pipe_buf = enso_pipe->buf;
   uint32_t enso_pipe_head = enso_pipe->rx_tail;
+  uint32_t enso_pipe_size = enso_pipe->size;
   int queue_id = enso_pipe->id;
 
   *buf = &enso_pipe_buf[enso_pipe_head * 16];
@@ -371,11 +563,20 @@ __consume_queue(struct RxEnsoPipeInternal* enso_pipe,
     return 0;
   }
 
-  uint32_t flit_aligned_size =
-      ((enso_pipe_tail - enso_pipe_head) % ENSO_PIPE_SIZE) * 64;
+  uint32_t nb_flits = (enso_pipe_tail - enso_pipe_head) & (enso_pipe_size - 1);
+  uint32_t flit_aligned_size = nb_flits * 64;
+
+  // Pipes smaller than a huge page are not mirrored, instead, we copy the
+  // bytes that wrapped around to the space that follows the pipe.
+  if (unlikely(enso_pipe_head + nb_flits > enso_pipe_size) &&
+      enso_pipe_size * 64 < kBufPageSize) {
+    uint32_t nb_wrapped_flits = enso_pipe_head + nb_flits - enso_pipe_size;
+    memcpy(&enso_pipe_buf[enso_pipe_size * 16], enso_pipe_buf,
+           nb_wrapped_flits * 64);
+  }
 
   if (!peek) {
-    enso_pipe_head = (enso_pipe_head + flit_aligned_size / 64) % ENSO_PIPE_SIZE;
+    enso_pipe_head = (enso_pipe_head + nb_flits) & (enso_pipe_size - 1);
     enso_pipe->rx_tail = enso_pipe_head;
   }
 
@@ -413,6 +614,7 @@ __get_next_enso_pipe_id(struct NotificationBufPair* notification_buf_pair) {
 
   enso_pipe_id_t enso_pipe_id =
       notification_buf_pair->next_rx_pipe_ids[next_rx_ids_head];
+  dequeue_rx_pipe(notification_buf_pair, enso_pipe_id);
 
   notification_buf_pair->next_rx_ids_head =
       (next_rx_ids_head + 1) % kNotificationBufSize;
@@ -440,30 +642,347 @@ uint32_t get_next_batch(struct NotificationBufPair* notification_buf_pair,
   struct SocketInternal* socket_entry = &socket_entries[__enso_pipe_id];
   struct RxEnsoPipeInternal* enso_pipe = &socket_entry->enso_pipe;
 
+  // The socket may have been shut down after the NIC notified its pipe.
+  if (unlikely(enso_pipe->buf == nullptr)) {
+    return 0;
+  }
+
   return __consume_queue(enso_pipe, notification_buf_pair, buf);
 }
 
+static _enso_always_inline void __write_pipe_head(
+    struct RxEnsoPipeInternal* enso_pipe) {
+  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_head);
+  enso_pipe->rx_flushed_head = enso_pipe->rx_head;
+  ++enso_pipe->nb_head_writes;
+  if (enso_pipe->head_update_cycles != 0) {
+    enso_pipe->last_head_write_tsc = __rdtsc();
+  }
+}
+
+static _enso_always_inline void __update_pipe_head(
+    struct RxEnsoPipeInternal* enso_pipe) {
+  ++enso_pipe->nb_head_updates;
+
+  uint32_t nb_unflushed_flits =
+      (enso_pipe->rx_head - enso_pipe->rx_flushed_head) & (enso_pipe->size - 1);
+
+  if (nb_unflushed_flits >= enso_pipe->head_update_flits) {
+    __write_pipe_head(enso_pipe);
+    return;
+  }
+
+  if (enso_pipe->head_update_cycles != 0 &&
+      (__rdtsc() - enso_pipe->last_head_write_tsc) >=
+          enso_pipe->head_update_cycles) {
+    __write_pipe_head(enso_pipe);
+  }
+}
+
+// Sets (or clears) the bits in `[first, last)` of a released flits bitmap.
+static void __set_released_flits(uint64_t* bitmap, uint32_t first,
+                                 uint32_t last, bool value) {
+  while (first < last) {
+    uint32_t bit = first % 64;
+    uint32_t nb_bits = std::min(64 - bit, last - first);
+    uint64_t mask = (nb_bits == 64) ? ~0ULL : ((1ULL << nb_bits) - 1) << bit;
+    if (value) {
+      bitmap[first / 64] |= mask;
+    } else {
+      bitmap[first / 64] &= ~mask;
+    }
+    first += nb_bits;
+  }
+}
+
+// Same as `__set_released_flits` but the range may wrap around the pipe.
+static void __set_released_flits_wrap(struct RxEnsoPipeInternal* enso_pipe,
+                                      uint32_t first, uint32_t nb_flits,
+                                      bool value) {
+  uint32_t last = first + nb_flits;
+  if (last <= enso_pipe->size) {
+    __set_released_flits(enso_pipe->released_flits, first, last, value);
+  } else {
+    __set_released_flits(enso_pipe->released_flits, first, enso_pipe->size,
+                         value);
+    __set_released_flits(enso_pipe->released_flits, 0, last - enso_pipe->size,
+                         value);
+  }
+}
+
+// Clears the run of released flits that starts at the head and returns its
+// length. Looks at up to 64 flits at a time.
+static uint32_t __pop_released_flits(struct RxEnsoPipeInternal* enso_pipe) {
+  uint64_t* bitmap = enso_pipe->released_flits;
+  uint32_t head = enso_pipe->rx_head;
+  uint32_t nb_flits = 0;
+
+  while (nb_flits < enso_pipe->size) {
+    uint32_t pos = (head + nb_flits) & (enso_pipe->size - 1);
+    uint32_t bit = pos % 64;
+    uint64_t word = bitmap[pos / 64] >> bit;
+    uint32_t nb_ones = (~word == 0) ? 64 : __builtin_ctzll(~word);
+    nb_ones = std::min(nb_ones, 64 - bit);
+    if (nb_ones == 0) {
+      break;
+    }
+    __set_released_flits(bitmap, pos, pos + nb_ones, false);
+    nb_flits += nb_ones;
+    if (bit + nb_ones < 64) {
+      break;
+    }
+  }
+
+  return nb_flits;
+}
+
+// Marks `nb_flits` flits starting at `first` as released and advances the head
+// past all the released flits that are no longer blocked.
+static void __release_flits(struct RxEnsoPipeInternal* enso_pipe,
+                            uint32_t first, uint32_t nb_flits) {
+  __set_released_flits_wrap(enso_pipe, first, nb_flits, true);
+  enso_pipe->nb_released_flits += nb_flits;
+  ++enso_pipe->nb_releases;
+
+  if (first != enso_pipe->rx_head) {
+    ++enso_pipe->nb_out_of_order_releases;
+    return;
+  }
+
+  uint32_t nb_popped_flits = __pop_released_flits(enso_pipe);
+  enso_pipe->nb_released_flits -= nb_popped_flits;
+  enso_pipe->rx_head =
+      (enso_pipe->rx_head + nb_popped_flits) & (enso_pipe->size - 1);
+  __update_pipe_head(enso_pipe);
+}
+
 void advance_pipe(struct RxEnsoPipeInternal* enso_pipe, size_t len) {
   uint32_t rx_pkt_head = enso_pipe->rx_head;
   uint32_t nb_flits = ((uint64_t)len - 1) / 64 + 1;
-  rx_pkt_head = (rx_pkt_head + nb_flits) % ENSO_PIPE_SIZE;
 
-  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, rx_pkt_head);
+  if (unlikely(enso_pipe->released_flits != nullptr)) {
+    __release_flits(enso_pipe, rx_pkt_head, nb_flits);
+    return;
+  }
+
+  rx_pkt_head = (rx_pkt_head + nb_flits) & (enso_pipe->size - 1);
+
   enso_pipe->rx_head = rx_pkt_head;
+  __update_pipe_head(enso_pipe);
 }
 
 void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe) {
-  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_tail);
+  if (unlikely(enso_pipe->released_flits != nullptr)) {
+    uint32_t nb_flits =
+        (enso_pipe->rx_tail - enso_pipe->rx_head) & (enso_pipe->size - 1);
+    __set_released_flits_wrap(enso_pipe, enso_pipe->rx_head, nb_flits, false);
+    enso_pipe->nb_released_flits = 0;
+  }
+
   enso_pipe->rx_head = enso_pipe->rx_tail;
+  __update_pipe_head(enso_pipe);
+}
+
+int enable_pipe_release_tracking(struct RxEnsoPipeInternal* enso_pipe) {
+  if (enso_pipe->released_flits != nullptr) {
+    return 0;
+  }
+
+  // Pipe sizes are powers of two of at least `kMinEnsoPipeSize` flits.
+  uint32_t nb_words = enso_pipe->size / 64;
+  enso_pipe->released_flits = new (std::nothrow) uint64_t[nb_words]();
+  if (enso_pipe->released_flits == nullptr) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  enso_pipe->nb_released_flits = 0;
+  enso_pipe->nb_releases = 0;
+  enso_pipe->nb_out_of_order_releases = 0;
+
+  return 0;
+}
+
+void release_pipe_region(struct RxEnsoPipeInternal* enso_pipe, const void* addr,
+                         size_t len) {
+  assert(enso_pipe->released_flits != nullptr);
+
+  // The address may be past the end of the pipe when the region wraps around.
+  uint64_t offset = (const uint8_t*)addr - (const uint8_t*)enso_pipe->buf;
+  uint32_t first = (offset / 64) & (enso_pipe->size - 1);
+  uint32_t nb_flits = ((uint64_t)len - 1) / 64 + 1;
+
+  __release_flits(enso_pipe, first, nb_flits);
+}
+
+void set_notif_batch_size(struct NotificationBufPair* notification_buf_pair,
+                          uint16_t max_batch_size, bool adaptive) {
+  notification_buf_pair->rx_notif_max_batch_size = max_batch_size;
+  notification_buf_pair->rx_notif_adaptive_batch = adaptive;
+  notification_buf_pair->rx_notif_window_scans = 0;
+  notification_buf_pair->rx_notif_window_empty_scans = 0;
+
+  // Adaptive batches start from the default size.
+  notification_buf_pair->rx_notif_batch_size =
+      adaptive ? std::min<uint16_t>(max_batch_size, kBatchSize)
+               : max_batch_size;
+}
+
+static _enso_always_inline bool __has_pending_rx(
+    struct NotificationBufPair* notification_buf_pair) {
+  if (notification_buf_pair->next_rx_ids_head !=
+      notification_buf_pair->next_rx_ids_tail) {
+    return true;
+  }
+  volatile struct RxNotification* next_notification =
+      notification_buf_pair->rx_buf + notification_buf_pair->rx_head;
+  return next_notification->signal != 0;
+}
+
+bool has_pending_rx(struct NotificationBufPair* notification_buf_pair) {
+  return __has_pending_rx(notification_buf_pair);
+}
+
+int get_rx_wakeup_fd(struct NotificationBufPair* notification_buf_pair) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+  return fpga_dev->GetRxWakeupFd(notification_buf_pair->id);
+}
+
+int arm_rx_wakeup(struct NotificationBufPair* notification_buf_pair) {
+  int fd = get_rx_wakeup_fd(notification_buf_pair);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // Consume previous wakeups, which may be stale.
+  uint64_t buf[8];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+
+  // The NIC interrupts as long as there are notifications after the head, so
+  // notifications that arrive before the NIC sees this are not missed.
+  DevBackend::mmio_write32(&notification_buf_pair->regs->rx_intr_arm, 1);
+
+  return __has_pending_rx(notification_buf_pair);
+}
+
+int wait_for_rx(struct NotificationBufPair* notification_buf_pair,
+                uint32_t busy_poll_us, int64_t timeout_us) {
+  using clock = std::chrono::steady_clock;
+
+#ifdef ENSO_STATS
+  ++notification_buf_pair->nb_rx_waits;
+#endif  // ENSO_STATS
+
+  // Without wakeups, we could only wait indefinitely by busy polling forever.
+  int fd = get_rx_wakeup_fd(notification_buf_pair);
+  if (fd < 0 && (errno != ENOTSUP || timeout_us < 0)) {
+    return -1;
+  }
+
+  clock::time_point now = clock::now();
+  clock::time_point deadline = clock::time_point::max();
+  if (timeout_us >= 0) {
+    deadline = now + std::chrono::microseconds(timeout_us);
+  }
+  clock::time_point busy_poll_deadline =
+      std::min(deadline, now + std::chrono::microseconds(busy_poll_us));
+
+  // Busy poll first, the data may be about to arrive.
+  do {
+    if (__has_pending_rx(notification_buf_pair)) {
+      return 1;
+    }
+    _mm_pause();
+  } while (clock::now() < busy_poll_deadline);
+
+  while (true) {
+    if (fd < 0) {
+      // The backend cannot wake us up, so we keep polling.
+      if (__has_pending_rx(notification_buf_pair)) {
+        return 1;
+      }
+      _mm_pause();
+    } else {
+      int pending = arm_rx_wakeup(notification_buf_pair);
+      if (pending != 0) {
+        return pending;
+      }
+
+      struct timespec timeout;
+      struct timespec* timeout_ptr = nullptr;
+      if (timeout_us >= 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline - clock::now());
+        int64_t remaining_ns = std::max<int64_t>(remaining.count(), 0);
+        timeout.tv_sec = remaining_ns / 1000000000;
+        timeout.tv_nsec = remaining_ns % 1000000000;
+        timeout_ptr = &timeout;
+      }
+
+      struct pollfd pfd = {fd, POLLIN, 0};
+#ifdef ENSO_STATS
+      ++notification_buf_pair->nb_rx_sleeps;
+#endif  // ENSO_STATS
+      int ret = ppoll(&pfd, 1, timeout_ptr, nullptr);
+      if (ret < 0) {
+        return -1;  // E.g., interrupted by a signal.
+      }
+      if (ret > 0) {
+#ifdef ENSO_STATS
+        ++notification_buf_pair->nb_rx_wakeups;
+#endif  // ENSO_STATS
+        if (__has_pending_rx(notification_buf_pair)) {
+          return 1;
+        }
+      }
+    }
+
+    if (clock::now() >= deadline) {
+#ifdef ENSO_STATS
+      ++notification_buf_pair->nb_rx_wait_timeouts;
+#endif  // ENSO_STATS
+      return 0;
+    }
+  }
 }
 
 void prefetch_pipe(struct RxEnsoPipeInternal* enso_pipe) {
-  DevBackend::mmio_write32(enso_pipe->buf_head_ptr, enso_pipe->rx_head);
+  __write_pipe_head(enso_pipe);
+}
+
+void flush_pipe_head(struct RxEnsoPipeInternal* enso_pipe) {
+  if (enso_pipe->rx_head != enso_pipe->rx_flushed_head) {
+    __write_pipe_head(enso_pipe);
+  }
+}
+
+void set_pipe_head_coalescing(struct RxEnsoPipeInternal* enso_pipe,
+                              uint32_t min_bytes, uint64_t max_cycles) {
+  enso_pipe->head_update_flits = (min_bytes + 63) / 64;
+  enso_pipe->head_update_cycles = max_cycles;
+  flush_pipe_head(enso_pipe);
+
+  // The time budget starts now, not at the last write.
+  if (max_cycles != 0) {
+    enso_pipe->last_head_write_tsc = __rdtsc();
+  }
+}
+
+static _enso_always_inline void __flush_tx(
+    struct NotificationBufPair* notification_buf_pair) {
+  uint32_t tx_tail = notification_buf_pair->tx_tail;
+  if (tx_tail != notification_buf_pair->tx_flushed_tail) {
+    DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr, tx_tail);
+    notification_buf_pair->tx_flushed_tail = tx_tail;
+    notification_buf_pair->tx_unflushed_bytes = 0;
+  }
 }
 
 static _enso_always_inline uint32_t
 __send_to_queue(struct NotificationBufPair* notification_buf_pair,
-                uint64_t phys_addr, uint32_t len) {
+                uint64_t phys_addr, uint32_t len, bool last_segment = true) {
   struct TxNotification* tx_buf = notification_buf_pair->tx_buf;
   uint32_t tx_tail = notification_buf_pair->tx_tail;
   uint32_t missing_bytes = len;
@@ -478,11 +997,17 @@ __send_to_queue(struct NotificationBufPair* notification_buf_pair,
         (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
 
     // Block until we can send.
-    while (unlikely(free_slots == 0)) {
-      ++notification_buf_pair->tx_full_cnt;
-      update_tx_head(notification_buf_pair);
-      free_slots =
-          (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
+    if (unlikely(free_slots == 0)) {
+      // Let the NIC know about the notifications we already enqueued, it may
+      // need to consume them before it can free any slot.
+      notification_buf_pair->tx_tail = tx_tail;
+      __flush_tx(notification_buf_pair);
+      while (free_slots == 0) {
+        ++notification_buf_pair->tx_full_cnt;
+        update_tx_head(notification_buf_pair);
+        free_slots = (notification_buf_pair->tx_head - tx_tail - 1) %
+                     kNotificationBufSize;
+      }
     }
 
     struct TxNotification* tx_notification = tx_buf + tx_tail;
@@ -491,8 +1016,10 @@ __send_to_queue(struct NotificationBufPair* notification_buf_pair,
     req_length = std::min(req_length, missing_bytes_in_page);
 
     // If the transmission needs to be split among multiple requests, we
-    // need to set a bit in the wrap tracker.
-    uint8_t wrap_tracker_mask = (missing_bytes > req_length) << (tx_tail & 0x7);
+    // need to set a bit in the wrap tracker. The same is true if more segments
+    // follow, so that all segments signal a single completion.
+    bool more_requests = (missing_bytes > req_length) || !last_segment;
+    uint8_t wrap_tracker_mask = more_requests << (tx_tail & 0x7);
     notification_buf_pair->wrap_tracker[tx_tail / 8] |= wrap_tracker_mask;
 
     tx_notification->length = req_length;
@@ -507,7 +1034,20 @@ __send_to_queue(struct NotificationBufPair* notification_buf_pair,
   }
 
   notification_buf_pair->tx_tail = tx_tail;
-  DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr, tx_tail);
+  notification_buf_pair->tx_unflushed_bytes += len;
+
+  // Segments are only made visible to the NIC once the last one is enqueued.
+  // Notifications may also be held back to coalesce doorbells.
+  if (last_segment) {
+    uint32_t nb_unflushed_notifs =
+        (tx_tail - notification_buf_pair->tx_flushed_tail) %
+        kNotificationBufSize;
+    if (nb_unflushed_notifs >= notification_buf_pair->tx_doorbell_notifs ||
+        notification_buf_pair->tx_unflushed_bytes >=
+            notification_buf_pair->tx_doorbell_bytes) {
+      __flush_tx(notification_buf_pair);
+    }
+  }
 
   return len;
 }
@@ -517,6 +1057,62 @@ uint32_t send_to_queue(struct NotificationBufPair* notification_buf_pair,
   return __send_to_queue(notification_buf_pair, phys_addr, len);
 }
 
+uint32_t send_segment_to_queue(
+    struct NotificationBufPair* notification_buf_pair, uint64_t phys_addr,
+    uint32_t len, bool last_segment) {
+  return __send_to_queue(notification_buf_pair, phys_addr, len, last_segment);
+}
+
+int try_send_to_queue(struct NotificationBufPair* notification_buf_pair,
+                      uint64_t phys_addr, uint32_t len) {
+  // Count the notifications needed, splitting the transfer the same way as
+  // `__send_to_queue`.
+  uint32_t nb_notifications = 0;
+  uint32_t page_offset = phys_addr % kBufPageSize;
+  uint32_t missing_bytes = len;
+  while (missing_bytes > 0) {
+    uint32_t req_length = std::min(missing_bytes, (uint32_t)kMaxTransferLen);
+    req_length = std::min(req_length, (uint32_t)kBufPageSize - page_offset);
+    page_offset = (page_offset + req_length) % kBufPageSize;
+    missing_bytes -= req_length;
+    ++nb_notifications;
+  }
+
+  uint32_t tx_tail = notification_buf_pair->tx_tail;
+  uint32_t free_slots =
+      (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
+
+  if (unlikely(free_slots < nb_notifications)) {
+    update_tx_head(notification_buf_pair);
+    free_slots =
+        (notification_buf_pair->tx_head - tx_tail - 1) % kNotificationBufSize;
+    if (free_slots < nb_notifications) {
+      ++notification_buf_pair->tx_full_cnt;
+      // Make sure the NIC can make progress on what is already enqueued.
+      __flush_tx(notification_buf_pair);
+      return -1;
+    }
+  }
+
+  // There is enough space, so this will not block.
+  __send_to_queue(notification_buf_pair, phys_addr, len);
+
+  return 0;
+}
+
+void flush_tx(struct NotificationBufPair* notification_buf_pair) {
+  __flush_tx(notification_buf_pair);
+}
+
+void set_tx_doorbell_coalescing(
+    struct NotificationBufPair* notification_buf_pair, uint32_t max_notifs,
+    uint32_t max_bytes) {
+  notification_buf_pair->tx_doorbell_notifs = std::max(max_notifs, 1U);
+  notification_buf_pair->tx_doorbell_bytes =
+      (max_bytes == 0) ? UINT32_MAX : max_bytes;
+  __flush_tx(notification_buf_pair);
+}
+
 uint32_t get_unreported_completions(
     struct NotificationBufPair* notification_buf_pair) {
   uint32_t completions;
@@ -591,7 +1187,7 @@ int send_config(struct NotificationBufPair* notification_buf_pair,
 
   tx_tail = (tx_tail + 1) % kNotificationBufSize;
   notification_buf_pair->tx_tail = tx_tail;
-  DevBackend::mmio_write32(notification_buf_pair->tx_tail_ptr, tx_tail);
+  __flush_tx(notification_buf_pair);
 
   // Wait for request to be consumed.
   uint32_t nb_unreported_completions =
@@ -632,6 +1228,84 @@ uint64_t get_dev_addr_from_virt_addr(
   return dev_addr;
 }
 
+int reserve_huge_pages(struct NotificationBufPair* notification_buf_pair,
+                       uint32_t nb_pages) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+
+  return notification_buf_pair->huge_page_pool->Reserve(
+      nb_pages, notification_buf_pair->numa_node, [fpga_dev](void* buf) {
+        return fpga_dev->ConvertVirtAddrToDevAddr(buf);
+      });
+}
+
+void* alloc_pipe_buf(struct NotificationBufPair* notification_buf_pair,
+                     const std::string& path, uint64_t* dev_addr,
+                     uint32_t size) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+  HugePagePool* pool = notification_buf_pair->huge_page_pool;
+  auto start = std::chrono::steady_clock::now();
+
+  void* buf;
+  HugePagePool::Page page;
+  if (size < kBufPageSize) {
+    if (pool->GetSlot(size, notification_buf_pair->numa_node,
+                      [fpga_dev](void* buf) {
+                        return fpga_dev->ConvertVirtAddrToDevAddr(buf);
+                      },
+                      &page)) {
+      return nullptr;
+    }
+    buf = page.buf;
+    *dev_addr = page.dev_addr;
+  } else if (size == kBufPageSize && pool->Get(&page)) {
+    buf = page.buf;
+    *dev_addr = page.dev_addr;
+  } else {
+    buf = get_huge_page(path, size, true, notification_buf_pair->numa_node);
+    if (unlikely(buf == nullptr)) {
+      return nullptr;
+    }
+    *dev_addr = get_dev_addr_from_virt_addr(notification_buf_pair, buf);
+  }
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  pool->RecordAllocation(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+  return buf;
+}
+
+void free_pipe_buf(struct NotificationBufPair* notification_buf_pair,
+                   void* buf, const std::string& path, uint32_t size) {
+  HugePagePool* pool = notification_buf_pair->huge_page_pool;
+  if (size < kBufPageSize) {
+    pool->PutSlot(buf);
+    return;
+  }
+
+  if (size == kBufPageSize && pool->Put(buf)) {
+    return;
+  }
+
+  unmap_huge_page(buf, size, true);
+  unlink(path.c_str());
+}
+
+uint32_t get_dev_addrs_from_virt_addrs(
+    struct NotificationBufPair* notification_buf_pair, void* const* virt_addrs,
+    uint64_t* dev_addrs, uint32_t nb_addrs) {
+  DevBackend* fpga_dev =
+      static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
+  uint32_t nb_translated = 0;
+  for (uint32_t i = 0; i < nb_addrs; ++i) {
+    dev_addrs[i] = fpga_dev->ConvertVirtAddrToDevAddr(virt_addrs[i]);
+    nb_translated += (dev_addrs[i] != 0);
+  }
+  return nb_translated;
+}
+
 void notification_buf_free(struct NotificationBufPair* notification_buf_pair) {
   DevBackend* fpga_dev =
       static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
@@ -643,7 +1317,7 @@ void notification_buf_free(struct NotificationBufPair* notification_buf_pair) {
   DevBackend::mmio_write32(&notification_buf_pair->regs->tx_mem_low, 0);
   DevBackend::mmio_write32(&notification_buf_pair->regs->tx_mem_high, 0);
 
-  munmap(notification_buf_pair->rx_buf, kAlignedDscBufPairSize);
+  unmap_huge_page(notification_buf_pair->rx_buf);
 
   std::string huge_page_path = notification_buf_pair->huge_page_prefix +
                                std::string(kHugePageNotifBufPathPrefix) +
@@ -654,28 +1328,66 @@ void notification_buf_free(struct NotificationBufPair* notification_buf_pair) {
   free(notification_buf_pair->pending_rx_pipe_tails);
   free(notification_buf_pair->wrap_tracker);
   free(notification_buf_pair->next_rx_pipe_ids);
+  free(notification_buf_pair->queued_rx_pipes);
+
+  delete notification_buf_pair->huge_page_pool;
 
   delete fpga_dev;
 }
 
+// Removes a pipe from `next_rx_pipe_ids`, such that a freed pipe is not
+// returned and that a new pipe with the same ID can be queued again.
+static void remove_queued_rx_pipe(
+    struct NotificationBufPair* notification_buf_pair,
+    enso_pipe_id_t enso_pipe_id) {
+  uint64_t* queued_word =
+      &notification_buf_pair->queued_rx_pipes[enso_pipe_id / 64];
+  uint64_t queued_mask = 1ULL << (enso_pipe_id % 64);
+  if (!(*queued_word & queued_mask)) {
+    return;
+  }
+  *queued_word &= ~queued_mask;
+
+  uint16_t next_rx_ids_tail = notification_buf_pair->next_rx_ids_tail;
+  uint16_t new_tail = notification_buf_pair->next_rx_ids_head;
+  for (uint16_t i = new_tail; i != next_rx_ids_tail;
+       i = (i + 1) % kNotificationBufSize) {
+    enso_pipe_id_t id = notification_buf_pair->next_rx_pipe_ids[i];
+    if (id != enso_pipe_id) {
+      notification_buf_pair->next_rx_pipe_ids[new_tail] = id;
+      new_tail = (new_tail + 1) % kNotificationBufSize;
+    }
+  }
+  notification_buf_pair->next_rx_ids_tail = new_tail;
+}
+
 void enso_pipe_free(struct NotificationBufPair* notification_buf_pair,
                     struct RxEnsoPipeInternal* enso_pipe,
                     enso_pipe_id_t enso_pipe_id) {
   DevBackend* fpga_dev =
       static_cast<DevBackend*>(notification_buf_pair->fpga_dev);
 
+  remove_queued_rx_pipe(notification_buf_pair, enso_pipe_id);
+
   DevBackend::mmio_write32(&enso_pipe->regs->rx_mem_low, 0);
   DevBackend::mmio_write32(&enso_pipe->regs->rx_mem_high, 0);
 
   if (enso_pipe->buf) {
-    munmap(enso_pipe->buf, kBufPageSize);
+    uint32_t nb_bytes = enso_pipe->size * 64;
+    if (nb_bytes < kBufPageSize) {
+      nb_bytes *= 2;
+    }
     std::string huge_page_path = enso_pipe->huge_page_prefix +
                                  std::string(kHugePageRxPipePathPrefix) +
                                  std::to_string(enso_pipe_id);
-    unlink(huge_page_path.c_str());
+    free_pipe_buf(notification_buf_pair, enso_pipe->buf, huge_page_path,
+                  nb_bytes);
     enso_pipe->buf = nullptr;
   }
 
+  delete[] enso_pipe->released_flits;
+  enso_pipe->released_flits = nullptr;
+
   fpga_dev->FreePipe(enso_pipe_id);
 
   update_fallback_queues_config(notification_buf_pair);
@@ -718,6 +1430,18 @@ void print_stats(struct SocketInternal* socket_entry, bool print_global) {
     printf("Dsc RX head: %d\n", notification_buf_pair->rx_head);
     printf("Dsc TX tail: %d\n", notification_buf_pair->tx_tail);
     printf("Dsc TX head: %d\n\n", notification_buf_pair->tx_head);
+    printf("Notification batch size: %d\n",
+           notification_buf_pair->rx_notif_batch_size);
+    printf("Notification scans: %lu (empty: %lu, full: %lu)\n",
+           notification_buf_pair->nb_rx_notif_scans,
+           notification_buf_pair->nb_empty_rx_notif_scans,
+           notification_buf_pair->nb_full_rx_notif_scans);
+    printf("Notifications: %lu\n\n", notification_buf_pair->nb_rx_notifs);
+    printf("RX waits: %lu (sleeps: %lu, wakeups: %lu, timeouts: %lu)\n\n",
+           notification_buf_pair->nb_rx_waits,
+           notification_buf_pair->nb_rx_sleeps,
+           notification_buf_pair->nb_rx_wakeups,
+           notification_buf_pair->nb_rx_wait_timeouts);
   }
 
   printf("Pkt RX tail: %d\n", socket_entry->enso_pipe.rx_tail);
@@ -62,25 +62,52 @@ struct SocketInternal {
  * @param bar PCIe BAR to use (set to -1 to automatically select one).
  * @param notification_buf_pair Notification buffer pair to initialize.
  * @param huge_page_prefix File prefix to use when allocating the huge pages.
+ * @param numa_policy Policy used to place the notification buffer and the
+ *                    pipes that use it.
+ * @param core_id Core that uses the notification buffer, used with
+ *                `NumaPolicy::kCore`. If negative, uses the current core.
  *
  * @return 0 on success, -1 on failure.
  */
 int notification_buf_init(uint32_t bdf, int32_t bar,
                           struct NotificationBufPair* notification_buf_pair,
-                          const std::string& huge_page_prefix);
+                          const std::string& huge_page_prefix,
+                          NumaPolicy numa_policy = NumaPolicy::kDevice,
+                          int32_t core_id = -1);
+
+/**
+ * @brief Checks if Enso Pipes of a given size can be allocated.
+ *
+ * @param notification_buf_pair Notification buffer pair to use.
+ * @param size Pipe size in flits.
+ *
+ * @return True if the size is supported, false otherwise.
+ */
+bool is_pipe_size_supported(struct NotificationBufPair* notification_buf_pair,
+                            uint32_t size);
 
 /**
  * @brief Initializes an Enso Pipe.
  *
+ * Pipes of `kEnsoPipeSize` use a mirrored huge page. Larger pipes must be
+ * physically contiguous, so they need a huge page from
+ * `kHugePage1GDefaultPrefix` that matches their size. Smaller pipes share a
+ * huge page with other pipes of the same size. Since those cannot be mirrored,
+ * each one is followed by as many bytes as the pipe size, where the bytes that
+ * wrap around are copied to keep batches contiguous.
+ *
  * @param enso_pipe Enso Pipe to initialize.
  * @param notification_buf_pair Notification buffer pair to use.
  * @param fallback Whether the queues is a fallback queue or not.
+ * @param size Pipe size in flits. Must be a power of two between
+ *             `kMinEnsoPipeSize` and `kMaxEnsoPipeSize`.
  *
- * @return Pipe ID on success, -1 on failure.
+ * @return Pipe ID on success, -1 on failure. errno is set to EINVAL if the size
+ *         is not supported.
  */
 int enso_pipe_init(struct RxEnsoPipeInternal* enso_pipe,
                    struct NotificationBufPair* notification_buf_pair,
-                   bool fallback);
+                   bool fallback, uint32_t size = kEnsoPipeSize);
 
 /**
  * @brief Initializes an enso pipe and the notification buffer if needed.
@@ -95,11 +122,28 @@ int dma_init(struct NotificationBufPair* notification_buf_pair,
  * @brief Gets latest tails for the pipes associated with the given
  * notification buffer.
  *
+ * Pipes are added to `next_rx_pipe_ids` at most once, even if they receive
+ * multiple notifications. Whoever takes a pipe id from `next_rx_pipe_ids` must
+ * call `dequeue_rx_pipe`.
+ *
  * @param notification_buf_pair Notification buffer to get data from.
  * @return Number of notifications received.
  */
 uint16_t get_new_tails(struct NotificationBufPair* notification_buf_pair);
 
+/**
+ * @brief Marks a pipe as no longer in `next_rx_pipe_ids`, such that it is
+ * queued again on its next notification.
+ *
+ * @param notification_buf_pair Notification buffer that queued the pipe.
+ * @param enso_pipe_id ID of the pipe taken from `next_rx_pipe_ids`.
+ */
+inline void dequeue_rx_pipe(struct NotificationBufPair* notification_buf_pair,
+                            enso_pipe_id_t enso_pipe_id) {
+  notification_buf_pair->queued_rx_pipes[enso_pipe_id / 64] &=
+      ~(1ULL << (enso_pipe_id % 64));
+}
+
 /**
  * @brief Gets the next batch of data from the given Enso Pipe.
  *
@@ -156,6 +200,9 @@ uint32_t get_next_batch(struct NotificationBufPair* notification_buf_pair,
  * `socket_entry` socket. If `len` is greater than the number of allocated bytes
  * in the buffer, the behavior is undefined.
  *
+ * The NIC may not be notified right away if head coalescing is enabled. See
+ * `set_pipe_head_coalescing`.
+ *
  * @param enso_pipe Enso pipe to advance.
  * @param len Number of bytes to free.
  */
@@ -169,6 +216,99 @@ void advance_pipe(struct RxEnsoPipeInternal* enso_pipe, size_t len);
  */
 void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe);
 
+/**
+ * @brief Enables out-of-order release of received bytes for a given Enso Pipe.
+ *
+ * Allocates a bitmap with one bit per flit in the pipe. Once enabled,
+ * `advance_pipe` and `fully_advance_pipe` also keep the bitmap consistent.
+ *
+ * @param enso_pipe Enso pipe to enable out-of-order release for.
+ * @return 0 on success, -1 on failure and sets errno.
+ */
+int enable_pipe_release_tracking(struct RxEnsoPipeInternal* enso_pipe);
+
+/**
+ * @brief Frees an arbitrary region of received bytes in a given Enso Pipe.
+ *
+ * The head only advances up to the oldest region that was not released yet.
+ * Requires `enable_pipe_release_tracking` to have been called. The bitmap is
+ * not synchronized, so this must be called from the thread that owns the pipe.
+ *
+ * @param enso_pipe Enso pipe that received the region.
+ * @param addr Start of the region (must be flit-aligned).
+ * @param len Number of bytes to free.
+ */
+void release_pipe_region(struct RxEnsoPipeInternal* enso_pipe, const void* addr,
+                         size_t len);
+
+/**
+ * @brief Sets how many notifications `get_new_tails` consumes at once.
+ *
+ * @param notification_buf_pair Notification buffer to configure.
+ * @param max_batch_size Number of notifications consumed at once or, if
+ *                       `adaptive` is set, the maximum number.
+ * @param adaptive Whether to adapt the number of notifications to the load,
+ *                 growing it while scans fill the batch and shrinking it while
+ *                 most scans are empty.
+ */
+void set_notif_batch_size(struct NotificationBufPair* notification_buf_pair,
+                          uint16_t max_batch_size, bool adaptive);
+
+/**
+ * @brief Checks if there are notifications to consume or pipes queued to be
+ *        received.
+ *
+ * @param notification_buf_pair Notification buffer to check.
+ * @return True if `get_next_enso_pipe_id` would return a pipe.
+ */
+bool has_pending_rx(struct NotificationBufPair* notification_buf_pair);
+
+/**
+ * @brief Returns a file descriptor that becomes readable when the NIC has new
+ *        notifications, after `arm_rx_wakeup` is called.
+ *
+ * The file descriptor is created on the first call and belongs to the
+ * notification buffer. It can be added to `poll`, `select`, or `epoll`.
+ *
+ * @param notification_buf_pair Notification buffer.
+ * @return The file descriptor. On error, -1 is returned and errno is set
+ *         (ENOTSUP if the device backend does not support wakeups).
+ */
+int get_rx_wakeup_fd(struct NotificationBufPair* notification_buf_pair);
+
+/**
+ * @brief Asks the NIC to make the file descriptor returned by
+ *        `get_rx_wakeup_fd` readable once there are notifications.
+ *
+ * Previous wakeups are consumed. The NIC makes the file descriptor readable
+ * only once for every call.
+ *
+ * @param notification_buf_pair Notification buffer.
+ * @return 1 if there already are notifications, in which case the caller
+ *         should not wait, or 0 otherwise. On error, -1 is returned and errno
+ *         is set.
+ */
+int arm_rx_wakeup(struct NotificationBufPair* notification_buf_pair);
+
+/**
+ * @brief Waits until there are notifications to consume.
+ *
+ * Busy polls for up to `busy_poll_us` and then sleeps until the NIC wakes us
+ * up (see `arm_rx_wakeup`). If the device backend does not support wakeups,
+ * it busy polls until the timeout, and an infinite timeout is an error.
+ *
+ * @param notification_buf_pair Notification buffer.
+ * @param busy_poll_us Time to busy poll before sleeping (in microseconds).
+ * @param timeout_us Maximum time to wait (in microseconds), or a negative
+ *                   value to wait indefinitely.
+ * @return 1 if there are notifications or 0 on timeout. On error (e.g., a
+ *         signal interrupted the wait), -1 is returned and errno is set
+ *         (ENOTSUP if `timeout_us` is negative and the device backend does not
+ *         support wakeups).
+ */
+int wait_for_rx(struct NotificationBufPair* notification_buf_pair,
+                uint32_t busy_poll_us, int64_t timeout_us);
+
 /**
  * @brief Prefetches a given Enso Pipe.
  *
@@ -176,6 +316,31 @@ void fully_advance_pipe(struct RxEnsoPipeInternal* enso_pipe);
  */
 void prefetch_pipe(struct RxEnsoPipeInternal* enso_pipe);
 
+/**
+ * @brief Writes the head of a given Enso Pipe to the NIC, if it was advanced
+ *        since the last write.
+ *
+ * @param enso_pipe Enso pipe to flush.
+ */
+void flush_pipe_head(struct RxEnsoPipeInternal* enso_pipe);
+
+/**
+ * @brief Configures how head updates are coalesced for a given Enso Pipe.
+ *
+ * When advancing the pipe (`advance_pipe` or `fully_advance_pipe`), the head is
+ * only written to the NIC if at least `min_bytes` were freed since the last
+ * write or if more than `max_cycles` TSC cycles elapsed since the last write.
+ *
+ * @param enso_pipe Enso pipe to configure.
+ * @param min_bytes Freed bytes that trigger a head write. Setting it to 0
+ *                  disables coalescing.
+ * @param max_cycles TSC cycles after which a head update is written regardless
+ *                   of the number of freed bytes. Setting it to 0 disables the
+ *                   time budget.
+ */
+void set_pipe_head_coalescing(struct RxEnsoPipeInternal* enso_pipe,
+                              uint32_t min_bytes, uint64_t max_cycles);
+
 /**
  * @brief Sends data through a given queue.
  *
@@ -186,7 +351,10 @@ void prefetch_pipe(struct RxEnsoPipeInternal* enso_pipe);
  * transmission is complete.
  *
  * This function currently blocks if there is not enough space in the
- * notification buffer.
+ * notification buffer. Use `try_send_to_queue` to avoid blocking.
+ *
+ * The NIC may not be notified right away if doorbell coalescing is enabled. See
+ * `set_tx_doorbell_coalescing`.
  *
  * @param notification_buf_pair Notification buffer to send data through.
  * @param phys_addr Physical memory address of the data to be sent.
@@ -197,6 +365,70 @@ void prefetch_pipe(struct RxEnsoPipeInternal* enso_pipe);
 uint32_t send_to_queue(struct NotificationBufPair* notification_buf_pair,
                        uint64_t phys_addr, uint32_t len);
 
+/**
+ * @brief Sends one segment of a scatter-gather transmission through a given
+ *        queue.
+ *
+ * All segments up to (and including) the one with `last_segment` set are
+ * reported as a single completion by `get_unreported_completions`. The NIC
+ * is only notified about the segments when the last segment is enqueued.
+ *
+ * This function blocks if there is not enough space in the notification
+ * buffer.
+ *
+ * @param notification_buf_pair Notification buffer to send data through.
+ * @param phys_addr Physical memory address of the segment.
+ * @param len Length, in bytes, of the segment.
+ * @param last_segment Whether this is the last segment of the transmission.
+ *
+ * @return number of bytes sent.
+ */
+uint32_t send_segment_to_queue(
+    struct NotificationBufPair* notification_buf_pair, uint64_t phys_addr,
+    uint32_t len, bool last_segment);
+
+/**
+ * @brief Sends data through a given queue without blocking.
+ *
+ * Same as `send_to_queue` but, if there is not enough space in the
+ * notification buffer for the entire transfer, returns without sending any
+ * data.
+ *
+ * @param notification_buf_pair Notification buffer to send data through.
+ * @param phys_addr Physical memory address of the data to be sent.
+ * @param len Length, in bytes, of the data.
+ *
+ * @return 0 if the data was sent, -1 if there is not enough space in the
+ *         notification buffer.
+ */
+int try_send_to_queue(struct NotificationBufPair* notification_buf_pair,
+                      uint64_t phys_addr, uint32_t len);
+
+/**
+ * @brief Notifies the NIC about all the transmissions that were enqueued but
+ *        held back to coalesce doorbells.
+ *
+ * @param notification_buf_pair Notification buffer to flush.
+ */
+void flush_tx(struct NotificationBufPair* notification_buf_pair);
+
+/**
+ * @brief Configures how TX doorbells (i.e., writes to the TX tail register)
+ *        are coalesced.
+ *
+ * Transmissions are held back until either `max_notifs` notifications or
+ * `max_bytes` bytes are pending, or until `flush_tx` is called.
+ *
+ * @param notification_buf_pair Notification buffer to configure.
+ * @param max_notifs Number of pending notifications that triggers a doorbell.
+ *                   Setting it to 1 (or 0) disables coalescing.
+ * @param max_bytes Number of pending bytes that triggers a doorbell. Setting it
+ *                  to 0 disables the byte threshold.
+ */
+void set_tx_doorbell_coalescing(
+    struct NotificationBufPair* notification_buf_pair, uint32_t max_notifs,
+    uint32_t max_bytes);
+
 /**
  * @brief Returns the number of transmission requests that were completed since
  * the last call to this function.
@@ -276,6 +508,68 @@ int get_round_robin_status(struct NotificationBufPair* notification_buf_pair);
 uint64_t get_dev_addr_from_virt_addr(
     struct NotificationBufPair* notification_buf_pair, void* virt_addr);
 
+/**
+ * @brief Converts multiple addresses in the application's virtual address
+ *        space to addresses that can be used by the device.
+ *
+ * @param notification_buf_pair Notification buffer pair to use.
+ * @param virt_addrs Virtual addresses to convert.
+ * @param dev_addrs Array to be filled with the converted addresses (0 for
+ *                  addresses that cannot be translated).
+ * @param nb_addrs Number of addresses to convert.
+ * @return Number of addresses that were translated.
+ */
+uint32_t get_dev_addrs_from_virt_addrs(
+    struct NotificationBufPair* notification_buf_pair, void* const* virt_addrs,
+    uint64_t* dev_addrs, uint32_t nb_addrs);
+
+/**
+ * @brief Adds huge pages to the notification buffer pair's pool.
+ *
+ * Pipes associated with the notification buffer pair take their buffers from
+ * the pool while it has free pages. Once a pipe is freed, its buffer goes back
+ * to the pool.
+ *
+ * @param notification_buf_pair Notification buffer pair to use.
+ * @param nb_pages Number of 2MB pages to add.
+ * @return 0 on success, -1 on failure.
+ */
+int reserve_huge_pages(struct NotificationBufPair* notification_buf_pair,
+                       uint32_t nb_pages);
+
+/**
+ * @brief Allocates a buffer for a pipe.
+ *
+ * Takes a page from the pool, if available. Otherwise, allocates a new
+ * mirrored huge page backed by the file at `path`.
+ *
+ * Buffers smaller than a huge page are not mirrored and share a page, taken
+ * from the pool, with other buffers of the same size. Buffers larger than a
+ * huge page are never taken from the pool.
+ *
+ * @param notification_buf_pair Notification buffer pair to use.
+ * @param path Path to the huge page file, used if the pool is empty.
+ * @param dev_addr Set to the device address of the buffer.
+ * @param size Size of the buffer in bytes, must be a power of two.
+ * @return The buffer or nullptr on failure.
+ */
+void* alloc_pipe_buf(struct NotificationBufPair* notification_buf_pair,
+                     const std::string& path, uint64_t* dev_addr,
+                     uint32_t size = kBufPageSize);
+
+/**
+ * @brief Frees a buffer allocated with `alloc_pipe_buf`.
+ *
+ * @param notification_buf_pair Notification buffer pair used to allocate the
+ *                              buffer.
+ * @param buf The buffer.
+ * @param path Path used to allocate the buffer.
+ * @param size Size used to allocate the buffer.
+ */
+void free_pipe_buf(struct NotificationBufPair* notification_buf_pair,
+                   void* buf, const std::string& path,
+                   uint32_t size = kBufPageSize);
+
 /**
  * @brief Frees the notification buffer pair.
  *
@@ -286,6 +580,10 @@ void notification_buf_free(struct NotificationBufPair* notification_buf_pair);
 /**
  * @brief Frees the Enso Pipe.
  *
+ * The pipe is also removed from `next_rx_pipe_ids`. Notifications that the NIC
+ * sent before the pipe was freed may still queue it later, so users of
+ * `get_next_enso_pipe_id` must skip IDs of pipes that no longer exist.
+ *
  * @param notification_buf_pair Notification buffer pair to use.
  * @param enso_pipe Enso Pipe to free.
  * @param enso_pipe_id Hardware ID of the Enso Pipe to free.
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Implementation of the `RxScheduler` class.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#include "rx_scheduler.h"
+
+#include <algorithm>
+
+namespace enso {
+
+RxScheduler::RxScheduler() noexcept : pipes_(kMaxNbFlows) {
+  for (auto& queue : queues_) {
+    queue.ids.resize(kMaxNbFlows);
+  }
+}
+
+void RxScheduler::SetClass(enso_pipe_id_t id, uint32_t sched_class,
+                           uint32_t weight) {
+  PipeState& pipe = pipes_[id];
+  pipe.sched_class = sched_class;
+  pipe.weight = weight;
+}
+
+void RxScheduler::ResetPipe(enso_pipe_id_t id) {
+  PipeState& pipe = pipes_[id];
+  pipe.sched_class = 0;
+  pipe.weight = 1;
+  pipe.deficit = 0;
+}
+
+void RxScheduler::Enqueue(enso_pipe_id_t id, uint64_t now) {
+  PipeState& pipe = pipes_[id];
+  if (pipe.queued) {
+    return;
+  }
+  pipe.queued = true;
+  pipe.enqueue_tsc = now;
+  queues_[pipe.sched_class].push_back(id);
+}
+
+int32_t RxScheduler::Dequeue() {
+  // Strict priority: only look at a class once all higher ones are empty.
+  for (uint32_t i = kNbRxSchedulingClasses; i-- > 0;) {
+    ClassQueue& queue = queues_[i];
+    while (!queue.empty()) {
+      enso_pipe_id_t id = queue.front();
+      queue.pop_front();
+      PipeState& pipe = pipes_[id];
+
+      // A pipe that already spent its credit gets a new quantum and waits for
+      // the next round.
+      if (pipe.deficit <= 0) {
+        pipe.deficit += pipe.weight * kQuantum;
+        queue.push_back(id);
+        continue;
+      }
+
+      pipe.queued = false;
+      return id;
+    }
+  }
+  return -1;
+}
+
+void RxScheduler::RecordDispatch(enso_pipe_id_t id, uint64_t now) {
+  const PipeState& pipe = pipes_[id];
+  RxSchedulingStats& stats = stats_[pipe.sched_class];
+
+  uint64_t delay = now - pipe.enqueue_tsc;
+  uint32_t bucket = delay ? 64 - __builtin_clzll(delay) : 0;
+
+  ++stats.nb_dispatches;
+  stats.total_delay_cycles += delay;
+  stats.max_delay_cycles = std::max(stats.max_delay_cycles, delay);
+  ++stats.delay_histogram[bucket];
+}
+
+void RxScheduler::Charge(enso_pipe_id_t id, uint32_t nb_bytes, bool pending,
+                         uint64_t now) {
+  PipeState& pipe = pipes_[id];
+
+  // Charge at least one quantum of the pipe, such that a pipe that is served
+  // without being consumed cannot hold the scheduler.
+  pipe.deficit -= std::max(nb_bytes, RxPipe::kQuantumSize);
+
+  if (!pending) {
+    // As in DRR, pipes that become idle lose their remaining credit. But,
+    // since batches may be much larger than the quantum, they keep their debt.
+    pipe.deficit = std::min<int64_t>(pipe.deficit, 0);
+    return;
+  }
+
+  if (pipe.queued) {
+    return;
+  }
+  pipe.queued = true;
+  pipe.enqueue_tsc = now;
+
+  ClassQueue& queue = queues_[pipe.sched_class];
+  if (pipe.deficit > 0) {
+    queue.push_front(id);
+  } else {
+    queue.push_back(id);
+  }
+}
+
+}  // namespace enso
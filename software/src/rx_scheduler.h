@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * @brief Scheduler used to pick the next RX pipe to receive from.
+ *
+ * @author Hugo Sadok <sadok@cmu.edu>
+ */
+
+#ifndef SOFTWARE_SRC_RX_SCHEDULER_H_
+#define SOFTWARE_SRC_RX_SCHEDULER_H_
+
+#include <enso/consts.h>
+#include <enso/pipe.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace enso {
+
+/**
+ * @brief Schedules pipes with pending data using strict priority across
+ *        classes and deficit round robin (DRR) within a class.
+ *
+ * Pipes in a higher class are always served before pipes in a lower one.
+ * Within a class, each pipe earns `weight * kQuantum` bytes of credit per
+ * round and is charged for the bytes that the application consumed once it
+ * is served.
+ *
+ * Not thread safe: must only be used by the thread that owns the device.
+ */
+class RxScheduler {
+ public:
+  /**
+   * @brief Bytes of credit that a pipe with weight 1 earns per round.
+   */
+  static constexpr int64_t kQuantum = 16384;
+
+  RxScheduler() noexcept;
+
+  RxScheduler(const RxScheduler&) = delete;
+  RxScheduler& operator=(const RxScheduler&) = delete;
+  RxScheduler(RxScheduler&&) = delete;
+  RxScheduler& operator=(RxScheduler&&) = delete;
+
+  /**
+   * @brief Sets the class and weight of a pipe.
+   *
+   * If the pipe is already queued, the new class only takes effect the next
+   * time it is queued.
+   *
+   * @param id ID of the pipe.
+   * @param sched_class Class of the pipe, higher classes have priority.
+   * @param weight Weight of the pipe within its class.
+   */
+  void SetClass(enso_pipe_id_t id, uint32_t sched_class, uint32_t weight);
+
+  /**
+   * @brief Restores the default class, weight and credit of a pipe. Should be
+   *        called when the pipe's ID is allocated to a new pipe.
+   *
+   * A pipe that is still queued stays queued, so that it is never queued
+   * twice.
+   *
+   * @param id ID of the pipe.
+   */
+  void ResetPipe(enso_pipe_id_t id);
+
+  /**
+   * @brief Queues a pipe with pending data. Does nothing if the pipe is
+   *        already queued.
+   *
+   * @param id ID of the pipe.
+   * @param now Current TSC, used to compute the pipe's queueing delay.
+   */
+  void Enqueue(enso_pipe_id_t id, uint64_t now);
+
+  /**
+   * @brief Takes the next pipe to be served.
+   *
+   * @return ID of the pipe or -1 if no pipe is queued.
+   */
+  int32_t Dequeue();
+
+  /**
+   * @brief Records the queueing delay of a pipe returned by `Dequeue()`
+   *        that is about to be served.
+   *
+   * @param id ID of the pipe.
+   * @param now Current TSC.
+   */
+  void RecordDispatch(enso_pipe_id_t id, uint64_t now);
+
+  /**
+   * @brief Charges a served pipe for the bytes that the application consumed
+   *        and queues it again if it still has pending data.
+   *
+   * A pipe that still has credit goes back to the front of its class, such
+   * that it keeps being served until it spends its quantum.
+   *
+   * @param id ID of the pipe.
+   * @param nb_bytes Number of bytes consumed since the pipe was dispatched.
+   * @param pending Whether the pipe still has pending data.
+   * @param now Current TSC.
+   */
+  void Charge(enso_pipe_id_t id, uint32_t nb_bytes, bool pending,
+              uint64_t now);
+
+  /**
+   * @brief Returns whether no pipe is queued.
+   */
+  inline bool empty() const {
+    for (const ClassQueue& queue : queues_) {
+      if (!queue.empty()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  inline const RxSchedulingStats& stats(uint32_t sched_class) const {
+    return stats_[sched_class];
+  }
+
+ private:
+  struct PipeState {
+    uint32_t sched_class = 0;
+    uint32_t weight = 1;
+    int64_t deficit = 0;
+    uint64_t enqueue_tsc = 0;
+    bool queued = false;
+  };
+
+  // Ring of pipe IDs that can be pushed to both ends. Every pipe is queued at
+  // most once, so it never holds more than `kMaxNbFlows` IDs. Indices wrap
+  // around at 2^32, so `kMaxNbFlows` must be a power of two.
+  static_assert((kMaxNbFlows & (kMaxNbFlows - 1)) == 0,
+                "kMaxNbFlows must be a power of two");
+  struct ClassQueue {
+    std::vector<enso_pipe_id_t> ids;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    inline bool empty() const { return head == tail; }
+    inline enso_pipe_id_t front() const { return ids[head % kMaxNbFlows]; }
+    inline void pop_front() { ++head; }
+    inline void push_front(enso_pipe_id_t id) {
+      ids[--head % kMaxNbFlows] = id;
+    }
+    inline void push_back(enso_pipe_id_t id) { ids[tail++ % kMaxNbFlows] = id; }
+  };
+
+  std::vector<PipeState> pipes_;
+  std::array<ClassQueue, kNbRxSchedulingClasses> queues_;
+  std::array<RxSchedulingStats, kNbRxSchedulingClasses> stats_ = {};
+};
+
+}  // namespace enso
+
+#endif  // SOFTWARE_SRC_RX_SCHEDULER_H_
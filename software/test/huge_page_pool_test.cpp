@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <enso/consts.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../src/huge_page_pool.h"
+
+namespace {
+
+uint64_t to_dev_addr(void* buf) { return (uint64_t)buf; }
+
+std::string pool_prefix(const std::string& name) {
+  return std::string(enso::kHugePageDefaultPrefix) + "_test_" + name + ":";
+}
+
+}  // namespace
+
+TEST(TestHugePagePool, GetPut) {
+  enso::HugePagePool pool(pool_prefix("GetPut"));
+  ASSERT_EQ(pool.Reserve(2, -1, to_dev_addr), 0);
+  EXPECT_EQ(pool.nb_pages(), 2);
+  EXPECT_EQ(pool.nb_free_pages(), 2);
+
+  enso::HugePagePool::Page page1, page2, page3;
+  ASSERT_TRUE(pool.Get(&page1));
+  ASSERT_TRUE(pool.Get(&page2));
+  EXPECT_NE(page1.buf, page2.buf);
+  EXPECT_EQ(page1.dev_addr, (uint64_t)page1.buf);
+  EXPECT_EQ(pool.nb_free_pages(), 0);
+
+  EXPECT_FALSE(pool.Get(&page3));
+  EXPECT_EQ(pool.nb_hits(), 2);
+  EXPECT_EQ(pool.nb_misses(), 1);
+
+  EXPECT_TRUE(pool.Put(page1.buf));
+  EXPECT_EQ(pool.nb_free_pages(), 1);
+
+  ASSERT_TRUE(pool.Get(&page3));
+  EXPECT_EQ(page3.buf, page1.buf);
+}
+
+TEST(TestHugePagePool, PutForeignPage) {
+  enso::HugePagePool pool(pool_prefix("PutForeignPage"));
+  ASSERT_EQ(pool.Reserve(1, -1, to_dev_addr), 0);
+
+  uint8_t buf[64];
+  EXPECT_FALSE(pool.Put(buf));
+  EXPECT_FALSE(pool.PutSlot(buf));
+  EXPECT_EQ(pool.nb_free_pages(), 1);
+}
+
+TEST(TestHugePagePool, SlotsFromReservedPage) {
+  constexpr uint32_t kSlotSize = enso::kBufPageSize / 4;
+  enso::HugePagePool pool(pool_prefix("SlotsFromReservedPage"));
+  ASSERT_EQ(pool.Reserve(1, -1, to_dev_addr), 0);
+
+  std::vector<enso::HugePagePool::Page> slots(4);
+  std::set<uint8_t*> bufs;
+  for (auto& slot : slots) {
+    ASSERT_EQ(pool.GetSlot(kSlotSize, -1, to_dev_addr, &slot), 0);
+    EXPECT_EQ(slot.dev_addr, (uint64_t)slot.buf);
+    EXPECT_EQ((uint64_t)slot.buf % kSlotSize, 0);
+    bufs.insert(slot.buf);
+  }
+
+  // All slots share the reserved page.
+  EXPECT_EQ(bufs.size(), 4);
+  EXPECT_EQ(*bufs.rbegin() - *bufs.begin(), 3 * kSlotSize);
+  EXPECT_EQ(pool.nb_free_pages(), 0);
+
+  // The page only goes back to the pool once all its slots are returned.
+  for (uint32_t i = 0; i < 3; ++i) {
+    EXPECT_TRUE(pool.PutSlot(slots[i].buf));
+    EXPECT_EQ(pool.nb_free_pages(), 0);
+  }
+  EXPECT_TRUE(pool.PutSlot(slots[3].buf));
+  EXPECT_EQ(pool.nb_free_pages(), 1);
+}
+
+TEST(TestHugePagePool, SlotsWithoutReservedPages) {
+  constexpr uint32_t kSlotSize = enso::kBufPageSize / 2;
+  enso::HugePagePool pool(pool_prefix("SlotsWithoutReservedPages"));
+
+  enso::HugePagePool::Page slot1, slot2, slot3;
+  ASSERT_EQ(pool.GetSlot(kSlotSize, -1, to_dev_addr, &slot1), 0);
+  ASSERT_EQ(pool.GetSlot(kSlotSize, -1, to_dev_addr, &slot2), 0);
+  EXPECT_EQ(slot2.buf - slot1.buf, kSlotSize);
+
+  // The first page is full, so the next slot comes from a new page.
+  ASSERT_EQ(pool.GetSlot(kSlotSize, -1, to_dev_addr, &slot3), 0);
+  EXPECT_NE(slot3.buf, slot1.buf);
+  EXPECT_NE(slot3.buf, slot2.buf);
+  EXPECT_EQ(pool.nb_pages(), 0);
+
+  // Freed slots are reused.
+  EXPECT_TRUE(pool.PutSlot(slot2.buf));
+  enso::HugePagePool::Page slot4;
+  ASSERT_EQ(pool.GetSlot(kSlotSize, -1, to_dev_addr, &slot4), 0);
+  EXPECT_EQ(slot4.buf, slot2.buf);
+
+  EXPECT_TRUE(pool.PutSlot(slot1.buf));
+  EXPECT_TRUE(pool.PutSlot(slot3.buf));
+  EXPECT_TRUE(pool.PutSlot(slot4.buf));
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <enso/consts.h>
+#include <enso/ixy_helpers.h>
+#include <gtest/gtest.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+TEST(TestIxyHelpers, VirtToPhysBulk) {
+  std::string path =
+      std::string(enso::kHugePageDefaultPrefix) + "_test_VirtToPhysBulk";
+  constexpr size_t kSize = 2 * enso::kBufPageSize;
+  uint8_t* page = (uint8_t*)enso::get_huge_page(path, kSize);
+  ASSERT_NE(page, nullptr);
+  unlink(path.c_str());
+
+  if (enso::virt_to_phys(page) == 0) {
+    enso::unmap_huge_page(page, kSize);
+    GTEST_SKIP() << "Physical addresses are not readable from pagemap";
+  }
+
+  uint64_t heap_buf = 0;
+  std::vector<void*> virts = {page,
+                              page + 64,
+                              page + enso::kBufPageSize / 2,
+                              page + enso::kBufPageSize + 128,
+                              &heap_buf,
+                              nullptr};
+  std::vector<uint64_t> phys(virts.size(), ~0ULL);
+
+  // Only the null address cannot be translated.
+  EXPECT_EQ(enso::virt_to_phys_bulk(virts.data(), phys.data(), virts.size()),
+            virts.size() - 1);
+  for (uint32_t i = 0; i < virts.size() - 1; ++i) {
+    EXPECT_EQ(phys[i], enso::virt_to_phys(virts[i]));
+  }
+  EXPECT_EQ(phys.back(), 0);
+
+  // Addresses in the same huge page are physically contiguous.
+  EXPECT_EQ(phys[1] - phys[0], 64);
+  EXPECT_EQ(phys[2] - phys[0], enso::kBufPageSize / 2);
+  EXPECT_EQ(phys[3] % enso::kBufPageSize, 128);
+
+  uint64_t unmap_count = enso::get_huge_page_unmap_count();
+  enso::unmap_huge_page(page, kSize);
+  EXPECT_EQ(enso::get_huge_page_unmap_count(), unmap_count + 1);
+}
+
+TEST(TestIxyHelpers, NumaPlacement) {
+  EXPECT_EQ(enso::get_numa_node_from_core(-1), -1);
+  EXPECT_EQ(enso::get_numa_node_from_core(1 << 20), -1);
+  EXPECT_EQ(enso::get_numa_node_from_bdf(0xffff), -1);
+
+  int numa_node = enso::get_numa_node_from_core(0);
+  if (numa_node < 0) {
+    GTEST_SKIP() << "The kernel does not expose NUMA nodes";
+  }
+  std::string node_path =
+      "/sys/devices/system/node/node" + std::to_string(numa_node);
+  EXPECT_EQ(access(node_path.c_str(), F_OK), 0);
+
+  // The page is placed on the requested node when it has free huge pages,
+  // which is the case on single-node machines.
+  std::string path =
+      std::string(enso::kHugePageDefaultPrefix) + "_test_NumaPlacement";
+  uint8_t* page = (uint8_t*)enso::get_huge_page(path, 0, false, numa_node);
+  ASSERT_NE(page, nullptr);
+  unlink(path.c_str());
+
+  int page_node = -1;
+  ASSERT_EQ(syscall(SYS_get_mempolicy, &page_node, nullptr, 0, page,
+                    MPOL_F_NODE | MPOL_F_ADDR),
+            0);
+  if (access("/sys/devices/system/node/node1", F_OK) != 0) {
+    EXPECT_EQ(page_node, numa_node);
+  }
+
+  enso::unmap_huge_page(page);
+}
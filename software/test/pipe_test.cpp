@@ -0,0 +1,1066 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Uses the loopback backend, which sends transmitted packets back to the
+// pipes that they are bound to.
+
+#include <arpa/inet.h>
+#include <enso/device_group.h>
+#include <enso/helpers.h>
+#include <enso/pipe.h>
+#include <enso/socket.h>
+#include <gtest/gtest.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <x86intrin.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t kDstPort = 80;
+constexpr uint32_t kDstIp = 0xc0a80001;  // 192.168.0.1
+constexpr uint32_t kPktSize = 64;
+constexpr std::chrono::seconds kTimeout(2);
+
+// Writes a 64-byte UDP packet to `kDstIp` that carries `id` in its last byte.
+void fill_pkt(uint8_t* pkt, uint8_t id, uint16_t dst_port = kDstPort) {
+  memset(pkt, 0, kPktSize);
+  struct ether_header* l2_hdr = (struct ether_header*)pkt;
+  struct iphdr* l3_hdr = (struct iphdr*)(l2_hdr + 1);
+  struct udphdr* l4_hdr = (struct udphdr*)(l3_hdr + 1);
+  l2_hdr->ether_type = htons(ETHERTYPE_IP);
+  l3_hdr->version = 4;
+  l3_hdr->ihl = 5;
+  l3_hdr->tot_len = htons(kPktSize - sizeof(*l2_hdr));
+  l3_hdr->protocol = IPPROTO_UDP;
+  l3_hdr->daddr = htonl(kDstIp);
+  l4_hdr->dest = htons(dst_port);
+  pkt[kPktSize - 1] = id;
+}
+
+// Grows a packet written by `fill_pkt()` to `pkt_size` bytes.
+void grow_pkt(uint8_t* pkt, uint32_t pkt_size) {
+  memset(pkt + kPktSize, 0, pkt_size - kPktSize);
+  struct iphdr* l3_hdr = (struct iphdr*)(pkt + sizeof(struct ether_header));
+  l3_hdr->tot_len = htons(pkt_size - sizeof(struct ether_header));
+}
+
+// Sends 64-byte UDP packets to `kDstIp`. Packet `i` carries `first_id + i` in
+// its last byte.
+void send_pkts(enso::TxPipe* tx_pipe, uint32_t nb_pkts, uint8_t first_id,
+               uint16_t dst_port = kDstPort) {
+  uint32_t nb_bytes = nb_pkts * kPktSize;
+  uint8_t* buf = tx_pipe->AllocateBuf(nb_bytes);
+  ASSERT_NE(buf, nullptr);
+
+  for (uint32_t i = 0; i < nb_pkts; ++i) {
+    fill_pkt(buf + i * kPktSize, first_id + i, dst_port);
+  }
+
+  tx_pipe->SendAndFree(nb_bytes);
+}
+
+// Receives packets until `nb_pkts` arrived or the timeout expires.
+template <typename Pipe>
+std::vector<uint8_t*> recv_pkts(Pipe* pipe, uint32_t nb_pkts) {
+  std::vector<uint8_t*> pkts;
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (pkts.size() < nb_pkts && std::chrono::steady_clock::now() < deadline) {
+    auto batch = pipe->RecvPkts(nb_pkts - pkts.size());
+    for (auto pkt : batch) {
+      pkts.push_back(pkt);
+    }
+  }
+  return pkts;
+}
+
+}  // namespace
+
+TEST(TestRxPipe, OutOfOrderRelease) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  ASSERT_EQ(rx_pipe->EnableOutOfOrderRelease(), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  send_pkts(tx_pipe, 3, 0);
+  std::vector<uint8_t*> pkts = recv_pkts(rx_pipe, 3);
+  ASSERT_EQ(pkts.size(), 3);
+
+  enso::RxReleaseStats stats = rx_pipe->GetReleaseStats();
+  EXPECT_EQ(stats.held_bytes, 3 * kPktSize);
+  EXPECT_EQ(stats.blocked_bytes, 0);
+
+  // The head cannot move past the first packet while it is held.
+  rx_pipe->Release(pkts[2], kPktSize);
+  rx_pipe->Release(pkts[1], kPktSize);
+  stats = rx_pipe->GetReleaseStats();
+  EXPECT_EQ(stats.held_bytes, kPktSize);
+  EXPECT_EQ(stats.blocked_bytes, 2 * kPktSize);
+  EXPECT_EQ(stats.nb_out_of_order_releases, 2);
+
+  // Releasing the first packet frees all of them.
+  rx_pipe->Release(pkts[0], kPktSize);
+  stats = rx_pipe->GetReleaseStats();
+  EXPECT_EQ(stats.held_bytes, 0);
+  EXPECT_EQ(stats.blocked_bytes, 0);
+  EXPECT_EQ(stats.nb_releases, 3);
+  EXPECT_EQ(stats.nb_out_of_order_releases, 2);
+
+  // The pipe keeps working after the head advanced.
+  send_pkts(tx_pipe, 1, 3);
+  pkts = recv_pkts(rx_pipe, 1);
+  ASSERT_EQ(pkts.size(), 1);
+  EXPECT_EQ(pkts[0][kPktSize - 1], 3);
+  rx_pipe->Release(pkts[0], kPktSize);
+  EXPECT_EQ(rx_pipe->GetReleaseStats().held_bytes, 0);
+}
+
+TEST(TestRxPipe, PrefetchVariableSizePkts) {
+  constexpr uint32_t kNbPkts = 8;
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // Packet `i` takes `(i % 3 + 1) * 64` bytes.
+  uint32_t nb_bytes = 0;
+  for (uint32_t i = 0; i < kNbPkts; ++i) {
+    nb_bytes += (i % 3 + 1) * kPktSize;
+  }
+  uint8_t* buf = tx_pipe->AllocateBuf(nb_bytes);
+  ASSERT_NE(buf, nullptr);
+  uint8_t* tx_pkt = buf;
+  for (uint32_t i = 0; i < kNbPkts; ++i) {
+    uint32_t pkt_size = (i % 3 + 1) * kPktSize;
+    fill_pkt(tx_pkt, i);
+    grow_pkt(tx_pkt, pkt_size);
+    tx_pkt += pkt_size;
+  }
+  tx_pipe->SendAndFree(nb_bytes);
+
+  // Wait for all the packets so that the prefetch can go past the limit.
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (rx_pipe->PeekPkts().available_bytes() < nb_bytes &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+
+  // Prefetching ahead must not change which packets are returned.
+  rx_pipe->SetPrefetchDistance(16);
+  auto peek_batch = rx_pipe->PeekPkts(kNbPkts / 2);
+  ASSERT_EQ(peek_batch.available_bytes(), nb_bytes);
+  uint32_t nb_pkts = 0;
+  for (auto pkt : peek_batch) {
+    EXPECT_EQ(pkt[kPktSize - 1], nb_pkts);
+    ++nb_pkts;
+  }
+  EXPECT_EQ(nb_pkts, kNbPkts / 2);
+
+  auto batch = rx_pipe->RecvPkts();
+  batch.SetPrefetchDistance(2);
+  nb_pkts = 0;
+  for (auto pkt : batch) {
+    EXPECT_EQ(pkt[kPktSize - 1], nb_pkts);
+    ++nb_pkts;
+  }
+  EXPECT_EQ(nb_pkts, kNbPkts);
+  EXPECT_EQ(batch.processed_bytes(), nb_bytes);
+  rx_pipe->Clear();
+}
+
+TEST(TestRxPipe, RecvFixedSizePkts) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  send_pkts(tx_pipe, 6, 0);
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (rx_pipe->PeekPkts().available_bytes() < 6 * kPktSize &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+  EXPECT_EQ(enso::get_uniform_pkt_size(rx_pipe->PeekPkts()), kPktSize);
+
+  // Packets are consumed as with `RecvPkts()`, up to the limit.
+  auto batch = rx_pipe->RecvFixedSizePkts<kPktSize>(4);
+  uint32_t nb_pkts = 0;
+  for (auto pkt : batch) {
+    EXPECT_EQ(pkt[kPktSize - 1], nb_pkts);
+    ++nb_pkts;
+  }
+  EXPECT_EQ(nb_pkts, 4);
+  EXPECT_EQ(batch.processed_bytes(), 4 * kPktSize);
+
+  // The remaining packets can be iterated with `As()`.
+  auto peek_batch = rx_pipe->PeekPkts();
+  ASSERT_EQ(peek_batch.available_bytes(), 2 * kPktSize);
+  for (auto pkt : peek_batch.As<enso::FixedSizePktIterator<kPktSize>>()) {
+    EXPECT_EQ(pkt[kPktSize - 1], nb_pkts);
+    ++nb_pkts;
+  }
+  EXPECT_EQ(nb_pkts, 6);
+  rx_pipe->Clear();
+
+  // Packets with different sizes cannot be iterated with a fixed stride.
+  uint8_t* buf = tx_pipe->AllocateBuf(3 * kPktSize);
+  ASSERT_NE(buf, nullptr);
+  fill_pkt(buf, 6);
+  fill_pkt(buf + kPktSize, 7);
+  grow_pkt(buf + kPktSize, 2 * kPktSize);
+  tx_pipe->SendAndFree(3 * kPktSize);
+  deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (rx_pipe->PeekPkts().available_bytes() < 3 * kPktSize &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+  EXPECT_EQ(enso::get_uniform_pkt_size(rx_pipe->PeekPkts()), 0);
+
+  // Unless the limit leaves out the larger packet.
+  EXPECT_EQ(enso::get_uniform_pkt_size(rx_pipe->PeekPkts(1)), kPktSize);
+  rx_pipe->Clear();
+}
+
+TEST(TestTxPipe, SendSegments) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // Segments can be anywhere in pinned memory, here the unused part of the TX
+  // pipe's buffer.
+  uint8_t* buf = tx_pipe->AllocateBuf(3 * kPktSize);
+  ASSERT_NE(buf, nullptr);
+  for (uint32_t i = 0; i < 3; ++i) {
+    fill_pkt(buf + i * kPktSize, i);
+  }
+
+  // Segments are sent in order, regardless of where they are.
+  std::array<enso::TxSegment, 2> segments = {
+      {{buf + 2 * kPktSize, kPktSize}, {buf, kPktSize}}};
+  EXPECT_EQ(tx_pipe->SendSegments(segments.data(), segments.size()), 1);
+  std::vector<uint8_t*> pkts = recv_pkts(rx_pipe, 2);
+  ASSERT_EQ(pkts.size(), 2);
+  EXPECT_EQ(pkts[0][kPktSize - 1], 2);
+  EXPECT_EQ(pkts[1][kPktSize - 1], 0);
+  rx_pipe->Clear();
+
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (tx_pipe->nb_completed_segment_sends() < 1 &&
+         std::chrono::steady_clock::now() < deadline) {
+    tx_pipe->TryExtendBuf();
+  }
+  EXPECT_EQ(tx_pipe->nb_completed_segment_sends(), 1);
+
+  // Misaligned segments are rejected without sending anything.
+  segments = {{{buf, kPktSize}, {buf + 1, kPktSize}}};
+  errno = 0;
+  EXPECT_EQ(tx_pipe->SendSegments(segments.data(), segments.size()), 0);
+  EXPECT_EQ(errno, EINVAL);
+  segments = {{{buf, kPktSize / 2}, {buf + kPktSize, kPktSize}}};
+  EXPECT_EQ(tx_pipe->SendSegments(segments.data(), segments.size()), 0);
+  EXPECT_TRUE(recv_pkts(rx_pipe, 1).empty());
+
+  // The next transmission gets the next sequence number.
+  EXPECT_EQ(tx_pipe->SendSegments(segments.data() + 1, 1), 2);
+  pkts = recv_pkts(rx_pipe, 1);
+  ASSERT_EQ(pkts.size(), 1);
+  EXPECT_EQ(pkts[0][kPktSize - 1], 1);
+}
+
+TEST(TestTxPipe, TrySendAndFree) {
+  // Enough to fill the notification buffer if the NIC falls behind, but few
+  // enough for the RX pipe to hold all of them.
+  constexpr uint32_t kNbPkts = 3 * enso::kNotificationBufSize / 2;
+  static_assert(kNbPkts * kPktSize <= enso::RxPipe::kMaxCapacity);
+
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // The capacity never goes beyond `kMaxCapacity`.
+  EXPECT_EQ(tx_pipe->TryAllocateBuf(enso::TxPipe::kMaxCapacity + kPktSize),
+            nullptr);
+
+  uint32_t nb_sent = 0;
+  uint32_t nb_would_block = 0;
+  for (uint32_t i = 0; i < kNbPkts; ++i) {
+    uint8_t* buf = tx_pipe->TryAllocateBuf(kPktSize);
+    ASSERT_NE(buf, nullptr);
+    fill_pkt(buf, nb_sent);
+    if (tx_pipe->TrySendAndFree(kPktSize) == 0) {
+      ++nb_sent;
+      continue;
+    }
+
+    // Nothing was sent, so the buffer is still allocated.
+    EXPECT_EQ(errno, EAGAIN);
+    EXPECT_EQ(tx_pipe->AllocateBuf(), buf);
+    ++nb_would_block;
+  }
+  EXPECT_EQ(nb_sent + nb_would_block, kNbPkts);
+
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+
+  // Only the packets that were accepted arrive, in order.
+  std::vector<uint8_t*> pkts = recv_pkts(rx_pipe, nb_sent);
+  ASSERT_EQ(pkts.size(), nb_sent);
+  for (uint32_t i = 0; i < nb_sent; ++i) {
+    EXPECT_EQ(pkts[i][kPktSize - 1], (uint8_t)i);
+  }
+  rx_pipe->Clear();
+  EXPECT_EQ(rx_pipe->PeekPkts().available_bytes(), 0);
+}
+
+TEST(TestSharedTxPipe, MultipleProducers) {
+  constexpr uint32_t kNbThreads = 4;
+  constexpr uint32_t kNbPktsPerThread = 256;
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::SharedTxPipe* tx_pipe = device->AllocateSharedTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // Packets carry the thread in their second-to-last byte. Every other
+  // reservation holds two packets.
+  std::vector<std::thread> producers;
+  for (uint32_t thread_id = 0; thread_id < kNbThreads; ++thread_id) {
+    producers.emplace_back([tx_pipe, thread_id]() {
+      for (uint32_t i = 0; i < kNbPktsPerThread;) {
+        uint32_t nb_pkts = (i % 4 == 0) ? 2 : 1;
+        auto reservation = tx_pipe->Reserve(nb_pkts * kPktSize);
+        for (uint32_t j = 0; j < nb_pkts; ++j, ++i) {
+          uint8_t* pkt = reservation.buf + j * kPktSize;
+          fill_pkt(pkt, i);
+          pkt[kPktSize - 2] = thread_id;
+        }
+        tx_pipe->Submit(reservation);
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  // Each thread's packets arrive in the order in which they were reserved.
+  std::vector<uint8_t*> pkts =
+      recv_pkts(rx_pipe, kNbThreads * kNbPktsPerThread);
+  ASSERT_EQ(pkts.size(), kNbThreads * kNbPktsPerThread);
+  std::array<uint32_t, kNbThreads> nb_pkts = {};
+  for (uint8_t* pkt : pkts) {
+    uint8_t thread_id = pkt[kPktSize - 2];
+    ASSERT_LT(thread_id, kNbThreads);
+    EXPECT_EQ(pkt[kPktSize - 1], (uint8_t)nb_pkts[thread_id]);
+    ++nb_pkts[thread_id];
+  }
+  for (uint32_t count : nb_pkts) {
+    EXPECT_EQ(count, kNbPktsPerThread);
+  }
+  rx_pipe->Clear();
+}
+
+TEST(TestRxTxPipe, SendAndFreeCompacted) {
+  for (auto mode : {enso::RxTxPipe::CompactionMode::kInPlace,
+                    enso::RxTxPipe::CompactionMode::kPerRun}) {
+    auto device = enso::Device::Create();
+    ASSERT_NE(device, nullptr);
+    enso::RxTxPipe* rx_tx_pipe = device->AllocateRxTxPipe();
+    ASSERT_NE(rx_tx_pipe, nullptr);
+    ASSERT_EQ(rx_tx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+    enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+    ASSERT_NE(tx_pipe, nullptr);
+
+    send_pkts(tx_pipe, 6, 0);
+    std::vector<uint8_t*> pkts = recv_pkts(rx_tx_pipe, 6);
+    ASSERT_EQ(pkts.size(), 6);
+
+    // Drops two separate runs. Echoed packets come back to the same pipe.
+    rx_tx_pipe->DropPkt(pkts[1]);
+    rx_tx_pipe->DropPkt(pkts[3]);
+    rx_tx_pipe->DropPkt(pkts[4]);
+    rx_tx_pipe->SendAndFreeCompacted(6 * kPktSize, mode);
+
+    pkts = recv_pkts(rx_tx_pipe, 3);
+    ASSERT_EQ(pkts.size(), 3);
+    EXPECT_EQ(pkts[0][kPktSize - 1], 0);
+    EXPECT_EQ(pkts[1][kPktSize - 1], 2);
+    EXPECT_EQ(pkts[2][kPktSize - 1], 5);
+    rx_tx_pipe->SendAndFree(3 * kPktSize);
+
+    // Dropping a whole batch sends nothing but still frees the pipe.
+    pkts = recv_pkts(rx_tx_pipe, 3);
+    ASSERT_EQ(pkts.size(), 3);
+    for (uint8_t* pkt : pkts) {
+      rx_tx_pipe->DropPkt(pkt);
+    }
+    rx_tx_pipe->SendAndFreeCompacted(3 * kPktSize, mode);
+    EXPECT_TRUE(recv_pkts(rx_tx_pipe, 1).empty());
+
+    send_pkts(tx_pipe, 1, 6);
+    pkts = recv_pkts(rx_tx_pipe, 1);
+    ASSERT_EQ(pkts.size(), 1);
+    EXPECT_EQ(pkts[0][kPktSize - 1], 6);
+  }
+}
+
+TEST(TestDevice, PipeNotifiedOnce) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  // Prefetching would make the NIC notify the pipe again.
+  enso::PollPolicy policy;
+  policy.mode = enso::PollMode::kThroughput;
+  ASSERT_EQ(device->SetPollPolicy(policy), 0);
+
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // Every transmission makes the NIC send a notification for the pipe.
+  for (uint32_t i = 0; i < 4; ++i) {
+    send_pkts(tx_pipe, 1, i);
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
+  }
+
+  enso::RxPipe* next_pipe = nullptr;
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (next_pipe == nullptr && std::chrono::steady_clock::now() < deadline) {
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  ASSERT_EQ(next_pipe, rx_pipe);
+  EXPECT_EQ(recv_pkts(rx_pipe, 4).size(), 4);
+  rx_pipe->Clear();
+
+  // The pipe is only queued once, however many notifications it got.
+  EXPECT_EQ(device->NextRxPipeToRecv(), nullptr);
+}
+
+TEST(TestDevice, TxDoorbellCoalescing) {
+  constexpr std::chrono::milliseconds kNicDelay(20);
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  // Without prefetching, `NextRxPipeToRecv()` would also return the pipe for
+  // notifications that `Recv()` already consumed.
+  ASSERT_EQ(device->SetPollPolicy(enso::PollPolicy()), 0);
+
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // The NIC only sees the sends once the notification threshold is reached.
+  device->SetTxDoorbellCoalescing(3);
+  send_pkts(tx_pipe, 1, 0);
+  send_pkts(tx_pipe, 1, 1);
+  std::this_thread::sleep_for(kNicDelay);
+  EXPECT_EQ(rx_pipe->PeekPkts().available_bytes(), 0);
+  send_pkts(tx_pipe, 1, 2);
+  std::vector<uint8_t*> pkts = recv_pkts(rx_pipe, 3);
+  ASSERT_EQ(pkts.size(), 3);
+  for (uint32_t i = 0; i < pkts.size(); ++i) {
+    EXPECT_EQ(pkts[i][kPktSize - 1], i);
+  }
+  rx_pipe->Clear();
+
+  // Same with the byte threshold.
+  device->SetTxDoorbellCoalescing(100, 2 * kPktSize);
+  send_pkts(tx_pipe, 1, 3);
+  std::this_thread::sleep_for(kNicDelay);
+  EXPECT_EQ(rx_pipe->PeekPkts().available_bytes(), 0);
+  send_pkts(tx_pipe, 1, 4);
+  EXPECT_EQ(recv_pkts(rx_pipe, 2).size(), 2);
+  rx_pipe->Clear();
+
+  // Held back sends are flushed by `FlushTx()`.
+  device->SetTxDoorbellCoalescing(100);
+  send_pkts(tx_pipe, 1, 5);
+  std::this_thread::sleep_for(kNicDelay);
+  EXPECT_EQ(rx_pipe->PeekPkts().available_bytes(), 0);
+  device->FlushTx();
+  EXPECT_EQ(recv_pkts(rx_pipe, 1).size(), 1);
+  rx_pipe->Clear();
+
+  // Disabling coalescing notifies the NIC on every send.
+  device->SetTxDoorbellCoalescing(1);
+  send_pkts(tx_pipe, 1, 6);
+  EXPECT_EQ(recv_pkts(rx_pipe, 1).size(), 1);
+  rx_pipe->Clear();
+
+  // And at the start of the next poll.
+  device->SetTxDoorbellCoalescing(100);
+  send_pkts(tx_pipe, 1, 7);
+  std::this_thread::sleep_for(kNicDelay);
+  EXPECT_EQ(rx_pipe->PeekPkts().available_bytes(), 0);
+  enso::RxPipe* next_pipe = nullptr;
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (next_pipe == nullptr && std::chrono::steady_clock::now() < deadline) {
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  EXPECT_EQ(next_pipe, rx_pipe);
+  pkts = recv_pkts(rx_pipe, 1);
+  ASSERT_EQ(pkts.size(), 1);
+  EXPECT_EQ(pkts[0][kPktSize - 1], 7);
+}
+
+TEST(TestDevice, RecvBurst) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  constexpr uint32_t kNbPipes = 3;
+  std::array<enso::RxPipe*, kNbPipes> rx_pipes;
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    rx_pipes[i] = device->AllocateRxPipe();
+    ASSERT_NE(rx_pipes[i], nullptr);
+    ASSERT_EQ(rx_pipes[i]->Bind(kDstPort + i, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  }
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // Two sends, and therefore two notifications, for the first pipe.
+  send_pkts(tx_pipe, 2, 0, kDstPort);
+  send_pkts(tx_pipe, 1, 2, kDstPort);
+  send_pkts(tx_pipe, 3, 0, kDstPort + 1);
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+
+  std::array<enso::PipeBatch, kNbPipes> batches;
+  std::array<uint32_t, kNbPipes> nb_bytes = {};
+
+  // Returns no more entries than requested.
+  EXPECT_EQ(device->RecvBurst(batches.data(), 1), 1);
+  uint32_t nb_batches = 1;
+  uint32_t total_bytes = 0;
+  deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (true) {
+    std::array<bool, kNbPipes> seen = {};
+    for (uint32_t i = 0; i < nb_batches; ++i) {
+      uint32_t pipe_idx = 0;
+      while (pipe_idx < kNbPipes && rx_pipes[pipe_idx] != batches[i].pipe) {
+        ++pipe_idx;
+      }
+      ASSERT_LT(pipe_idx, kNbPipes);
+
+      // Notifications for the same pipe are coalesced into a single entry.
+      EXPECT_FALSE(seen[pipe_idx]);
+      seen[pipe_idx] = true;
+
+      ASSERT_EQ(batches[i].length % kPktSize, 0);
+      for (uint32_t j = 0; j < batches[i].length / kPktSize; ++j) {
+        uint8_t* pkt = batches[i].buf + j * kPktSize;
+        EXPECT_EQ(pkt[kPktSize - 1], nb_bytes[pipe_idx] / kPktSize + j);
+      }
+      nb_bytes[pipe_idx] += batches[i].length;
+      total_bytes += batches[i].length;
+    }
+    if (total_bytes >= 6 * kPktSize ||
+        std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    nb_batches = device->RecvBurst(batches.data(), kNbPipes);
+  }
+
+  EXPECT_EQ(nb_bytes[0], 3 * kPktSize);
+  EXPECT_EQ(nb_bytes[1], 3 * kPktSize);
+  EXPECT_EQ(nb_bytes[2], 0);
+
+  for (enso::RxPipe* rx_pipe : rx_pipes) {
+    rx_pipe->Clear();
+  }
+  EXPECT_EQ(device->RecvBurst(batches.data(), kNbPipes), 0);
+}
+
+TEST(TestDevice, RxHeadCoalescing) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  // Without prefetching, `NextRxPipeToRecv()` would also return the pipe for
+  // notifications that `Recv()` already consumed, so it would not be idle.
+  ASSERT_EQ(device->SetPollPolicy(enso::PollPolicy()), 0);
+
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  constexpr uint64_t kMaxCycles = 100000000;
+  device->SetRxHeadCoalescing(4 * kPktSize, kMaxCycles);
+
+  // Freeing less than `min_bytes` holds the head back.
+  send_pkts(tx_pipe, 3, 0);
+  uint8_t* buf;
+  uint32_t nb_bytes = 0;
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (nb_bytes < 3 * kPktSize &&
+         std::chrono::steady_clock::now() < deadline) {
+    nb_bytes += rx_pipe->Recv(&buf, 3 * kPktSize - nb_bytes);
+  }
+  ASSERT_EQ(nb_bytes, 3 * kPktSize);
+  rx_pipe->Free(nb_bytes);
+
+  enso::RxHeadStats stats = device->GetRxHeadStats();
+  EXPECT_EQ(stats.nb_head_writes, 0);
+#ifdef ENSO_STATS
+  // Packets received with `Recv()` are counted too.
+  EXPECT_EQ(stats.nb_pkts, 3);
+#endif  // ENSO_STATS
+
+  // Once the time budget elapses, polling an idle device writes the head.
+  uint64_t start = __rdtsc();
+  while (__rdtsc() - start < kMaxCycles) {
+  }
+  EXPECT_EQ(device->NextRxPipeToRecv(), nullptr);
+  EXPECT_EQ(device->GetRxHeadStats().nb_head_writes, 1);
+
+  // Reaching `min_bytes` writes the head right away.
+  send_pkts(tx_pipe, 4, 3);
+  std::vector<uint8_t*> pkts = recv_pkts(rx_pipe, 4);
+  ASSERT_EQ(pkts.size(), 4);
+  rx_pipe->Clear();
+  stats = device->GetRxHeadStats();
+  EXPECT_EQ(stats.nb_head_writes, 2);
+#ifdef ENSO_STATS
+  EXPECT_EQ(stats.nb_pkts, 7);
+#endif  // ENSO_STATS
+}
+
+TEST(TestDevice, AdaptivePollPolicy) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  constexpr uint32_t kNbPipes = 4;
+  std::array<enso::RxPipe*, kNbPipes> rx_pipes;
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    rx_pipes[i] = device->AllocateRxPipe();
+    ASSERT_NE(rx_pipes[i], nullptr);
+    ASSERT_EQ(rx_pipes[i]->Bind(kDstPort + i, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  }
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  enso::PollPolicy policy;
+  policy.mode = enso::PollMode::kAdaptive;
+  policy.adaptive_window = kNbPipes;
+  policy.adaptive_idle_threshold = 0.9;
+  EXPECT_EQ(device->SetPollPolicy(policy), -1);
+  EXPECT_EQ(errno, EINVAL);
+
+  policy.adaptive_idle_threshold = 0.5;
+  ASSERT_EQ(device->SetPollPolicy(policy), 0);
+  EXPECT_EQ(device->active_poll_mode(), enso::PollMode::kLatency);
+
+  // A window where every poll returns a pipe switches to the throughput
+  // profile.
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    send_pkts(tx_pipe, 1, i, kDstPort + i);
+  }
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    enso::RxPipe* rx_pipe = device->NextRxPipeToRecv();
+    ASSERT_NE(rx_pipe, nullptr);
+    EXPECT_EQ(recv_pkts(rx_pipe, 1).size(), 1);
+    rx_pipe->Clear();
+  }
+  EXPECT_EQ(device->active_poll_mode(), enso::PollMode::kThroughput);
+
+  // And a window of idle polls switches back.
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    EXPECT_EQ(device->NextRxPipeToRecv(), nullptr);
+  }
+  EXPECT_EQ(device->active_poll_mode(), enso::PollMode::kLatency);
+
+  // Fixed modes never switch.
+  policy.mode = enso::PollMode::kThroughput;
+  ASSERT_EQ(device->SetPollPolicy(policy), 0);
+  EXPECT_EQ(device->active_poll_mode(), enso::PollMode::kThroughput);
+  for (uint32_t i = 0; i < 2 * kNbPipes; ++i) {
+    EXPECT_EQ(device->NextRxPipeToRecv(), nullptr);
+  }
+  EXPECT_EQ(device->active_poll_mode(), enso::PollMode::kThroughput);
+
+  // Pipes are still returned after switching profiles.
+  send_pkts(tx_pipe, 1, 0, kDstPort);
+  enso::RxPipe* next_pipe = nullptr;
+  deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (next_pipe == nullptr && std::chrono::steady_clock::now() < deadline) {
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  EXPECT_EQ(next_pipe, rx_pipes[0]);
+}
+
+TEST(TestDevice, PrefetchUpcomingRxPipes) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  // The latency profile prefetches, even with `latency_opt=false`.
+  ASSERT_EQ(device->SetPollPolicy(enso::PollPolicy()), 0);
+
+  EXPECT_EQ(device->SetRxPrefetchLatency(0), -1);
+  EXPECT_EQ(errno, EINVAL);
+
+  // Too long for any poll loop to hide it with a single pipe.
+  ASSERT_EQ(device->SetRxPrefetchLatency(1ULL << 40), 0);
+
+  constexpr uint32_t kNbPipes = 4;
+  std::array<enso::RxPipe*, kNbPipes> rx_pipes;
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    rx_pipes[i] = device->AllocateRxPipe();
+    ASSERT_NE(rx_pipes[i], nullptr);
+    ASSERT_EQ(rx_pipes[i]->Bind(kDstPort + i, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  }
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    send_pkts(tx_pipe, 1, i, kDstPort + i);
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
+  }
+
+  // Pipes are returned in order, and each of them is prefetched (i.e., its
+  // head is written) only once, whether it is the returned pipe or one that
+  // follows it.
+  enso::RxPipe* next_pipe = nullptr;
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (next_pipe == nullptr && std::chrono::steady_clock::now() < deadline) {
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  EXPECT_EQ(next_pipe, rx_pipes[0]);
+  for (uint32_t i = 1; i < kNbPipes; ++i) {
+    EXPECT_EQ(device->NextRxPipeToRecv(), rx_pipes[i]);
+  }
+  EXPECT_EQ(device->GetRxHeadStats().nb_head_writes, kNbPipes);
+
+  // Calls that are much closer than the latency prefetch further ahead.
+  EXPECT_GT(device->rx_prefetch_lookahead(), 1);
+
+  // And a latency shorter than the time between calls only needs the
+  // returned pipe.
+  ASSERT_EQ(device->SetRxPrefetchLatency(1), 0);
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    EXPECT_EQ(recv_pkts(rx_pipes[i], 1).size(), 1);
+    rx_pipes[i]->Clear();
+  }
+  send_pkts(tx_pipe, 1, 0, kDstPort);
+  next_pipe = nullptr;
+  deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (next_pipe == nullptr && std::chrono::steady_clock::now() < deadline) {
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  EXPECT_EQ(next_pipe, rx_pipes[0]);
+  EXPECT_EQ(device->rx_prefetch_lookahead(), 1);
+}
+
+TEST(TestDevice, AdaptiveNotificationBatch) {
+  constexpr uint32_t kMaxBatchSize = 4 * enso::kBatchSize;
+  constexpr uint32_t kNbNotifications = enso::kBatchSize + 8;
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+
+  enso::PollPolicy policy;
+  policy.mode = enso::PollMode::kThroughput;
+  policy.throughput = {false, kMaxBatchSize, true, 0, 0, 1, 0};
+  ASSERT_EQ(device->SetPollPolicy(policy), 0);
+  EXPECT_EQ(device->GetNotificationStats().batch_size, enso::kBatchSize);
+
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  // Waiting for every transmission makes the NIC notify each of them.
+  for (uint32_t i = 0; i < kNbNotifications; ++i) {
+    send_pkts(tx_pipe, 1, i);
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
+  }
+
+  // A scan that fills the batch grows it.
+  enso::RxPipe* next_pipe = nullptr;
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (next_pipe == nullptr && std::chrono::steady_clock::now() < deadline) {
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  ASSERT_EQ(next_pipe, rx_pipe);
+  EXPECT_EQ(device->GetNotificationStats().batch_size,
+            enso::kBatchSize + enso::kNotifBatchSizeStep);
+
+  // The pipe only sees the tails of the notifications consumed so far.
+  uint32_t nb_pkts = 0;
+  deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (nb_pkts < kNbNotifications &&
+         std::chrono::steady_clock::now() < deadline) {
+    if (next_pipe != nullptr) {
+      for ([[maybe_unused]] auto pkt : next_pipe->RecvPkts()) {
+        ++nb_pkts;
+      }
+      next_pipe->Clear();
+    }
+    next_pipe = device->NextRxPipeToRecv();
+  }
+  EXPECT_EQ(nb_pkts, kNbNotifications);
+
+  // Windows of empty scans shrink it, down to the minimum.
+  for (uint32_t i = 0; i < 8 * enso::kNotifBatchWindow; ++i) {
+    device->NextRxPipeToRecv();
+  }
+  EXPECT_EQ(device->GetNotificationStats().batch_size,
+            enso::kMinNotifBatchSize);
+
+  // Without adaptation, the batch size is fixed.
+  policy.throughput.adaptive_notification_batch = false;
+  ASSERT_EQ(device->SetPollPolicy(policy), 0);
+  for (uint32_t i = 0; i < 2 * enso::kNotifBatchWindow; ++i) {
+    EXPECT_EQ(device->NextRxPipeToRecv(), nullptr);
+  }
+  EXPECT_EQ(device->GetNotificationStats().batch_size, kMaxBatchSize);
+}
+
+TEST(TestDevice, WaitForRx) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::RxPipe* rx_pipe = device->AllocateRxPipe();
+  ASSERT_NE(rx_pipe, nullptr);
+  ASSERT_EQ(rx_pipe->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), 0);
+  device->SetRxBusyPollBudget(0);
+
+  // Times out when there is nothing to receive.
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(device->WaitForRx(10000), 0);
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(10));
+
+  // Wakes up once another thread sends to the pipe.
+  std::thread sender([] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto sender_device = enso::Device::Create();
+    ASSERT_NE(sender_device, nullptr);
+    enso::TxPipe* tx_pipe = sender_device->AllocateTxPipe();
+    ASSERT_NE(tx_pipe, nullptr);
+    send_pkts(tx_pipe, 1, 0);
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
+  });
+  int ret = device->WaitForRx(
+      std::chrono::duration_cast<std::chrono::microseconds>(kTimeout).count());
+  sender.join();
+  EXPECT_EQ(ret, 1);
+#ifdef ENSO_STATS
+  enso::RxWaitStats stats = device->GetRxWaitStats();
+  EXPECT_EQ(stats.nb_waits, 2);
+  EXPECT_EQ(stats.nb_timeouts, 1);
+  EXPECT_GE(stats.nb_wakeups, 1);
+#endif  // ENSO_STATS
+  EXPECT_EQ(device->NextRxPipeToRecv(), rx_pipe);
+  EXPECT_EQ(recv_pkts(rx_pipe, 1).size(), 1);
+}
+
+TEST(TestDeviceGroup, BindStartStop) {
+  constexpr uint32_t kNbShards = 2;
+  constexpr uint32_t kNbPipesPerCore = 2;
+  constexpr uint32_t kNbPipes = kNbShards * kNbPipesPerCore;
+
+  // Both shards share a core so that the test runs on any machine.
+  enso::DeviceGroupConfig config;
+  config.core_ids = std::vector<uint32_t>(kNbShards, 0);
+  config.nb_pipes_per_core = kNbPipesPerCore;
+  config.rx_tx_pipes = false;
+  auto group = enso::DeviceGroup::Create(config);
+  ASSERT_NE(group, nullptr);
+  EXPECT_EQ(group->nb_shards(), kNbShards);
+  EXPECT_EQ(group->nb_pipes(), kNbPipes);
+
+  // Flows are assigned to the pipes round-robin.
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    EXPECT_EQ(group->Bind(kDstPort + i, 0, kDstIp, 0, IPPROTO_UDP), i);
+  }
+
+  EXPECT_EQ(group->Start(nullptr), -1);
+
+  // The first shard sends one packet to every flow once all shards applied
+  // their bindings. Each shard then records the flow received by each pipe.
+  std::atomic<uint32_t> nb_initialized = 0;
+  std::array<std::atomic<int32_t>, kNbPipes> received_ids;
+  for (auto& id : received_ids) {
+    id = -1;
+  }
+  auto init = [&nb_initialized](enso::DeviceGroup::Shard& shard) {
+    if (shard.index == 0) {
+      shard.context = shard.device->AllocateTxPipe();
+    }
+    ++nb_initialized;
+  };
+  auto poll = [&nb_initialized,
+               &received_ids](enso::DeviceGroup::Shard& shard) {
+    if (shard.context != nullptr && nb_initialized.load() == kNbShards) {
+      enso::TxPipe* tx_pipe = (enso::TxPipe*)shard.context;
+      for (uint32_t i = 0; i < kNbPipes; ++i) {
+        send_pkts(tx_pipe, 1, i, kDstPort + i);
+      }
+      shard.context = nullptr;
+    }
+    for (uint32_t i = 0; i < shard.rx_pipes.size(); ++i) {
+      enso::RxPipe* rx_pipe = shard.rx_pipes[i];
+      for (auto pkt : rx_pipe->RecvPkts()) {
+        received_ids[shard.index * kNbPipesPerCore + i] = pkt[kPktSize - 1];
+      }
+      rx_pipe->Clear();
+    }
+  };
+  ASSERT_EQ(group->Start(poll, init), 0);
+
+  // Cannot bind or start again once started.
+  EXPECT_EQ(group->Bind(kDstPort, 0, kDstIp, 0, IPPROTO_UDP), -1);
+  EXPECT_EQ(group->Start(poll), -1);
+
+  auto all_received = [&received_ids]() {
+    for (auto& id : received_ids) {
+      if (id.load() < 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (!all_received() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  group->Stop();
+
+  for (uint32_t i = 0; i < kNbPipes; ++i) {
+    EXPECT_EQ(received_ids[i].load(), i);
+  }
+}
+
+TEST(TestSocket, ShutDownWhileQueued) {
+  auto device = enso::Device::Create();
+  ASSERT_NE(device, nullptr);
+  enso::TxPipe* tx_pipe = device->AllocateTxPipe();
+  ASSERT_NE(tx_pipe, nullptr);
+
+  std::array<int, 3> socket_fds;
+  for (uint32_t i = 0; i < socket_fds.size(); ++i) {
+    socket_fds[i] = enso::socket(AF_INET, SOCK_DGRAM, 0, false);
+    ASSERT_GE(socket_fds[i], 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kDstPort + 1 + i);
+    addr.sin_addr.s_addr = htonl(kDstIp);
+    ASSERT_EQ(enso::bind(socket_fds[i], (struct sockaddr*)&addr, sizeof(addr)),
+              0);
+  }
+
+  // Receives from any socket until one has data or the timeout expires.
+  auto recv_any = [&socket_fds](int* socket_fd) {
+    void* buf;
+    ssize_t nb_bytes = 0;
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (nb_bytes == 0 && std::chrono::steady_clock::now() < deadline) {
+      nb_bytes = enso::recv_select(socket_fds[0], socket_fd, &buf, 0, 0);
+    }
+    if (nb_bytes > 0) {
+      enso::free_enso_pipe(*socket_fd, nb_bytes);
+    }
+    return nb_bytes;
+  };
+
+  // Both sockets are queued once the first one is received from.
+  send_pkts(tx_pipe, 1, 0, kDstPort + 1);
+  send_pkts(tx_pipe, 1, 1, kDstPort + 2);
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (tx_pipe->TryExtendBuf() < enso::TxPipe::kMaxCapacity &&
+         std::chrono::steady_clock::now() < deadline) {
+  }
+  int socket_fd = -1;
+  EXPECT_EQ(recv_any(&socket_fd), kPktSize);
+  EXPECT_EQ(socket_fd, socket_fds[0]);
+
+  // The second socket is no longer returned once it is shut down.
+  enso::shutdown(socket_fds[1], 0);
+  EXPECT_EQ(recv_any(&socket_fd), 0);
+
+  // Other sockets are still notified.
+  send_pkts(tx_pipe, 1, 2, kDstPort + 3);
+  EXPECT_EQ(recv_any(&socket_fd), kPktSize);
+  EXPECT_EQ(socket_fd, socket_fds[2]);
+
+  enso::shutdown(socket_fds[2], 0);
+  enso::shutdown(socket_fds[0], 0);
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <enso/helpers.h>
+#include <enso/pkt_headers.h>
+#include <gtest/gtest.h>
+#include <netinet/ether.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kPktBufSize = 256;
+
+// Writes an Ethernet header with the given VLAN tags and returns the offset of
+// the L3 header.
+uint32_t write_l2_header(uint8_t* pkt, uint16_t ether_type,
+                         const std::vector<uint16_t>& vlan_tpids = {}) {
+  uint16_t* types =
+      (uint16_t*)(pkt + offsetof(struct ether_header, ether_type));
+  for (uint16_t tpid : vlan_tpids) {
+    *types = htons(tpid);
+    types += 2;  // Skips the TCI.
+  }
+  *types = htons(ether_type);
+  return sizeof(struct ether_header) + vlan_tpids.size() * 4;
+}
+
+void write_ipv4_header(uint8_t* l3, uint16_t tot_len, uint8_t protocol,
+                       uint8_t ihl = 5) {
+  struct iphdr* ip = (struct iphdr*)l3;
+  ip->version = 4;
+  ip->ihl = ihl;
+  ip->tot_len = htons(tot_len);
+  ip->protocol = protocol;
+  ip->saddr = htonl(0xc0a80001);
+  ip->daddr = htonl(0xc0a80002);
+}
+
+void write_ipv6_header(uint8_t* l3, uint16_t payload_len, uint8_t next_header) {
+  struct ip6_hdr* ip = (struct ip6_hdr*)l3;
+  ip->ip6_plen = htons(payload_len);
+  ip->ip6_nxt = next_header;
+}
+
+}  // namespace
+
+TEST(TestPktLen, Ipv4) {
+  uint8_t pkt[kPktBufSize] = {};
+  uint32_t l3_offset = write_l2_header(pkt, ETHERTYPE_IP);
+  write_ipv4_header(pkt + l3_offset, 100, IPPROTO_UDP);
+
+  EXPECT_EQ(enso::get_pkt_len(pkt), 114);
+}
+
+TEST(TestPktLen, Vlan) {
+  uint8_t pkt[kPktBufSize] = {};
+  uint32_t l3_offset = write_l2_header(pkt, ETHERTYPE_IP, {ETHERTYPE_VLAN});
+  write_ipv4_header(pkt + l3_offset, 100, IPPROTO_UDP);
+
+  EXPECT_EQ(l3_offset, 18);
+  EXPECT_EQ(enso::get_pkt_len(pkt), 118);
+  EXPECT_EQ(enso::get_next_pkt(pkt), pkt + 128);
+}
+
+TEST(TestPktLen, QinQ) {
+  uint8_t pkt[kPktBufSize] = {};
+  uint32_t l3_offset = write_l2_header(pkt, ETHERTYPE_IP,
+                                       {enso::kEtherTypeQinQ, ETHERTYPE_VLAN});
+  write_ipv4_header(pkt + l3_offset, 100, IPPROTO_UDP);
+
+  EXPECT_EQ(l3_offset, 22);
+  EXPECT_EQ(enso::get_pkt_len(pkt), 122);
+}
+
+TEST(TestPktLen, Ipv6) {
+  uint8_t pkt[kPktBufSize] = {};
+  uint32_t l3_offset = write_l2_header(pkt, ETHERTYPE_IPV6);
+  ((struct ip6_hdr*)(pkt + l3_offset))->ip6_plen = htons(100);
+
+  EXPECT_EQ(enso::get_pkt_len(pkt), 14 + 40 + 100);
+}
+
+TEST(TestPktLen, VlanIpv6) {
+  uint8_t pkt[kPktBufSize] = {};
+  uint32_t l3_offset = write_l2_header(pkt, ETHERTYPE_IPV6, {ETHERTYPE_VLAN});
+  ((struct ip6_hdr*)(pkt + l3_offset))->ip6_plen = htons(100);
+
+  EXPECT_EQ(enso::get_pkt_len(pkt), 18 + 40 + 100);
+}
+
+TEST(TestPktLen, UnknownEtherType) {
+  uint8_t pkt[kPktBufSize] = {};
+  write_l2_header(pkt, ETHERTYPE_ARP);
+
+  EXPECT_EQ(enso::get_pkt_len(pkt), 64);
+  EXPECT_EQ(enso::get_pkt_len(pkt, 128), 128);
+}
+
+// Compares the vectorized header extraction with the scalar one on a batch
+// that mixes packet types and does not fill the last vector.
+TEST(TestPktHeaders, MatchesScalar) {
+  constexpr uint32_t kNbPkts = 45;
+  std::vector<uint8_t> buf(kNbPkts * kPktBufSize + kPktBufSize);
+  std::mt19937 rng(42);
+
+  uint32_t offset = 0;
+  for (uint32_t i = 0; i < kNbPkts; ++i) {
+    uint8_t* pkt = buf.data() + offset;
+    for (uint32_t j = 0; j < kPktBufSize; ++j) {
+      pkt[j] = rng();
+    }
+
+    uint16_t tot_len = 46 + rng() % 150;
+    uint32_t l3_offset;
+    switch (i % 10) {
+      case 0:  // UDP.
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IP);
+        write_ipv4_header(pkt + l3_offset, tot_len, IPPROTO_UDP);
+        break;
+      case 1:  // TCP with IP options.
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IP);
+        write_ipv4_header(pkt + l3_offset, tot_len, IPPROTO_TCP, 7);
+        break;
+      case 2:  // No ports.
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IP);
+        write_ipv4_header(pkt + l3_offset, tot_len, IPPROTO_ICMP);
+        break;
+      case 3:  // Truncated before the ports.
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IP);
+        write_ipv4_header(pkt + l3_offset, 22, IPPROTO_UDP);
+        break;
+      case 4:
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IPV6);
+        write_ipv6_header(pkt + l3_offset, tot_len, IPPROTO_UDP);
+        break;
+      case 5:
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IP, {ETHERTYPE_VLAN});
+        write_ipv4_header(pkt + l3_offset, tot_len, IPPROTO_UDP);
+        break;
+      case 6:
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IP,
+                                    {enso::kEtherTypeQinQ, ETHERTYPE_VLAN});
+        write_ipv4_header(pkt + l3_offset, tot_len, IPPROTO_TCP, 6);
+        break;
+      case 7:
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IPV6, {ETHERTYPE_VLAN});
+        write_ipv6_header(pkt + l3_offset, tot_len, IPPROTO_TCP);
+        break;
+      case 8:  // Hop-by-hop extension header, so no ports.
+        l3_offset = write_l2_header(pkt, ETHERTYPE_IPV6);
+        write_ipv6_header(pkt + l3_offset, tot_len, IPPROTO_HOPOPTS);
+        break;
+      default:
+        write_l2_header(pkt, ETHERTYPE_ARP);
+        break;
+    }
+
+    uint16_t pkt_len = enso::get_pkt_len(pkt);
+    offset += ((pkt_len - 1) / 64 + 1) * 64;
+  }
+
+  enso::PktHeaders<64> headers;
+  EXPECT_EQ(enso::parse_pkt_headers(buf.data(), offset, &headers), offset);
+  ASSERT_EQ(headers.nb_pkts, kNbPkts);
+
+  enso::PktHeaders<64> expected = headers;
+  for (uint32_t i = 0; i < kNbPkts; ++i) {
+    enso::fill_pkt_header_fields_scalar(&expected, i);
+  }
+
+  for (uint32_t i = 0; i < kNbPkts; ++i) {
+    SCOPED_TRACE(i);
+    EXPECT_EQ(headers.ether_type[i], expected.ether_type[i]);
+    EXPECT_EQ(headers.src_ip[i], expected.src_ip[i]);
+    EXPECT_EQ(headers.dst_ip[i], expected.dst_ip[i]);
+    EXPECT_EQ(headers.src_port[i], expected.src_port[i]);
+    EXPECT_EQ(headers.dst_port[i], expected.dst_port[i]);
+    EXPECT_EQ(headers.l4_offset[i], expected.l4_offset[i]);
+    EXPECT_EQ(headers.protocol[i], expected.protocol[i]);
+  }
+
+  // Sanity check the reference itself.
+  EXPECT_EQ(expected.dst_ip[0], 0xc0a80002);
+  EXPECT_EQ(expected.l4_offset[1], 14 + 7 * 4);
+  EXPECT_EQ(expected.src_port[2], 0);
+  EXPECT_EQ(expected.dst_port[3], 0);
+  EXPECT_EQ(expected.ether_type[4], ETHERTYPE_IPV6);
+  EXPECT_EQ(expected.src_ip[4], 0);
+  EXPECT_EQ(expected.protocol[4], IPPROTO_UDP);
+  EXPECT_EQ(expected.l4_offset[4], 14 + 40);
+  EXPECT_EQ(expected.ether_type[5], ETHERTYPE_IP);
+  EXPECT_EQ(expected.dst_ip[5], 0xc0a80002);
+  EXPECT_EQ(expected.l4_offset[5], 18 + 20);
+  EXPECT_EQ(expected.dst_ip[6], 0xc0a80002);
+  EXPECT_EQ(expected.protocol[6], IPPROTO_TCP);
+  EXPECT_EQ(expected.l4_offset[6], 22 + 24);
+  EXPECT_EQ(expected.l4_offset[7], 18 + 40);
+  EXPECT_EQ(expected.protocol[7], IPPROTO_TCP);
+  EXPECT_EQ(expected.protocol[8], IPPROTO_HOPOPTS);
+  EXPECT_EQ(expected.dst_port[8], 0);
+  EXPECT_EQ(expected.ether_type[9], ETHERTYPE_ARP);
+  EXPECT_EQ(expected.l4_offset[9], 0);
+
+  // Ports are read from the right place in tagged and IPv6 packets.
+  for (uint32_t i : {5, 6, 7}) {
+    SCOPED_TRACE(i);
+    const uint8_t* pkt = buf.data() + expected.offset[i];
+    const struct udphdr* l4_hdr =
+        (const struct udphdr*)(pkt + expected.l4_offset[i]);
+    EXPECT_EQ(expected.dst_port[i], ntohs(l4_hdr->dest));
+  }
+}
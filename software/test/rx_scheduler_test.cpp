@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2023, Carnegie Mellon University
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted (subject to the limitations in the disclaimer
+ * below) provided that the following conditions are met:
+ *
+ *      * Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE GRANTED BY
+ * THIS LICENSE. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <enso/consts.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+
+#include "../src/rx_scheduler.h"
+
+TEST(TestRxScheduler, Empty) {
+  enso::RxScheduler scheduler;
+  EXPECT_TRUE(scheduler.empty());
+  EXPECT_EQ(scheduler.Dequeue(), -1);
+}
+
+TEST(TestRxScheduler, EnqueueOnce) {
+  enso::RxScheduler scheduler;
+  scheduler.Enqueue(3, 0);
+  scheduler.Enqueue(3, 0);
+  EXPECT_FALSE(scheduler.empty());
+
+  EXPECT_EQ(scheduler.Dequeue(), 3);
+  EXPECT_EQ(scheduler.Dequeue(), -1);
+  EXPECT_TRUE(scheduler.empty());
+}
+
+TEST(TestRxScheduler, StrictPriority) {
+  enso::RxScheduler scheduler;
+  scheduler.SetClass(1, 0, 1);
+  scheduler.SetClass(2, enso::kNbRxSchedulingClasses - 1, 1);
+
+  scheduler.Enqueue(1, 0);
+  scheduler.Enqueue(2, 0);
+
+  // The higher class is served as long as it has pending data.
+  for (uint32_t i = 0; i < 10; ++i) {
+    ASSERT_EQ(scheduler.Dequeue(), 2);
+    scheduler.Charge(2, enso::RxScheduler::kQuantum, true, 0);
+  }
+
+  ASSERT_EQ(scheduler.Dequeue(), 2);
+  scheduler.Charge(2, enso::RxScheduler::kQuantum, false, 0);
+  EXPECT_EQ(scheduler.Dequeue(), 1);
+}
+
+TEST(TestRxScheduler, WeightedRoundRobin) {
+  constexpr uint32_t kBatchSize = enso::RxScheduler::kQuantum / 4;
+  enso::RxScheduler scheduler;
+  scheduler.SetClass(1, 0, 1);
+  scheduler.SetClass(2, 0, 3);
+
+  scheduler.Enqueue(1, 0);
+  scheduler.Enqueue(2, 0);
+
+  // Both pipes always have data, so they share the bytes by weight.
+  std::array<uint64_t, 3> nb_bytes = {};
+  for (uint32_t i = 0; i < 1600; ++i) {
+    int32_t id = scheduler.Dequeue();
+    ASSERT_TRUE(id == 1 || id == 2);
+    nb_bytes[id] += kBatchSize;
+    scheduler.Charge(id, kBatchSize, true, 0);
+  }
+
+  EXPECT_EQ(nb_bytes[1] * 3, nb_bytes[2]);
+}
+
+TEST(TestRxScheduler, ServedUntilQuantumSpent) {
+  constexpr uint32_t kBatchSize = enso::RxScheduler::kQuantum / 4;
+  enso::RxScheduler scheduler;
+
+  scheduler.Enqueue(1, 0);
+  scheduler.Enqueue(2, 0);
+
+  // A pipe that still has credit goes back to the front of its class.
+  for (uint32_t i = 0; i < 4; ++i) {
+    ASSERT_EQ(scheduler.Dequeue(), 1);
+    scheduler.Charge(1, kBatchSize, true, 0);
+  }
+  EXPECT_EQ(scheduler.Dequeue(), 2);
+}
+
+TEST(TestRxScheduler, DispatchStats) {
+  enso::RxScheduler scheduler;
+  scheduler.SetClass(1, 1, 1);
+
+  scheduler.Enqueue(1, 100);
+  ASSERT_EQ(scheduler.Dequeue(), 1);
+  scheduler.RecordDispatch(1, 300);
+
+  const enso::RxSchedulingStats& stats = scheduler.stats(1);
+  EXPECT_EQ(stats.nb_dispatches, 1);
+  EXPECT_EQ(stats.total_delay_cycles, 200);
+  EXPECT_EQ(stats.max_delay_cycles, 200);
+  EXPECT_EQ(scheduler.stats(0).nb_dispatches, 0);
+}
+
+TEST(TestRxScheduler, ResetPipe) {
+  constexpr uint32_t kBatchSize = enso::RxScheduler::kQuantum / 4;
+  enso::RxScheduler scheduler;
+  scheduler.SetClass(1, enso::kNbRxSchedulingClasses - 1, 4);
+  scheduler.SetClass(2, 0, 1);
+
+  // Leaves pipe 1 with credit.
+  scheduler.Enqueue(1, 0);
+  ASSERT_EQ(scheduler.Dequeue(), 1);
+  scheduler.Charge(1, kBatchSize, false, 0);
+
+  scheduler.ResetPipe(1);
+
+  // Back in the default class and weight, pipe 1 now shares the bytes with
+  // pipe 2 equally.
+  scheduler.Enqueue(2, 0);
+  scheduler.Enqueue(1, 0);
+  std::array<uint64_t, 3> nb_bytes = {};
+  for (uint32_t i = 0; i < 800; ++i) {
+    int32_t id = scheduler.Dequeue();
+    ASSERT_TRUE(id == 1 || id == 2);
+    nb_bytes[id] += kBatchSize;
+    scheduler.Charge(id, kBatchSize, true, 0);
+  }
+
+  EXPECT_EQ(nb_bytes[1], nb_bytes[2]);
+}